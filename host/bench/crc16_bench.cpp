@@ -0,0 +1,178 @@
+/**
+ * CRC-16/X-25 software variants : conformance against the DMA sniffer
+ * model and throughput comparison
+ **/
+#include "src/crc16.h"
+#include "hardware/dma.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC
+#endif
+
+namespace {
+
+typedef uint16_t (*crc_fn)(uint16_t, const uint8_t*, uint32_t);
+
+struct Variant {
+    const char* name;
+    crc_fn fn;
+};
+
+const Variant variants[] = {
+    {"bitwise", crc16_update_bitwise},
+    {"table", crc16_update_table},
+    {"slice4", crc16_update_slice4},
+    {"slice8", crc16_update_slice8},
+};
+
+/**
+ * Computes a CRC with the DMA sniffer configured as the firmware does
+ **/
+uint32_t sniffer_crc(const uint8_t* data, uint32_t len, std::vector<uint8_t>& sink)
+{
+    static int channel = -1;
+    if(channel < 0){
+        channel = dma_claim_unused_channel(true);
+    }
+    sink.resize(len ? len : 1);
+    dma_channel_config c = dma_channel_get_default_config(channel);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_sniff_enable(&c, true);
+    dma_sniffer_enable(channel, 0x3, true);
+    dma_hw->sniff_ctrl |= 0x800;
+    dma_hw->sniff_ctrl |= 0x400;
+    dma_hw->sniff_data = 0xFFFF;
+    dma_channel_configure(channel, &c, sink.data(), data, len, true);
+    dma_channel_wait_for_finish_blocking(channel);
+    uint32_t crc = dma_hw->sniff_data;
+    dma_sniffer_disable();
+    return crc;
+}
+
+bool check()
+{
+    bool ok = true;
+    const char* text = "123456789";
+    for(const Variant& v : variants){
+        uint16_t crc = ~v.fn(CRC16_X25_INIT, reinterpret_cast<const uint8_t*>(text), 9);
+        if(crc != 0x906E){
+            printf("%s : check value %04x, expected 906e\n", v.name, crc);
+            ok = false;
+        }
+    }
+
+    std::mt19937 rng(1);
+    std::vector<uint8_t> data, sink;
+    for(int i = 0; i < 2000 && ok; ++i){
+        uint32_t len = rng() % (i < 100 ? 16 : 2048);
+        data.resize(len + 2);
+        for(uint32_t j = 0; j < len; ++j){
+            data[j] = rng();
+        }
+        uint16_t ref = crc16_update_bitwise(CRC16_X25_INIT, data.data(), len);
+        for(const Variant& v : variants){
+            // Whole buffer, then in two parts
+            uint32_t split = len ? rng() % len : 0;
+            uint16_t crc = v.fn(CRC16_X25_INIT, data.data(), len);
+            uint16_t parts = v.fn(v.fn(CRC16_X25_INIT, data.data(), split), data.data() + split, len - split);
+            if(crc != ref || parts != ref){
+                printf("%s : mismatch on %u bytes (split %u)\n", v.name, len, split);
+                ok = false;
+            }
+        }
+        // Sniffer output of the frame, then residue once CRC is appended
+        uint32_t sniff = sniffer_crc(data.data(), len, sink);
+        if((sniff >> 16) != (crc16_to_sniffer(ref) >> 16)){
+            printf("sniffer : %08x, software %08x on %u bytes\n", sniff, crc16_to_sniffer(ref), len);
+            ok = false;
+        }
+        uint16_t fcs = ~ref;
+        data[len] = fcs & 0xFF;
+        data[len + 1] = fcs >> 8;
+        sniff = sniffer_crc(data.data(), len + 2, sink);
+        if(!crc16_is_valid(crc16_update(CRC16_X25_INIT, data.data(), len + 2)) ||
+           ((sniff >> 16) != (crc16_to_sniffer(CRC16_X25_RESIDUE) >> 16))){
+            printf("residue : sniffer %08x on %u bytes\n", sniff, len + 2);
+            ok = false;
+        }
+    }
+    printf("Conformance                 %s\n", ok ? "passed" : "FAILED");
+    return ok;
+}
+
+void bench(uint32_t size, uint64_t totalBytes)
+{
+    std::vector<uint8_t> data(size);
+    std::mt19937 rng(2);
+    for(uint8_t& b : data){
+        b = rng();
+    }
+    uint64_t iterations = totalBytes / size ? totalBytes / size : 1;
+    for(const Variant& v : variants){
+        uint64_t n = (v.fn == crc16_update_bitwise) ? (iterations + 7) / 8 : iterations;
+        volatile uint16_t sink = 0;
+        auto t0 = std::chrono::steady_clock::now();
+#ifdef HAVE_TSC
+        uint64_t c0 = __rdtsc();
+#endif
+        uint16_t crc = CRC16_X25_INIT;
+        for(uint64_t i = 0; i < n; ++i){
+            crc = v.fn(crc, data.data(), size);
+        }
+        sink = crc;
+#ifdef HAVE_TSC
+        uint64_t cycles = __rdtsc() - c0;
+#endif
+        auto t1 = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+        double bytes = static_cast<double>(n) * size;
+        printf("%-8s %6u bytes  %8.1f MB/s  %6.3f ns/byte", v.name, size, bytes / ns * 1e3, ns / bytes);
+#ifdef HAVE_TSC
+        printf("  %6.3f bytes/cycle", bytes / cycles);
+#endif
+        printf("\n");
+        (void)sink;
+    }
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    bool checkOnly = false;
+    uint64_t totalBytes = 64ull << 20;
+    std::vector<uint32_t> sizes = {16, 256, 4096};
+    for(int i = 1; i < argc; ++i){
+        std::string a = argv[i];
+        if(a == "--check"){
+            checkOnly = true;
+        }else if(a == "--size" && i + 1 < argc){
+            sizes = {static_cast<uint32_t>(strtoul(argv[++i], nullptr, 0))};
+        }else if(a == "--mbytes" && i + 1 < argc){
+            totalBytes = strtoull(argv[++i], nullptr, 0) << 20;
+        }else{
+            fprintf(stderr, "Usage: %s [--check] [--size BYTES] [--mbytes MB]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(!check()){
+        return 1;
+    }
+    if(checkOnly){
+        return 0;
+    }
+    for(uint32_t size : sizes){
+        bench(size, totalBytes);
+    }
+    return 0;
+}
@@ -0,0 +1,619 @@
+/**
+ * Software HDLC codec (src/hdlc_codec.h) : conformance and throughput
+ * The encoder is checked bit for bit against the bit level encoder of the
+ * simulator and the hdlc_tx program, the decoder against the bit level
+ * decoder and the hdlc_rx program (both run on the PIO interpreter).
+ * Streams are split in random chunks to cross every byte boundary.
+ **/
+#include "src/hdlc_codec.h"
+#include "src/crc16.h"
+#include "sim/hdlc_bits.h"
+#include "sim/pio_cpu.h"
+
+#include "hdlc_rx.pio.h"
+#include "hdlc_tx.pio.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+#define DATA_PIN 0          // RX data in / TX data out
+#define CLK_PIN 1           // RX clock in (data pin + 1) / TX clock out
+#define TX_EN_PIN 2         // TX clock enable
+
+// IRQ numbers of hdlc_rx.pio (state machine 0) and hdlc_tx.pio (state machine 1)
+#define RX_ABORT_INT 0
+#define RX_DATA_DONE 1
+#define FLAG_SENT_IRQ 1
+
+#define BIT_CYCLES 32       // Bit period of the PIO checks (system clock cycles)
+#define DECODE_BUFFER 96    // Decoder buffer, longer frames are overruns
+
+enum FrameKind { VALID, BAD_CRC, SHORT, ABORTED, OVERRUN };
+
+struct Frame {
+    FrameKind kind;
+    std::vector<uint8_t> bytes;     // Without CRC
+};
+
+/**
+ * A decoded frame : status and bytes as seen on the bus
+ **/
+struct Result {
+    receiver_status status;
+    std::vector<uint8_t> bytes;
+
+    bool operator==(const Result& r) const
+    {
+        // Bytes of an aborted frame are not kept
+        return status == r.status && (status == frame_aborted || bytes == r.bytes);
+    }
+};
+
+const char* statusName(receiver_status s)
+{
+    switch(s){
+    case done: return "done";
+    case bad_crc: return "bad CRC";
+    case frame_short: return "short";
+    case overrun: return "overrun";
+    case frame_aborted: return "aborted";
+    default: return "?";
+    }
+}
+
+/**
+ * Random and stuffing heavy payloads, as pio_timing
+ **/
+std::vector<uint8_t> payload(uint len, std::mt19937& rng)
+{
+    static const uint8_t patterns[] = {0xFF, 0x7E, 0x7F, 0xFE, 0x3F, 0xF8, 0x1F, 0xFC};
+    std::vector<uint8_t> bytes(len);
+    uint kind = rng() % 8;
+    for(uint j = 0; j < len; ++j){
+        switch(kind){
+        case 0: bytes[j] = 0xFF; break;
+        case 1: bytes[j] = 0x7E; break;
+        case 2: bytes[j] = (j & 1) ? 0x7E : 0xFF; break;
+        case 3: bytes[j] = patterns[rng() % sizeof(patterns)]; break;
+        default: bytes[j] = static_cast<uint8_t>(rng()); break;
+        }
+    }
+    return bytes;
+}
+
+std::vector<Frame> makeFrames(uint count, std::mt19937& rng)
+{
+    std::vector<Frame> frames;
+    for(uint i = 0; i < count; ++i){
+        Frame f;
+        uint r = rng() % 20;
+        f.kind = r < 14 ? VALID : r < 16 ? BAD_CRC : r < 17 ? SHORT : r < 19 ? ABORTED : OVERRUN;
+        uint len = f.kind == SHORT ? 1 + rng() % 2 :
+                   f.kind == OVERRUN ? DECODE_BUFFER + rng() % 64 : 1 + rng() % (DECODE_BUFFER - 2);
+        f.bytes = payload(len, rng);
+        frames.push_back(f);
+    }
+    return frames;
+}
+
+std::vector<uint8_t> withCrc(const std::vector<uint8_t>& bytes)
+{
+    std::vector<uint8_t> out = bytes;
+    uint16_t crc = crc16_x25(bytes.data(), bytes.size());
+    out.push_back(crc & 0xFF);
+    out.push_back(crc >> 8);
+    return out;
+}
+
+/**
+ * Expected decoding of a frame
+ **/
+Result expected(const Frame& f)
+{
+    switch(f.kind){
+    case VALID: return {done, withCrc(f.bytes)};
+    case BAD_CRC: {
+        std::vector<uint8_t> b = withCrc(f.bytes);
+        b[b.size() - 1] ^= 0x01;
+        return {bad_crc, b};
+    }
+    case SHORT: return {frame_short, f.bytes};
+    case ABORTED: return {frame_aborted, {}};
+    default: {
+        std::vector<uint8_t> b = withCrc(f.bytes);
+        b.resize(DECODE_BUFFER);
+        return {overrun, b};
+    }
+    }
+}
+
+/**
+ * Encoded stream of frames, frame data given in random chunks
+ * Frames are separated by one or two flags
+ **/
+struct Stream {
+    std::vector<uint8_t> bytes;
+    uint64_t bits = 0;              // Line bits (the last byte is completed with ones)
+};
+
+Stream encodeFrames(const std::vector<Frame>& frames, std::mt19937& rng)
+{
+    Stream s;
+    HdlcEncoder enc;
+    hdlc_encoder_init(enc);
+    uint8_t out[512];
+    auto add = [&](uint32_t n){
+        s.bytes.insert(s.bytes.end(), out, out + n);
+    };
+    for(const Frame& f : frames){
+        add(hdlc_encode_flag(enc, out));
+        size_t pos = 0;
+        while(pos < f.bytes.size()){
+            size_t n = std::min<size_t>(f.bytes.size() - pos, 1 + rng() % 16);
+            add(hdlc_encode_data(enc, f.bytes.data() + pos, n, out));
+            pos += n;
+        }
+        switch(f.kind){
+        case SHORT:
+            add(hdlc_encode_flag(enc, out));
+            break;
+        case ABORTED:
+            add(hdlc_encode_abort(enc, out));
+            break;
+        case BAD_CRC: {
+            std::vector<uint8_t> b = expected(f).bytes;
+            add(hdlc_encode_data(enc, b.data() + f.bytes.size(), 2, out));
+            add(hdlc_encode_flag(enc, out));
+            break;
+        }
+        default:
+            add(hdlc_encode_end(enc, out));
+            break;
+        }
+        // Aborts end with the flag of the next frame
+        if(f.kind == ABORTED || rng() % 4 == 0){
+            add(hdlc_encode_flag(enc, out));
+        }
+    }
+    s.bits = s.bytes.size() * 8 + enc.count;
+    add(hdlc_encode_flush(enc, out));
+    return s;
+}
+
+bool bit(const Stream& s, uint64_t i)
+{
+    return (s.bytes[i / 8] >> (i % 8)) & 1;
+}
+
+/**
+ * Decodes a stream in random chunks
+ **/
+std::vector<Result> decode(const Stream& s, std::mt19937& rng, uint maxChunk)
+{
+    std::vector<Result> results;
+    uint8_t buffer[DECODE_BUFFER];
+    HdlcDecoder dec;
+    hdlc_decoder_init(dec, buffer, sizeof(buffer));
+    size_t pos = 0;
+    while(pos < s.bytes.size()){
+        uint32_t len = std::min<size_t>(s.bytes.size() - pos, 1 + rng() % maxChunk);
+        uint32_t used;
+        receiver_status status = hdlc_decode(dec, &s.bytes[pos], len, used);
+        pos += used;
+        if(status != busy){
+            Result r = {status, {}};
+            if(status != frame_aborted){
+                r.bytes.assign(buffer, buffer + std::min(dec.length, dec.bufLen));
+            }
+            results.push_back(r);
+        }
+    }
+    return results;
+}
+
+/**
+ * Decodes a stream with the bit level decoder of the simulator
+ **/
+std::vector<Result> decodeBits(const Stream& s)
+{
+    std::vector<Result> results;
+    sim::HdlcDecoder dec;
+    for(uint64_t i = 0; i < s.bits; ++i){
+        sim::HdlcDecoder::Event e = dec.push(bit(s, i));
+        if(e == sim::HdlcDecoder::Event::Abort){
+            results.push_back({frame_aborted, {}});
+        }else if(e == sim::HdlcDecoder::Event::Frame){
+            const std::vector<uint8_t>& f = dec.frame();
+            if(f.size() > DECODE_BUFFER){
+                results.push_back({overrun, std::vector<uint8_t>(f.begin(), f.begin() + DECODE_BUFFER)});
+            }else{
+                results.push_back({f.size() < 3 ? frame_short : dec.crcOk() ? done : bad_crc, f});
+            }
+        }
+    }
+    return results;
+}
+
+bool compare(const char* name, const std::vector<Result>& ref, const std::vector<Result>& got)
+{
+    size_t n = std::min(ref.size(), got.size());
+    for(size_t i = 0; i < n; ++i){
+        if(!(ref[i] == got[i])){
+            printf("%s : frame %zu is %s (%zu bytes), expected %s (%zu bytes)\n", name, i, statusName(got[i].status),
+                   got[i].bytes.size(), statusName(ref[i].status), ref[i].bytes.size());
+            return false;
+        }
+    }
+    if(ref.size() != got.size()){
+        printf("%s : %zu frames, expected %zu\n", name, got.size(), ref.size());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Encoder against the bit level encoder : same line bits
+ **/
+bool checkEncoder(const std::vector<Frame>& frames)
+{
+    sim::HdlcEncoder ref;
+    HdlcEncoder enc;
+    hdlc_encoder_init(enc);
+    std::vector<bool> refBits;
+    std::vector<uint8_t> out;
+    for(const Frame& f : frames){
+        if(f.kind != VALID && f.kind != OVERRUN){
+            continue;
+        }
+        ref.frame(f.bytes);
+        while(!ref.empty()){
+            refBits.push_back(ref.next());
+        }
+        size_t start = out.size();
+        out.resize(start + HDLC_ENCODED_MAX(f.bytes.size() + 2) + 2);
+        out.resize(start + hdlc_encode_frame(enc, f.bytes.data(), f.bytes.size(), &out[start]));
+    }
+    uint64_t bits = out.size() * 8 + enc.count;
+    uint8_t last;
+    if(hdlc_encode_flush(enc, &last)){
+        out.push_back(last);
+    }
+    if(bits != refBits.size()){
+        printf("encoder : %lu line bits, expected %zu\n", static_cast<unsigned long>(bits), refBits.size());
+        return false;
+    }
+    Stream encoded = {out, bits};
+    for(uint64_t i = 0; i < bits; ++i){
+        if(bit(encoded, i) != refBits[i]){
+            printf("encoder : line bit %lu differs\n", static_cast<unsigned long>(i));
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Decoder against the hdlc_rx program, configured as hdlc_rx_program_init does
+ * Bytes pushed between two flags are a frame, an abort drops them
+ **/
+std::vector<Result> decodePio(const Stream& s)
+{
+    std::vector<Result> results;
+    sim::PioCpu cpu;
+    uint offset = cpu.load(hdlc_rx_program);
+    pio_sm_config c = hdlc_rx_program_get_default_config(offset);
+    sm_config_set_in_pins(&c, DATA_PIN);
+    sm_config_set_jmp_pin(&c, DATA_PIN);
+    sm_config_set_fifo_join(&c, PIO_FIFO_JOIN_RX);
+    sm_config_set_in_shift(&c, true, false, 8);
+    cpu.start(0, offset, c);
+    std::vector<uint8_t> segment;
+
+    auto run = [&](uint cycles){
+        for(uint i = 0; i < cycles; ++i){
+            cpu.step();
+            sim::PioCpu::StateMachine& sm = cpu.sm(0);
+            while(!sm.rx.empty()){
+                segment.push_back(sm.rx.pop() >> 24);
+            }
+            if(cpu.irqFlags() & (1u << RX_ABORT_INT)){
+                cpu.clearIrq(RX_ABORT_INT);
+                results.push_back({frame_aborted, {}});
+                segment.clear();
+            }
+            if(cpu.irqFlags() & (1u << RX_DATA_DONE)){
+                cpu.clearIrq(RX_DATA_DONE);
+                if(!segment.empty()){
+                    Result r = {bad_crc, segment};
+                    if(segment.size() > DECODE_BUFFER){
+                        r.status = overrun;
+                        r.bytes.resize(DECODE_BUFFER);
+                    }else if(segment.size() < 3){
+                        r.status = frame_short;
+                    }else if(crc16_is_valid(crc16_update(CRC16_X25_INIT, segment.data(), segment.size()))){
+                        r.status = done;
+                    }
+                    results.push_back(r);
+                }
+                segment.clear();
+            }
+        }
+    };
+    for(uint64_t i = 0; i < s.bits; ++i){
+        cpu.setInput(CLK_PIN, false);
+        cpu.setInput(DATA_PIN, bit(s, i));
+        run(BIT_CYCLES / 2);
+        cpu.setInput(CLK_PIN, true);
+        run(BIT_CYCLES / 2);
+    }
+    cpu.setInput(CLK_PIN, false);
+    run(BIT_CYCLES * 4);
+    return results;
+}
+
+/**
+ * Encoder against the clock_tx and hdlc_tx programs : frames are given to
+ * the TX FIFO back to back, the data pin is sampled on clock rising edges
+ * and every frame must be found with the line bits of the codec
+ **/
+bool checkPioTx(const std::vector<Frame>& frames)
+{
+    sim::PioCpu cpu;
+    uint clockOffset = cpu.load(clock_tx_program);
+    pio_sm_config cc = clock_tx_program_get_default_config(clockOffset);
+    sm_config_set_sideset_pins(&cc, CLK_PIN);
+    sm_config_set_in_pins(&cc, TX_EN_PIN);
+    sm_config_set_clkdiv(&cc, BIT_CYCLES / 4);
+    uint dataOffset = cpu.load(hdlc_tx_program);
+    pio_sm_config dc = hdlc_tx_program_get_default_config(dataOffset);
+    sm_config_set_set_pins(&dc, DATA_PIN, 1);
+    sm_config_set_in_pins(&dc, TX_EN_PIN);
+    // Ones read back from the data pin itself, no collision
+    sm_config_set_jmp_pin(&dc, DATA_PIN);
+    sm_config_set_fifo_join(&dc, PIO_FIFO_JOIN_TX);
+    sm_config_set_out_shift(&dc, true, true, 8);
+    cpu.setPinDir(DATA_PIN, true);
+    cpu.setPinDir(CLK_PIN, true);
+    cpu.start(0, clockOffset, cc);
+    cpu.start(1, dataOffset, dc);
+
+    std::vector<const Frame*> sent;
+    for(const Frame& f : frames){
+        if(f.kind == VALID || f.kind == OVERRUN){
+            sent.push_back(&f);
+        }
+    }
+    if(sent.empty()){
+        return true;
+    }
+    std::vector<bool> line;
+    std::vector<uint8_t> pending = withCrc(sent[0]->bytes);
+    size_t next = 1;                    // Next frame, given once the flag of the last one is sent
+    size_t fed = 0;
+    bool clock = false;
+    bool dataLevel = false;
+    uint64_t idle = 0;                  // Bits sent after the last frame
+    cpu.setInput(TX_EN_PIN, true);
+    while(idle < 64){
+        sim::PioCpu::StateMachine& sm = cpu.sm(1);
+        while(fed < pending.size() && !sm.tx.full()){
+            sm.tx.push(pending[fed++]);
+        }
+        dataLevel = cpu.pin(DATA_PIN);
+        cpu.step();
+        bool level = cpu.pin(CLK_PIN);
+        if(level != clock){
+            clock = level;
+            if(clock){
+                line.push_back(dataLevel);
+                idle += next == sent.size() && fed == pending.size() && sm.tx.empty();
+            }
+        }
+        // FLAG_SENT : the firmware chains the next frame
+        if(cpu.irqFlags() & (1u << FLAG_SENT_IRQ)){
+            cpu.clearIrq(FLAG_SENT_IRQ);
+            if(fed == pending.size() && sm.tx.empty() && next < sent.size()){
+                pending = withCrc(sent[next++]->bytes);
+                fed = 0;
+            }
+        }
+    }
+    // Line bits of each frame (flag, data, CRC, flag) in order, flags may be shared
+    size_t pos = 0;
+    uint8_t out[512];
+    for(size_t i = 0; i < sent.size(); ++i){
+        HdlcEncoder enc;
+        hdlc_encoder_init(enc);
+        uint32_t n = hdlc_encode_frame(enc, sent[i]->bytes.data(), sent[i]->bytes.size(), out);
+        Stream s = {std::vector<uint8_t>(out, out + n), n * 8ull};
+        std::vector<bool> bits;
+        for(uint64_t j = 0; j < s.bits; ++j){
+            bits.push_back(bit(s, j));
+        }
+        auto it = std::search(line.begin() + pos, line.end(), bits.begin(), bits.end());
+        if(it == line.end()){
+            printf("hdlc_tx : frame %zu of %zu not found in the line bits\n", i, sent.size());
+            return false;
+        }
+        pos = (it - line.begin()) + bits.size() - 8;
+    }
+    // Line decoded by the codec
+    Stream s;
+    s.bits = line.size();
+    s.bytes.assign((line.size() + 7) / 8, 0);
+    for(size_t i = 0; i < line.size(); ++i){
+        s.bytes[i / 8] |= line[i] << (i % 8);
+    }
+    std::mt19937 rng(3);
+    std::vector<Result> ref;
+    for(const Frame* f : sent){
+        ref.push_back(expected(*f));
+    }
+    return compare("hdlc_tx decoded", ref, decode(s, rng, 8));
+}
+
+bool check(uint count, uint pioFrames, uint32_t seed)
+{
+    std::mt19937 rng(seed);
+    std::vector<Frame> frames = makeFrames(count, rng);
+    Stream s = encodeFrames(frames, rng);
+    std::vector<Result> ref;
+    for(const Frame& f : frames){
+        ref.push_back(expected(f));
+    }
+    bool ok = checkEncoder(frames);
+    printf("Encoder / bit level         %s, %u frames\n", ok ? "passed" : "FAILED", count);
+    bool decOk = compare("decoder, 1 byte chunks", ref, decode(s, rng, 1)) &&
+                 compare("decoder, random chunks", ref, decode(s, rng, 64)) &&
+                 compare("decoder, whole stream", ref, decode(s, rng, s.bytes.size())) &&
+                 compare("bit level decoder", ref, decodeBits(s));
+    printf("Decoder / bit level         %s, %lu line bits\n", decOk ? "passed" : "FAILED", static_cast<unsigned long>(s.bits));
+    ok = ok && decOk;
+
+    // The PIO interpreter is slow, fewer frames
+    std::vector<Frame> few(frames.begin(), frames.begin() + std::min<size_t>(pioFrames, frames.size()));
+    Stream fs = encodeFrames(few, rng);
+    std::vector<Result> fewRef;
+    for(const Frame& f : few){
+        fewRef.push_back(expected(f));
+    }
+    bool rxOk = compare("hdlc_rx", fewRef, decodePio(fs));
+    printf("Decoder / hdlc_rx           %s, %zu frames\n", rxOk ? "passed" : "FAILED", few.size());
+    bool txOk = checkPioTx(few);
+    printf("Encoder / hdlc_tx           %s\n", txOk ? "passed" : "FAILED");
+    return ok && rxOk && txOk;
+}
+
+double seconds(std::chrono::steady_clock::time_point t0)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+/**
+ * Encodes and decodes frames of size bytes, MB/s of frame data
+ **/
+void bench(const char* name, uint32_t size, bool ones, uint64_t totalBytes)
+{
+    std::mt19937 rng(2);
+    std::vector<uint8_t> data(size);
+    for(uint8_t& b : data){
+        b = ones ? 0xFF : rng();
+    }
+    uint64_t frames = totalBytes / size ? totalBytes / size : 1;
+    std::vector<uint8_t> out(HDLC_ENCODED_MAX(size + 2) + 4);
+    HdlcEncoder enc;
+    hdlc_encoder_init(enc);
+    volatile uint32_t sink = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    uint32_t n = 0;
+    for(uint64_t i = 0; i < frames; ++i){
+        n = hdlc_encode_frame(enc, data.data(), size, out.data());
+        sink = sink + n;
+    }
+    double encS = seconds(t0);
+    uint32_t encoded = n;
+
+    // Back to back frames, decoded by input blocks of 4 KB
+    std::vector<uint8_t> stream;
+    uint32_t perBlock = std::max<uint32_t>(1, 65536 / encoded);
+    hdlc_encoder_init(enc);
+    for(uint32_t i = 0; i < perBlock; ++i){
+        uint32_t m = hdlc_encode_frame(enc, data.data(), size, out.data());
+        stream.insert(stream.end(), out.begin(), out.begin() + m);
+    }
+    // Ones after the last flag, the stream is decoded several times
+    if(hdlc_encode_flush(enc, out.data())){
+        stream.push_back(out[0]);
+    }
+    std::vector<uint8_t> buffer(size + 2);
+    HdlcDecoder dec;
+    hdlc_decoder_init(dec, buffer.data(), buffer.size());
+    uint64_t decoded = 0;
+    uint64_t errors = 0;
+    t0 = std::chrono::steady_clock::now();
+    while(decoded < frames){
+        size_t pos = 0;
+        while(pos < stream.size()){
+            uint32_t len = std::min<size_t>(stream.size() - pos, 4096);
+            uint32_t used;
+            receiver_status status = hdlc_decode(dec, &stream[pos], len, used);
+            pos += used;
+            if(status != busy){
+                errors += status != done;
+                ++decoded;
+            }
+        }
+    }
+    double decS = seconds(t0);
+
+    // Bit level encoder and decoder of the simulator
+    uint64_t refFrames = std::max<uint64_t>(1, frames / 64);
+    std::vector<uint8_t> bytes(data.begin(), data.end());
+    sim::HdlcEncoder refEnc;
+    sim::HdlcDecoder refDec;
+    t0 = std::chrono::steady_clock::now();
+    for(uint64_t i = 0; i < refFrames; ++i){
+        refEnc.frame(bytes);
+        while(!refEnc.empty()){
+            sink = sink + (refDec.push(refEnc.next()) == sim::HdlcDecoder::Event::Frame);
+        }
+    }
+    double refS = seconds(t0);
+    (void)sink;
+
+    double mb = static_cast<double>(frames) * size / 1e6;
+    printf("%-7s %5u bytes  encode %8.1f MB/s  decode %8.1f MB/s  bit level %6.1f MB/s  %5.2f line bits/byte%s\n",
+           name, size, mb / encS, decoded * static_cast<double>(size) / 1e6 / decS,
+           static_cast<double>(refFrames) * size / 1e6 / refS, encoded * 8.0 / size,
+           errors ? "  DECODE ERRORS" : "");
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    bool checkOnly = false;
+    uint64_t totalBytes = 64ull << 20;
+    uint frames = 5000;
+    uint pioFrames = 300;
+    uint32_t seed = 1;
+    std::vector<uint32_t> sizes = {16, 256, 4096};
+    for(int i = 1; i < argc; ++i){
+        std::string a = argv[i];
+        if(a == "--check"){
+            checkOnly = true;
+        }else if(a == "--size" && i + 1 < argc){
+            sizes = {static_cast<uint32_t>(strtoul(argv[++i], nullptr, 0))};
+        }else if(a == "--mbytes" && i + 1 < argc){
+            totalBytes = strtoull(argv[++i], nullptr, 0) << 20;
+        }else if(a == "--frames" && i + 1 < argc){
+            frames = strtoul(argv[++i], nullptr, 0);
+        }else if(a == "--pio-frames" && i + 1 < argc){
+            pioFrames = strtoul(argv[++i], nullptr, 0);
+        }else if(a == "--seed" && i + 1 < argc){
+            seed = strtoul(argv[++i], nullptr, 0);
+        }else{
+            fprintf(stderr, "Usage: %s [--check] [--size BYTES] [--mbytes MB] [--frames N] [--pio-frames N] [--seed N]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(!check(frames, pioFrames, seed)){
+        return 1;
+    }
+    if(checkOnly){
+        return 0;
+    }
+    printf("\n");
+    for(uint32_t size : sizes){
+        bench("random", size, false, totalBytes);
+        bench("0xFF", size, true, totalBytes);
+    }
+    return 0;
+}
@@ -0,0 +1,366 @@
+/**
+ * Program loads through the message streams
+ * A station asks for messages of growing length (1 KB to 64 KB). Core 0
+ * plays the host side : it answers the consigne with a stream and fills
+ * its chunk buffers at the host link rate (drains them with --upload)
+ * while the bus engine sends them. Reports, for each length, the time to
+ * the first data frame, the transfer time and throughput, and the peak of
+ * buffer memory used (streams and frame pool), which must not depend on
+ * the message length.
+ **/
+#include "sim/bus.h"
+#include "sim/dut_port.h"
+#include "sim/rp2040.h"
+#include "sim/simulator.h"
+#include "sim/station.h"
+#include "sim/stats.h"
+#include "src/bus_timing.h"
+#include "src/frame_pool.h"
+#include "src/intercore.h"
+#include "src/message_stream.h"
+#include "pico/multicore.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// Bus engine of picoreseau.cpp, launched on core 1 by the host side below
+void bus_engine();
+
+#define DATA_RX_PIN 0
+#define CLK_RX_PIN 1
+#define TX_TRCV_ENABLE_PIN 5
+#define STATION 1
+
+namespace {
+
+struct Options {
+    std::vector<uint16_t> sizes = {1024, 2048, 4096, 8192, 16384, 32768, 65535};
+    unsigned repeat = 3;            // Messages of each length
+    unsigned hostKbps = 8000;       // Rate the host side fills or drains chunks, 0 : immediate
+    bool upload = false;            // Messages sent by the station (GET_DATA)
+    uint64_t pollNs = 200;          // Cost of one polling iteration
+    bool verbose = false;
+};
+
+Options opt;
+
+void usage(const char* prog)
+{
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  --sizes A,B,...   Message lengths (default 1024,2048,...,32768,65535)\n"
+        "  --repeat N        Messages of each length (default 3)\n"
+        "  --host-kbps R     Rate of the host side link (default 8000, 0 : immediate)\n"
+        "  --upload          The station sends its messages (GET_DATA) instead of loading them\n"
+        "  --poll-ns NS      Simulated duration of a polling iteration (default 200)\n"
+        "  --verbose         Shows firmware output\n", prog);
+}
+
+bool parse(int argc, char** argv, Options& o)
+{
+    for(int i = 1; i < argc; ++i){
+        std::string a = argv[i];
+        auto value = [&](void) -> const char* {
+            if(i + 1 >= argc){
+                fprintf(stderr, "Missing value for %s\n", a.c_str());
+                exit(1);
+            }
+            return argv[++i];
+        };
+        if(a == "--sizes"){
+            o.sizes.clear();
+            std::stringstream ss(value());
+            std::string item;
+            while(std::getline(ss, item, ',')){
+                unsigned long n = strtoul(item.c_str(), nullptr, 0);
+                if(n == 0 || n > 65535){
+                    return false;
+                }
+                o.sizes.push_back(static_cast<uint16_t>(n));
+            }
+        }else if(a == "--repeat"){
+            o.repeat = strtoul(value(), nullptr, 0);
+        }else if(a == "--host-kbps"){
+            o.hostKbps = strtoul(value(), nullptr, 0);
+        }else if(a == "--upload"){
+            o.upload = true;
+        }else if(a == "--poll-ns"){
+            o.pollNs = strtoull(value(), nullptr, 0);
+        }else if(a == "--verbose"){
+            o.verbose = true;
+        }else{
+            return false;
+        }
+    }
+    return !o.sizes.empty() && o.repeat > 0;
+}
+
+/**
+ * Message of the host side, on a stream
+ **/
+struct HostMessage {
+    bool active = false;
+    uint8_t station = 0;
+    uint32_t len = 0;
+    uint32_t pos = 0;               // Bytes filled or drained
+    bool busy = false;              // A chunk is being filled or drained
+    uint32_t chunkLen = 0;
+    uint32_t readyUs = 0;           // End of the current chunk
+    bool ok = true;                 // Drained bytes as expected
+};
+
+HostMessage messages[MSG_STREAMS];
+uint32_t messagesEnded = 0;
+uint32_t messagesFailed = 0;
+uint32_t hostErrors = 0;            // Drained data not as expected
+std::map<uint32_t, uint32_t> poolPeak;  // Frame pool bytes in use during messages of a length
+sim::ClientStation* station = nullptr;
+size_t expectedTransfers = 0;
+
+/**
+ * Time the host link takes for a chunk
+ **/
+uint32_t chunkUs(uint32_t len)
+{
+    return opt.hostKbps ? len * 8000u / opt.hostKbps : 0;
+}
+
+/**
+ * Answers the consigne of a waiting station with a stream
+ **/
+void startMessage(const MessageRequest& r)
+{
+    int index = stream_open();
+    MessageOrder order = {r.station, MSG_NO_STREAM, !opt.upload, r.msgLen};
+    if(index >= 0){
+        HostMessage& m = messages[index];
+        m = HostMessage();
+        m.active = true;
+        m.station = r.station;
+        m.len = r.msgLen;
+        order.stream = index;
+    }
+    intercore_post(hostToBus, IC_MESSAGE, &order, sizeof(order));
+}
+
+/**
+ * Checks and frees the oldest chunk of an upload
+ **/
+void drainChunk(MessageStream& stream, HostMessage& m)
+{
+    uint32_t len = 0;
+    const uint8_t* data = stream_read(stream, len);
+    for(uint32_t i = 0; i < len; ++i){
+        if(data[i] != sim::ClientStation::messageByte(m.station, m.pos + i)){
+            m.ok = false;
+        }
+    }
+    m.pos += len;
+    stream_release(stream);
+}
+
+/**
+ * Fills (load) or drains (upload) the chunk buffers of a stream, one chunk
+ * at a time at the host link rate
+ **/
+void pump(uint index, HostMessage& m)
+{
+    MessageStream& stream = stream_get(index);
+    uint32_t now = time_us_32();
+    if(m.busy && (int32_t)(now - m.readyUs) < 0){
+        return;
+    }
+    if(!opt.upload){
+        if(m.busy){
+            uint8_t* data = stream_write(stream);
+            for(uint32_t i = 0; i < m.chunkLen; ++i){
+                data[i] = sim::ClientStation::messageByte(m.station, m.pos + i);
+            }
+            stream_commit(stream, m.chunkLen);
+            m.pos += m.chunkLen;
+            m.busy = false;
+        }
+        if(m.pos < m.len && stream_write(stream) != nullptr){
+            m.chunkLen = std::min<uint32_t>(NR_DATA_CHUNK, m.len - m.pos);
+            m.busy = true;
+            m.readyUs = now + chunkUs(m.chunkLen);
+        }
+        return;
+    }
+    if(m.busy){
+        drainChunk(stream, m);
+        m.busy = false;
+    }
+    uint32_t len = 0;
+    if(stream_read(stream, len) != nullptr){
+        m.busy = true;
+        m.readyUs = now + chunkUs(len);
+    }
+}
+
+/**
+ * Host side, core 0 : serves the messages of waiting stations
+ **/
+void hostMain()
+{
+    multicore_launch_core1(bus_engine);
+    uint8_t on = 1;
+    intercore_post(hostToBus, IC_SERVER, &on, 1);
+    while(true){
+        IntercoreMessage msg;
+        while(busToHost.pop(msg)){
+            if(msg.type == IC_CONSIGNE){
+                MessageRequest r;
+                memcpy(&r, msg.data, sizeof(r));
+                startMessage(r);
+            }else if(msg.type == IC_MESSAGE_END){
+                MessageEnd e;
+                memcpy(&e, msg.data, sizeof(e));
+                HostMessage& m = messages[e.stream];
+                // Chunks left after the last acknowledge are checked at once
+                uint32_t len = 0;
+                while(opt.upload && stream_read(stream_get(e.stream), len) != nullptr){
+                    drainChunk(stream_get(e.stream), m);
+                }
+                ++messagesEnded;
+                if(e.status != MSG_DONE){
+                    ++messagesFailed;
+                }else if(opt.upload && (!m.ok || m.pos != m.len)){
+                    ++hostErrors;
+                }
+                m.active = false;
+                stream_close(e.stream);
+            }else if(msg.type == IC_LOG && opt.verbose){
+                LogRecord record;
+                memcpy(&record, msg.data, sizeof(record));
+                log_print(record);
+            }
+        }
+        PoolStats pool;
+        pool_get_stats(pool);
+        uint32_t inUse = pool.small.inUse * POOL_SMALL_SIZE + pool.large.inUse * POOL_LARGE_SIZE;
+        for(uint i = 0; i < MSG_STREAMS; ++i){
+            if(messages[i].active){
+                pump(i, messages[i]);
+                uint32_t& peak = poolPeak[messages[i].len];
+                peak = std::max(peak, inUse);
+            }
+        }
+        //The last stream comes back once its frames left the emitter
+        if(station->transfers.size() >= expectedTransfers && messagesEnded >= expectedTransfers){
+            sim::Simulator& s = sim::Simulator::instance();
+            s.setStopTime(s.now());
+        }
+        tight_loop_contents();
+    }
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    if(!parse(argc, argv, opt)){
+        usage(argv[0]);
+        return 1;
+    }
+
+    sim::Simulator& s = sim::Simulator::instance();
+    sim::Rp2040& mcu = s.mcu();
+    s.setPollQuantum(opt.pollNs);
+
+    sim::Bus bus(BusConfig::bitNs);
+    sim::DutPort dut(mcu, DATA_RX_PIN, CLK_RX_PIN, TX_TRCV_ENABLE_PIN);
+    sim::BusMonitor monitor(bus, &dut);
+    bus.attach(&dut);
+    bus.attach(&monitor);
+    sim::ClientConfig cfg;
+    cfg.startNs = 1000000;
+    cfg.thinkMinNs = 2000000;
+    cfg.thinkMaxNs = 5000000;
+    cfg.msgLens.clear();
+    for(uint16_t size : opt.sizes){
+        cfg.msgLens.insert(cfg.msgLens.end(), opt.repeat, size);
+    }
+    sim::ClientStation client(bus, STATION, cfg);
+    bus.attach(&client);
+    station = &client;
+    expectedTransfers = cfg.msgLens.size();
+    s.addComponent(&bus);
+    monitor.startMeasure(0);
+    // Longest run : every message at 1 KB/s
+    uint64_t total = 0;
+    for(uint16_t len : cfg.msgLens){
+        total += len;
+    }
+    s.setStopTime(total * 1000000ull + 1000000000ull);
+
+    fflush(stdout);
+    int savedStdout = dup(STDOUT_FILENO);
+    if(!opt.verbose){
+        int devNull = open("/dev/null", O_WRONLY);
+        dup2(devNull, STDOUT_FILENO);
+        close(devNull);
+    }
+    s.firmwareEnter();
+    try{
+        hostMain();
+    }catch(const sim::Stop&){
+    }
+    s.firmwareExit();
+    fflush(stdout);
+    dup2(savedStdout, STDOUT_FILENO);
+    close(savedStdout);
+
+    // Report, per message length
+    printf("Simulated time              %.3f s, %.0f kbit/s, %s, host link %s%u kbit/s\n", s.now() / 1e9,
+           1e6 / BusConfig::bitNs, opt.upload ? "upload (GET_DATA)" : "program load (SEND_DATA)",
+           opt.hostKbps ? "" : "immediate, ", opt.hostKbps);
+    printf("Streams                     %u of %u x %u bytes chunks, %zu bytes\n", MSG_STREAMS, MSG_STREAM_BUFFERS,
+           NR_DATA_CHUNK, sizeof(MessageStream) * MSG_STREAMS);
+    printf("%8s %5s %5s %15s %15s %10s %10s\n", "Bytes", "Msgs", "Ok", "First byte ms", "Transfer ms", "KB/s",
+           "Pool peak");
+    std::map<uint16_t, std::vector<const sim::ClientStation::Transfer*>> bySize;
+    for(const sim::ClientStation::Transfer& t : client.transfers){
+        bySize[t.length].push_back(&t);
+    }
+    for(uint16_t size : opt.sizes){
+        const auto& list = bySize[size];
+        if(list.empty()){
+            continue;
+        }
+        sim::LatencyStats first;
+        sim::LatencyStats duration;
+        unsigned ok = 0;
+        for(const sim::ClientStation::Transfer* t : list){
+            if(t->ok){
+                ++ok;
+                first.add(t->firstByteNs);
+                duration.add(t->durationNs);
+            }
+        }
+        double ms = duration.count() ? duration.mean() / 1e6 : 0;
+        printf("%8u %5zu %5u %15.2f %15.2f %10.1f %10u\n", size, list.size(), ok,
+               first.count() ? first.mean() / 1e6 : 0.0, ms, ms > 0 ? size / ms * 1000 / 1024 : 0.0, poolPeak[size]);
+        bySize.erase(size);
+    }
+    printf("Host side                   %u messages, %u failed, %u with bad data\n", messagesEnded, messagesFailed,
+           hostErrors);
+    PoolStats pool;
+    pool_get_stats(pool);
+    printf("Frame pool high water       small %u/%u, large %u/%u, %lu failures\n", pool.small.highWater,
+           POOL_SMALL_COUNT, pool.large.highWater, POOL_LARGE_COUNT,
+           static_cast<unsigned long>(pool.small.failures + pool.large.failures));
+    printf("Station                     %lu transactions, timeouts echo=%lu reply=%lu call=%lu data=%lu\n",
+           client.transactions, client.echoTimeouts, client.replyTimeouts, client.callTimeouts, client.dataTimeouts);
+    printf("Bus                         %lu frames, %lu bad CRC, %lu collisions\n", monitor.frames,
+           monitor.badFrames, monitor.collisions);
+    return 0;
+}
@@ -0,0 +1,483 @@
+/**
+ * Hot path regression suite
+ * Host part : consigne parsing, CRC-16 and HDLC codec of typical frames,
+ * best of several runs in ns per frame. End to end part : client stations
+ * run call, consigne and acknowledge round trips against the firmware on
+ * the simulated bus, the cycle probes (src/cycle_probe.h) count the receive
+ * interrupts, frame sending and protocol transitions, the bus gives the
+ * round trip latencies in simulated time.
+ * Results are JSON metrics, lower is better. Round trips in simulated time
+ * and operations counted per frame are exact on any host : --baseline
+ * fails if one of them is worse by more than the threshold. Host timings
+ * (ns, and cycles which follow the host time in the simulator) depend on
+ * the machine and its load, they are compared for information only.
+ * --target compares the JSON line printed by the console 'b' command of a
+ * firmware built with PICORESEAU_CYCLE_PROBES with an adapter baseline
+ * instead, every metric gated (picoreseau_target.json by default).
+ **/
+#include "sim/bus.h"
+#include "sim/dut_port.h"
+#include "sim/rp2040.h"
+#include "sim/simulator.h"
+#include "sim/station.h"
+#include "src/bus_stats.h"
+#include "src/bus_timing.h"
+#include "src/consigne.h"
+#include "src/crc16.h"
+#include "src/cycle_probe.h"
+#include "src/hdlc_codec.h"
+#include "src/protocol.h"
+#include "src/wake.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <random>
+#include <regex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+// Firmware entry point (main of picoreseau.cpp, renamed for the host build)
+int picoreseau_main();
+
+#define DATA_RX_PIN 0
+#define CLK_RX_PIN 1
+#define TX_TRCV_ENABLE_PIN 5
+
+#define CONSIGNE_FRAMES 64          // Consigne frames parsed in turn
+#define DATA_FRAME_LEN (1 + NR_DATA_HEADER_LEN + NR_DATA_CHUNK)     // Message data frame, address to data
+#define CONTROL_FRAME_LEN 3         // Control word frame, address to station
+
+namespace {
+
+struct Options {
+    std::string output;             // JSON file, stdout if empty
+    std::string baseline;           // Stored results to compare with
+    std::string target;             // Firmware results to compare instead of running the benches
+    double thresholdPct = 25;       // Slowdown flagged as a regression
+    unsigned runs = 5;              // Runs of each host bench, the best is kept
+    unsigned stations = 4;
+    uint64_t bootMs = 3500;         // Firmware start-up time (debug delay)
+    uint64_t durationMs = 1000;     // Measured simulated time
+    uint64_t pollNs = 200;          // Cost of one polling iteration
+};
+
+typedef struct Metric {
+    std::string name;
+    double value;
+    bool hostTime;                  // Depends on the host, not gated
+} Metric;
+
+typedef std::vector<Metric> Metrics;
+
+void usage(const char* prog)
+{
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  --output FILE     Writes the JSON results in FILE (default stdout)\n"
+        "  --baseline FILE   Compares the results with FILE, fails on regressions of exact metrics\n"
+        "  --threshold PCT   Slowdown flagged as a regression (default 25)\n"
+        "  --target FILE     Compares firmware results (console 'b') with the baseline (default\n"
+        "                    picoreseau_target.json beside this suite's sources), runs nothing\n"
+        "  --runs N          Runs of each host bench, the best is kept (default 5)\n"
+        "  --stations N      Client stations of the end to end run (default 4)\n"
+        "  --duration-ms MS  Measured simulated time of the end to end run (default 1000)\n"
+        "  --poll-ns NS      Simulated duration of a polling iteration (default 200)\n", prog);
+}
+
+bool parse(int argc, char** argv, Options& o)
+{
+    for(int i = 1; i < argc; ++i){
+        std::string a = argv[i];
+        auto value = [&](void) -> const char* {
+            if(i + 1 >= argc){
+                fprintf(stderr, "Missing value for %s\n", a.c_str());
+                exit(1);
+            }
+            return argv[++i];
+        };
+        if(a == "--output"){
+            o.output = value();
+        }else if(a == "--baseline"){
+            o.baseline = value();
+        }else if(a == "--threshold"){
+            o.thresholdPct = strtod(value(), nullptr);
+        }else if(a == "--target"){
+            o.target = value();
+        }else if(a == "--runs"){
+            o.runs = strtoul(value(), nullptr, 0);
+        }else if(a == "--stations"){
+            o.stations = strtoul(value(), nullptr, 0);
+        }else if(a == "--duration-ms"){
+            o.durationMs = strtoull(value(), nullptr, 0);
+        }else if(a == "--poll-ns"){
+            o.pollNs = strtoull(value(), nullptr, 0);
+        }else{
+            return false;
+        }
+    }
+    return o.runs > 0 && o.stations >= 1 && o.stations <= 31;
+}
+
+/**
+ * Times a function, best of several runs
+ * @param f Called with the iteration number, its results are summed so
+ *          the work is not optimized away
+ * @return ns per iteration
+ **/
+template<typename F>
+double bestNs(unsigned runs, uint64_t iterations, F f)
+{
+    volatile uint64_t sink = 0;
+    double best = 0;
+    for(unsigned r = 0; r < runs; ++r){
+        uint64_t sum = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        for(uint64_t i = 0; i < iterations; ++i){
+            sum += f(i);
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        sink = sink + sum;
+        double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / iterations;
+        if(r == 0 || ns < best){
+            best = ns;
+        }
+    }
+    return best;
+}
+
+/**
+ * Consigne frames as received (bytes following the address)
+ **/
+std::vector<std::vector<uint8_t>> consigneFrames(std::mt19937& rng)
+{
+    std::vector<std::vector<uint8_t>> frames(CONSIGNE_FRAMES);
+    for(auto& f : frames){
+        f.resize(ConsigneView::MIN_FRAME_LEN + rng() % (ConsigneView::MAX_LEN - ConsigneView::CTX_DATA + ConsigneView::HEADER_LEN));
+        for(uint8_t& b : f){
+            b = rng();
+        }
+    }
+    return frames;
+}
+
+/**
+ * Host part : framing and parsing code, timed on the host CPU
+ **/
+void hostBenches(const Options& opt, Metrics& m)
+{
+    std::mt19937 rng(1);
+    std::vector<std::vector<uint8_t>> consignes = consigneFrames(rng);
+    m.push_back({"consigne_parse_ns", bestNs(opt.runs, 4000000, [&](uint64_t i) -> uint64_t {
+        const std::vector<uint8_t>& f = consignes[i % CONSIGNE_FRAMES];
+        ConsigneView c;
+        if(!c.parse(f.data(), f.size(), ConsigneView::MIN_FRAME_LEN)){
+            return 0;
+        }
+        uint64_t sum = c.dest() + c.code_tache() + c.code_app() + c.msg_len() + c.page() + c.msg_addr() +
+            c.ordinateur() + c.application() + c.length();
+        for(uint32_t j = 0; j < c.ctx_len(); ++j){
+            sum += c.ctx_data()[j];
+        }
+        return sum;
+    }), true});
+
+    std::vector<uint8_t> data(DATA_FRAME_LEN);
+    for(uint8_t& b : data){
+        b = rng();
+    }
+    m.push_back({"crc16_control_ns", bestNs(opt.runs, 8000000, [&](uint64_t i) -> uint64_t {
+        data[0] = i;
+        return crc16_x25(data.data(), CONTROL_FRAME_LEN);
+    }), true});
+    m.push_back({"crc16_data_ns", bestNs(opt.runs, 20000, [&](uint64_t i) -> uint64_t {
+        data[0] = i;
+        return crc16_x25(data.data(), DATA_FRAME_LEN);
+    }), true});
+
+    std::vector<uint8_t> encoded(HDLC_ENCODED_MAX(DATA_FRAME_LEN + 2) + 3);
+    HdlcEncoder enc;
+    hdlc_encoder_init(enc);
+    m.push_back({"hdlc_encode_data_ns", bestNs(opt.runs, 20000, [&](uint64_t i) -> uint64_t {
+        data[0] = i;
+        return hdlc_encode_frame(enc, data.data(), DATA_FRAME_LEN, encoded.data());
+    }), true});
+
+    // Back to back frames, the stream ends with ones
+    hdlc_encoder_init(enc);
+    uint32_t n = hdlc_encode_frame(enc, data.data(), DATA_FRAME_LEN, encoded.data());
+    n += hdlc_encode_flush(enc, &encoded[n]);
+    std::vector<uint8_t> buffer(DATA_FRAME_LEN + 2);
+    HdlcDecoder dec;
+    hdlc_decoder_init(dec, buffer.data(), buffer.size());
+    uint64_t errors = 0;
+    m.push_back({"hdlc_decode_data_ns", bestNs(opt.runs, 20000, [&](uint64_t i) -> uint64_t {
+        uint32_t pos = 0;
+        uint64_t frames = 0;
+        while(pos < n){
+            uint32_t used;
+            receiver_status status = hdlc_decode(dec, &encoded[pos], n - pos, used);
+            pos += used;
+            if(status != busy){
+                errors += status != done;
+                ++frames;
+            }
+        }
+        return frames;
+    }), true});
+    if(errors){
+        fprintf(stderr, "hdlc_decode : %lu frames in error\n", static_cast<unsigned long>(errors));
+    }
+}
+
+/**
+ * Measurement start hook : resets statistics once the firmware booted
+ **/
+class MeasureStart : public sim::Component {
+public:
+    MeasureStart(uint64_t t, sim::BusMonitor& monitor) : t_(t), monitor_(monitor) {}
+    uint64_t nextEvent() const override { return done_ ? UINT64_MAX : t_; }
+    void run(uint64_t now) override
+    {
+        done_ = true;
+        monitor_.startMeasure(now);
+        bus_stats_reset();
+        probe_reset();
+        const sim::CpuMeter& cpu = sim::Simulator::instance().cpu();
+        cpuNs = cpu.threadNs + cpu.isrNs;
+        sleeps = wake_stats().sleeps;
+    }
+    uint64_t cpuNs = 0;
+    uint32_t sleeps = 0;
+
+private:
+    uint64_t t_;
+    sim::BusMonitor& monitor_;
+    bool done_ = false;
+};
+
+/**
+ * End to end part : the firmware serves client stations on the simulated bus
+ * @return false if no transaction completed
+ **/
+bool endToEnd(const Options& opt, Metrics& m)
+{
+    sim::Simulator& s = sim::Simulator::instance();
+    s.setPollQuantum(opt.pollNs);
+    sim::Bus bus(BusConfig::bitNs);
+    sim::DutPort dut(s.mcu(), DATA_RX_PIN, CLK_RX_PIN, TX_TRCV_ENABLE_PIN);
+    sim::BusMonitor monitor(bus, &dut);
+    bus.attach(&dut);
+    bus.attach(&monitor);
+
+    uint64_t start = opt.bootMs * 1000000ull;
+    std::vector<std::unique_ptr<sim::ClientStation>> clients;
+    for(unsigned i = 0; i < opt.stations; ++i){
+        sim::ClientConfig cfg;
+        cfg.startNs = start;
+        cfg.callIdleNs = 250 * BusConfig::bitNs;
+        cfg.callJitterNs = 100 * BusConfig::bitNs;
+        cfg.responseIdleNs = 25 * BusConfig::bitNs;
+        cfg.echoNs = 150 * BusConfig::bitNs;
+        cfg.seed = 1000 + i;
+        clients.emplace_back(new sim::ClientStation(bus, i + 1, cfg));
+        bus.attach(clients.back().get());
+    }
+    s.addComponent(&bus);
+    MeasureStart measure(start, monitor);
+    s.addComponent(&measure);
+    s.setStopTime(start + opt.durationMs * 1000000ull);
+
+    // Firmware output would mix with the results
+    fflush(stdout);
+    int savedStdout = dup(STDOUT_FILENO);
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, STDOUT_FILENO);
+    close(devNull);
+    s.firmwareEnter();
+    try{
+        picoreseau_main();
+    }catch(const sim::Stop&){
+    }
+    s.firmwareExit();
+    fflush(stdout);
+    dup2(savedStdout, STDOUT_FILENO);
+    close(savedStdout);
+
+    double frames = monitor.frames ? monitor.frames : 1;
+    for(uint32_t i = 0; i < PROBE_COUNT; ++i){
+        const ProbeStat& p = probeStats[i];
+        m.push_back({std::string(probe_name(i)) + "_cycles", p.count ? static_cast<double>(p.sum) / p.count : 0.0, true});
+    }
+    const sim::CpuMeter& cpu = s.cpu();
+    m.push_back({"cpu_per_frame_ns", (cpu.threadNs + cpu.isrNs - measure.cpuNs) / frames, true});
+    // Interrupts and bus engine wake-ups per bus frame
+    m.push_back({"pio0_isr_per_frame", probeStats[PROBE_PIO0_ISR].count / frames, false});
+    m.push_back({"rx_dma_isr_per_frame", probeStats[PROBE_RX_DMA_ISR].count / frames, false});
+    m.push_back({"wakeups_per_frame", (wake_stats().sleeps - measure.sleeps) / frames, false});
+
+    uint64_t transactions = 0;
+    sim::LatencyStats trans, echo, ack;
+    for(auto& c : clients){
+        transactions += c->transactions;
+        for(uint64_t v : c->transactionLatency.samples()) trans.add(v);
+        for(uint64_t v : c->echoLatency.samples()) echo.add(v);
+        for(uint64_t v : c->ackLatency.samples()) ack.add(v);
+    }
+    const LatencyStat& t = busStats.turnaround;
+    m.push_back({"turnaround_us", t.count ? static_cast<double>(t.sum) / t.count : 0.0, false});
+    m.push_back({"turnaround_max_us", static_cast<double>(t.max), false});
+    m.push_back({"echo_us", echo.mean() / 1000.0, false});
+    m.push_back({"ack_us", ack.mean() / 1000.0, false});
+    m.push_back({"transaction_us", trans.mean() / 1000.0, false});
+    return transactions > 0;
+}
+
+/**
+ * Results as JSON : exact metrics, then host timings
+ **/
+std::string toJson(const std::string& suite, const Metrics& m)
+{
+    std::ostringstream out;
+    out << "{\n  \"suite\": \"" << suite << "\"";
+    for(bool hostTime : {false, true}){
+        out << ",\n  \"" << (hostTime ? "host_time" : "metrics") << "\": {";
+        const char* separator = "\n";
+        for(const Metric& metric : m){
+            if(metric.hostTime != hostTime){
+                continue;
+            }
+            char value[32];
+            snprintf(value, sizeof(value), "%.3f", metric.value);
+            out << separator << "    \"" << metric.name << "\": " << value;
+            separator = ",\n";
+        }
+        out << "\n  }";
+    }
+    out << "\n}\n";
+    return out.str();
+}
+
+/**
+ * Reads the metrics of a results file, console output around the JSON is
+ * ignored, the last value of a metric is kept
+ **/
+bool readMetrics(const std::string& path, std::map<std::string, double>& m)
+{
+    std::ifstream f(path);
+    if(!f){
+        return false;
+    }
+    std::stringstream text;
+    text << f.rdbuf();
+    std::string s = text.str();
+    static const std::regex pair("\"([A-Za-z0-9_]+)\"\\s*:\\s*(-?[0-9.]+(?:[eE][-+]?[0-9]+)?)");
+    for(auto it = std::sregex_iterator(s.begin(), s.end(), pair); it != std::sregex_iterator(); ++it){
+        m[(*it)[1].str()] = strtod((*it)[2].str().c_str(), nullptr);
+    }
+    return !m.empty();
+}
+
+/**
+ * Prints each baseline metric beside its current value
+ * @param info Metrics compared for information only (host timings)
+ * @return false if a gated metric is slower than the threshold or missing
+ **/
+bool compare(const std::map<std::string, double>& baseline, const std::map<std::string, double>& current,
+             double thresholdPct, const std::set<std::string>& info = std::set<std::string>())
+{
+    bool ok = true;
+    fprintf(stderr, "%-28s %12s %12s %9s\n", "Metric", "baseline", "current", "change");
+    for(const auto& b : baseline){
+        auto c = current.find(b.first);
+        if(c == current.end()){
+            fprintf(stderr, "%-28s %12.3f %12s %9s  MISSING\n", b.first.c_str(), b.second, "-", "-");
+            ok = false;
+            continue;
+        }
+        bool gated = info.count(b.first) == 0;
+        bool slower = c->second > b.second * (1 + thresholdPct / 100);
+        bool faster = c->second < b.second * (1 - thresholdPct / 100);
+        const char* flag = slower ? (gated ? "  SLOWER" : "  slower (host time)") : faster ? "  faster" : "";
+        if(b.second > 0){
+            fprintf(stderr, "%-28s %12.3f %12.3f %+8.1f%%%s\n", b.first.c_str(), b.second, c->second,
+                    100 * (c->second - b.second) / b.second, flag);
+        }else{
+            fprintf(stderr, "%-28s %12.3f %12.3f %9s%s\n", b.first.c_str(), b.second, c->second, "-", flag);
+        }
+        ok = ok && !(slower && gated);
+    }
+    for(const auto& c : current){
+        if(baseline.find(c.first) == baseline.end()){
+            fprintf(stderr, "%-28s %12s %12.3f %9s  new\n", c.first.c_str(), "-", c.second, "-");
+        }
+    }
+    fprintf(stderr, "%s (threshold %.0f %%)\n", ok ? "No regression" : "REGRESSION", thresholdPct);
+    return ok;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    if(!parse(argc, argv, opt)){
+        usage(argv[0]);
+        return 1;
+    }
+    if(!opt.target.empty() && opt.baseline.empty()){
+        opt.baseline = PICORESEAU_TARGET_BASELINE;
+    }
+    std::map<std::string, double> baseline;
+    if(!opt.baseline.empty() && !readMetrics(opt.baseline, baseline)){
+        fprintf(stderr, "No metrics in %s\n", opt.baseline.c_str());
+        return 1;
+    }
+    if(!opt.target.empty()){
+        std::map<std::string, double> target;
+        if(!readMetrics(opt.target, target)){
+            fprintf(stderr, "No metrics in %s\n", opt.target.c_str());
+            return 1;
+        }
+        return compare(baseline, target, opt.thresholdPct) ? 0 : 1;
+    }
+
+    Metrics m;
+    hostBenches(opt, m);
+    if(!endToEnd(opt, m)){
+        fprintf(stderr, "No transaction completed\n");
+        return 1;
+    }
+    std::string json = toJson("host", m);
+    if(opt.output.empty()){
+        fputs(json.c_str(), stdout);
+    }else{
+        std::ofstream f(opt.output);
+        if(!(f << json)){
+            fprintf(stderr, "Unable to write %s\n", opt.output.c_str());
+            return 1;
+        }
+    }
+    if(!baseline.empty()){
+        std::map<std::string, double> current;
+        std::set<std::string> info;
+        for(const Metric& metric : m){
+            current[metric.name] = metric.value;
+            if(metric.hostTime){
+                info.insert(metric.name);
+            }
+        }
+        return compare(baseline, current, opt.thresholdPct, info) ? 0 : 1;
+    }
+    return 0;
+}
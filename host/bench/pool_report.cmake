@@ -0,0 +1,48 @@
+# Frame pool occupancy report : high-water marks of the small and large classes under the
+# heaviest simulated loads, against their block counts (src/frame_pool.h, USE_POOL_STATS)
+#   16 stations        protocol traffic, many sessions at once
+#   contention         stations calling while the firmware answers (collisions, retries)
+#   64 KB upload       GET_DATA message, large blocks for the data frames
+# cmake -DSIM_DIR=<host build dir> -P pool_report.cmake
+
+set(SCENARIOS
+    "16 stations|picoreseau_sim|--stations,16,--duration-ms,1000"
+    "contention|picoreseau_sim|--stations,4,--duration-ms,1000,--call-idle,25,--call-jitter,4"
+    "64 KB upload|message_bench|--sizes,65535,--upload"
+    "64 KB download|message_bench|--sizes,65535"
+)
+
+message("Load               Small blocks   Large blocks   Failures")
+set(FULL "")
+foreach(SCENARIO ${SCENARIOS})
+    string(REPLACE "|" ";" FIELDS "${SCENARIO}")
+    list(GET FIELDS 0 NAME)
+    list(GET FIELDS 1 TOOL)
+    list(GET FIELDS 2 ARGS)
+    string(REPLACE "," ";" ARGS "${ARGS}")
+    execute_process(COMMAND ${SIM_DIR}/${TOOL} ${ARGS} OUTPUT_VARIABLE OUT RESULT_VARIABLE R)
+    if (NOT R EQUAL 0 OR NOT OUT MATCHES "Frame pool high water +small ([0-9]+)/([0-9]+), large ([0-9]+)/([0-9]+), ([0-9]+) failures")
+        message(FATAL_ERROR "${TOOL} ${ARGS} failed")
+    endif()
+    set(LINE "${NAME}")
+    string(LENGTH "${LINE}" L)
+    math(EXPR PAD "19 - ${L}")
+    string(REPEAT " " ${PAD} SPACES)
+    set(SMALL "${CMAKE_MATCH_1}/${CMAKE_MATCH_2}")
+    set(LARGE "${CMAKE_MATCH_3}/${CMAKE_MATCH_4}")
+    set(LINE "${LINE}${SPACES}${SMALL}")
+    string(LENGTH "${SMALL}" L)
+    math(EXPR PAD "15 - ${L}")
+    string(REPEAT " " ${PAD} SPACES)
+    set(LINE "${LINE}${SPACES}${LARGE}")
+    string(LENGTH "${LARGE}" L)
+    math(EXPR PAD "15 - ${L}")
+    string(REPEAT " " ${PAD} SPACES)
+    message("${LINE}${SPACES}${CMAKE_MATCH_5}")
+    if (CMAKE_MATCH_1 EQUAL CMAKE_MATCH_2 OR CMAKE_MATCH_3 EQUAL CMAKE_MATCH_4 OR NOT CMAKE_MATCH_5 EQUAL 0)
+        list(APPEND FULL "${NAME}")
+    endif()
+endforeach()
+if (FULL)
+    message(WARNING "Frame pool exhausted : ${FULL}")
+endif()
@@ -0,0 +1,44 @@
+# Runs the simulator built for each bus bit rate (PICORESEAU_RATE_BENCH) :
+#   16 stations        frames/s and transactions/s of the protocol
+#   flooded bus        frames/s of back to back traffic, frames the firmware lost
+#                      (RX ring overruns and queue overflows)
+# cmake -DSIM_DIR=<host build dir> -DRATES=250000,500000 -P rate_bench.cmake
+
+string(REPLACE "," ";" RATES "${RATES}")
+
+function(sim_value OUT TEXT REGEX)
+    if (TEXT MATCHES "${REGEX}")
+        set(${OUT} ${CMAKE_MATCH_1} PARENT_SCOPE)
+    else()
+        set(${OUT} "-" PARENT_SCOPE)
+    endif()
+endfunction()
+
+message("Rate kbit/s   Stations frames/s   Transactions/s   Bus use   Flood frames/s   Flood lost")
+foreach(RATE ${RATES})
+    set(SIM ${SIM_DIR}/picoreseau_sim_${RATE})
+    execute_process(COMMAND ${SIM} --stations 16 --duration-ms 1000 OUTPUT_VARIABLE STATIONS RESULT_VARIABLE R1)
+    execute_process(COMMAND ${SIM} --stations 0 --traffic 1 --duration-ms 1000 OUTPUT_VARIABLE FLOOD RESULT_VARIABLE R2)
+    if (NOT R1 EQUAL 0 OR NOT R2 EQUAL 0)
+        message(FATAL_ERROR "${SIM} failed")
+    endif()
+    sim_value(FRAMES "${STATIONS}" "valid \\(([0-9.]+) frames/s\\)")
+    sim_value(TRANSACTIONS "${STATIONS}" "Transactions +[0-9]+ \\(([0-9.]+)/s\\)")
+    sim_value(USE "${STATIONS}" "Bus utilisation +([0-9.]+ %)")
+    sim_value(FLOOD_FRAMES "${FLOOD}" "valid \\(([0-9.]+) frames/s\\)")
+    sim_value(OVERRUNS "${FLOOD}" "overrun=([0-9]+)")
+    sim_value(OVERFLOWS "${FLOOD}" "overflow=([0-9]+)")
+    math(EXPR KBPS "${RATE} / 1000")
+    math(EXPR LOST "${OVERRUNS} + ${OVERFLOWS}")
+    set(LINE "")
+    foreach(FIELD "${KBPS}|11" "${FRAMES}|20" "${TRANSACTIONS}|17" "${USE}|10" "${FLOOD_FRAMES}|17" "${LOST}|13")
+        string(REPLACE "|" ";" FIELD "${FIELD}")
+        list(GET FIELD 0 VALUE)
+        list(GET FIELD 1 WIDTH)
+        string(LENGTH "${VALUE}" V)
+        math(EXPR PAD "${WIDTH} - ${V}")
+        string(REPEAT " " ${PAD} SPACES)
+        set(LINE "${LINE}${SPACES}${VALUE}")
+    endforeach()
+    message("${LINE}")
+endforeach()
@@ -0,0 +1,289 @@
+/**
+ * Two bus segments served by one RP2040
+ * Each segment is flooded by a traffic station, the firmware receives all
+ * frames of both segments through their own transceiver (promiscuous) and
+ * bridges them : stations 16 to 31 are on segment 1, the others on segment
+ * 0, a valid frame for a station of the other segment is sent again there.
+ * Reports bus and firmware throughput of each segment and the aggregate,
+ * run it with --segments 1 to compare with a single segment.
+ **/
+#include "sim/bus.h"
+#include "sim/dut_port.h"
+#include "sim/rp2040.h"
+#include "sim/simulator.h"
+#include "sim/station.h"
+#include "src/bus_stats.h"
+#include "src/bus_timing.h"
+#include "src/frame_pool.h"
+#include "src/hdlc_rx.h"
+#include "src/hdlc_tx.h"
+#include "src/transceiver.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+static_assert(NR_SEGMENTS == 2, "The bench needs a firmware built for 2 segments");
+
+#define RX_FRAMES_PER_LOOP 4        // Received frames handled per segment and loop, as the bus engine
+
+namespace {
+
+// GPIOs of the segments, the received clock follows the received data
+const TransceiverPins pins[NR_SEGMENTS] = {
+    {0, 2, 3, 4, 5},
+    {6, 8, 9, 10, 11},
+};
+
+struct Options {
+    unsigned segments = 2;
+    uint64_t durationMs = 1000;     // Measurement duration
+    uint64_t bootMs = 1;            // Transceivers set up before traffic starts
+    uint64_t pollNs = 200;          // Cost of one polling iteration
+    uint64_t trafficGapUs = 20;     // Bus idle between frames of the traffic stations
+    bool bridge = true;
+    uint32_t seed = 1;
+};
+
+/**
+ * Frames seen by the firmware on a segment
+ **/
+struct SegmentCount {
+    uint64_t valid = 0;
+    uint64_t badCrc = 0;
+    uint64_t aborted = 0;
+    uint64_t other = 0;             // Short or overrun
+    uint64_t forwarded = 0;         // Valid frames queued on the other segment
+    uint64_t dropped = 0;           // Not forwarded : no buffer or TX queue full
+};
+
+SegmentCount counts[NR_SEGMENTS];
+unsigned activeSegments = NR_SEGMENTS;
+bool bridging = true;
+
+void usage(const char* name)
+{
+    printf("Usage: %s [options]\n"
+        "  --segments N      Bus segments driven (1 or 2, default 2)\n"
+        "  --duration-ms MS  Measured simulated time (default 1000)\n"
+        "  --poll-ns NS      Simulated duration of a polling iteration (default 200)\n"
+        "  --traffic GAP_US  Bus idle between frames of the traffic stations (default 20)\n"
+        "  --no-bridge       Only receives, frames are not sent to the other segment\n"
+        "  --seed S          Random seed (default 1)\n", name);
+}
+
+bool parse(int argc, char** argv, Options& o)
+{
+    for(int i = 1; i < argc; ++i){
+        std::string a = argv[i];
+        auto value = [&]() -> const char* {
+            if(i + 1 >= argc){
+                return "0";
+            }
+            return argv[++i];
+        };
+        if(a == "--segments"){
+            o.segments = strtoul(value(), nullptr, 0);
+        }else if(a == "--duration-ms"){
+            o.durationMs = strtoull(value(), nullptr, 0);
+        }else if(a == "--poll-ns"){
+            o.pollNs = strtoull(value(), nullptr, 0);
+        }else if(a == "--traffic"){
+            o.trafficGapUs = strtoull(value(), nullptr, 0);
+        }else if(a == "--no-bridge"){
+            o.bridge = false;
+        }else if(a == "--seed"){
+            o.seed = strtoul(value(), nullptr, 0);
+        }else{
+            return false;
+        }
+    }
+    return o.segments >= 1 && o.segments <= NR_SEGMENTS && o.trafficGapUs > 0;
+}
+
+/**
+ * Gets the segment of a station
+ **/
+inline unsigned homeSegment(uint8_t address)
+{
+    return address >= NR_MAX_STATIONS / 2 ? 1 : 0;
+}
+
+/**
+ * Sends a received frame on the other segment
+ **/
+void forward(unsigned segment, const RxFrame& frame)
+{
+    SegmentCount& c = counts[segment];
+    uint8_t* buffer = pool_alloc(frame.length + 1);
+    if(buffer == nullptr){
+        ++c.dropped;
+        return;
+    }
+    buffer[0] = frame.address;
+    uint32_t len = 0;
+    if(copyFrame(frame, &buffer[1], frame.length, len) != done){
+        pool_release(buffer);
+        ++c.other;
+        return;
+    }
+    if(sendFrame(getEmitter(1 - segment), buffer, len + 1, pool_tx_done) == 0){
+        pool_release(buffer);
+        ++c.dropped;
+        return;
+    }
+    ++c.forwarded;
+}
+
+/**
+ * Firmware of the bench, runs on core 0
+ **/
+void bridgeMain()
+{
+    for(unsigned i = 0; i < activeSegments; ++i){
+        configureTransceiver(i, pins[i]);
+        setReceiverPromiscuous(getReceiver(i), true);
+        enableReceiver(getReceiver(i), true);
+    }
+    while(true){
+        for(unsigned i = 0; i < activeSegments; ++i){
+            RxFrame frame;
+            for(uint32_t n = 0; n < RX_FRAMES_PER_LOOP && receiveFrame(getReceiver(i), frame); ++n){
+                SegmentCount& c = counts[i];
+                if(frame.status == done){
+                    ++c.valid;
+                    if(bridging && activeSegments == NR_SEGMENTS && homeSegment(frame.address) != i){
+                        forward(i, frame);
+                    }
+                }else if(frame.status == bad_crc){
+                    ++c.badCrc;
+                }else if(frame.status == frame_aborted){
+                    ++c.aborted;
+                }else{
+                    ++c.other;
+                }
+            }
+        }
+        tight_loop_contents();
+    }
+}
+
+/**
+ * Measurement start hook : resets counters once traffic runs
+ **/
+class MeasureStart : public sim::Component {
+public:
+    MeasureStart(uint64_t t, std::vector<std::unique_ptr<sim::BusMonitor>>& monitors) :
+        t_(t), monitors_(monitors) {}
+    uint64_t nextEvent() const override { return done_ ? UINT64_MAX : t_; }
+    void run(uint64_t now) override
+    {
+        done_ = true;
+        for(auto& m : monitors_){
+            m->startMeasure(now);
+        }
+        for(unsigned i = 0; i < NR_SEGMENTS; ++i){
+            counts[i] = SegmentCount();
+            sent[i] = getEmitter(i).done;
+        }
+        bus_stats_reset();
+        const sim::CpuMeter& cpu = sim::Simulator::instance().cpu();
+        threadNs = cpu.threadNs;
+        isrNs = cpu.isrNs;
+        isrCalls = cpu.isrCalls;
+    }
+    uint64_t threadNs = 0;
+    uint64_t isrNs = 0;
+    uint64_t isrCalls = 0;
+    uint32_t sent[NR_SEGMENTS] = {};    // Frames sent by the emitters before the measure
+
+private:
+    uint64_t t_;
+    std::vector<std::unique_ptr<sim::BusMonitor>>& monitors_;
+    bool done_ = false;
+};
+
+}
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    if(!parse(argc, argv, opt)){
+        usage(argv[0]);
+        return 1;
+    }
+    activeSegments = opt.segments;
+    bridging = opt.bridge;
+
+    sim::Simulator& s = sim::Simulator::instance();
+    sim::Rp2040& mcu = s.mcu();
+    s.setPollQuantum(opt.pollNs);
+
+    uint64_t start = opt.bootMs * 1000000ull;
+    std::vector<std::unique_ptr<sim::Bus>> buses;
+    std::vector<std::unique_ptr<sim::DutPort>> ports;
+    std::vector<std::unique_ptr<sim::BusMonitor>> monitors;
+    std::vector<std::unique_ptr<sim::TrafficStation>> traffic;
+    for(unsigned i = 0; i < opt.segments; ++i){
+        buses.emplace_back(new sim::Bus(BusConfig::bitNs));
+        ports.emplace_back(new sim::DutPort(mcu, pins[i].dataRx, pins[i].dataRx + 1, pins[i].txEnable));
+        monitors.emplace_back(new sim::BusMonitor(*buses[i], ports[i].get()));
+        sim::TrafficConfig cfg;
+        cfg.startNs = start;
+        cfg.gapNs = opt.trafficGapUs * 1000;
+        cfg.seed = opt.seed * 1000 + i;
+        traffic.emplace_back(new sim::TrafficStation(*buses[i], cfg));
+        buses[i]->attach(ports[i].get());
+        buses[i]->attach(monitors[i].get());
+        buses[i]->attach(traffic[i].get());
+        s.addComponent(buses[i].get());
+    }
+    MeasureStart measure(start, monitors);
+    s.addComponent(&measure);
+    s.setStopTime(start + opt.durationMs * 1000000ull);
+
+    s.firmwareEnter();
+    try{
+        bridgeMain();
+    }catch(const sim::Stop&){
+    }
+    s.firmwareExit();
+
+    // Report
+    double seconds = opt.durationMs / 1000.0;
+    printf("Simulated time              %.3f s, %u segment%s, %.0f kbit/s, bridge %s\n", seconds, opt.segments,
+           opt.segments > 1 ? "s" : "",
+           1e6 / BusConfig::bitNs, opt.bridge && opt.segments == NR_SEGMENTS ? "on" : "off");
+    uint64_t busFrames = 0;
+    uint64_t rxFrames = 0;
+    for(unsigned i = 0; i < opt.segments; ++i){
+        const sim::BusMonitor& m = *monitors[i];
+        const SegmentCount& c = counts[i];
+        const HdlcEmitter& tx = getEmitter(i);
+        printf("Segment %u bus               %lu valid (%.1f frames/s), %lu bad CRC, %lu aborts, %lu collisions, %.1f %% busy\n",
+               i, m.frames, m.frames / seconds, m.badFrames, m.aborts, m.collisions, 100.0 * m.busyNs / (seconds * 1e9));
+        printf("Segment %u firmware          rx %lu valid (%.1f frames/s), %lu bad CRC, %lu aborted, %lu other\n",
+               i, c.valid, c.valid / seconds, c.badCrc, c.aborted, c.other);
+        printf("Segment %u bridge            %lu forwarded, %lu dropped, %lu sent on this segment\n",
+               i, c.forwarded, c.dropped, static_cast<unsigned long>(tx.done - measure.sent[i]));
+        busFrames += m.frames;
+        rxFrames += c.valid;
+    }
+    printf("Aggregate                   bus %.1f frames/s, firmware rx %.1f frames/s (%ld missed)\n",
+           busFrames / seconds, rxFrames / seconds, static_cast<long>(busFrames - rxFrames));
+    const BusStats& b = busStats;
+    PoolStats pool;
+    pool_get_stats(pool);
+    printf("Firmware counters           overflow=%lu, pool small %u/%u (%lu failures)\n",
+           static_cast<unsigned long>(b.queueOverflows), pool.small.highWater, POOL_SMALL_COUNT,
+           static_cast<unsigned long>(pool.small.failures));
+    const sim::CpuMeter& cpu = s.cpu();
+    uint64_t threadNs = cpu.threadNs - measure.threadNs;
+    uint64_t isrNs = cpu.isrNs - measure.isrNs;
+    printf("Firmware CPU (host)         thread %.3f ms, ISR %.3f ms (%lu calls)\n",
+           threadNs / 1e6, isrNs / 1e6, cpu.isrCalls - measure.isrCalls);
+    return 0;
+}
@@ -0,0 +1,401 @@
+/**
+ * Host library against the simulated adapter
+ * A host program (bridge/bridge.h) opens the bus through the vendor
+ * interface, over a pipe pair or a pty, while a traffic station floods
+ * the bus : every bus frame must reach the program, its own frames must
+ * be sent unchanged. Reports frames/s both ways, receive and completion
+ * latencies, and the USB packets and transfers used per frame, with
+ * batching (default) or one record per transfer (--no-batch)
+ **/
+#include "bridge/bridge.h"
+#include "bridge/transport.h"
+#include "sim/bus.h"
+#include "sim/dut_port.h"
+#include "sim/rp2040.h"
+#include "sim/simulator.h"
+#include "sim/station.h"
+#include "sim/stats.h"
+#include "src/bus_timing.h"
+#include "src/usb_bridge.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// Firmware entry point (main of picoreseau.cpp, renamed for the host build)
+int picoreseau_main();
+
+#define DATA_RX_PIN 0
+#define CLK_RX_PIN 1
+#define TX_TRCV_ENABLE_PIN 5
+
+#define HOST_PERIOD_NS 100000       // The host program runs every 100 us
+#define OPEN_BEFORE_NS 100000000    // Bus opened 100 ms before the measure
+#define DRAIN_NS 20000000           // Nothing sent during the last 20 ms
+
+namespace {
+
+struct Options {
+    uint64_t bootMs = 3500;         // Firmware start-up time (debug delay)
+    uint64_t durationMs = 1000;     // Measured simulated time
+    uint64_t pollNs = 200;          // Cost of one polling iteration
+    uint64_t trafficGapUs = 20;     // Bus idle between frames of the traffic station, 0 : none
+    unsigned sendRate = 500;        // Frames/s sent by the host program
+    bool batching = true;
+    bool pty = false;
+    bool verbose = false;
+    uint32_t seed = 1;
+};
+
+void usage(const char* prog)
+{
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  --duration-ms MS  Measured simulated time (default 1000)\n"
+        "  --poll-ns NS      Simulated duration of a polling iteration (default 200)\n"
+        "  --traffic GAP_US  Bus idle between frames of the traffic station (default 20, 0 : none)\n"
+        "  --send FPS        Frames/s sent by the host program (default 500)\n"
+        "  --no-batch        One record per USB transfer\n"
+        "  --pty             Host program on a pty instead of a pipe pair\n"
+        "  --seed S          Random seed (default 1)\n"
+        "  --verbose         Shows firmware output\n", prog);
+}
+
+bool parse(int argc, char** argv, Options& o)
+{
+    for(int i = 1; i < argc; ++i){
+        std::string a = argv[i];
+        auto value = [&](void) -> const char* {
+            if(i + 1 >= argc){
+                fprintf(stderr, "Missing value for %s\n", a.c_str());
+                exit(1);
+            }
+            return argv[++i];
+        };
+        if(a == "--duration-ms"){
+            o.durationMs = strtoull(value(), nullptr, 0);
+        }else if(a == "--poll-ns"){
+            o.pollNs = strtoull(value(), nullptr, 0);
+        }else if(a == "--traffic"){
+            o.trafficGapUs = strtoull(value(), nullptr, 0);
+        }else if(a == "--send"){
+            o.sendRate = strtoul(value(), nullptr, 0);
+        }else if(a == "--no-batch"){
+            o.batching = false;
+        }else if(a == "--pty"){
+            o.pty = true;
+        }else if(a == "--seed"){
+            o.seed = strtoul(value(), nullptr, 0);
+        }else if(a == "--verbose"){
+            o.verbose = true;
+        }else{
+            return false;
+        }
+    }
+    return o.durationMs * 1000000ull > DRAIN_NS;
+}
+
+/**
+ * Host program, runs in simulated time : opens the bus, sends random
+ * frames at a fixed rate and checks what it gets back
+ **/
+class HostProgram : public sim::Component {
+public:
+    HostProgram(bridge::Bridge& bridge, const Options& o, uint64_t start, uint64_t stop) :
+        bridge_(bridge), batching_(o.batching), openTime_(start - OPEN_BEFORE_NS), start_(start), stop_(stop),
+        period_(o.sendRate ? 1000000000ull / o.sendRate : UINT64_MAX), rng_(o.seed)
+    {
+        next_ = openTime_;
+        nextSend_ = start;
+        bridge_.onReceive([this](const bridge::Frame& f) { received(f); });
+        bridge_.onSent([this](uint16_t tag, uint8_t status) { sent(tag, status); });
+    }
+
+    uint64_t nextEvent() const override { return failed_ ? UINT64_MAX : next_; }
+
+    void run(uint64_t now) override
+    {
+        next_ = now + HOST_PERIOD_NS;
+        if(now == openTime_){
+            bridge_.open(batching_);
+        }
+        while(bridge_.isOpen() && now >= nextSend_ && nextSend_ < stop_){
+            sendFrame(now);
+            nextSend_ += period_;
+        }
+        if(!bridge_.process(0)){
+            fprintf(stderr, "Link to the adapter lost\n");
+            failed_ = true;
+        }
+    }
+
+    /**
+     * Starts the measure
+     **/
+    void reset()
+    {
+        frames = 0;
+        valid = 0;
+        bad = 0;
+        completed = 0;
+        rejected = 0;
+        sentFrames.clear();
+        rxLatency = sim::LatencyStats();
+        txLatency = sim::LatencyStats();
+    }
+
+    uint64_t frames = 0;            // Frames received
+    uint64_t valid = 0;             // With a valid CRC
+    uint64_t bad = 0;               // Bad CRC, aborted or short
+    uint64_t completed = 0;
+    uint64_t rejected = 0;
+    std::vector<std::vector<uint8_t>> sentFrames;
+    sim::LatencyStats rxLatency;    // Closing flag to the host program
+    sim::LatencyStats txLatency;    // send() to completion
+
+private:
+    void sendFrame(uint64_t now)
+    {
+        std::uniform_int_distribution<unsigned> len(3, 64);
+        std::uniform_int_distribution<unsigned> byte(0, 255);
+        std::vector<uint8_t> f(len(rng_));
+        for(uint8_t& b : f){
+            b = byte(rng_);
+        }
+        f[0] = 1 + byte(rng_) % 31;
+        int tag = bridge_.send(f.data(), f.size());
+        if(tag >= 0){
+            sendTimes_[tag] = now;
+            if(now >= start_){
+                sentFrames.push_back(f);
+            }
+        }
+    }
+
+    void received(const bridge::Frame& f)
+    {
+        uint64_t now = sim::Simulator::instance().now();
+        ++frames;
+        if(f.flags == USB_RX_CRC_OK){
+            ++valid;
+        }else{
+            ++bad;
+        }
+        //Adapter clock is the simulated one
+        rxLatency.add(static_cast<uint32_t>(now / 1000 - f.time) * 1000ull);
+    }
+
+    void sent(uint16_t tag, uint8_t status)
+    {
+        uint64_t now = sim::Simulator::instance().now();
+        auto it = sendTimes_.find(tag);
+        if(it != sendTimes_.end()){
+            if(it->second >= start_){
+                txLatency.add(now - it->second);
+            }
+            sendTimes_.erase(it);
+        }
+        ++completed;
+        if(status != USB_SENT_OK){
+            ++rejected;
+        }
+    }
+
+    bridge::Bridge& bridge_;
+    bool batching_;
+    uint64_t openTime_;
+    uint64_t start_;
+    uint64_t stop_;
+    uint64_t period_;
+    uint64_t next_;
+    uint64_t nextSend_;
+    bool failed_ = false;
+    std::mt19937 rng_;
+    std::map<uint16_t, uint64_t> sendTimes_;
+};
+
+/**
+ * Measurement start hook : resets counters once the bus is open
+ **/
+class MeasureStart : public sim::Component {
+public:
+    MeasureStart(uint64_t t, sim::BusMonitor& monitor, HostProgram& host, const bridge::Bridge& bridge) :
+        t_(t), monitor_(monitor), host_(host), bridge_(bridge) {}
+    uint64_t nextEvent() const override { return done_ ? UINT64_MAX : t_; }
+    void run(uint64_t now) override
+    {
+        done_ = true;
+        monitor_.startMeasure(now);
+        host_.reset();
+        sim::Simulator& s = sim::Simulator::instance();
+        const sim::UsbDevice& usb = s.mcu().usb;
+        inPackets = usb.inPackets;
+        inTransfers = usb.inTransfers;
+        inBytes = usb.inBytes;
+        outPackets = usb.outPackets;
+        outBytes = usb.outBytes;
+        hostBatches = bridge_.stats().batchesOut;
+        const sim::CpuMeter& cpu = s.cpu();
+        threadNs = cpu.threadNs;
+        isrNs = cpu.isrNs;
+        isrCalls = cpu.isrCalls;
+        batchesIn = bridge_stats().inBatches;
+    }
+    uint64_t inPackets = 0;         // USB counters at the measure start
+    uint64_t inTransfers = 0;
+    uint64_t inBytes = 0;
+    uint64_t outPackets = 0;
+    uint64_t outBytes = 0;
+    uint64_t hostBatches = 0;
+    uint64_t threadNs = 0;
+    uint64_t isrNs = 0;
+    uint64_t isrCalls = 0;
+    uint32_t batchesIn = 0;
+
+private:
+    uint64_t t_;
+    sim::BusMonitor& monitor_;
+    HostProgram& host_;
+    const bridge::Bridge& bridge_;
+    bool done_ = false;
+};
+
+void printLatency(const char* name, const sim::LatencyStats& s)
+{
+    printf("%-28s n=%-6zu min=%8.1f avg=%8.1f p99=%8.1f max=%8.1f us\n", name, s.count(),
+           s.min() / 1000.0, s.mean() / 1000.0, s.percentile(99) / 1000.0, s.max() / 1000.0);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    if(!parse(argc, argv, opt)){
+        usage(argv[0]);
+        return 1;
+    }
+
+    sim::Simulator& s = sim::Simulator::instance();
+    sim::Rp2040& mcu = s.mcu();
+    s.setPollQuantum(opt.pollNs);
+
+    // Link between the host program and the vendor interface
+    std::unique_ptr<bridge::FdTransport> transport;
+    if(opt.pty){
+        int master = posix_openpt(O_RDWR | O_NOCTTY);
+        if(master < 0 || grantpt(master) != 0 || unlockpt(master) != 0){
+            fprintf(stderr, "Unable to create a pty\n");
+            return 1;
+        }
+        transport.reset(bridge::FdTransport::openTty(ptsname(master)));
+        if(!transport){
+            return 1;
+        }
+        mcu.usb.connect(master, master);
+    }else{
+        int toDevice[2];
+        int toHost[2];
+        if(pipe(toDevice) != 0 || pipe(toHost) != 0){
+            fprintf(stderr, "Unable to create pipes\n");
+            return 1;
+        }
+        transport.reset(new bridge::FdTransport(toHost[0], toDevice[1]));
+        mcu.usb.connect(toDevice[0], toHost[1]);
+    }
+    bridge::Bridge bridge(*transport);
+
+    uint64_t start = opt.bootMs * 1000000ull;
+    uint64_t end = start + opt.durationMs * 1000000ull;
+    sim::Bus bus(BusConfig::bitNs);
+    sim::DutPort dut(mcu, DATA_RX_PIN, CLK_RX_PIN, TX_TRCV_ENABLE_PIN);
+    sim::BusMonitor monitor(bus, &dut);
+    std::vector<std::vector<uint8_t>> dutFrames;
+    monitor.setDutLog(&dutFrames);
+    bus.attach(&dut);
+    bus.attach(&monitor);
+    std::unique_ptr<sim::TrafficStation> traffic;
+    if(opt.trafficGapUs){
+        sim::TrafficConfig cfg;
+        cfg.startNs = start;
+        cfg.stopNs = end - DRAIN_NS;
+        cfg.gapNs = opt.trafficGapUs * 1000;
+        cfg.seed = opt.seed;
+        traffic.reset(new sim::TrafficStation(bus, cfg));
+        bus.attach(traffic.get());
+    }
+    HostProgram host(bridge, opt, start, end - DRAIN_NS);
+    MeasureStart measure(start, monitor, host, bridge);
+    s.addComponent(&bus);
+    s.addComponent(&mcu.usb);
+    // Counters are reset before the first frame is sent
+    s.addComponent(&measure);
+    s.addComponent(&host);
+    s.setStopTime(end);
+
+    fflush(stdout);
+    int savedStdout = dup(STDOUT_FILENO);
+    if(!opt.verbose){
+        int devNull = open("/dev/null", O_WRONLY);
+        dup2(devNull, STDOUT_FILENO);
+        close(devNull);
+    }
+    s.firmwareEnter();
+    try{
+        picoreseau_main();
+    }catch(const sim::Stop&){
+    }
+    s.firmwareExit();
+    fflush(stdout);
+    dup2(savedStdout, STDOUT_FILENO);
+    close(savedStdout);
+
+    // Report
+    double seconds = opt.durationMs / 1000.0;
+    uint64_t seen = monitor.frames + monitor.badFrames + monitor.aborts;
+    printf("Simulated time              %.3f s, %.0f kbit/s, %s, batching %s\n", seconds, 1e6 / BusConfig::bitNs,
+           opt.pty ? "pty" : "pipe", opt.batching ? "on" : "off");
+    printf("Bus frames                  %lu valid (%.1f frames/s), %lu bad CRC, %lu aborts, %lu collisions, %.1f %% busy\n",
+           monitor.frames, monitor.frames / seconds, monitor.badFrames, monitor.aborts, monitor.collisions,
+           100.0 * monitor.busyNs / (seconds * 1e9));
+    const bridge::Stats& bs = bridge.stats();
+    printf("Host received               %lu frames (%.1f frames/s), %lu valid, %lu damaged, %ld missing, %lu dropped by the adapter\n",
+           host.frames, host.frames / seconds, host.valid, host.bad, static_cast<long>(seen - host.frames), bs.rxDropped);
+    // Frames found unchanged on the bus, in order (collisions destroy some)
+    size_t same = 0;
+    for(size_t i = 0, j = 0; i < host.sentFrames.size() && j < dutFrames.size(); ++i){
+        if(host.sentFrames[i] == dutFrames[j]){
+            ++same;
+            ++j;
+        }
+    }
+    printf("Host sent                   %zu frames (%.1f frames/s), %lu completed, %lu rejected, %zu unchanged on the bus%s\n",
+           host.sentFrames.size(), host.sentFrames.size() / seconds, host.completed, host.rejected, same,
+           same == dutFrames.size() ? "" : " (MISMATCH)");
+    printLatency("Receive latency", host.rxLatency);
+    printLatency("Send completion", host.txLatency);
+    const sim::UsbDevice& usb = mcu.usb;
+    uint64_t inPackets = usb.inPackets - measure.inPackets;
+    uint64_t inTransfers = usb.inTransfers - measure.inTransfers;
+    uint64_t records = host.frames + host.completed;
+    printf("USB IN                      %lu packets, %lu transfers, %lu bytes, %.2f packets and %.2f transfers per record\n",
+           inPackets, inTransfers, usb.inBytes - measure.inBytes,
+           records ? static_cast<double>(inPackets) / records : 0.0,
+           records ? static_cast<double>(inTransfers) / records : 0.0);
+    printf("USB OUT                     %lu packets, %lu bytes\n", usb.outPackets - measure.outPackets,
+           usb.outBytes - measure.outBytes);
+    uint32_t batches = bridge_stats().inBatches - measure.batchesIn;
+    printf("Adapter batches             %u (%.2f records per batch), host batches %lu\n", batches,
+           batches ? static_cast<double>(records) / batches : 0.0, bs.batchesOut - measure.hostBatches);
+    const sim::CpuMeter& cpu = s.cpu();
+    printf("Firmware CPU (host)         thread %.3f ms, ISR %.3f ms (%lu calls)\n",
+           (cpu.threadNs - measure.threadNs) / 1e6, (cpu.isrNs - measure.isrNs) / 1e6, cpu.isrCalls - measure.isrCalls);
+    return 0;
+}
@@ -0,0 +1,218 @@
+#include "bridge.h"
+
+#include "src/usb_protocol.h"
+
+#include <cstring>
+
+#define READ_CHUNK 16384                // Bytes read from the transport at once
+
+namespace bridge {
+
+Bridge::Bridge(Transport& transport) : transport_(transport)
+{
+}
+
+void Bridge::open(bool batching)
+{
+    batching_ = batching;
+    UsbOpen o = {USB_BRIDGE_VERSION};
+    Record r = {USB_OPEN, static_cast<uint8_t>(batching ? 0 : USB_OPEN_NO_BATCH), {}};
+    r.payload.resize(sizeof(o));
+    memcpy(r.payload.data(), &o, sizeof(o));
+    control_.push_back(r);
+}
+
+void Bridge::close()
+{
+    control_.push_back(Record{USB_CLOSE, 0, {}});
+    open_ = false;
+    credits_ = 0;
+}
+
+int Bridge::send(const uint8_t* frame, size_t len)
+{
+    if(len == 0 || len > USB_BRIDGE_MAX_FRAME){
+        return -1;
+    }
+    uint16_t tag = nextTag_++;
+    UsbSend s = {tag};
+    Record r = {USB_SEND, 0, {}};
+    r.payload.resize(sizeof(s) + len);
+    memcpy(r.payload.data(), &s, sizeof(s));
+    memcpy(&r.payload[sizeof(s)], frame, len);
+    queue_.push_back(std::move(r));
+    return tag;
+}
+
+/**
+ * Builds the next batch : control records, then frames within the credits
+ **/
+void Bridge::fillOutput()
+{
+    output_.assign(sizeof(UsbBatchHeader), 0);
+    outputOffset_ = 0;
+    uint16_t count = 0;
+    auto add = [&](const Record& r) -> bool {
+        if(output_.size() + sizeof(UsbRecordHeader) + r.payload.size() > USB_BRIDGE_BATCH_SIZE ||
+           (!batching_ && count != 0)){
+            return false;
+        }
+        UsbRecordHeader h = {r.type, r.flags, static_cast<uint16_t>(r.payload.size())};
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(&h);
+        output_.insert(output_.end(), p, p + sizeof(h));
+        output_.insert(output_.end(), r.payload.begin(), r.payload.end());
+        ++count;
+        return true;
+    };
+    while(!control_.empty() && add(control_.front())){
+        control_.pop_front();
+    }
+    while(open_ && !queue_.empty() && inFlight_ < credits_ && add(queue_.front())){
+        queue_.pop_front();
+        ++inFlight_;
+        ++stats_.txFrames;
+    }
+    if(count == 0){
+        output_.clear();
+        return;
+    }
+    UsbBatchHeader h = {USB_BRIDGE_MAGIC, static_cast<uint16_t>(output_.size()), count, 0};
+    memcpy(output_.data(), &h, sizeof(h));
+    ++stats_.batchesOut;
+}
+
+/**
+ * Writes pending batches
+ * @return false if the link is lost
+ **/
+bool Bridge::writeOutput()
+{
+    while(true){
+        if(outputOffset_ >= output_.size()){
+            fillOutput();
+            if(output_.empty()){
+                return true;
+            }
+        }
+        ssize_t n = transport_.write(&output_[outputOffset_], output_.size() - outputOffset_);
+        if(n < 0){
+            return false;
+        }
+        if(n == 0){
+            return true;
+        }
+        outputOffset_ += n;
+        stats_.bytesOut += n;
+    }
+}
+
+/**
+ * Reads available bytes and handles the complete batches
+ * @return false if the link is lost
+ **/
+bool Bridge::readInput()
+{
+    while(true){
+        size_t size = input_.size();
+        input_.resize(size + READ_CHUNK);
+        ssize_t n = transport_.read(&input_[size], READ_CHUNK);
+        input_.resize(size + (n > 0 ? n : 0));
+        if(n < 0){
+            return false;
+        }
+        if(n == 0){
+            break;
+        }
+        stats_.bytesIn += n;
+    }
+    size_t pos = 0;
+    while(input_.size() - pos >= sizeof(UsbBatchHeader)){
+        UsbBatchHeader h;
+        memcpy(&h, &input_[pos], sizeof(h));
+        if(h.magic != USB_BRIDGE_MAGIC || h.length < sizeof(h) || h.length > USB_BRIDGE_BATCH_SIZE){
+            //Resynchronizes on the next byte
+            ++stats_.badBatches;
+            ++pos;
+            continue;
+        }
+        if(input_.size() - pos < h.length){
+            break;
+        }
+        stats_.rxDropped += h.dropped;
+        ++stats_.batchesIn;
+        parseBatch(&input_[pos + sizeof(h)], h.length - sizeof(h));
+        pos += h.length;
+    }
+    input_.erase(input_.begin(), input_.begin() + pos);
+    return true;
+}
+
+void Bridge::parseBatch(const uint8_t* data, size_t len)
+{
+    size_t pos = 0;
+    while(len - pos >= sizeof(UsbRecordHeader)){
+        UsbRecordHeader r;
+        memcpy(&r, &data[pos], sizeof(r));
+        pos += sizeof(r);
+        if(r.length > len - pos){
+            ++stats_.badBatches;
+            return;
+        }
+        handleRecord(r.type, r.flags, &data[pos], r.length);
+        pos += r.length;
+    }
+}
+
+void Bridge::handleRecord(uint8_t type, uint8_t flags, const uint8_t* payload, size_t len)
+{
+    if(type == USB_RECEIVED && len >= sizeof(UsbReceived)){
+        UsbReceived r;
+        memcpy(&r, payload, sizeof(r));
+        ++stats_.rxFrames;
+        if(onReceive_){
+            Frame f;
+            f.time = r.time;
+            f.flags = flags;
+            f.bytes.assign(payload + sizeof(r), payload + len);
+            onReceive_(f);
+        }
+    }else if(type == USB_SENT && len >= sizeof(UsbSent)){
+        UsbSent s;
+        memcpy(&s, payload, sizeof(s));
+        if(inFlight_ > 0){
+            --inFlight_;
+        }
+        ++stats_.txCompleted;
+        if(s.status != USB_SENT_OK){
+            ++stats_.txRejected;
+        }
+        if(onSent_){
+            onSent_(s.tag, s.status);
+        }
+    }else if(type == USB_HELLO && len >= sizeof(UsbHello)){
+        UsbHello h;
+        memcpy(&h, payload, sizeof(h));
+        //Frames of a previous session are not reported
+        open_ = h.version == USB_BRIDGE_VERSION;
+        credits_ = h.credits;
+        inFlight_ = 0;
+    }
+}
+
+bool Bridge::process(int timeoutMs)
+{
+    //Completions read first give their credits to the next batch
+    if(!readInput() || !writeOutput()){
+        return false;
+    }
+    if(timeoutMs != 0){
+        //Waits for the adapter, or for room to write the rest of a batch
+        if(!transport_.wait(timeoutMs, outputOffset_ < output_.size())){
+            return false;
+        }
+        return readInput() && writeOutput();
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,125 @@
+#ifndef __BRIDGE_BRIDGE_H__
+#define __BRIDGE_BRIDGE_H__
+#include "transport.h"
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <vector>
+
+namespace bridge {
+
+/**
+ * Frame seen on the bus
+ **/
+struct Frame {
+    uint32_t time = 0;                  // Closing flag (us, adapter clock)
+    uint8_t flags = 0;                  // usb_received_flags
+    std::vector<uint8_t> bytes;         // Address and data, without CRC
+};
+
+struct Stats {
+    uint64_t rxFrames = 0;              // Frames given to onReceive
+    uint64_t rxDropped = 0;             // Frames lost by the adapter (host too slow)
+    uint64_t txFrames = 0;              // Frames written to the adapter
+    uint64_t txCompleted = 0;           // Completions received
+    uint64_t txRejected = 0;            // Completions with an error
+    uint64_t batchesIn = 0;
+    uint64_t batchesOut = 0;
+    uint64_t bytesIn = 0;
+    uint64_t bytesOut = 0;
+    uint64_t badBatches = 0;            // Bytes skipped to find a batch header
+};
+
+/**
+ * Asynchronous access to the bus through the adapter (usb_protocol.h)
+ * Nothing blocks but process() : frames given to send() are queued and
+ * written, several per batch, as credits allow. Received frames and
+ * completions are given to the handlers from process().
+ **/
+class Bridge {
+public:
+    typedef std::function<void(const Frame& frame)> ReceiveHandler;
+    typedef std::function<void(uint16_t tag, uint8_t status)> SentHandler;
+
+    explicit Bridge(Transport& transport);
+
+    /**
+     * Takes the bus, the adapter protocol engine stops
+     * @param batching false asks the adapter for one record per transfer
+     * (lowest latency, for comparisons), the library then sends one frame
+     * per batch too
+     **/
+    void open(bool batching = true);
+
+    /**
+     * Gives the bus back to the adapter protocol engine
+     **/
+    void close();
+
+    /**
+     * Gets if the adapter answered open()
+     **/
+    bool isOpen() const { return open_; }
+
+    void onReceive(ReceiveHandler handler) { onReceive_ = handler; }
+    void onSent(SentHandler handler) { onSent_ = handler; }
+
+    /**
+     * Queues a frame
+     * @param frame Address and data, without CRC
+     * @return Tag given to onSent, -1 if the frame is empty or too long
+     **/
+    int send(const uint8_t* frame, size_t len);
+
+    /**
+     * Exchanges with the adapter : writes queued records, reads batches and
+     * calls the handlers
+     * @param timeoutMs Maximum wait when there is nothing to do (0 : none)
+     * @return false if the link is lost
+     **/
+    bool process(int timeoutMs);
+
+    /**
+     * Gets the frames queued or sent but not completed
+     **/
+    size_t pending() const { return queue_.size() + inFlight_; }
+
+    /**
+     * Credits given by the adapter (frames in flight at most)
+     **/
+    uint16_t credits() const { return credits_; }
+
+    const Stats& stats() const { return stats_; }
+
+private:
+    struct Record {
+        uint8_t type;
+        uint8_t flags;
+        std::vector<uint8_t> payload;
+    };
+    void fillOutput();
+    bool writeOutput();
+    bool readInput();
+    void parseBatch(const uint8_t* data, size_t len);
+    void handleRecord(uint8_t type, uint8_t flags, const uint8_t* payload, size_t len);
+
+    Transport& transport_;
+    bool open_ = false;
+    bool batching_ = true;
+    uint16_t credits_ = 0;
+    size_t inFlight_ = 0;               // Frames written, not completed
+    uint16_t nextTag_ = 0;
+    std::deque<Record> control_;        // USB_OPEN and USB_CLOSE, sent first
+    std::deque<Record> queue_;          // Frames waiting for a credit
+    std::vector<uint8_t> output_;       // Batch being written
+    size_t outputOffset_ = 0;
+    std::vector<uint8_t> input_;        // Bytes read, not parsed yet
+    ReceiveHandler onReceive_;
+    SentHandler onSent_;
+    Stats stats_;
+};
+
+}
+
+#endif
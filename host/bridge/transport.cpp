@@ -0,0 +1,290 @@
+#include "transport.h"
+
+#include "src/usb_protocol.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/usbdevice_fs.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define USB_IN_TRANSFERS 2              // IN transfers kept queued
+#define USB_TRANSFER_SIZE USB_BRIDGE_BATCH_SIZE
+
+namespace bridge {
+
+namespace {
+
+void setNonBlocking(int fd)
+{
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+/**
+ * Reads a sysfs attribute
+ **/
+std::string readAttribute(const std::string& dir, const char* name)
+{
+    std::string value;
+    FILE* f = fopen((dir + "/" + name).c_str(), "r");
+    if(f == nullptr){
+        return value;
+    }
+    char line[128];
+    if(fgets(line, sizeof(line), f) != nullptr){
+        value = line;
+        value.erase(value.find_last_not_of(" \n") + 1);
+    }
+    fclose(f);
+    return value;
+}
+
+/**
+ * Result of a read or write on a non blocking descriptor
+ **/
+ssize_t ioResult(ssize_t n)
+{
+    if(n > 0){
+        return n;
+    }
+    if(n < 0 && (errno == EAGAIN || errno == EINTR)){
+        return 0;
+    }
+    //End of file : the other side closed the link
+    return -1;
+}
+
+}
+
+// ---------------------------------------------------------------- FdTransport
+
+FdTransport::FdTransport(int readFd, int writeFd) : readFd_(readFd), writeFd_(writeFd)
+{
+    setNonBlocking(readFd_);
+    setNonBlocking(writeFd_);
+}
+
+FdTransport* FdTransport::openTty(const std::string& path)
+{
+    int fd = ::open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if(fd < 0){
+        fprintf(stderr, "Unable to open %s: %s\n", path.c_str(), strerror(errno));
+        return nullptr;
+    }
+    struct termios t;
+    if(tcgetattr(fd, &t) == 0){
+        cfmakeraw(&t);
+        tcsetattr(fd, TCSANOW, &t);
+    }
+    FdTransport* transport = new FdTransport(fd, fd);
+    transport->owned_ = true;
+    return transport;
+}
+
+FdTransport::~FdTransport()
+{
+    if(owned_){
+        close(readFd_);
+        if(writeFd_ != readFd_){
+            close(writeFd_);
+        }
+    }
+}
+
+ssize_t FdTransport::read(uint8_t* buffer, size_t size)
+{
+    return ioResult(::read(readFd_, buffer, size));
+}
+
+ssize_t FdTransport::write(const uint8_t* data, size_t size)
+{
+    return ioResult(::write(writeFd_, data, size));
+}
+
+bool FdTransport::wait(int timeoutMs, bool writing)
+{
+    struct pollfd fds[2] = {{readFd_, POLLIN, 0}, {writeFd_, POLLOUT, 0}};
+    int n = poll(fds, writing ? 2 : 1, timeoutMs);
+    if(n < 0){
+        return errno == EINTR;
+    }
+    return (fds[0].revents & (POLLERR | POLLNVAL)) == 0;
+}
+
+// ---------------------------------------------------------------- UsbTransport
+
+struct UsbTransport::Urb {
+    std::vector<uint8_t> data;
+    struct usbdevfs_urb urb;            // Last member, ends with the iso descriptors
+};
+
+UsbTransport* UsbTransport::open(const std::string& serial)
+{
+    static const char* devices = "/sys/bus/usb/devices";
+    DIR* dir = opendir(devices);
+    if(dir == nullptr){
+        fprintf(stderr, "Unable to list %s: %s\n", devices, strerror(errno));
+        return nullptr;
+    }
+    char id[2][8];
+    snprintf(id[0], sizeof(id[0]), "%04x", USB_BRIDGE_VID);
+    snprintf(id[1], sizeof(id[1]), "%04x", USB_BRIDGE_PID);
+    std::string node;
+    struct dirent* e;
+    while(node.empty() && (e = readdir(dir)) != nullptr){
+        std::string path = std::string(devices) + "/" + e->d_name;
+        if(readAttribute(path, "idVendor") != id[0] || readAttribute(path, "idProduct") != id[1]){
+            continue;
+        }
+        if(!serial.empty() && readAttribute(path, "serial") != serial){
+            continue;
+        }
+        char name[64];
+        snprintf(name, sizeof(name), "/dev/bus/usb/%03d/%03d", atoi(readAttribute(path, "busnum").c_str()),
+                 atoi(readAttribute(path, "devnum").c_str()));
+        node = name;
+    }
+    closedir(dir);
+    if(node.empty()){
+        fprintf(stderr, "No adapter found (%s:%s)\n", id[0], id[1]);
+        return nullptr;
+    }
+    int fd = ::open(node.c_str(), O_RDWR | O_CLOEXEC);
+    if(fd < 0){
+        fprintf(stderr, "Unable to open %s: %s\n", node.c_str(), strerror(errno));
+        return nullptr;
+    }
+    unsigned int itf = USB_BRIDGE_INTERFACE;
+    if(ioctl(fd, USBDEVFS_CLAIMINTERFACE, &itf) < 0){
+        fprintf(stderr, "Unable to claim interface %u of %s: %s\n", itf, node.c_str(), strerror(errno));
+        close(fd);
+        return nullptr;
+    }
+    UsbTransport* transport = new UsbTransport(fd);
+    for(Urb* urb : transport->in_){
+        if(!transport->submitIn(urb)){
+            fprintf(stderr, "Unable to read %s: %s\n", node.c_str(), strerror(errno));
+            delete transport;
+            return nullptr;
+        }
+    }
+    return transport;
+}
+
+UsbTransport::UsbTransport(int fd) : fd_(fd), out_(new Urb)
+{
+    out_->data.resize(USB_TRANSFER_SIZE);
+    for(int i = 0; i < USB_IN_TRANSFERS; ++i){
+        in_.push_back(new Urb);
+        in_.back()->data.resize(USB_TRANSFER_SIZE);
+    }
+}
+
+UsbTransport::~UsbTransport()
+{
+    //Closing kills the queued transfers before their buffers are freed
+    unsigned int itf = USB_BRIDGE_INTERFACE;
+    ioctl(fd_, USBDEVFS_RELEASEINTERFACE, &itf);
+    close(fd_);
+    for(Urb* urb : in_){
+        delete urb;
+    }
+    delete out_;
+}
+
+bool UsbTransport::submitIn(Urb* urb)
+{
+    memset(&urb->urb, 0, sizeof(urb->urb));
+    urb->urb.type = USBDEVFS_URB_TYPE_BULK;
+    urb->urb.endpoint = USB_BRIDGE_EP_IN;
+    urb->urb.buffer = urb->data.data();
+    urb->urb.buffer_length = static_cast<int>(urb->data.size());
+    urb->urb.usercontext = urb;
+    return ioctl(fd_, USBDEVFS_SUBMITURB, &urb->urb) == 0;
+}
+
+/**
+ * Takes the completed transfers, IN ones are queued again
+ * @return false if the adapter is gone
+ **/
+bool UsbTransport::reap()
+{
+    while(!failed_){
+        struct usbdevfs_urb* done = nullptr;
+        if(ioctl(fd_, USBDEVFS_REAPURBNDELAY, &done) < 0){
+            if(errno != EAGAIN){
+                failed_ = true;
+            }
+            break;
+        }
+        Urb* urb = static_cast<Urb*>(done->usercontext);
+        if(done->status != 0){
+            failed_ = true;
+        }else if(urb == out_){
+            outBusy_ = false;
+        }else{
+            received_.insert(received_.end(), urb->data.begin(), urb->data.begin() + done->actual_length);
+            if(!submitIn(urb)){
+                failed_ = true;
+            }
+        }
+    }
+    return !failed_;
+}
+
+ssize_t UsbTransport::read(uint8_t* buffer, size_t size)
+{
+    if(received_.empty() && !reap()){
+        return -1;
+    }
+    size_t n = std::min(size, received_.size());
+    std::copy(received_.begin(), received_.begin() + n, buffer);
+    received_.erase(received_.begin(), received_.begin() + n);
+    return static_cast<ssize_t>(n);
+}
+
+ssize_t UsbTransport::write(const uint8_t* data, size_t size)
+{
+    if(!reap()){
+        return -1;
+    }
+    if(outBusy_){
+        return 0;
+    }
+    size_t n = std::min(size, out_->data.size());
+    std::copy(data, data + n, out_->data.begin());
+    memset(&out_->urb, 0, sizeof(out_->urb));
+    out_->urb.type = USBDEVFS_URB_TYPE_BULK;
+    out_->urb.endpoint = USB_BRIDGE_EP_OUT;
+    out_->urb.buffer = out_->data.data();
+    out_->urb.buffer_length = static_cast<int>(n);
+    out_->urb.usercontext = out_;
+    if(ioctl(fd_, USBDEVFS_SUBMITURB, &out_->urb) < 0){
+        failed_ = true;
+        return -1;
+    }
+    outBusy_ = true;
+    return static_cast<ssize_t>(n);
+}
+
+bool UsbTransport::wait(int timeoutMs, bool writing)
+{
+    if(!received_.empty() || (writing && !outBusy_)){
+        return true;
+    }
+    //usbfs signals completed transfers as writable
+    struct pollfd fds = {fd_, POLLOUT, 0};
+    if(poll(&fds, 1, timeoutMs) < 0 && errno != EINTR){
+        return false;
+    }
+    return reap();
+}
+
+}
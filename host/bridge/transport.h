@@ -0,0 +1,108 @@
+#ifndef __BRIDGE_TRANSPORT_H__
+#define __BRIDGE_TRANSPORT_H__
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+namespace bridge {
+
+/**
+ * Byte link to the adapter vendor interface, never blocks except in wait()
+ **/
+class Transport {
+public:
+    virtual ~Transport() = default;
+
+    /**
+     * Reads received bytes
+     * @return Bytes read, 0 if none is available, -1 if the link is lost
+     **/
+    virtual ssize_t read(uint8_t* buffer, size_t size) = 0;
+
+    /**
+     * Writes bytes
+     * @return Bytes taken (may be less than size, 0 if the link is busy),
+     * -1 if the link is lost
+     **/
+    virtual ssize_t write(const uint8_t* data, size_t size) = 0;
+
+    /**
+     * Waits for bytes to read, or for room to write
+     * @param timeoutMs Maximum wait, 0 returns at once, -1 waits forever
+     * @param writing Also returns when write() can take bytes
+     * @return false if the link is lost
+     **/
+    virtual bool wait(int timeoutMs, bool writing) = 0;
+};
+
+/**
+ * Link over file descriptors : pipe pair, socket, pty or serial line
+ * (the host simulator exposes the vendor interface this way)
+ **/
+class FdTransport : public Transport {
+public:
+    /**
+     * Uses two descriptors, made non blocking, they are not closed
+     * @param readFd Data from the adapter
+     * @param writeFd Data to the adapter
+     **/
+    FdTransport(int readFd, int writeFd);
+
+    /**
+     * Opens a tty (pty slave), set to raw mode and closed by the destructor
+     **/
+    static FdTransport* openTty(const std::string& path);
+
+    ~FdTransport() override;
+
+    ssize_t read(uint8_t* buffer, size_t size) override;
+    ssize_t write(const uint8_t* data, size_t size) override;
+    bool wait(int timeoutMs, bool writing) override;
+
+private:
+    int readFd_;
+    int writeFd_;
+    bool owned_ = false;
+};
+
+/**
+ * Link over the bulk endpoints of the adapter, with Linux usbfs
+ * (/dev/bus/usb, no library needed). IN transfers are kept queued so the
+ * adapter never waits for the host, OUT transfers are sent one at a time.
+ **/
+class UsbTransport : public Transport {
+public:
+    /**
+     * Opens the first adapter found (USB_BRIDGE_VID/PID) and claims its
+     * vendor interface
+     * @param serial Serial number to select an adapter, empty for any
+     * @return nullptr if no adapter is found or it can't be opened (the
+     * reason is printed on stderr)
+     **/
+    static UsbTransport* open(const std::string& serial = std::string());
+
+    ~UsbTransport() override;
+
+    ssize_t read(uint8_t* buffer, size_t size) override;
+    ssize_t write(const uint8_t* data, size_t size) override;
+    bool wait(int timeoutMs, bool writing) override;
+
+private:
+    struct Urb;
+    explicit UsbTransport(int fd);
+    bool submitIn(Urb* urb);
+    bool reap();
+
+    int fd_;
+    bool failed_ = false;
+    std::vector<Urb*> in_;              // Bulk IN transfers, always queued
+    Urb* out_;                          // Bulk OUT transfer
+    bool outBusy_ = false;
+    std::vector<uint8_t> received_;     // Completed IN data not read yet
+};
+
+}
+
+#endif
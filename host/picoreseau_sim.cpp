@@ -0,0 +1,494 @@
+/**
+ * Runs the picoreseau firmware against a simulated nanoreseau bus
+ * Reports bus throughput, turnaround latency and firmware CPU time
+ **/
+#include "sim/bus.h"
+#include "sim/dut_port.h"
+#include "sim/rp2040.h"
+#include "sim/simulator.h"
+#include "sim/station.h"
+#include "src/bus_stats.h"
+#include "src/bus_timing.h"
+#include "src/capture.h"
+#include "src/frame_pool.h"
+#include "src/hdlc_tx.h"
+#include "src/scheduler.h"
+#include "src/wake.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// Firmware entry point (main of picoreseau.cpp, renamed for the host build)
+int picoreseau_main();
+
+#define DATA_RX_PIN 0
+#define CLK_RX_PIN 1
+#define TX_TRCV_ENABLE_PIN 5
+
+namespace {
+
+struct Options {
+    unsigned stations = 4;
+    uint64_t bootMs = 3500;         // Firmware start-up time (debug delay)
+    uint64_t durationMs = 1000;     // Measurement duration
+    uint64_t pollNs = 200;          // Cost of one polling iteration
+    uint64_t bitNs = BusConfig::bitNs;  // Bus bit period, the firmware is built for it
+    uint32_t seed = 1;
+    std::string replay;
+    uint64_t maxGapUs = 0;          // Replay idle times shortened to it, 0 : original timing
+    std::string record;             // Capture file of the measured traffic
+    bool bench = false;             // Reports host throughput
+    std::string console;            // Typed on the firmware console when measure starts
+    std::string capture;            // Capture file, the firmware runs as a sniffer
+    uint64_t trafficGapUs = 0;      // Traffic generator idle time between frames, 0 : none
+    bool verbose = false;
+    bool perStation = false;        // Reports service latency of each station
+    bool collisionDetect = true;    // Firmware reads its frames back and aborts them on collisions
+    bool onesWin = false;           // Contended bits are the wired OR, the firmware zeros lose
+    unsigned callIdleBits = 250;    // Bus idle before a station initial call
+    unsigned callJitterBits = 100;  // Random extra idle before an initial call
+    bool pollLoop = false;          // Bus engine polls instead of sleeping between events
+};
+
+void usage(const char* prog)
+{
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  --stations N      Number of simulated client stations (default 4, max 31)\n"
+        "  --duration-ms MS  Measured simulated time (default 1000)\n"
+        "  --boot-ms MS      Firmware start-up time before traffic (default 3500)\n"
+        "  --poll-ns NS      Simulated duration of a polling iteration (default 200)\n"
+        "  --bit-ns NS       Bus bit period (default %u, the firmware bit rate)\n"
+        "  --seed S          Random seed (default 1)\n"
+        "  --replay FILE     Replays recorded traffic (text or .nrc) instead of client stations, exits\n"
+        "                    with 2 if it is incomplete or the firmware answers differ from the .nrc\n"
+        "  --accelerate US   Replays with idle times longer than US shortened to US\n"
+        "  --record FILE     Records the measured bus traffic in a capture file (.nrc)\n"
+        "  --bench           Reports host frames/s and CPU time per frame\n"
+        "  --console TEXT    Types TEXT on the firmware console when measure starts\n"
+        "  --capture FILE    Captures the bus in FILE (pcap) and reports capture loss\n"
+        "  --traffic GAP_US  Adds a station flooding the bus with random frames\n"
+        "  --per-station     Reports the service latency of each station\n"
+        "  --call-idle BITS  Bus idle before a station initial call (default 250, 25 contends with the firmware)\n"
+        "  --call-jitter BITS  Random extra idle before an initial call (default 100)\n"
+        "  --no-collision-detect  Firmware frames are sent to the end on collisions\n"
+        "  --ones-win        A driven one wins contended bits (default a driven zero wins)\n"
+        "  --poll-loop       Bus engine loop polls instead of sleeping until an event\n"
+        "  --verbose         Shows firmware output\n", prog, static_cast<unsigned>(BusConfig::bitNs));
+}
+
+bool parse(int argc, char** argv, Options& o)
+{
+    for(int i = 1; i < argc; ++i){
+        std::string a = argv[i];
+        auto value = [&](void) -> const char* {
+            if(i + 1 >= argc){
+                fprintf(stderr, "Missing value for %s\n", a.c_str());
+                exit(1);
+            }
+            return argv[++i];
+        };
+        if(a == "--stations"){
+            o.stations = strtoul(value(), nullptr, 0);
+        }else if(a == "--duration-ms"){
+            o.durationMs = strtoull(value(), nullptr, 0);
+        }else if(a == "--boot-ms"){
+            o.bootMs = strtoull(value(), nullptr, 0);
+        }else if(a == "--poll-ns"){
+            o.pollNs = strtoull(value(), nullptr, 0);
+        }else if(a == "--bit-ns"){
+            o.bitNs = strtoull(value(), nullptr, 0);
+        }else if(a == "--seed"){
+            o.seed = strtoul(value(), nullptr, 0);
+        }else if(a == "--replay"){
+            o.replay = value();
+        }else if(a == "--accelerate"){
+            o.maxGapUs = strtoull(value(), nullptr, 0);
+        }else if(a == "--record"){
+            o.record = value();
+        }else if(a == "--bench"){
+            o.bench = true;
+        }else if(a == "--console"){
+            o.console = value();
+        }else if(a == "--capture"){
+            o.capture = value();
+        }else if(a == "--traffic"){
+            o.trafficGapUs = strtoull(value(), nullptr, 0);
+        }else if(a == "--per-station"){
+            o.perStation = true;
+        }else if(a == "--call-idle"){
+            o.callIdleBits = strtoul(value(), nullptr, 0);
+        }else if(a == "--call-jitter"){
+            o.callJitterBits = strtoul(value(), nullptr, 0);
+        }else if(a == "--no-collision-detect"){
+            o.collisionDetect = false;
+        }else if(a == "--ones-win"){
+            o.onesWin = true;
+        }else if(a == "--poll-loop"){
+            o.pollLoop = true;
+        }else if(a == "--verbose"){
+            o.verbose = true;
+        }else{
+            return false;
+        }
+    }
+    return o.stations <= 31;
+}
+
+/**
+ * Capture file content, by record flags
+ **/
+struct CaptureCount {
+    uint64_t valid = 0;
+    uint64_t badCrc = 0;
+    uint64_t aborted = 0;
+    uint64_t other = 0;             // Short or overrun
+};
+
+/**
+ * Strips the console output printed before the pcap header and counts records
+ * @return false if the file is not a capture
+ **/
+bool readCapture(const std::string& path, CaptureCount& count)
+{
+    FILE* f = fopen(path.c_str(), "rb");
+    if(f == nullptr){
+        return false;
+    }
+    std::vector<uint8_t> data;
+    uint8_t buffer[4096];
+    size_t n;
+    while((n = fread(buffer, 1, sizeof(buffer), f)) > 0){
+        data.insert(data.end(), buffer, buffer + n);
+    }
+    fclose(f);
+    static const uint8_t magic[4] = {0xd4, 0xc3, 0xb2, 0xa1};
+    auto start = std::search(data.begin(), data.end(), magic, magic + 4);
+    if(data.end() - start < static_cast<long>(sizeof(PcapHeader))){
+        return false;
+    }
+    data.erase(data.begin(), start);
+    f = fopen(path.c_str(), "wb");
+    fwrite(data.data(), 1, data.size(), f);
+    fclose(f);
+    size_t pos = sizeof(PcapHeader);
+    while(pos + sizeof(PcapRecord) < data.size()){
+        PcapRecord r;
+        memcpy(&r, &data[pos], sizeof(r));
+        pos += sizeof(r);
+        if(r.inclLen == 0 || pos + r.inclLen > data.size()){
+            break;
+        }
+        uint8_t flags = data[pos];
+        if(flags == CAPTURE_CRC_OK){
+            ++count.valid;
+        }else if(flags == 0){
+            ++count.badCrc;
+        }else if(flags == CAPTURE_ABORTED){
+            ++count.aborted;
+        }else{
+            ++count.other;
+        }
+        pos += r.inclLen;
+    }
+    return true;
+}
+
+/**
+ * Measurement start hook : resets statistics once the firmware booted
+ **/
+class MeasureStart : public sim::Component {
+public:
+    MeasureStart(uint64_t t, sim::BusMonitor& monitor, const std::string& console, bool collisionDetect,
+                 bool pollLoop) :
+        t_(t), monitor_(monitor), console_(console), collisionDetect_(collisionDetect), pollLoop_(pollLoop) {}
+    uint64_t nextEvent() const override { return done_ ? UINT64_MAX : t_; }
+    void run(uint64_t now) override
+    {
+        done_ = true;
+        monitor_.startMeasure(now);
+        memset(&scheduler_stats(), 0, sizeof(SchedulerStats));
+        bus_stats_reset();
+        setCollisionDetect(getEmitter(0), collisionDetect_);
+        wake_set_polling(pollLoop_);
+        WakeStats& wake = wake_stats();
+        memset(wake.latency, 0, sizeof(wake.latency));
+        sleepUs = wake_sleep_time(now / 1000);
+        sleeps = wake.sleeps;
+        sim::Simulator::instance().consoleInput(console_);
+        const sim::CpuMeter& cpu = sim::Simulator::instance().cpu();
+        threadNs = cpu.threadNs;
+        isrNs = cpu.isrNs;
+        isrCalls = cpu.isrCalls;
+    }
+    uint64_t threadNs = 0;
+    uint64_t isrNs = 0;
+    uint64_t isrCalls = 0;
+    uint32_t sleepUs = 0;
+    uint32_t sleeps = 0;
+
+private:
+    uint64_t t_;
+    sim::BusMonitor& monitor_;
+    std::string console_;
+    bool collisionDetect_;
+    bool pollLoop_;
+    bool done_ = false;
+};
+
+void printLatency(const char* name, const sim::LatencyStats& s)
+{
+    printf("%-28s n=%-6zu min=%8.1f avg=%8.1f p99=%8.1f max=%8.1f us\n", name, s.count(),
+           s.min() / 1000.0, s.mean() / 1000.0, s.percentile(99) / 1000.0, s.max() / 1000.0);
+}
+
+/**
+ * Prints a firmware latency statistic (us)
+ **/
+void printFirmwareLatency(const char* name, const LatencyStat& s)
+{
+    printf("%-28s n=%-6lu avg=%8.1f max=%8lu us\n", name, static_cast<unsigned long>(s.count),
+           s.count ? static_cast<double>(s.sum) / s.count : 0.0, static_cast<unsigned long>(s.max));
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    if(!parse(argc, argv, opt)){
+        usage(argv[0]);
+        return 1;
+    }
+
+    sim::Simulator& s = sim::Simulator::instance();
+    sim::Rp2040& mcu = s.mcu();
+    s.setPollQuantum(opt.pollNs);
+
+    sim::Bus bus(opt.bitNs);
+    bus.setOnesWin(opt.onesWin);
+    sim::DutPort dut(mcu, DATA_RX_PIN, CLK_RX_PIN, TX_TRCV_ENABLE_PIN);
+    sim::BusMonitor monitor(bus, &dut);
+    bus.attach(&dut);
+    bus.attach(&monitor);
+
+    uint64_t start = opt.bootMs * 1000000ull;
+    std::vector<std::unique_ptr<sim::ClientStation>> clients;
+    std::unique_ptr<sim::ReplayStation> replay;
+    if(!opt.replay.empty()){
+        replay.reset(new sim::ReplayStation(bus, start));
+        if(!replay->load(opt.replay, opt.maxGapUs * 1000)){
+            fprintf(stderr, "Unable to load %s\n", opt.replay.c_str());
+            return 1;
+        }
+        bus.attach(replay.get());
+    }
+    sim::CaptureWriter recorder;
+    if(!opt.record.empty()){
+        monitor.setRecorder(&recorder);
+    }
+    std::vector<std::vector<uint8_t>> dutFrames;
+    if(replay){
+        // The replayed traffic is the only station
+        if(!replay->masterFrames().empty()){
+            monitor.setDutLog(&dutFrames);
+        }
+    }else{
+        for(unsigned i = 0; i < opt.stations; ++i){
+            sim::ClientConfig cfg;
+            cfg.startNs = start;
+            // Station turnarounds follow the bit rate as the firmware ones (500 kbit/s defaults)
+            cfg.callIdleNs = opt.callIdleBits * opt.bitNs;
+            cfg.callJitterNs = opt.callJitterBits * opt.bitNs;
+            cfg.responseIdleNs = 25 * opt.bitNs;
+            cfg.echoNs = 150 * opt.bitNs;
+            cfg.seed = opt.seed * 1000 + i;
+            clients.emplace_back(new sim::ClientStation(bus, i + 1, cfg));
+            bus.attach(clients.back().get());
+        }
+    }
+    std::unique_ptr<sim::TrafficStation> traffic;
+    if(opt.trafficGapUs){
+        sim::TrafficConfig cfg;
+        cfg.startNs = start;
+        // Last batches are sent before the end
+        cfg.stopNs = start + opt.durationMs * 1000000ull - (CAPTURE_FLUSH_US + 30000) * 1000ull;
+        cfg.gapNs = opt.trafficGapUs * 1000;
+        cfg.seed = opt.seed;
+        traffic.reset(new sim::TrafficStation(bus, cfg));
+        bus.attach(traffic.get());
+    }
+    s.addComponent(&bus);
+    MeasureStart measure(start, monitor, opt.console, opt.collisionDetect, opt.pollLoop);
+    s.addComponent(&measure);
+    s.setStopTime(start + opt.durationMs * 1000000ull);
+
+    // Firmware output is hidden unless asked, it is the capture when capturing
+    fflush(stdout);
+    int savedStdout = dup(STDOUT_FILENO);
+    if(!opt.capture.empty()){
+        // Capture starts as soon as the firmware reads its console
+        s.consoleInput("c");
+        int file = open(opt.capture.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(file < 0){
+            fprintf(stderr, "Unable to create %s\n", opt.capture.c_str());
+            return 1;
+        }
+        dup2(file, STDOUT_FILENO);
+        close(file);
+    }else if(!opt.verbose){
+        int devNull = open("/dev/null", O_WRONLY);
+        dup2(devNull, STDOUT_FILENO);
+        close(devNull);
+    }
+    uint64_t hostStart = sim::Simulator::hostNs();
+    s.firmwareEnter();
+    try{
+        picoreseau_main();
+    }catch(const sim::Stop&){
+    }
+    s.firmwareExit();
+    uint64_t hostNs = sim::Simulator::hostNs() - hostStart;
+    fflush(stdout);
+    dup2(savedStdout, STDOUT_FILENO);
+    close(savedStdout);
+
+    // Report
+    double seconds = opt.durationMs / 1000.0;
+    const sim::CpuMeter& cpu = s.cpu();
+    uint64_t threadNs = cpu.threadNs - measure.threadNs;
+    uint64_t isrNs = cpu.isrNs - measure.isrNs;
+    uint64_t isrCalls = cpu.isrCalls - measure.isrCalls;
+    printf("Simulated time              %.3f s, %u stations, %.0f kbit/s\n", seconds,
+           replay ? 1u : opt.stations, 1e6 / opt.bitNs);
+    printf("Bus frames                  %lu valid (%.1f frames/s), %lu bad CRC, %lu aborts, %lu collisions (%lu with the DUT)\n",
+           monitor.frames, monitor.frames / seconds, monitor.badFrames, monitor.aborts, monitor.collisions,
+           monitor.dutCollisions);
+    printf("Bus utilisation             %.1f %%\n", 100.0 * monitor.busyNs / (seconds * 1e9));
+    printLatency("DUT turnaround", monitor.dutTurnaround);
+    printLatency("Station turnaround", monitor.stationTurnaround);
+    PoolStats pool;
+    pool_get_stats(pool);
+    printf("Frame pool high water       small %u/%u, large %u/%u, %lu failures\n",
+           pool.small.highWater, POOL_SMALL_COUNT, pool.large.highWater, POOL_LARGE_COUNT,
+           static_cast<unsigned long>(pool.small.failures + pool.large.failures));
+    const BusStats& b = busStats;
+    printf("Firmware counters           rx %lu tx %lu, crc=%lu abort=%lu short=%lu overrun=%lu overflow=%lu no buffer=%lu filtered=%lu\n",
+           static_cast<unsigned long>(b.rxFrames), static_cast<unsigned long>(b.txFrames),
+           static_cast<unsigned long>(b.crcErrors), static_cast<unsigned long>(b.aborts),
+           static_cast<unsigned long>(b.shortFrames), static_cast<unsigned long>(b.overruns),
+           static_cast<unsigned long>(b.queueOverflows), static_cast<unsigned long>(b.noBuffer),
+           static_cast<unsigned long>(b.filtered));
+    printf("Firmware timeouts           echo=%lu reply=%lu, retransmissions=%lu, call retries=%lu\n",
+           static_cast<unsigned long>(b.echoTimeouts), static_cast<unsigned long>(b.replyTimeouts),
+           static_cast<unsigned long>(b.retransmissions), static_cast<unsigned long>(b.callRetries));
+    printf("Firmware collisions         %lu%s, back-offs=%lu, dropped=%lu\n",
+           static_cast<unsigned long>(b.collisions), opt.collisionDetect ? "" : " (detection off)",
+           static_cast<unsigned long>(b.backoffs), static_cast<unsigned long>(b.collisionDrops));
+    printFirmwareLatency("Firmware turnaround", b.turnaround);
+    const WakeStats& wake = wake_stats();
+    printf("Bus engine asleep           %.1f %%, %lu sleeps%s\n", (wake_sleep_time(s.now() / 1000) - measure.sleepUs) / (seconds * 1e4),
+           static_cast<unsigned long>(wake.sleeps - measure.sleeps), opt.pollLoop ? " (polling)" : "");
+    static const char* const wakeNames[WAKE_EVENTS] = {
+        "Wake-up rx frame", "Wake-up bus activity", "Wake-up frame sent", "Wake-up protocol deadline", "Wake-up loop timer"};
+    for(uint32_t i = 0; i < WAKE_EVENTS; ++i){
+        printFirmwareLatency(wakeNames[i], wake.latency[i]);
+    }
+    if(!clients.empty()){
+        uint64_t transactions = 0, echoTo = 0, replyTo = 0, callTo = 0;
+        sim::LatencyStats trans, echo, ack;
+        for(auto& c : clients){
+            transactions += c->transactions;
+            echoTo += c->echoTimeouts;
+            replyTo += c->replyTimeouts;
+            callTo += c->callTimeouts;
+            for(uint64_t v : c->transactionLatency.samples()) trans.add(v);
+            for(uint64_t v : c->echoLatency.samples()) echo.add(v);
+            for(uint64_t v : c->ackLatency.samples()) ack.add(v);
+        }
+        printf("Transactions                %lu (%.1f/s), timeouts echo=%lu reply=%lu call=%lu\n",
+               transactions, transactions / seconds, echoTo, replyTo, callTo);
+        printLatency("Echo latency", echo);
+        printLatency("MCPCH latency", ack);
+        printLatency("Transaction time", trans);
+        const SchedulerStats& sched = scheduler_stats();
+        printf("Scheduler calls             %lu (%.1f/s)\n", static_cast<unsigned long>(sched.calls), sched.calls / seconds);
+        printFirmwareLatency("Service latency", sched.service);
+        if(opt.perStation){
+            for(auto& c : clients){
+                char name[32];
+                snprintf(name, sizeof(name), "  station %u service", c->address());
+                printFirmwareLatency(name, sched.station[c->address()]);
+                snprintf(name, sizeof(name), "  station %u transaction", c->address());
+                printLatency(name, c->transactionLatency);
+            }
+        }
+    }
+    // Exit status of a replay : every frame sent, answers as recorded
+    int status = 0;
+    if(replay){
+        printf("Replayed frames             %lu%s\n", replay->framesReplayed, replay->done() ? "" : " (incomplete)");
+        if(!replay->done()){
+            status = 2;
+        }
+        const std::vector<std::vector<uint8_t>>& expected = replay->masterFrames();
+        if(!expected.empty()){
+            // Answers of the firmware compared with the recorded ones
+            size_t same = 0;
+            while(same < expected.size() && same < dutFrames.size() && expected[same] == dutFrames[same]){
+                ++same;
+            }
+            printf("Replay check                %zu/%zu master frames identical, %zu sent after%s\n", same,
+                   expected.size(), dutFrames.size() > same ? dutFrames.size() - same : 0,
+                   same == expected.size() ? "" : " (MISMATCH)");
+            if(same != expected.size()){
+                status = 2;
+            }
+        }
+    }
+    if(traffic){
+        printf("Traffic sent                %lu valid, %lu bad CRC, %lu aborted\n",
+               traffic->frames, traffic->badCrc, traffic->aborted);
+    }
+    if(!opt.capture.empty()){
+        CaptureCount count;
+        if(!readCapture(opt.capture, count)){
+            fprintf(stderr, "No capture in %s\n", opt.capture.c_str());
+            return 1;
+        }
+        const volatile CaptureStats& cs = capture_stats();
+        uint64_t seen = monitor.frames + monitor.badFrames + monitor.aborts;
+        uint64_t captured = count.valid + count.badCrc + count.aborted + count.other;
+        printf("Captured frames             %lu valid, %lu bad CRC, %lu aborted, %lu short/overrun\n",
+               count.valid, count.badCrc, count.aborted, count.other);
+        printf("Capture loss                %ld of %lu frames (%.3f %%), no batch %lu, queue overflows %lu, overruns %lu\n",
+               static_cast<long>(seen - captured), seen, seen ? 100.0 * (static_cast<double>(seen) - captured) / seen : 0.0,
+               static_cast<unsigned long>(cs.dropped), static_cast<unsigned long>(b.queueOverflows),
+               static_cast<unsigned long>(b.overruns));
+    }
+    printf("Firmware CPU (host)         thread %.3f ms, ISR %.3f ms (%lu calls)\n",
+           threadNs / 1e6, isrNs / 1e6, isrCalls);
+    if(monitor.frames){
+        printf("CPU time per frame          %.2f us\n", (threadNs + isrNs) / 1e3 / monitor.frames);
+    }
+    if(opt.bench){
+        uint64_t frames = monitor.frames + monitor.badFrames + monitor.aborts;
+        printf("Host wall time              %.3f ms, %.0f frames/s, %.2f us per frame\n", hostNs / 1e6,
+               frames / (hostNs / 1e9), frames ? hostNs / 1e3 / frames : 0.0);
+    }
+    if(!opt.record.empty()){
+        if(!recorder.write(opt.record)){
+            fprintf(stderr, "Unable to write %s\n", opt.record.c_str());
+            return 1;
+        }
+        printf("Recorded                    %u records in %s\n", recorder.size(), opt.record.c_str());
+    }
+    return status;
+}
@@ -0,0 +1,158 @@
+#ifndef _HARDWARE_DMA_H
+#define _HARDWARE_DMA_H
+/**
+ * Host replacement of hardware/dma.h
+ * Transfers are performed by the simulator on the host memory, the PIO FIFO
+ * registers are recognized as DREQ paced peripherals
+ **/
+#include "pico.h"
+
+#define NUM_DMA_CHANNELS 12
+
+#define DREQ_PIO0_TX0 0
+#define DREQ_PIO0_RX0 4
+#define DREQ_PIO1_TX0 8
+#define DREQ_PIO1_RX0 12
+#define DREQ_DMA_TIMER0 0x3b
+#define DREQ_FORCE 0x3f
+
+#define DMA_SNIFF_CTRL_OUT_INV_BITS 0x00000800u
+#define DMA_SNIFF_CTRL_OUT_REV_BITS 0x00000400u
+#define DMA_SNIFF_CTRL_BSWAP_BITS 0x00000200u
+#define DMA_SNIFF_CTRL_CALC_LSB 5
+#define DMA_SNIFF_CTRL_CALC_BITS 0x000001e0u
+#define DMA_SNIFF_CTRL_DMACH_LSB 1
+#define DMA_SNIFF_CTRL_DMACH_BITS 0x0000001eu
+#define DMA_SNIFF_CTRL_EN_BITS 0x00000001u
+
+#ifdef __cplusplus
+namespace sim {
+/**
+ * Sniffer data register : reads return the post-processed (reversed,
+ * inverted) accumulator like the hardware does
+ **/
+class SniffDataReg {
+public:
+    operator uint32_t() const;
+    SniffDataReg& operator=(uint32_t value);
+    uint32_t acc = 0;
+};
+}
+typedef sim::SniffDataReg sniff_data_reg_t;
+extern "C" {
+#else
+typedef io_rw_32 sniff_data_reg_t;
+#endif
+
+/**
+ * Address registers are pointer wide on the host
+ **/
+typedef volatile uintptr_t io_rw_ptr;
+
+typedef struct {
+    io_rw_ptr read_addr;
+    io_rw_ptr write_addr;
+    io_rw_32 transfer_count;
+    io_rw_32 ctrl_trig;
+} dma_channel_hw_t;
+
+typedef struct {
+    dma_channel_hw_t ch[NUM_DMA_CHANNELS];
+    io_rw_32 intr;
+    io_rw_32 inte0;
+    io_rw_32 intf0;
+    io_rw_32 ints0;
+    io_rw_32 inte1;
+    io_rw_32 intf1;
+    io_rw_32 ints1;
+    io_rw_32 multi_channel_trigger;
+    io_rw_32 sniff_ctrl;
+    sniff_data_reg_t sniff_data;
+    io_ro_32 fifo_levels;
+    io_wo_32 abort;
+} dma_hw_t;
+
+extern dma_hw_t sim_dma_hw;
+#define dma_hw (&sim_dma_hw)
+
+enum dma_channel_transfer_size {
+    DMA_SIZE_8 = 0,
+    DMA_SIZE_16 = 1,
+    DMA_SIZE_32 = 2,
+};
+
+/**
+ * Channel configuration (host : decoded fields instead of the CTRL register value)
+ **/
+typedef struct {
+    bool enable;
+    bool high_priority;
+    enum dma_channel_transfer_size size;
+    bool read_increment;
+    bool write_increment;
+    uint ring_size_bits;
+    bool ring_write;
+    uint chain_to;
+    uint dreq;
+    bool irq_quiet;
+    bool bswap;
+    bool sniff_enable;
+} dma_channel_config;
+
+void dma_channel_claim(uint channel);
+void dma_channel_unclaim(uint channel);
+int dma_claim_unused_channel(bool required);
+bool dma_channel_is_claimed(uint channel);
+
+static inline dma_channel_hw_t *dma_channel_hw_addr(uint channel) { return &dma_hw->ch[channel]; }
+
+dma_channel_config dma_channel_get_default_config(uint channel);
+dma_channel_config dma_get_channel_config(uint channel);
+
+static inline void channel_config_set_read_increment(dma_channel_config *c, bool incr) { c->read_increment = incr; }
+static inline void channel_config_set_write_increment(dma_channel_config *c, bool incr) { c->write_increment = incr; }
+static inline void channel_config_set_dreq(dma_channel_config *c, uint dreq) { c->dreq = dreq; }
+static inline void channel_config_set_chain_to(dma_channel_config *c, uint chain_to) { c->chain_to = chain_to; }
+static inline void channel_config_set_transfer_data_size(dma_channel_config *c, enum dma_channel_transfer_size size) { c->size = size; }
+static inline void channel_config_set_irq_quiet(dma_channel_config *c, bool irq_quiet) { c->irq_quiet = irq_quiet; }
+static inline void channel_config_set_high_priority(dma_channel_config *c, bool high_priority) { c->high_priority = high_priority; }
+static inline void channel_config_set_enable(dma_channel_config *c, bool enable) { c->enable = enable; }
+static inline void channel_config_set_sniff_enable(dma_channel_config *c, bool sniff_enable) { c->sniff_enable = sniff_enable; }
+static inline void channel_config_set_bswap(dma_channel_config *c, bool bswap) { c->bswap = bswap; }
+
+static inline void channel_config_set_ring(dma_channel_config *c, bool write, uint size_bits)
+{
+    c->ring_write = write;
+    c->ring_size_bits = size_bits;
+}
+
+void dma_channel_set_config(uint channel, const dma_channel_config *config, bool trigger);
+void dma_channel_set_read_addr(uint channel, const volatile void *read_addr, bool trigger);
+void dma_channel_set_write_addr(uint channel, volatile void *write_addr, bool trigger);
+void dma_channel_set_trans_count(uint channel, uint32_t trans_count, bool trigger);
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr,
+                           const volatile void *read_addr, uint transfer_count, bool trigger);
+void dma_channel_transfer_from_buffer_now(uint channel, const volatile void *read_addr, uint32_t transfer_count);
+void dma_channel_transfer_to_buffer_now(uint channel, volatile void *write_addr, uint32_t transfer_count);
+void dma_start_channel_mask(uint32_t chan_mask);
+static inline void dma_channel_start(uint channel) { dma_start_channel_mask(1u << channel); }
+void dma_channel_abort(uint channel);
+bool dma_channel_is_busy(uint channel);
+void dma_channel_wait_for_finish_blocking(uint channel);
+
+void dma_channel_set_irq0_enabled(uint channel, bool enabled);
+void dma_channel_set_irq1_enabled(uint channel, bool enabled);
+bool dma_channel_get_irq0_status(uint channel);
+bool dma_channel_get_irq1_status(uint channel);
+void dma_channel_acknowledge_irq0(uint channel);
+void dma_channel_acknowledge_irq1(uint channel);
+
+void dma_sniffer_enable(uint channel, uint mode, bool force_channel_enable);
+void dma_sniffer_set_byte_swap_enabled(bool swap);
+void dma_sniffer_disable(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
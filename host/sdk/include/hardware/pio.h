@@ -0,0 +1,248 @@
+#ifndef _HARDWARE_PIO_H
+#define _HARDWARE_PIO_H
+/**
+ * Host replacement of hardware/pio.h
+ * The PIO register blocks are plain memory owned by the simulator, FIFO
+ * and IRQ accesses go through the functions below
+ **/
+#include "pico.h"
+#include "hardware/gpio.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NUM_PIOS 2
+#define NUM_PIO_STATE_MACHINES 4
+#define PIO_INSTRUCTION_COUNT 32
+
+typedef struct {
+    io_rw_32 clkdiv;
+    io_rw_32 execctrl;
+    io_rw_32 shiftctrl;
+    io_ro_32 addr;
+    io_rw_32 instr;
+    io_rw_32 pinctrl;
+} pio_sm_hw_t;
+
+typedef struct {
+    io_rw_32 inte;
+    io_rw_32 intf;
+    io_ro_32 ints;
+} pio_irq_ctrl_hw_t;
+
+typedef struct pio_hw {
+    io_rw_32 ctrl;
+    io_ro_32 fstat;
+    io_rw_32 fdebug;
+    io_ro_32 flevel;
+    io_wo_32 txf[NUM_PIO_STATE_MACHINES];
+    io_ro_32 rxf[NUM_PIO_STATE_MACHINES];
+    io_rw_32 irq;
+    io_wo_32 irq_force;
+    io_rw_32 input_sync_bypass;
+    io_rw_32 dbg_padout;
+    io_rw_32 dbg_padoe;
+    io_rw_32 dbg_cfginfo;
+    io_wo_32 instr_mem[PIO_INSTRUCTION_COUNT];
+    pio_sm_hw_t sm[NUM_PIO_STATE_MACHINES];
+    io_rw_32 intr;
+    pio_irq_ctrl_hw_t inte0_ctrl;
+    pio_irq_ctrl_hw_t inte1_ctrl;
+} pio_hw_t;
+
+typedef pio_hw_t *PIO;
+
+extern pio_hw_t sim_pio_hw[NUM_PIOS];
+
+#define pio0_hw (&sim_pio_hw[0])
+#define pio1_hw (&sim_pio_hw[1])
+#define pio0 pio0_hw
+#define pio1 pio1_hw
+
+/**
+ * Program as generated by the host pioasm (name is used by the simulator)
+ **/
+typedef struct pio_program {
+    const uint16_t *instructions;
+    uint8_t length;
+    int8_t origin;
+    const char *name;
+} pio_program_t;
+
+enum pio_fifo_join {
+    PIO_FIFO_JOIN_NONE = 0,
+    PIO_FIFO_JOIN_TX = 1,
+    PIO_FIFO_JOIN_RX = 2,
+};
+
+enum pio_mov_status_type {
+    STATUS_TX_LESSTHAN = 0,
+    STATUS_RX_LESSTHAN = 1,
+};
+
+/**
+ * State machine configuration (host : decoded fields instead of register values)
+ **/
+typedef struct {
+    float clkdiv;
+    uint wrap_target;
+    uint wrap;
+    uint sideset_bit_count;
+    bool sideset_optional;
+    bool sideset_pindirs;
+    uint sideset_base;
+    uint jmp_pin;
+    uint in_base;
+    uint out_base;
+    uint out_count;
+    uint set_base;
+    uint set_count;
+    bool in_shift_right;
+    bool autopush;
+    uint push_threshold;
+    bool out_shift_right;
+    bool autopull;
+    uint pull_threshold;
+    enum pio_fifo_join fifo_join;
+    bool out_sticky;
+    bool has_enable_pin;
+    uint enable_pin_index;
+    enum pio_mov_status_type status_sel;
+    uint status_n;
+} pio_sm_config;
+
+enum pio_interrupt_source {
+    pis_sm0_rx_fifo_not_empty = 0,
+    pis_sm1_rx_fifo_not_empty = 1,
+    pis_sm2_rx_fifo_not_empty = 2,
+    pis_sm3_rx_fifo_not_empty = 3,
+    pis_sm0_tx_fifo_not_full = 4,
+    pis_sm1_tx_fifo_not_full = 5,
+    pis_sm2_tx_fifo_not_full = 6,
+    pis_sm3_tx_fifo_not_full = 7,
+    pis_interrupt0 = 8,
+    pis_interrupt1 = 9,
+    pis_interrupt2 = 10,
+    pis_interrupt3 = 11,
+};
+
+pio_sm_config pio_get_default_sm_config(void);
+
+static inline void sm_config_set_wrap(pio_sm_config *c, uint wrap_target, uint wrap)
+{
+    c->wrap_target = wrap_target;
+    c->wrap = wrap;
+}
+
+static inline void sm_config_set_sideset(pio_sm_config *c, uint bit_count, bool optional, bool pindirs)
+{
+    c->sideset_bit_count = bit_count;
+    c->sideset_optional = optional;
+    c->sideset_pindirs = pindirs;
+}
+
+static inline void sm_config_set_sideset_pins(pio_sm_config *c, uint sideset_base) { c->sideset_base = sideset_base; }
+static inline void sm_config_set_jmp_pin(pio_sm_config *c, uint pin) { c->jmp_pin = pin; }
+static inline void sm_config_set_in_pins(pio_sm_config *c, uint in_base) { c->in_base = in_base; }
+
+static inline void sm_config_set_out_pins(pio_sm_config *c, uint out_base, uint out_count)
+{
+    c->out_base = out_base;
+    c->out_count = out_count;
+}
+
+static inline void sm_config_set_set_pins(pio_sm_config *c, uint set_base, uint set_count)
+{
+    c->set_base = set_base;
+    c->set_count = set_count;
+}
+
+static inline void sm_config_set_clkdiv(pio_sm_config *c, float div) { c->clkdiv = div; }
+
+static inline void sm_config_set_clkdiv_int_frac(pio_sm_config *c, uint16_t div_int, uint8_t div_frac)
+{
+    c->clkdiv = (float)div_int + (float)div_frac / 256.0f;
+}
+
+static inline void sm_config_set_in_shift(pio_sm_config *c, bool shift_right, bool autopush, uint push_threshold)
+{
+    c->in_shift_right = shift_right;
+    c->autopush = autopush;
+    c->push_threshold = push_threshold;
+}
+
+static inline void sm_config_set_out_shift(pio_sm_config *c, bool shift_right, bool autopull, uint pull_threshold)
+{
+    c->out_shift_right = shift_right;
+    c->autopull = autopull;
+    c->pull_threshold = pull_threshold;
+}
+
+static inline void sm_config_set_fifo_join(pio_sm_config *c, enum pio_fifo_join join) { c->fifo_join = join; }
+
+static inline void sm_config_set_out_special(pio_sm_config *c, bool sticky, bool has_enable_pin, uint enable_pin_index)
+{
+    c->out_sticky = sticky;
+    c->has_enable_pin = has_enable_pin;
+    c->enable_pin_index = enable_pin_index;
+}
+
+static inline void sm_config_set_mov_status(pio_sm_config *c, enum pio_mov_status_type status_sel, uint status_n)
+{
+    c->status_sel = status_sel;
+    c->status_n = status_n;
+}
+
+static inline uint pio_get_index(PIO pio) { return pio == pio1 ? 1 : 0; }
+
+static inline uint pio_get_dreq(PIO pio, uint sm, bool is_tx)
+{
+    return (is_tx ? 0 : NUM_PIO_STATE_MACHINES) + sm + (pio_get_index(pio) * 2 * NUM_PIO_STATE_MACHINES);
+}
+
+bool pio_can_add_program(PIO pio, const pio_program_t *program);
+uint pio_add_program(PIO pio, const pio_program_t *program);
+void pio_remove_program(PIO pio, const pio_program_t *program, uint loaded_offset);
+void pio_clear_instruction_memory(PIO pio);
+
+void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config);
+void pio_sm_set_config(PIO pio, uint sm, const pio_sm_config *config);
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled);
+void pio_sm_restart(PIO pio, uint sm);
+void pio_sm_set_clkdiv(PIO pio, uint sm, float div);
+void pio_sm_set_jmp_pin(PIO pio, uint sm, uint pin);
+void pio_sm_set_consecutive_pindirs(PIO pio, uint sm, uint pin_base, uint pin_count, bool is_out);
+void pio_sm_set_pins(PIO pio, uint sm, uint32_t pin_values);
+void pio_sm_exec(PIO pio, uint sm, uint instr);
+uint8_t pio_sm_get_pc(PIO pio, uint sm);
+void pio_gpio_init(PIO pio, uint pin);
+
+void pio_sm_claim(PIO pio, uint sm);
+void pio_sm_unclaim(PIO pio, uint sm);
+int pio_claim_unused_sm(PIO pio, bool required);
+bool pio_sm_is_claimed(PIO pio, uint sm);
+
+void pio_sm_put(PIO pio, uint sm, uint32_t data);
+void pio_sm_put_blocking(PIO pio, uint sm, uint32_t data);
+uint32_t pio_sm_get(PIO pio, uint sm);
+uint32_t pio_sm_get_blocking(PIO pio, uint sm);
+bool pio_sm_is_rx_fifo_full(PIO pio, uint sm);
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm);
+uint pio_sm_get_rx_fifo_level(PIO pio, uint sm);
+bool pio_sm_is_tx_fifo_full(PIO pio, uint sm);
+bool pio_sm_is_tx_fifo_empty(PIO pio, uint sm);
+uint pio_sm_get_tx_fifo_level(PIO pio, uint sm);
+void pio_sm_clear_fifos(PIO pio, uint sm);
+void pio_sm_drain_tx_fifo(PIO pio, uint sm);
+
+void pio_set_irq0_source_enabled(PIO pio, enum pio_interrupt_source source, bool enabled);
+void pio_set_irq1_source_enabled(PIO pio, enum pio_interrupt_source source, bool enabled);
+bool pio_interrupt_get(PIO pio, uint pio_interrupt_num);
+void pio_interrupt_clear(PIO pio, uint pio_interrupt_num);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
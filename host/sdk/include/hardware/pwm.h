@@ -0,0 +1,66 @@
+#ifndef _HARDWARE_PWM_H
+#define _HARDWARE_PWM_H
+/**
+ * Host replacement of hardware/pwm.h
+ * Counters are clocked by the simulated bus clock edges
+ **/
+#include "pico.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NUM_PWM_SLICES 8
+
+enum pwm_clkdiv_mode {
+    PWM_DIV_FREE_RUNNING = 0,
+    PWM_DIV_B_HIGH = 1,
+    PWM_DIV_B_RISING = 2,
+    PWM_DIV_B_FALLING = 3,
+};
+
+enum pwm_chan {
+    PWM_CHAN_A = 0,
+    PWM_CHAN_B = 1,
+};
+
+/**
+ * Slice configuration (host : decoded fields instead of register values)
+ **/
+typedef struct {
+    bool phase_correct;
+    enum pwm_clkdiv_mode mode;
+    float div;
+    uint16_t top;
+} pwm_config;
+
+static inline uint pwm_gpio_to_slice_num(uint gpio) { return (gpio >> 1u) & 7u; }
+static inline uint pwm_gpio_to_channel(uint gpio) { return gpio & 1u; }
+
+static inline pwm_config pwm_get_default_config(void)
+{
+    pwm_config c;
+    c.phase_correct = false;
+    c.mode = PWM_DIV_FREE_RUNNING;
+    c.div = 1.0f;
+    c.top = 0xffff;
+    return c;
+}
+
+static inline void pwm_config_set_phase_correct(pwm_config *c, bool phase_correct) { c->phase_correct = phase_correct; }
+static inline void pwm_config_set_clkdiv(pwm_config *c, float div) { c->div = div; }
+static inline void pwm_config_set_clkdiv_int(pwm_config *c, uint div) { c->div = (float)div; }
+static inline void pwm_config_set_clkdiv_mode(pwm_config *c, enum pwm_clkdiv_mode mode) { c->mode = mode; }
+static inline void pwm_config_set_wrap(pwm_config *c, uint16_t wrap) { c->top = wrap; }
+
+void pwm_init(uint slice_num, pwm_config *c, bool start);
+void pwm_set_enabled(uint slice_num, bool enabled);
+void pwm_set_wrap(uint slice_num, uint16_t wrap);
+void pwm_set_counter(uint slice_num, uint16_t c);
+uint16_t pwm_get_counter(uint slice_num);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef _HARDWARE_STRUCTS_SYSTICK_H
+#define _HARDWARE_STRUCTS_SYSTICK_H
+/**
+ * Host replacement of hardware/structs/systick.h
+ * The current value counts down at the processor clock from the host time :
+ * firmware code runs on the host CPU, cycle counts give its host cost
+ **/
+#include "pico.h"
+
+#define SIM_SYSTICK_HZ 125000000ull     // Processor clock of the counter
+#define SIM_SYSTICK_ENABLE_BITS 0x1u    // CSR enable
+
+#ifdef __cplusplus
+namespace sim {
+/**
+ * SysTick current value register, writes clear it like the hardware does
+ **/
+class SysTickValueReg {
+public:
+    operator uint32_t() const;
+    SysTickValueReg& operator=(uint32_t value);
+    uint64_t origin = 0;                // Host time of the last write (ns)
+};
+}
+
+typedef struct {
+    io_rw_32 csr;
+    io_rw_32 rvr;
+    sim::SysTickValueReg cvr;
+    io_ro_32 calib;
+} systick_hw_t;
+
+extern systick_hw_t sim_systick_hw;
+#define systick_hw (&sim_systick_hw)
+#endif
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef _HARDWARE_TIMER_H
+#define _HARDWARE_TIMER_H
+/**
+ * Host replacement of hardware/timer.h
+ **/
+#include "pico.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint64_t time_us_64(void);
+
+static inline uint32_t time_us_32(void) { return (uint32_t)time_us_64(); }
+
+void busy_wait_us(uint64_t delay_us);
+static inline void busy_wait_us_32(uint32_t delay_us) { busy_wait_us(delay_us); }
+
+#define NUM_TIMERS 4
+
+/**
+ * Hardware alarms, the callback is called from the TIMER_IRQ_n handler on
+ * the core that set it
+ **/
+typedef void (*hardware_alarm_callback_t)(uint alarm_num);
+
+void hardware_alarm_claim(uint alarm_num);
+int hardware_alarm_claim_unused(bool required);
+void hardware_alarm_unclaim(uint alarm_num);
+bool hardware_alarm_is_claimed(uint alarm_num);
+void hardware_alarm_set_callback(uint alarm_num, hardware_alarm_callback_t callback);
+bool hardware_alarm_set_target(uint alarm_num, absolute_time_t t);
+void hardware_alarm_cancel(uint alarm_num);
+void hardware_alarm_force_irq(uint alarm_num);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef _PICO_H
+#define _PICO_H
+/**
+ * Host replacement of the Pico SDK base header
+ * Only the subset used by the firmware is provided, backed by the simulator
+ **/
+#include "pico/types.h"
+
+#define __isr
+#define __not_in_flash_func(func_name) func_name
+#define __time_critical_func(func_name) func_name
+#define __no_inline_not_in_flash_func(func_name) func_name
+#define __scratch_x(group)
+#define __scratch_y(group)
+#define __aligned(x) __attribute__((aligned(x)))
+
+#define count_of(a) (sizeof(a) / sizeof((a)[0]))
+
+#define NUM_CORES 2
+
+#define PICO_DEFAULT_LED_PIN 25
+#define PICO_SMPS_MODE_PIN 23
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Busy-wait hint, advances the simulated time by one poll quantum
+ **/
+void tight_loop_contents(void);
+
+/**
+ * Panics (host : prints the message and aborts)
+ **/
+void panic(const char* fmt, ...) __attribute__((noreturn));
+
+static inline void __dmb(void) {}
+
+/**
+ * Sleeps until an event : an interrupt on the core or a SEV (simulated
+ * time advances meanwhile), returns at once if one is left from before
+ **/
+void __wfe(void);
+
+/**
+ * Sleeps until an interrupt, handled as __wfe
+ **/
+void __wfi(void);
+
+/**
+ * Signals an event to both cores
+ **/
+void __sev(void);
+
+/**
+ * Gets the number of the core executing the code
+ **/
+uint get_core_num(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef _PICO_MULTICORE_H
+#define _PICO_MULTICORE_H
+/**
+ * Host replacement of pico/multicore.h
+ **/
+#include "pico.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void multicore_reset_core1(void);
+void multicore_launch_core1(void (*entry)(void));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef _PICO_STDIO_USB_H
+#define _PICO_STDIO_USB_H
+/**
+ * Host replacement of pico/stdio_usb.h
+ * stdout is a plain file, there is no CR/LF translation to turn off
+ **/
+#include "pico.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct stdio_driver stdio_driver_t;
+
+extern stdio_driver_t stdio_usb;
+
+void stdio_set_translate_crlf(stdio_driver_t* driver, bool translate);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef _PICO_STDLIB_H
+#define _PICO_STDLIB_H
+/**
+ * Host replacement of pico/stdlib.h
+ **/
+#include "pico.h"
+#include "pico/time.h"
+#include "hardware/gpio.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Initializes stdio (host : stdout is used as is)
+ **/
+bool stdio_init_all(void);
+
+#define PICO_ERROR_TIMEOUT -1
+
+/**
+ * Gets a character from stdio (host : simulated console input)
+ * @return Character or PICO_ERROR_TIMEOUT
+ **/
+int getchar_timeout_us(uint32_t timeout_us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
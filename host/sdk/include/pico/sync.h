@@ -0,0 +1,37 @@
+#ifndef _PICO_SYNC_H
+#define _PICO_SYNC_H
+/**
+ * Host replacement of pico/sync.h
+ **/
+#include "pico.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Masks the simulated interrupts, returns the previous mask state
+ **/
+uint32_t save_and_disable_interrupts(void);
+
+/**
+ * Restores the interrupt mask state
+ **/
+void restore_interrupts(uint32_t status);
+
+typedef struct critical_section {
+    uint32_t save;
+} critical_section_t;
+
+static inline void critical_section_init(critical_section_t* crit_sec) { crit_sec->save = 0; }
+static inline void critical_section_enter_blocking(critical_section_t* crit_sec)
+{
+    crit_sec->save = save_and_disable_interrupts();
+}
+static inline void critical_section_exit(critical_section_t* crit_sec) { restore_interrupts(crit_sec->save); }
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef _PICO_TIME_H
+#define _PICO_TIME_H
+/**
+ * Host replacement of pico/time.h
+ * Time is the simulated time, waiting functions let the simulation run
+ **/
+#include "pico.h"
+#include "hardware/timer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+absolute_time_t get_absolute_time(void);
+
+static inline uint64_t to_us_since_boot(absolute_time_t t) { return t; }
+static inline void update_us_since_boot(absolute_time_t* t, uint64_t us) { *t = us; }
+static inline absolute_time_t from_us_since_boot(uint64_t us) { return us; }
+
+static inline absolute_time_t delayed_by_us(const absolute_time_t t, uint64_t us) { return t + us; }
+static inline absolute_time_t delayed_by_ms(const absolute_time_t t, uint32_t ms) { return t + ms * 1000ull; }
+static inline absolute_time_t make_timeout_time_us(uint64_t us) { return delayed_by_us(get_absolute_time(), us); }
+static inline absolute_time_t make_timeout_time_ms(uint32_t ms) { return delayed_by_ms(get_absolute_time(), ms); }
+
+static inline int64_t absolute_time_diff_us(absolute_time_t from, absolute_time_t to)
+{
+    return (int64_t)(to - from);
+}
+
+static inline bool time_reached(absolute_time_t t) { return get_absolute_time() >= t; }
+
+/**
+ * Sleeps until an event (__wfe) or the timeout
+ * @return true if the timeout was reached
+ **/
+bool best_effort_wfe_or_timeout(absolute_time_t timeout_timestamp);
+
+void sleep_until(absolute_time_t target);
+void sleep_us(uint64_t us);
+void sleep_ms(uint32_t ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
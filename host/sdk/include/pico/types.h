@@ -0,0 +1,24 @@
+#ifndef _PICO_TYPES_H
+#define _PICO_TYPES_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef unsigned int uint;
+
+/**
+ * Absolute time in microseconds since boot of the simulated chip
+ **/
+typedef uint64_t absolute_time_t;
+
+typedef volatile uint32_t io_rw_32;
+typedef volatile uint32_t io_ro_32;     // Writable by the simulator
+typedef volatile uint32_t io_wo_32;
+typedef volatile uint16_t io_rw_16;
+typedef volatile uint16_t io_ro_16;
+typedef volatile uint16_t io_wo_16;
+typedef volatile uint8_t io_rw_8;
+typedef volatile uint8_t io_ro_8;
+typedef volatile uint8_t io_wo_8;
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef _TUSB_H_
+#define _TUSB_H_
+/**
+ * Host replacement of tusb.h
+ * Only the vendor class device API is provided, on the simulated USB link
+ * (sim/usb_device.h). The stack entry points do nothing, the link is
+ * modelled at the packet level.
+ **/
+#include "pico.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+bool tusb_init(void);
+void tud_task(void);
+
+bool tud_vendor_mounted(void);
+uint32_t tud_vendor_available(void);
+uint32_t tud_vendor_read(void* buffer, uint32_t bufsize);
+uint32_t tud_vendor_write_available(void);
+uint32_t tud_vendor_write(const void* buffer, uint32_t bufsize);
+uint32_t tud_vendor_write_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,107 @@
+#include "bus.h"
+
+namespace sim {
+
+Bus::Bus(uint64_t bitPeriodNs) : bitPeriod_(bitPeriodNs)
+{
+}
+
+void Bus::attach(BusNode* node)
+{
+    nodes_.push_back(node);
+}
+
+uint64_t Bus::nextEvent() const
+{
+    uint64_t now = Simulator::instance().now();
+    uint64_t half = bitPeriod_ / 2;
+    uint64_t edge = nextEdge_;
+    uint64_t current = (now + half - 1) / half;
+    if(current > edge){
+        edge = current;
+    }
+    // Driven bit, next edge is either its rising edge or the next bit
+    if(driven_){
+        return edgeTime(edge);
+    }
+    if(edge % 2 == 1){
+        ++edge;
+    }
+    for(BusNode* n : nodes_){
+        if(n->wantsBus(now)){
+            return edgeTime(edge);
+        }
+    }
+    // Idle bus, jump to next wake up
+    uint64_t wake = UINT64_MAX;
+    for(BusNode* n : nodes_){
+        uint64_t w = n->nextWake();
+        if(w < wake){
+            wake = w;
+        }
+    }
+    if(wake == UINT64_MAX){
+        return UINT64_MAX;
+    }
+    uint64_t wakeEdge = (wake + half - 1) / half;
+    if(wakeEdge % 2 == 1){
+        ++wakeEdge;
+    }
+    return edgeTime(wakeEdge > edge ? wakeEdge : edge);
+}
+
+void Bus::run(uint64_t now)
+{
+    uint64_t half = bitPeriod_ / 2;
+    uint64_t edge = now / half;
+    nextEdge_ = edge + 1;
+    for(BusNode* n : nodes_){
+        if(n->nextWake() <= now){
+            n->wake(now);
+        }
+    }
+    if(edge % 2 == 1){
+        // Rising edge, receivers sample the line
+        if(driven_){
+            for(BusNode* n : nodes_){
+                n->sample(now, bit_, drivers_, driver_);
+            }
+        }
+        return;
+    }
+    // Falling edge, drivers update the line
+    bool wasDriven = driven_;
+    drivers_ = 0;
+    driver_ = nullptr;
+    active_.clear();
+    bit_ = !onesWin_;
+    for(BusNode* n : nodes_){
+        bool b = true;
+        if(n->drive(now, b)){
+            if(drivers_ == 0){
+                driver_ = n;
+            }
+            ++drivers_;
+            active_.push_back(n);
+            bit_ = onesWin_ ? bit_ || b : bit_ && b;
+        }
+    }
+    driven_ = drivers_ > 0;
+    if(driven_){
+        ++bits;
+        if(drivers_ > 1){
+            ++collisionBits;
+        }
+        lastActivity_ = now + bitPeriod_;
+    }else{
+        //Line is idle high whatever wins contention
+        bit_ = true;
+        if(wasDriven){
+            for(BusNode* n : nodes_){
+                n->released(now);
+            }
+        }
+    }
+}
+
+}
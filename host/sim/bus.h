@@ -0,0 +1,133 @@
+#ifndef __SIM_BUS_H__
+#define __SIM_BUS_H__
+#include "simulator.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace sim {
+
+/**
+ * Something attached to the nanoreseau bus (chip under test, station, probe)
+ **/
+class BusNode {
+public:
+    explicit BusNode(const std::string& name) : name_(name) {}
+    virtual ~BusNode() = default;
+
+    const std::string& name() const { return name_; }
+
+    /**
+     * Gets if the node will drive the bus on next clock falling edge
+     **/
+    virtual bool wantsBus(uint64_t now) { return false; }
+
+    /**
+     * Gets when the node needs to be woken up while the bus is idle
+     * @return Time in ns, UINT64_MAX if nothing is scheduled
+     **/
+    virtual uint64_t nextWake() const { return UINT64_MAX; }
+
+    /**
+     * Wakes up the node (nextWake reached)
+     **/
+    virtual void wake(uint64_t now) {}
+
+    /**
+     * Start of a bit period (clock falling edge)
+     * @param bit Data bit driven on the line
+     * @return true if the node drives clock and data during this bit
+     **/
+    virtual bool drive(uint64_t now, bool& bit) { return false; }
+
+    /**
+     * Bit sampled on the clock rising edge
+     * @param bit Data line level
+     * @param drivers Number of nodes driving the bus (more than one is a collision)
+     * @param driver Node driving the bus (first one in case of collision)
+     **/
+    virtual void sample(uint64_t now, bool bit, int drivers, BusNode* driver) {}
+
+    /**
+     * The bus is not driven anymore (no clock)
+     **/
+    virtual void released(uint64_t now) {}
+
+private:
+    std::string name_;
+};
+
+/**
+ * Bit level model of the nanoreseau bus (RS485 clock and data pairs)
+ * Bits are aligned on a global grid, every bit period starts with a clock
+ * falling edge where drivers update the data line, receivers sample on the
+ * rising edge in the middle of the bit. With several drivers the data line
+ * is the wired AND of all driven levels, or their wired OR when ones win
+ **/
+class Bus : public Component {
+public:
+    /**
+     * @param bitPeriodNs Bit period in ns (2000 for 500 kbit/s)
+     **/
+    explicit Bus(uint64_t bitPeriodNs = 2000);
+
+    void attach(BusNode* node);
+
+    /**
+     * Sets the level winning when drivers contend (RS485 contention is won
+     * by the stronger transceiver)
+     * @param ones true : a driven one wins over zeros, false : zeros win (default)
+     **/
+    void setOnesWin(bool ones) { onesWin_ = ones; }
+
+    uint64_t nextEvent() const override;
+    void run(uint64_t now) override;
+
+    uint64_t bitPeriod() const { return bitPeriod_; }
+
+    /**
+     * Gets the time of last bit driven on the bus
+     **/
+    uint64_t lastActivity() const { return lastActivity_; }
+
+    /**
+     * Gets if the bus is being driven
+     **/
+    bool busy() const { return driven_; }
+
+    /**
+     * Time the bus stayed idle (0 while driven)
+     **/
+    uint64_t idleTime(uint64_t now) const { return driven_ ? 0 : now - lastActivity_; }
+
+    /**
+     * Gets if a node drives the current bit
+     **/
+    bool drives(const BusNode* node) const
+    {
+        return std::find(active_.begin(), active_.end(), node) != active_.end();
+    }
+
+    uint64_t bits = 0;              // Driven bit periods
+    uint64_t collisionBits = 0;     // Bits driven by more than one node
+
+private:
+    uint64_t edgeTime(uint64_t edge) const { return edge * (bitPeriod_ / 2); }
+
+    uint64_t bitPeriod_;
+    uint64_t nextEdge_ = 0;         // Index of next half bit edge to process
+    std::vector<BusNode*> nodes_;
+    bool driven_ = false;           // Bus driven during current bit
+    bool bit_ = true;               // Current data level
+    bool onesWin_ = false;          // Contended bits are the wired OR of the driven levels
+    int drivers_ = 0;
+    BusNode* driver_ = nullptr;
+    std::vector<BusNode*> active_;  // Nodes driving the current bit
+    uint64_t lastActivity_ = 0;
+};
+
+}
+
+#endif
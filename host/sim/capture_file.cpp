@@ -0,0 +1,139 @@
+#include "capture_file.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace sim {
+
+static size_t align8(size_t n)
+{
+    return (n + 7) & ~static_cast<size_t>(7);
+}
+
+CaptureFile::~CaptureFile()
+{
+    close();
+}
+
+void CaptureFile::close()
+{
+    if(data_ != nullptr){
+        munmap(const_cast<uint8_t*>(data_), length_);
+        data_ = nullptr;
+        length_ = 0;
+    }
+}
+
+bool CaptureFile::detect(const std::string& path)
+{
+    FILE* f = fopen(path.c_str(), "rb");
+    if(f == nullptr){
+        return false;
+    }
+    uint32_t magic = 0;
+    bool ok = fread(&magic, sizeof(magic), 1, f) == 1 && magic == NRC_MAGIC;
+    fclose(f);
+    return ok;
+}
+
+bool CaptureFile::open(const std::string& path)
+{
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0){
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(NrcHeader))){
+        ::close(fd);
+        return false;
+    }
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(p == MAP_FAILED){
+        return false;
+    }
+    data_ = static_cast<const uint8_t*>(p);
+    length_ = st.st_size;
+    // Structure is checked once, records are then used without checks
+    const NrcHeader& h = header();
+    bool ok = h.magic == NRC_MAGIC && h.version == NRC_VERSION && h.headerSize == sizeof(NrcHeader) &&
+        (h.indexOffset & 7) == 0 && h.indexOffset + static_cast<uint64_t>(h.recordCount) * 4 <= length_;
+    const uint32_t* index = reinterpret_cast<const uint32_t*>(data_ + (ok ? h.indexOffset : 0));
+    for(uint32_t i = 0; ok && i < h.recordCount; ++i){
+        uint64_t offset = index[i];
+        ok = (offset & 7) == 0 && offset + sizeof(NrcRecord) <= length_;
+        if(ok){
+            const NrcRecord& r = *reinterpret_cast<const NrcRecord*>(data_ + offset);
+            ok = offset + sizeof(NrcRecord) + r.length <= length_ && r.kind <= NRC_ECHO;
+        }
+    }
+    if(!ok){
+        close();
+    }
+    return ok;
+}
+
+const NrcRecord& CaptureFile::record(uint32_t i) const
+{
+    const uint32_t* index = reinterpret_cast<const uint32_t*>(data_ + header().indexOffset);
+    return *reinterpret_cast<const NrcRecord*>(data_ + index[i]);
+}
+
+void CaptureWriter::add(const NrcRecord& r, const uint8_t* bytes)
+{
+    offsets_.push_back(static_cast<uint32_t>(records_.size()));
+    size_t pos = records_.size();
+    records_.resize(pos + align8(sizeof(r) + r.length), 0);
+    memcpy(&records_[pos], &r, sizeof(r));
+    if(bytes != nullptr && r.length){
+        memcpy(&records_[pos + sizeof(r)], bytes, r.length);
+    }
+    if(r.timeUs > lastUs_){
+        lastUs_ = r.timeUs;
+    }
+}
+
+void CaptureWriter::frame(uint64_t timeUs, const uint8_t* bytes, size_t len, uint8_t flags)
+{
+    NrcRecord r = {timeUs, 0, static_cast<uint16_t>(len), NRC_FRAME, flags};
+    add(r, bytes);
+}
+
+void CaptureWriter::echo(uint64_t timeUs, uint32_t durationUs, uint8_t flags)
+{
+    NrcRecord r = {timeUs, durationUs, 0, NRC_ECHO, flags};
+    add(r, nullptr);
+}
+
+bool CaptureWriter::write(const std::string& path) const
+{
+    NrcHeader h = {};
+    h.magic = NRC_MAGIC;
+    h.version = NRC_VERSION;
+    h.headerSize = sizeof(NrcHeader);
+    h.recordCount = size();
+    h.indexOffset = sizeof(NrcHeader);
+    h.startUs = startUs_;
+    h.durationUs = lastUs_;
+    size_t recordsOffset = align8(sizeof(NrcHeader) + offsets_.size() * 4);
+    std::vector<uint8_t> out(recordsOffset, 0);
+    memcpy(out.data(), &h, sizeof(h));
+    for(size_t i = 0; i < offsets_.size(); ++i){
+        uint32_t offset = static_cast<uint32_t>(recordsOffset + offsets_[i]);
+        memcpy(&out[sizeof(h) + i * 4], &offset, 4);
+    }
+    out.insert(out.end(), records_.begin(), records_.end());
+    FILE* f = fopen(path.c_str(), "wb");
+    if(f == nullptr){
+        return false;
+    }
+    bool ok = fwrite(out.data(), 1, out.size(), f) == out.size();
+    return fclose(f) == 0 && ok;
+}
+
+}
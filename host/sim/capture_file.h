@@ -0,0 +1,115 @@
+#ifndef __SIM_CAPTURE_FILE_H__
+#define __SIM_CAPTURE_FILE_H__
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace sim {
+
+/**
+ * Capture file of bus sessions (.nrc)
+ * Little endian, every part is 8 byte aligned so a mapped file is used in
+ * place :
+ *   NrcHeader
+ *   uint32_t index[recordCount]   offset of each record from the file start
+ *   records                       NrcRecord followed by its bytes, padded to 8
+ * Records are in time order, frames are stored address first without CRC.
+ **/
+
+#define NRC_MAGIC 0x3143524Eu       // "NRC1"
+#define NRC_VERSION 1
+
+struct NrcHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t headerSize;            // sizeof(NrcHeader)
+    uint32_t recordCount;
+    uint32_t indexOffset;           // Offset of the index
+    uint64_t startUs;               // Capture clock at time 0 of the records
+    uint64_t durationUs;            // Time of the last record
+};
+
+enum NrcKind : uint8_t {
+    NRC_FRAME,
+    NRC_ECHO,                       // Clock with flags only, durationUs long
+};
+
+enum NrcFlags : uint8_t {
+    NRC_MASTER = 0x01,              // Sent by the master (the adapter)
+    NRC_BAD_CRC = 0x02,
+    NRC_ABORTED = 0x04,             // Frame ended by an abort
+};
+
+struct NrcRecord {
+    uint64_t timeUs;                // Start of the transmission, from the capture start
+    uint32_t durationUs;            // Echo duration, 0 for frames
+    uint16_t length;                // Frame bytes following the record
+    uint8_t kind;                   // NrcKind
+    uint8_t flags;                  // NrcFlags
+};
+
+static_assert(sizeof(NrcHeader) == 32, "Header is mapped in place");
+static_assert(sizeof(NrcRecord) == 16, "Records are mapped in place");
+
+/**
+ * Capture file mapped in memory
+ **/
+class CaptureFile {
+public:
+    CaptureFile() = default;
+    ~CaptureFile();
+    CaptureFile(const CaptureFile&) = delete;
+    CaptureFile& operator=(const CaptureFile&) = delete;
+
+    /**
+     * Maps a file and checks its structure
+     * @return false if it is not a valid capture file
+     **/
+    bool open(const std::string& path);
+
+    /**
+     * Gets if a file starts with the capture file magic
+     **/
+    static bool detect(const std::string& path);
+
+    const NrcHeader& header() const { return *reinterpret_cast<const NrcHeader*>(data_); }
+    uint32_t size() const { return header().recordCount; }
+    const NrcRecord& record(uint32_t i) const;
+    const uint8_t* bytes(uint32_t i) const { return reinterpret_cast<const uint8_t*>(&record(i) + 1); }
+
+private:
+    void close();
+    const uint8_t* data_ = nullptr;
+    size_t length_ = 0;
+};
+
+/**
+ * Writes a capture file, records are kept in memory until close
+ **/
+class CaptureWriter {
+public:
+    explicit CaptureWriter(uint64_t startUs = 0) : startUs_(startUs) {}
+
+    void frame(uint64_t timeUs, const uint8_t* bytes, size_t len, uint8_t flags);
+    void echo(uint64_t timeUs, uint32_t durationUs, uint8_t flags);
+
+    uint32_t size() const { return static_cast<uint32_t>(offsets_.size()); }
+
+    /**
+     * Writes the file
+     * @return false on error
+     **/
+    bool write(const std::string& path) const;
+
+private:
+    void add(const NrcRecord& r, const uint8_t* bytes);
+    uint64_t startUs_;
+    uint64_t lastUs_ = 0;
+    std::vector<uint32_t> offsets_;     // Record offsets in records_
+    std::vector<uint8_t> records_;
+};
+
+}
+
+#endif
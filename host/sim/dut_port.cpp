@@ -0,0 +1,77 @@
+#include "dut_port.h"
+
+namespace sim {
+
+DutPort::DutPort(Rp2040& mcu, uint rxDataPin, uint rxClkPin, uint txEnablePin) :
+    BusNode("dut"), mcu_(mcu), rxDataPin_(rxDataPin), rxClkPin_(rxClkPin), txEnablePin_(txEnablePin)
+{
+    mcu_.setInput(rxDataPin_, true);
+    mcu_.setInput(rxClkPin_, false);
+}
+
+bool DutPort::clockRunning(const PioBlock& p) const
+{
+    for(const PioStateMachine& sm : p.sm){
+        if(sm.enabled && sm.program == PioProgram::ClockTx && sm.config.in_base == txEnablePin_ && mcu_.pinLevel(txEnablePin_)){
+            return true;
+        }
+    }
+    return false;
+}
+
+bool DutPort::wantsBus(uint64_t now)
+{
+    for(const PioBlock& p : mcu_.pio){
+        if(clockRunning(p)){
+            return true;
+        }
+    }
+    return false;
+}
+
+bool DutPort::drive(uint64_t now, bool& bit)
+{
+    bool driving = false;
+    for(PioBlock& p : mcu_.pio){
+        if(!clockRunning(p)){
+            continue;
+        }
+        driving = true;
+        for(PioStateMachine& sm : p.sm){
+            if(sm.enabled && sm.program == PioProgram::HdlcTx && sm.config.in_base == txEnablePin_){
+                sm.model->clockFalling();
+                bit = mcu_.gpio[sm.config.set_base].out;
+            }
+        }
+    }
+    mcu_.setInput(rxClkPin_, false);
+    return driving;
+}
+
+void DutPort::sample(uint64_t now, bool bit, int drivers, BusNode* driver)
+{
+    mcu_.setInput(rxDataPin_, bit);
+    mcu_.setInput(rxClkPin_, true);
+    mcu_.risingEdge(rxClkPin_);
+    for(PioBlock& p : mcu_.pio){
+        for(PioStateMachine& sm : p.sm){
+            if(!sm.enabled){
+                continue;
+            }
+            if(sm.program == PioProgram::HdlcRx && sm.config.in_base == rxDataPin_){
+                sm.model->clockRising(bit);
+            }else if(sm.program == PioProgram::HdlcTx && sm.config.in_base == txEnablePin_){
+                // Read back of the data driven
+                sm.model->clockRising(bit);
+            }
+        }
+    }
+}
+
+void DutPort::released(uint64_t now)
+{
+    mcu_.setInput(rxDataPin_, true);
+    mcu_.setInput(rxClkPin_, false);
+}
+
+}
@@ -0,0 +1,40 @@
+#ifndef __SIM_DUT_PORT_H__
+#define __SIM_DUT_PORT_H__
+#include "bus.h"
+#include "rp2040.h"
+
+namespace sim {
+
+/**
+ * Connects a transceiver of the simulated RP2040 (firmware under test) to
+ * the bus, one port per bus segment
+ * The chip drives the bus when the clock_tx state machine of the segment
+ * has its enable pin high, data comes from the hdlc_tx state machine with
+ * the same enable pin, which reads the line back on its jump pin
+ **/
+class DutPort : public BusNode {
+public:
+    /**
+     * @param rxDataPin GPIO receiving the bus data line
+     * @param rxClkPin GPIO receiving the bus clock line
+     * @param txEnablePin GPIO enabling the emitter of the segment
+     **/
+    DutPort(Rp2040& mcu, uint rxDataPin, uint rxClkPin, uint txEnablePin);
+
+    bool wantsBus(uint64_t now) override;
+    bool drive(uint64_t now, bool& bit) override;
+    void sample(uint64_t now, bool bit, int drivers, BusNode* driver) override;
+    void released(uint64_t now) override;
+
+private:
+    bool clockRunning(const PioBlock& p) const;
+
+    Rp2040& mcu_;
+    uint rxDataPin_;
+    uint rxClkPin_;
+    uint txEnablePin_;
+};
+
+}
+
+#endif
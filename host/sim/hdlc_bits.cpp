@@ -0,0 +1,137 @@
+#include "hdlc_bits.h"
+
+namespace sim {
+
+uint16_t crc16X25(const uint8_t* data, size_t len)
+{
+    uint16_t crc = 0xFFFF;
+    for(size_t i = 0; i < len; ++i){
+        crc ^= data[i];
+        for(int b = 0; b < 8; ++b){
+            crc = (crc & 1) ? ((crc >> 1) ^ 0x8408) : (crc >> 1);
+        }
+    }
+    return ~crc;
+}
+
+void HdlcEncoder::flag()
+{
+    bits_.push_back(false);
+    for(int i = 0; i < 6; ++i){
+        bits_.push_back(true);
+    }
+    bits_.push_back(false);
+    ones_ = 0;
+}
+
+void HdlcEncoder::byte(uint8_t b)
+{
+    for(int i = 0; i < 8; ++i){
+        bool bit = (b >> i) & 1;
+        bits_.push_back(bit);
+        if(bit){
+            if(++ones_ == 5){
+                bits_.push_back(false);
+                ones_ = 0;
+            }
+        }else{
+            ones_ = 0;
+        }
+    }
+}
+
+void HdlcEncoder::frame(const std::vector<uint8_t>& bytes, bool badCrc)
+{
+    flag();
+    for(uint8_t b : bytes){
+        byte(b);
+    }
+    uint16_t crc = crc16X25(bytes.data(), bytes.size());
+    if(badCrc){
+        crc ^= 0x0100;
+    }
+    byte(crc & 0xFF);
+    byte(crc >> 8);
+    flag();
+}
+
+void HdlcEncoder::abortedFrame(const std::vector<uint8_t>& bytes)
+{
+    flag();
+    for(uint8_t b : bytes){
+        byte(b);
+    }
+    abort();
+}
+
+void HdlcEncoder::abort()
+{
+    for(int i = 0; i < 7; ++i){
+        bits_.push_back(true);
+    }
+    ones_ = 0;
+}
+
+bool HdlcEncoder::next()
+{
+    bool b = bits_.front();
+    bits_.pop_front();
+    return b;
+}
+
+HdlcDecoder::Event HdlcDecoder::push(bool bit)
+{
+    if(bit){
+        ++ones_;
+        if(ones_ == 7){
+            bytes_.clear();
+            nbBits_ = 0;
+            acc_ = 0;
+            hunting_ = true;
+            return Event::Abort;
+        }
+        if(ones_ >= 6){
+            return Event::None;     // May be a flag
+        }
+    }else{
+        int ones = ones_;
+        ones_ = 0;
+        if(ones == 6){
+            // Flag, partial bits are discarded
+            Event e = Event::None;
+            if(!hunting_ && !bytes_.empty()){
+                frame_ = bytes_;
+                e = Event::Frame;
+            }
+            bytes_.clear();
+            nbBits_ = 0;
+            acc_ = 0;
+            hunting_ = false;
+            return e;
+        }
+        if(ones >= 7 || ones == 5){
+            return Event::None;     // End of abort or inserted zero
+        }
+    }
+    if(hunting_){
+        return Event::None;
+    }
+    acc_ |= (bit ? 1 : 0) << nbBits_;
+    if(++nbBits_ == 8){
+        bytes_.push_back(acc_);
+        acc_ = 0;
+        nbBits_ = 0;
+    }
+    return Event::None;
+}
+
+bool HdlcDecoder::crcOk() const
+{
+    if(frame_.size() < 3){
+        return false;
+    }
+    uint16_t crc = crc16X25(frame_.data(), frame_.size() - 2);
+    return (frame_[frame_.size() - 2] == (crc & 0xFF)) && (frame_[frame_.size() - 1] == (crc >> 8));
+}
+
+}
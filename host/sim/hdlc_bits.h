@@ -0,0 +1,97 @@
+#ifndef __SIM_HDLC_BITS_H__
+#define __SIM_HDLC_BITS_H__
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+namespace sim {
+
+/**
+ * Computes CRC-16/X-25 (the frame check sequence of the bus)
+ **/
+uint16_t crc16X25(const uint8_t* data, size_t len);
+
+/**
+ * Bit level HDLC encoder used by simulated stations
+ * Bytes are sent LSB first, a zero is inserted after five consecutive ones
+ **/
+class HdlcEncoder {
+public:
+    /**
+     * Queues a flag (01111110)
+     **/
+    void flag();
+
+    /**
+     * Queues a frame (opening flag, stuffed data, CRC and closing flag)
+     * @param bytes Frame content (address first), without CRC
+     * @param badCrc Sends a wrong CRC
+     **/
+    void frame(const std::vector<uint8_t>& bytes, bool badCrc = false);
+
+    /**
+     * Queues a frame ended by an abort instead of its CRC and closing flag
+     **/
+    void abortedFrame(const std::vector<uint8_t>& bytes);
+
+    /**
+     * Queues an abort sequence (seven ones)
+     **/
+    void abort();
+
+    bool empty() const { return bits_.empty(); }
+    size_t size() const { return bits_.size(); }
+    void clear() { bits_.clear(); }
+
+    /**
+     * Gets next bit to emit
+     **/
+    bool next();
+
+private:
+    void byte(uint8_t b);
+    std::deque<bool> bits_;
+    int ones_ = 0;
+};
+
+/**
+ * Bit level HDLC decoder used by simulated stations and bus probe
+ **/
+class HdlcDecoder {
+public:
+    enum class Event { None, Frame, Abort };
+
+    /**
+     * Decodes one bit
+     * @return Event::Frame when a complete frame is available in frame()
+     **/
+    Event push(bool bit);
+
+    /**
+     * Gets last decoded frame (with its CRC)
+     **/
+    const std::vector<uint8_t>& frame() const { return frame_; }
+
+    /**
+     * Gets if last decoded frame has a valid CRC
+     **/
+    bool crcOk() const;
+
+    /**
+     * Gets if a frame is being received
+     **/
+    bool inFrame() const { return !bytes_.empty(); }
+
+private:
+    std::vector<uint8_t> bytes_;
+    std::vector<uint8_t> frame_;
+    uint8_t acc_ = 0;
+    int nbBits_ = 0;
+    int ones_ = 0;
+    bool hunting_ = true;
+};
+
+}
+
+#endif
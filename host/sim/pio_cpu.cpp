@@ -0,0 +1,397 @@
+#include "pio_cpu.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace sim {
+
+static uint32_t bitMask(uint n)
+{
+    return n >= 32 ? 0xFFFFFFFFu : ((1u << n) - 1);
+}
+
+static uint32_t reverse(uint32_t v)
+{
+    uint32_t r = 0;
+    for(int i = 0; i < 32; ++i){
+        r = (r << 1) | ((v >> i) & 1);
+    }
+    return r;
+}
+
+PioCpu::PioCpu()
+{
+    for(StateMachine& s : sm_){
+        s.rx.setCapacity(4);
+        s.tx.setCapacity(4);
+    }
+}
+
+uint PioCpu::load(const pio_program_t& program)
+{
+    uint32_t mask = bitMask(program.length);
+    int offset = -1;
+    if(program.origin >= 0){
+        if(!(usedInstructions_ & (mask << program.origin))){
+            offset = program.origin;
+        }
+    }else{
+        // Same placement as the SDK : highest free offset
+        for(int o = PIO_INSTRUCTION_COUNT - program.length; o >= 0 && offset < 0; --o){
+            if(!(usedInstructions_ & (mask << o))){
+                offset = o;
+            }
+        }
+    }
+    if(offset < 0){
+        panic("PIO program %s does not fit", program.name);
+    }
+    for(uint i = 0; i < program.length; ++i){
+        uint16_t instr = program.instructions[i];
+        // Jump targets are relative to the program
+        if((instr >> 13) == 0){
+            instr = (instr & 0xFFE0) | ((instr + offset) & 0x1F);
+        }
+        memory_[offset + i] = instr;
+    }
+    usedInstructions_ |= mask << offset;
+    return offset;
+}
+
+void PioCpu::start(uint sm, uint pc, const pio_sm_config& config)
+{
+    StateMachine& s = sm_[sm];
+    s = StateMachine();
+    s.config = config;
+    s.rx.setCapacity(config.fifo_join == PIO_FIFO_JOIN_RX ? 8 : (config.fifo_join == PIO_FIFO_JOIN_TX ? 0 : 4));
+    s.tx.setCapacity(config.fifo_join == PIO_FIFO_JOIN_TX ? 8 : (config.fifo_join == PIO_FIFO_JOIN_RX ? 0 : 4));
+    s.pc = pc;
+    s.enabled = true;
+}
+
+void PioCpu::setInput(uint pin, bool level)
+{
+    inputs_ = level ? (inputs_ | (1u << pin)) : (inputs_ & ~(1u << pin));
+}
+
+void PioCpu::setPinDir(uint pin, bool out)
+{
+    dirs_ = out ? (dirs_ | (1u << pin)) : (dirs_ & ~(1u << pin));
+}
+
+bool PioCpu::pin(uint pin) const
+{
+    return (pads() >> pin) & 1;
+}
+
+uint32_t PioCpu::pads() const
+{
+    return (outputs_ & dirs_) | (inputs_ & ~dirs_);
+}
+
+void PioCpu::step()
+{
+    for(uint n = 0; n < NUM_PIO_STATE_MACHINES; ++n){
+        if(sm_[n].enabled){
+            tick(n);
+        }else{
+            sm_[n].last = Activity();
+        }
+    }
+    irq_ = (irq_ & ~irqClear_) | irqSet_;
+    irqSet_ = 0;
+    irqClear_ = 0;
+    sync_[1] = sync_[0];
+    sync_[0] = pads();
+    ++cycle_;
+}
+
+void PioCpu::tick(uint n)
+{
+    StateMachine& s = sm_[n];
+    s.last = Activity();
+    uint32_t div = static_cast<uint32_t>(std::lround(s.config.clkdiv * 256.0f));
+    s.divAcc += 256;
+    if(s.divAcc < div){
+        return;
+    }
+    s.divAcc = div < 256 ? 0 : s.divAcc - div;
+    s.last.ticked = true;
+    ++s.ticks;
+    if(s.delay){
+        --s.delay;
+        ++s.delayCycles;
+    }else{
+        bool fromExec = s.execPending;
+        uint16_t instr = fromExec ? s.execInstr : memory_[s.pc];
+        s.execPending = false;
+        s.last.pc = s.pc;
+        s.last.instr = instr;
+        sideSet(s, instr);
+        bool jumped = false;
+        if(execute(n, instr, jumped)){
+            s.last.executed = true;
+            ++s.instructions;
+            s.delay = (instr >> 8) & bitMask(5 - s.config.sideset_bit_count);
+            if(!jumped && !fromExec){
+                s.pc = (s.pc == s.config.wrap) ? s.config.wrap_target : (s.pc + 1) % PIO_INSTRUCTION_COUNT;
+            }
+        }else{
+            // Stalled, the same instruction is issued again
+            if(fromExec){
+                s.execPending = true;
+            }
+            s.last.stalled = true;
+            ++s.stallCycles;
+        }
+    }
+    uint threshold = s.config.pull_threshold ? s.config.pull_threshold : 32;
+    if(s.config.autopull && s.osrCount >= threshold && !s.tx.empty()){
+        s.osr = s.tx.pop();
+        s.osrCount = 0;
+    }
+}
+
+void PioCpu::sideSet(StateMachine& s, uint16_t instr)
+{
+    uint count = s.config.sideset_bit_count;
+    if(count == 0){
+        return;
+    }
+    uint value = ((instr >> 8) & 0x1F) >> (5 - count);
+    uint bits = count;
+    if(s.config.sideset_optional){
+        --bits;
+        if(!((value >> bits) & 1)){
+            return;
+        }
+        value &= bitMask(bits);
+    }
+    writePins(s.config.sideset_base, bits, value, s.config.sideset_pindirs);
+}
+
+void PioCpu::writePins(uint base, uint count, uint32_t value, bool dirs)
+{
+    uint32_t& target = dirs ? dirs_ : outputs_;
+    for(uint i = 0; i < count; ++i){
+        uint32_t bit = 1u << ((base + i) % 32);
+        target = ((value >> i) & 1) ? (target | bit) : (target & ~bit);
+    }
+}
+
+uint32_t PioCpu::readPins(const StateMachine& s) const
+{
+    uint base = s.config.in_base % 32;
+    return base ? (sync_[1] >> base) | (sync_[1] << (32 - base)) : sync_[1];
+}
+
+uint PioCpu::irqIndex(uint n, uint index) const
+{
+    // Relative IRQ : the state machine number is added to the 2 low bits
+    return (index & 0x10) ? ((index & 4) | ((index + n) & 3)) : (index & 7);
+}
+
+bool PioCpu::execute(uint n, uint16_t instr, bool& jumped)
+{
+    StateMachine& s = sm_[n];
+    const pio_sm_config& c = s.config;
+    uint arg1 = (instr >> 5) & 7;
+    uint arg2 = instr & 0x1F;
+    uint bitCount = arg2 ? arg2 : 32;
+    uint pushThreshold = c.push_threshold ? c.push_threshold : 32;
+    uint pullThreshold = c.pull_threshold ? c.pull_threshold : 32;
+    switch(instr >> 13){
+    case 0: {   // JMP
+        bool cond = false;
+        switch(arg1){
+        case 0: cond = true; break;
+        case 1: cond = s.x == 0; break;
+        case 2: cond = s.x-- != 0; break;
+        case 3: cond = s.y == 0; break;
+        case 4: cond = s.y-- != 0; break;
+        case 5: cond = s.x != s.y; break;
+        case 6: cond = (sync_[1] >> (c.jmp_pin % 32)) & 1; s.last.readData = true; break;
+        case 7: cond = s.osrCount < pullThreshold; break;
+        }
+        if(cond){
+            s.pc = arg2;
+            jumped = true;
+        }
+        return true;
+    }
+    case 1: {   // WAIT
+        bool polarity = (instr >> 7) & 1;
+        bool level = false;
+        uint irq = 0;
+        switch((instr >> 5) & 3){
+        case 0: level = (sync_[1] >> arg2) & 1; break;
+        case 1: level = (readPins(s) >> arg2) & 1; break;
+        case 2: irq = irqIndex(n, arg2); level = (irq_ >> irq) & 1; break;
+        default: break;
+        }
+        if(level != polarity){
+            return false;
+        }
+        if(((instr >> 5) & 3) == 2 && polarity){
+            irqClear_ |= 1u << irq;
+        }
+        return true;
+    }
+    case 2: {   // IN
+        uint32_t data = 0;
+        switch(arg1){
+        case 0: data = readPins(s); s.last.readData = true; break;
+        case 1: data = s.x; break;
+        case 2: data = s.y; break;
+        case 6: data = s.isr; break;
+        case 7: data = s.osr; break;
+        default: break;
+        }
+        if(c.autopush && s.rx.full() && s.isrCount + bitCount >= pushThreshold){
+            return false;
+        }
+        data &= bitMask(bitCount);
+        if(bitCount == 32){
+            s.isr = data;
+        }else if(c.in_shift_right){
+            s.isr = (s.isr >> bitCount) | (data << (32 - bitCount));
+        }else{
+            s.isr = (s.isr << bitCount) | data;
+        }
+        s.isrCount = std::min(32u, s.isrCount + bitCount);
+        if(c.autopush && s.isrCount >= pushThreshold){
+            s.rx.push(s.isr);
+            s.isr = 0;
+            s.isrCount = 0;
+        }
+        return true;
+    }
+    case 3: {   // OUT
+        if(c.autopull && s.osrCount >= pullThreshold){
+            if(s.tx.empty()){
+                return false;
+            }
+            s.osr = s.tx.pop();
+            s.osrCount = 0;
+        }
+        uint32_t data;
+        if(c.out_shift_right){
+            data = s.osr & bitMask(bitCount);
+            s.osr = bitCount == 32 ? 0 : s.osr >> bitCount;
+        }else{
+            data = bitCount == 32 ? s.osr : s.osr >> (32 - bitCount);
+            s.osr = bitCount == 32 ? 0 : s.osr << bitCount;
+        }
+        s.osrCount = std::min(32u, s.osrCount + bitCount);
+        switch(arg1){
+        case 0: writePins(c.out_base, c.out_count, data, false); s.last.wrotePins = true; break;
+        case 1: s.x = data; break;
+        case 2: s.y = data; break;
+        case 4: writePins(c.out_base, c.out_count, data, true); break;
+        case 5: s.pc = data & 0x1F; jumped = true; break;
+        case 6: s.isr = data; s.isrCount = bitCount; break;
+        case 7: s.execPending = true; s.execInstr = data; break;
+        default: break;
+        }
+        return true;
+    }
+    case 4: {
+        bool conditional = (instr >> 6) & 1;
+        bool block = (instr >> 5) & 1;
+        if(!((instr >> 7) & 1)){
+            // PUSH
+            if(conditional && s.isrCount < pushThreshold){
+                return true;
+            }
+            if(s.rx.full() && block){
+                return false;
+            }
+            // Without block the data is lost if the FIFO is full
+            s.rx.push(s.isr);
+            s.isr = 0;
+            s.isrCount = 0;
+        }else{
+            // PULL
+            if(conditional && s.osrCount < pullThreshold){
+                return true;
+            }
+            if(s.tx.empty()){
+                if(block){
+                    return false;
+                }
+                s.osr = s.x;
+            }else{
+                s.osr = s.tx.pop();
+            }
+            s.osrCount = 0;
+        }
+        return true;
+    }
+    case 5: {   // MOV
+        uint32_t data = 0;
+        switch(instr & 7){
+        case 0: data = readPins(s); s.last.readData = true; break;
+        case 1: data = s.x; break;
+        case 2: data = s.y; break;
+        case 5:
+            if(c.status_sel == STATUS_TX_LESSTHAN){
+                data = s.tx.level() < c.status_n ? 0xFFFFFFFFu : 0;
+            }else{
+                data = s.rx.level() < c.status_n ? 0xFFFFFFFFu : 0;
+            }
+            break;
+        case 6: data = s.isr; break;
+        case 7: data = s.osr; break;
+        default: break;
+        }
+        switch((instr >> 3) & 3){
+        case 1: data = ~data; break;
+        case 2: data = reverse(data); break;
+        default: break;
+        }
+        switch(arg1){
+        case 0: writePins(c.out_base, c.out_count, data, false); s.last.wrotePins = true; break;
+        case 1: s.x = data; break;
+        case 2: s.y = data; break;
+        case 4: s.execPending = true; s.execInstr = data; break;
+        case 5: s.pc = data & 0x1F; jumped = true; break;
+        case 6: s.isr = data; s.isrCount = 0; break;
+        case 7: s.osr = data; s.osrCount = 0; break;
+        default: break;
+        }
+        return true;
+    }
+    case 6: {   // IRQ
+        uint bit = 1u << irqIndex(n, arg2);
+        if((instr >> 6) & 1){
+            irqClear_ |= bit;
+        }else if((instr >> 5) & 1){
+            // irq wait : sets the flag then waits for it to be cleared
+            if(!s.irqWaiting){
+                irqSet_ |= bit;
+                s.irqWaiting = true;
+                return false;
+            }
+            if(irq_ & bit){
+                return false;
+            }
+            s.irqWaiting = false;
+        }else{
+            irqSet_ |= bit;
+        }
+        return true;
+    }
+    default: {  // SET
+        switch(arg1){
+        case 0: writePins(c.set_base, c.set_count, arg2, false); s.last.wrotePins = true; break;
+        case 1: s.x = arg2; break;
+        case 2: s.y = arg2; break;
+        case 4: writePins(c.set_base, c.set_count, arg2, true); break;
+        default: break;
+        }
+        return true;
+    }
+    }
+}
+
+}
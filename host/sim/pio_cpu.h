@@ -0,0 +1,122 @@
+#ifndef __SIM_PIO_CPU_H__
+#define __SIM_PIO_CPU_H__
+#include "rp2040.h"
+
+namespace sim {
+
+/**
+ * Cycle level interpreter of a PIO block
+ * Unlike the bit level models of pio_models.h, it executes the instructions
+ * of the assembled programs, one system clock cycle per step() :
+ *   - state machines run when their clock divider fires (fractional, 1/256)
+ *   - one instruction per state machine cycle, then its delay cycles
+ *   - side-set applied when the instruction is issued, stalls included
+ *   - WAIT, blocking PUSH/PULL, IRQ wait, autopush and autopull stall
+ *   - inputs go through the 2 cycle synchronizer
+ *   - IRQ flags written by a state machine are seen by others next cycle
+ * Autopull refills the OSR at the end of any state machine cycle where it
+ * is empty and the TX FIFO has data, as the bit level models assume.
+ **/
+class PioCpu {
+public:
+    /**
+     * What a state machine did during the last cycle
+     **/
+    struct Activity {
+        bool ticked = false;        // Its clock divider fired
+        bool executed = false;      // An instruction completed (delay not included)
+        bool stalled = false;
+        uint8_t pc = 0;             // Address of the instruction issued
+        uint16_t instr = 0;
+        bool readData = false;      // Pins read by IN, MOV or JMP pin
+        bool wrotePins = false;     // Pins written by SET, OUT or MOV
+    };
+
+    struct StateMachine {
+        bool enabled = false;
+        pio_sm_config config = {};
+        Fifo rx;
+        Fifo tx;
+        uint8_t pc = 0;
+        uint32_t x = 0;
+        uint32_t y = 0;
+        uint32_t isr = 0;
+        uint32_t osr = 0;
+        uint isrCount = 0;          // Bits shifted in
+        uint osrCount = 32;         // Bits shifted out (32 : empty)
+        uint delay = 0;             // Delay cycles left
+        uint32_t divAcc = 0;        // Clock divider accumulator (1/256)
+        bool execPending = false;   // Instruction given by OUT/MOV EXEC
+        bool irqWaiting = false;    // IRQ set by irq wait, waiting for its clear
+        uint16_t execInstr = 0;
+        Activity last;
+        uint64_t ticks = 0;         // State machine cycles
+        uint64_t instructions = 0;
+        uint64_t stallCycles = 0;
+        uint64_t delayCycles = 0;
+    };
+
+    PioCpu();
+
+    /**
+     * Loads a program in instruction memory, jumps are relocated
+     * @return offset of the program
+     **/
+    uint load(const pio_program_t& program);
+
+    /**
+     * Configures and enables a state machine at a program address
+     **/
+    void start(uint sm, uint pc, const pio_sm_config& config);
+
+    /**
+     * Sets the level driven on a pin from outside
+     **/
+    void setInput(uint pin, bool level);
+
+    /**
+     * Sets the direction of a pin (true : driven by the PIO)
+     **/
+    void setPinDir(uint pin, bool out);
+
+    /**
+     * Gets the level of a pin (PIO output or outside input)
+     **/
+    bool pin(uint pin) const;
+
+    /**
+     * Runs one system clock cycle
+     **/
+    void step();
+
+    uint64_t cycle() const { return cycle_; }
+    uint8_t irqFlags() const { return irq_; }
+    void clearIrq(uint n) { irq_ &= ~(1u << n); }
+    StateMachine& sm(uint n) { return sm_[n]; }
+    const StateMachine& sm(uint n) const { return sm_[n]; }
+
+private:
+    uint32_t pads() const;
+    void tick(uint n);
+    bool execute(uint n, uint16_t instr, bool& jumped);
+    void writePins(uint base, uint count, uint32_t value, bool dirs);
+    uint32_t readPins(const StateMachine& s) const;
+    uint irqIndex(uint n, uint index) const;
+    void sideSet(StateMachine& s, uint16_t instr);
+
+    uint16_t memory_[PIO_INSTRUCTION_COUNT] = {};
+    uint32_t usedInstructions_ = 0;
+    StateMachine sm_[NUM_PIO_STATE_MACHINES];
+    uint32_t inputs_ = 0;           // Levels driven from outside
+    uint32_t outputs_ = 0;          // Levels driven by the state machines
+    uint32_t dirs_ = 0;             // Pins driven by the state machines
+    uint32_t sync_[2] = {0, 0};     // Input synchronizer stages
+    uint8_t irq_ = 0;
+    uint8_t irqSet_ = 0;            // IRQ changes applied at the end of the cycle
+    uint8_t irqClear_ = 0;
+    uint64_t cycle_ = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,242 @@
+#include "pio_models.h"
+#include "src/transceiver.h"
+
+namespace sim {
+
+// IRQ indexes of the programs, relative to their state machine
+#define RX_ABORT_INT 0
+#define RX_DATA_DONE 1
+#define FLAG_SENT_IRQ 0
+#define COLLISION_IRQ 3
+
+HdlcRxModel::HdlcRxModel(Rp2040& mcu, uint pioIndex, uint sm) :
+    mcu_(mcu), pio_(pioIndex), sm_(sm)
+{
+}
+
+void HdlcRxModel::shift(bool bit)
+{
+    PioStateMachine& sm = mcu_.pio[pio_].sm[sm_];
+    if(sm.config.in_shift_right){
+        isr_ = (isr_ >> 1) | (bit ? 0x80000000u : 0u);
+    }else{
+        isr_ = (isr_ << 1) | (bit ? 1u : 0u);
+    }
+    if(isrCount_ < 32){
+        ++isrCount_;
+    }
+}
+
+void HdlcRxModel::pushIfFull()
+{
+    PioStateMachine& sm = mcu_.pio[pio_].sm[sm_];
+    uint threshold = sm.config.push_threshold ? sm.config.push_threshold : 32;
+    if(isrCount_ < threshold){
+        return;
+    }
+    // push iffull noblock : data is dropped if the FIFO is full
+    if(!sm.rx.push(isr_)){
+        ++overflows;
+    }
+    isr_ = 0;
+    isrCount_ = 0;
+    mcu_.dmaService();
+}
+
+void HdlcRxModel::restart()
+{
+    isr_ = 0;
+    isrCount_ = 0;
+    x_ = 7;
+}
+
+void HdlcRxModel::clockRising(bool data)
+{
+    if(data){
+        // one_rcv
+        if(x_ == 0){
+            return;
+        }
+        shift(true);
+        --x_;
+        if(x_ == 1){
+            return;     // Sixth one, may be a flag
+        }
+        pushIfFull();
+    }else if(x_ == 2){
+        x_ = 7;         // Inserted zero
+    }else if(x_ == 1){
+        mcu_.raisePioIrq(pio_, pio_relative_irq(RX_DATA_DONE, sm_));
+        restart();
+    }else if(x_ == 0){
+        mcu_.raisePioIrq(pio_, pio_relative_irq(RX_ABORT_INT, sm_));
+        restart();
+    }else{
+        shift(false);
+        x_ = 7;
+        pushIfFull();
+    }
+}
+
+HdlcTxModel::HdlcTxModel(Rp2040& mcu, uint pioIndex, uint sm) :
+    mcu_(mcu), pio_(pioIndex), sm_(sm)
+{
+}
+
+void HdlcTxModel::out(bool bit)
+{
+    PioStateMachine& sm = mcu_.pio[pio_].sm[sm_];
+    mcu_.gpio[sm.config.set_base].out = bit;
+    driven_ = bit;
+}
+
+bool HdlcTxModel::osrEmpty() const
+{
+    const PioStateMachine& sm = mcu_.pio[pio_].sm[sm_];
+    uint threshold = sm.config.pull_threshold ? sm.config.pull_threshold : 32;
+    return osrCount_ >= threshold;
+}
+
+void HdlcTxModel::refill()
+{
+    PioStateMachine& sm = mcu_.pio[pio_].sm[sm_];
+    if(sm.config.autopull && osrEmpty() && !sm.tx.empty()){
+        osr_ = sm.tx.pop();
+        osrCount_ = 0;
+        mcu_.dmaService();
+    }
+}
+
+void HdlcTxModel::clockRising(bool data)
+{
+    if(!readback_){
+        return;
+    }
+    readback_ = false;
+    const PioStateMachine& sm = mcu_.pio[pio_].sm[sm_];
+    if(mcu_.pinLevel(sm.config.jmp_pin) != driven_){
+        // irq wait : the pin keeps the one until the MCU clears the IRQ
+        state_ = Collision;
+        mcu_.raisePioIrq(pio_, pio_relative_irq(COLLISION_IRQ, sm_));
+    }
+}
+
+void HdlcTxModel::clockFalling()
+{
+    readback_ = false;
+    switch(state_){
+    case WaitEnable:
+        // send_flag_first_zero
+        out(false);
+        y_ = 4;
+        flagOnes_ = 6;
+        state_ = FlagOnes;
+        break;
+    case FlagOnes:
+        out(true);
+        if(--flagOnes_ == 0){
+            state_ = FlagLastZero;
+        }
+        break;
+    case FlagLastZero:
+        out(false);
+        refill();
+        state_ = osrEmpty() ? PostFlag : Data;
+        break;
+    case PostFlag:
+        // Pin stays low, MCU is told the flag is out
+        mcu_.raisePioIrq(pio_, pio_relative_irq(FLAG_SENT_IRQ, sm_));
+        state_ = WaitEnable;
+        break;
+    case Data:
+        readback_ = true;
+        if(stuff_){
+            out(false);
+            y_ = 4;
+            stuff_ = false;
+        }else{
+            bool bit = osr_ & 1;
+            osr_ >>= 1;
+            ++osrCount_;
+            if(bit){
+                out(true);
+                if(y_ == 0){
+                    stuff_ = true;
+                }else{
+                    --y_;
+                }
+            }else{
+                out(false);
+                y_ = 4;
+            }
+        }
+        if(!stuff_){
+            refill();
+            if(osrEmpty()){
+                state_ = WaitEnable;
+            }
+        }
+        break;
+    case Collision:
+        if(mcu_.pio[pio_].irqFlags & (1u << pio_relative_irq(COLLISION_IRQ, sm_))){
+            break;
+        }
+        // out null, 32 then the abort : 8 ones by the flag loop and its last zero
+        osr_ = 0;
+        osrCount_ = 32;
+        stuff_ = false;
+        out(true);
+        flagOnes_ = 7;
+        state_ = FlagOnes;
+        break;
+    }
+}
+
+BusIdleModel::BusIdleModel(Rp2040& mcu, uint pioIndex, uint sm) :
+    mcu_(mcu), pio_(pioIndex), sm_(sm)
+{
+}
+
+void BusIdleModel::pinChanged(uint pin, bool level)
+{
+    const PioStateMachine& sm = mcu_.pio[pio_].sm[sm_];
+    if(pin != sm.config.in_base){
+        return;
+    }
+    if(level){
+        if(!active_){
+            active_ = true;
+            notify();
+        }
+        idleAt_ = UINT64_MAX;
+    }else if(active_){
+        // 125 MHz system clock, 8 ns per cycle
+        idleAt_ = Simulator::instance().now() + static_cast<uint64_t>(65 * 8 * sm.config.clkdiv);
+    }
+}
+
+uint64_t BusIdleModel::nextEvent() const
+{
+    return idleAt_;
+}
+
+void BusIdleModel::run(uint64_t now)
+{
+    active_ = false;
+    idleAt_ = UINT64_MAX;
+    notify();
+}
+
+void BusIdleModel::notify()
+{
+    // push noblock : dropped if the FIFO is full
+    mcu_.pio[pio_].sm[sm_].rx.push(0);
+}
+
+uint BusIdleModel::pc() const
+{
+    // Waits on the first instruction while idle, counts in the timeout loop otherwise
+    return active_ ? 3 : 0;
+}
+
+}
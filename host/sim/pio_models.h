@@ -0,0 +1,90 @@
+#ifndef __SIM_PIO_MODELS_H__
+#define __SIM_PIO_MODELS_H__
+#include "rp2040.h"
+
+namespace sim {
+
+/**
+ * Bit level model of hdlc_rx.pio
+ * Mirrors the program flow : zero deletion after 5 ones, flag after 6 ones
+ * (RX_DATA_DONE IRQ) and abort after 7 ones (RX_ABORT_INT IRQ), IRQs are
+ * relative to the state machine
+ **/
+class HdlcRxModel : public PioModel {
+public:
+    HdlcRxModel(Rp2040& mcu, uint pioIndex, uint sm);
+    void clockRising(bool data) override;
+
+    uint64_t overflows = 0;         // Bytes lost because of a full RX FIFO
+
+private:
+    void shift(bool bit);
+    void pushIfFull();
+    void restart();
+
+    Rp2040& mcu_;
+    uint pio_;
+    uint sm_;
+    uint32_t isr_ = 0;
+    uint isrCount_ = 0;
+    int x_ = 7;
+};
+
+/**
+ * Bit level model of hdlc_tx program of hdlc_tx.pio
+ * Called on each falling edge generated by the clock_tx program, data bits
+ * are read back from the jump pin on the rising edge : the other level
+ * raises the collision IRQ, the model then waits for its clear and sends the
+ * abort. The bus model is a wired AND, only ones can be seen changed
+ **/
+class HdlcTxModel : public PioModel {
+public:
+    HdlcTxModel(Rp2040& mcu, uint pioIndex, uint sm);
+    void clockFalling() override;
+    void clockRising(bool data) override;
+
+private:
+    enum State { WaitEnable, FlagOnes, FlagLastZero, PostFlag, Data, Collision };
+    void out(bool bit);
+    void refill();
+    bool osrEmpty() const;
+
+    Rp2040& mcu_;
+    uint pio_;
+    uint sm_;
+    State state_ = WaitEnable;
+    uint32_t osr_ = 0;
+    uint osrCount_ = 32;
+    int y_ = 4;
+    int flagOnes_ = 0;
+    bool stuff_ = false;
+    bool readback_ = false;         // A data bit was driven during this bit
+    bool driven_ = false;           // Its level
+};
+
+/**
+ * Model of bus_idle program of clock_detect.pio
+ * Pushes a word on a clock high level while idle, and another one once the
+ * clock stayed low during the timeout (65 cycles of the state machine)
+ **/
+class BusIdleModel : public PioModel {
+public:
+    BusIdleModel(Rp2040& mcu, uint pioIndex, uint sm);
+    void pinChanged(uint pin, bool level) override;
+    uint64_t nextEvent() const override;
+    void run(uint64_t now) override;
+    uint pc() const override;
+
+private:
+    void notify();
+
+    Rp2040& mcu_;
+    uint pio_;
+    uint sm_;
+    bool active_ = false;
+    uint64_t idleAt_ = UINT64_MAX;      // End of the timeout while the clock is low
+};
+
+}
+
+#endif
@@ -0,0 +1,499 @@
+#include "rp2040.h"
+#include "pio_models.h"
+#include "hardware/structs/systick.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+pio_hw_t sim_pio_hw[NUM_PIOS];
+dma_hw_t sim_dma_hw;
+systick_hw_t sim_systick_hw;
+
+namespace sim {
+
+bool Fifo::push(uint32_t v)
+{
+    if(full()){
+        return false;
+    }
+    data_[(head_ + count_) % capacity_] = v;
+    ++count_;
+    return true;
+}
+
+uint32_t Fifo::pop()
+{
+    if(empty()){
+        return 0;
+    }
+    uint32_t v = data_[head_];
+    head_ = (head_ + 1) % capacity_;
+    --count_;
+    return v;
+}
+
+static uint32_t reverse32(uint32_t v)
+{
+    uint32_t r = 0;
+    for(int i = 0; i < 32; ++i){
+        r = (r << 1) | (v & 1);
+        v >>= 1;
+    }
+    return r;
+}
+
+static uint8_t reverse8(uint8_t v)
+{
+    uint8_t r = 0;
+    for(int i = 0; i < 8; ++i){
+        r = (r << 1) | (v & 1);
+        v >>= 1;
+    }
+    return r;
+}
+
+SniffDataReg::operator uint32_t() const
+{
+    uint32_t v = acc;
+    if(sim_dma_hw.sniff_ctrl & DMA_SNIFF_CTRL_OUT_REV_BITS){
+        v = reverse32(v);
+    }
+    if(sim_dma_hw.sniff_ctrl & DMA_SNIFF_CTRL_OUT_INV_BITS){
+        v = ~v;
+    }
+    return v;
+}
+
+SniffDataReg& SniffDataReg::operator=(uint32_t value)
+{
+    acc = value;
+    return *this;
+}
+
+SysTickValueReg::operator uint32_t() const
+{
+    if(!(sim_systick_hw.csr & SIM_SYSTICK_ENABLE_BITS)){
+        return 0;
+    }
+    //Wraps to the reload value once zero is reached
+    uint64_t ticks = (Simulator::hostNs() - origin) * SIM_SYSTICK_HZ / 1000000000ull;
+    uint64_t period = static_cast<uint64_t>(sim_systick_hw.rvr) + 1;
+    return ticks == 0 ? 0 : sim_systick_hw.rvr - (ticks - 1) % period;
+}
+
+SysTickValueReg& SysTickValueReg::operator=(uint32_t value)
+{
+    origin = Simulator::hostNs();
+    return *this;
+}
+
+Rp2040::Rp2040()
+{
+    for(uint i = 0; i < NUM_PIOS; ++i){
+        pio[i].hw = &sim_pio_hw[i];
+        pio[i].index = i;
+    }
+}
+
+uint64_t Rp2040::nextEvent() const
+{
+    uint64_t next = UINT64_MAX;
+    for(const PioBlock& p : pio){
+        for(const PioStateMachine& sm : p.sm){
+            if(sm.enabled && sm.model && sm.model->nextEvent() < next){
+                next = sm.model->nextEvent();
+            }
+        }
+    }
+    for(const TimerAlarm& a : alarm){
+        if(a.armed && a.targetNs < next){
+            next = a.targetNs;
+        }
+    }
+    return next;
+}
+
+void Rp2040::run(uint64_t now)
+{
+    for(PioBlock& p : pio){
+        for(PioStateMachine& sm : p.sm){
+            if(sm.enabled && sm.model && sm.model->nextEvent() <= now){
+                sm.model->run(now);
+            }
+        }
+    }
+    for(TimerAlarm& a : alarm){
+        if(a.armed && a.targetNs <= now){
+            a.armed = false;
+            a.fired = true;
+        }
+    }
+}
+
+bool Rp2040::pinLevel(uint pin) const
+{
+    const Gpio& g = gpio[pin];
+    if(g.dirOut){
+        return g.out;
+    }
+    return g.in;
+}
+
+void Rp2040::setInput(uint pin, bool level)
+{
+    if(gpio[pin].in == level){
+        return;
+    }
+    gpio[pin].in = level;
+    for(PioBlock& p : pio){
+        for(PioStateMachine& sm : p.sm){
+            if(sm.enabled && sm.model){
+                sm.model->pinChanged(pin, level);
+            }
+        }
+    }
+}
+
+void Rp2040::raisePioIrq(uint pioIndex, uint num)
+{
+    pio[pioIndex].irqFlags |= (1u << num);
+    pio[pioIndex].hw->irq = pio[pioIndex].irqFlags;
+}
+
+void Rp2040::createModel(uint pioIndex, uint smIndex)
+{
+    PioStateMachine& sm = pio[pioIndex].sm[smIndex];
+    switch(sm.program){
+    case PioProgram::HdlcRx:
+        sm.model.reset(new HdlcRxModel(*this, pioIndex, smIndex));
+        break;
+    case PioProgram::HdlcTx:
+        sm.model.reset(new HdlcTxModel(*this, pioIndex, smIndex));
+        break;
+    case PioProgram::BusIdle:
+        sm.model.reset(new BusIdleModel(*this, pioIndex, smIndex));
+        break;
+    default:
+        sm.model.reset(new PioModel());
+        break;
+    }
+}
+
+bool Rp2040::dreqReady(uint dreq) const
+{
+    if(dreq < 2 * 2 * NUM_PIO_STATE_MACHINES){
+        const PioBlock& p = pio[dreq / (2 * NUM_PIO_STATE_MACHINES)];
+        uint idx = dreq % (2 * NUM_PIO_STATE_MACHINES);
+        if(idx < NUM_PIO_STATE_MACHINES){
+            return !p.sm[idx].tx.full();
+        }
+        return !p.sm[idx - NUM_PIO_STATE_MACHINES].rx.empty();
+    }
+    return true;
+}
+
+/**
+ * Finds if an address is a PIO FIFO register
+ * @return Pointer to the FIFO, nullptr if not a FIFO address
+ **/
+static Fifo* fifoAt(Rp2040& mcu, uintptr_t addr, bool tx)
+{
+    for(uint i = 0; i < NUM_PIOS; ++i){
+        pio_hw_t* hw = mcu.pio[i].hw;
+        uintptr_t base = reinterpret_cast<uintptr_t>(tx ? &hw->txf[0] : &hw->rxf[0]);
+        if(addr >= base && addr < base + 4 * NUM_PIO_STATE_MACHINES){
+            uint sm = (addr - base) / 4;
+            return tx ? &mcu.pio[i].sm[sm].tx : &mcu.pio[i].sm[sm].rx;
+        }
+    }
+    return nullptr;
+}
+
+uint32_t Rp2040::dmaRead(uintptr_t addr, dma_channel_transfer_size size, bool& ok)
+{
+    ok = true;
+    Fifo* fifo = fifoAt(*this, addr, false);
+    if(fifo != nullptr){
+        if(fifo->empty()){
+            ok = false;
+            return 0;
+        }
+        uint32_t word = fifo->pop();
+        uint lane = addr & 3;
+        switch(size){
+        case DMA_SIZE_8:
+            return (word >> (8 * lane)) & 0xFF;
+        case DMA_SIZE_16:
+            return (word >> (8 * (lane & 2))) & 0xFFFF;
+        default:
+            return word;
+        }
+    }
+    switch(size){
+    case DMA_SIZE_8:
+        return *reinterpret_cast<const volatile uint8_t*>(addr);
+    case DMA_SIZE_16:
+        return *reinterpret_cast<const volatile uint16_t*>(addr);
+    default:
+        return *reinterpret_cast<const volatile uint32_t*>(addr);
+    }
+}
+
+bool Rp2040::dmaWrite(uintptr_t addr, uint32_t value, dma_channel_transfer_size size)
+{
+    Fifo* fifo = fifoAt(*this, addr, true);
+    if(fifo != nullptr){
+        // Narrow writes are replicated on the 32 bits bus
+        if(size == DMA_SIZE_8){
+            value = (value & 0xFF) * 0x01010101u;
+        }else if(size == DMA_SIZE_16){
+            value = (value & 0xFFFF) * 0x00010001u;
+        }
+        return fifo->push(value);
+    }
+    switch(size){
+    case DMA_SIZE_8:
+        *reinterpret_cast<volatile uint8_t*>(addr) = value;
+        break;
+    case DMA_SIZE_16:
+        *reinterpret_cast<volatile uint16_t*>(addr) = value;
+        break;
+    default:
+        *reinterpret_cast<volatile uint32_t*>(addr) = value;
+        break;
+    }
+    return true;
+}
+
+void Rp2040::sniff(uint channel, uint32_t data, dma_channel_transfer_size size)
+{
+    uint32_t ctrl = sim_dma_hw.sniff_ctrl;
+    if(!(ctrl & DMA_SNIFF_CTRL_EN_BITS) ||
+        (((ctrl & DMA_SNIFF_CTRL_DMACH_BITS) >> DMA_SNIFF_CTRL_DMACH_LSB) != channel) ||
+        !dma[channel].config.sniff_enable){
+        return;
+    }
+    uint calc = (ctrl & DMA_SNIFF_CTRL_CALC_BITS) >> DMA_SNIFF_CTRL_CALC_LSB;
+    uint nbBytes = 1u << size;
+    uint32_t& acc = sim_dma_hw.sniff_data.acc;
+    for(uint i = 0; i < nbBytes; ++i){
+        uint8_t b = (data >> (8 * i)) & 0xFF;
+        switch(calc){
+        case 0x0:
+        case 0x1:
+            // CRC-32 (IEEE802.3), 0x1 with bit reversed data
+            if(calc == 0x1){
+                b = reverse8(b);
+            }
+            acc ^= static_cast<uint32_t>(b) << 24;
+            for(int j = 0; j < 8; ++j){
+                acc = (acc & 0x80000000u) ? ((acc << 1) ^ 0x04C11DB7u) : (acc << 1);
+            }
+            break;
+        case 0x2:
+        case 0x3:
+            // CRC-16-CCITT, 0x3 with bit reversed data
+            if(calc == 0x3){
+                b = reverse8(b);
+            }
+            acc ^= static_cast<uint32_t>(b) << 8;
+            for(int j = 0; j < 8; ++j){
+                acc = (acc & 0x8000u) ? ((acc << 1) ^ 0x1021u) : (acc << 1);
+            }
+            acc &= 0xFFFF;
+            break;
+        case 0xe:
+            acc ^= b;
+            break;
+        case 0xf:
+            acc += b;
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+void Rp2040::dmaTrigger(uint channel)
+{
+    DmaChannel& ch = dma[channel];
+    if(!ch.config.enable){
+        return;
+    }
+    sim_dma_hw.ch[channel].transfer_count = ch.reload;
+    ch.busy = true;
+    if(ch.reload == 0){
+        dmaComplete(channel);
+        return;
+    }
+    dmaService();
+}
+
+void Rp2040::dmaComplete(uint channel)
+{
+    DmaChannel& ch = dma[channel];
+    ch.busy = false;
+    if(!ch.config.irq_quiet){
+        sim_dma_hw.intr |= (1u << channel);
+    }
+    if(ch.config.chain_to != channel){
+        dmaTrigger(ch.config.chain_to);
+    }
+}
+
+void Rp2040::dmaService()
+{
+    static bool inService = false;
+    if(inService){
+        return;
+    }
+    inService = true;
+    bool progress = true;
+    while(progress){
+        progress = false;
+        for(uint c = 0; c < NUM_DMA_CHANNELS; ++c){
+            DmaChannel& ch = dma[c];
+            dma_channel_hw_t& hw = sim_dma_hw.ch[c];
+            while(ch.busy && dreqReady(ch.config.dreq)){
+                bool ok = false;
+                uint32_t v = dmaRead(hw.read_addr, ch.config.size, ok);
+                if(!ok){
+                    break;
+                }
+                if(ch.config.bswap && ch.config.size == DMA_SIZE_32){
+                    v = __builtin_bswap32(v);
+                }else if(ch.config.bswap && ch.config.size == DMA_SIZE_16){
+                    v = __builtin_bswap16(v);
+                }
+                sniff(c, v, ch.config.size);
+                if(!dmaWrite(hw.write_addr, v, ch.config.size)){
+                    break;
+                }
+                ++ch.transfers;
+                uintptr_t inc = 1u << ch.config.size;
+                uintptr_t mask = ch.config.ring_size_bits ? ((uintptr_t(1) << ch.config.ring_size_bits) - 1) : ~uintptr_t(0);
+                if(ch.config.read_increment){
+                    uintptr_t a = hw.read_addr;
+                    hw.read_addr = (ch.config.ring_size_bits && !ch.config.ring_write) ?
+                        ((a & ~mask) | ((a + inc) & mask)) : (a + inc);
+                }
+                if(ch.config.write_increment){
+                    uintptr_t a = hw.write_addr;
+                    hw.write_addr = (ch.config.ring_size_bits && ch.config.ring_write) ?
+                        ((a & ~mask) | ((a + inc) & mask)) : (a + inc);
+                }
+                progress = true;
+                if(--hw.transfer_count == 0){
+                    dmaComplete(c);
+                }
+            }
+        }
+    }
+    inService = false;
+}
+
+void Rp2040::risingEdge(uint pin)
+{
+    if(!(pin & 1)){
+        return;
+    }
+    PwmSlice& s = pwm[(pin >> 1) & 7];
+    if(!s.enabled || s.config.mode != PWM_DIV_B_RISING || gpio[pin].function != GPIO_FUNC_PWM){
+        return;
+    }
+    s.fraction += 1.0f;
+    float div = s.config.div > 0.0f ? s.config.div : 1.0f;
+    while(s.fraction >= div){
+        s.fraction -= div;
+        s.counter = (s.counter >= s.config.top) ? 0 : s.counter + 1;
+    }
+}
+
+uint16_t Rp2040::pwmCounter(uint slice) const
+{
+    const PwmSlice& s = pwm[slice];
+    if(s.enabled && s.config.mode == PWM_DIV_FREE_RUNNING){
+        // 125 MHz system clock
+        uint64_t ticks = static_cast<uint64_t>((Simulator::instance().now() - s.startNs) * 0.125 / s.config.div);
+        return static_cast<uint16_t>((s.counter + ticks) % (static_cast<uint64_t>(s.config.top) + 1));
+    }
+    return s.counter;
+}
+
+bool Rp2040::irqPending(uint num, uint core) const
+{
+    if(irq[num].softPending[core]){
+        return true;
+    }
+    switch(num){
+    case TIMER_IRQ_0:
+    case TIMER_IRQ_1:
+    case TIMER_IRQ_2:
+    case TIMER_IRQ_3:
+        return alarm[num - TIMER_IRQ_0].fired;
+    case PIO0_IRQ_0:
+    case PIO0_IRQ_1:
+    case PIO1_IRQ_0:
+    case PIO1_IRQ_1: {
+        const PioBlock& p = pio[(num - PIO0_IRQ_0) / 2];
+        uint32_t intr = static_cast<uint32_t>(p.irqFlags & 0xF) << 8;
+        for(uint i = 0; i < NUM_PIO_STATE_MACHINES; ++i){
+            if(!p.sm[i].rx.empty()){
+                intr |= 1u << i;
+            }
+            if(!p.sm[i].tx.full()){
+                intr |= 1u << (i + 4);
+            }
+        }
+        return (intr & p.inte[(num - PIO0_IRQ_0) % 2]) != 0;
+    }
+    case DMA_IRQ_0:
+        return (sim_dma_hw.intr & sim_dma_hw.inte0) != 0;
+    case DMA_IRQ_1:
+        return (sim_dma_hw.intr & sim_dma_hw.inte1) != 0;
+    default:
+        return false;
+    }
+}
+
+void Rp2040::serviceInterrupts()
+{
+    Simulator& s = Simulator::instance();
+    int guard = 0;
+    while(true){
+        int best = -1;
+        uint bestCore = 0;
+        for(uint c = 0; c < NUM_CORES; ++c){
+            if(interruptsMasked[c]){
+                continue;
+            }
+            for(uint n = 0; n < NUM_IRQS; ++n){
+                if(irq[n].enabled[c] && !irq[n].handlers.empty() && irqPending(n, c)){
+                    if(best < 0 || irq[n].priority < irq[best].priority){
+                        best = n;
+                        bestCore = c;
+                    }
+                }
+            }
+        }
+        if(best < 0){
+            return;
+        }
+        if(++guard > 10000){
+            fprintf(stderr, "IRQ %d is stuck pending on core %u\n", best, bestCore);
+            abort();
+        }
+        irq[best].softPending[bestCore] = false;
+        // Copy as handlers may change the handler list
+        auto handlers = irq[best].handlers;
+        uint core = s.core();
+        s.setCore(bestCore);
+        for(auto& h : handlers){
+            s.callHandler(h.second);
+        }
+        s.setCore(core);
+    }
+}
+
+}
@@ -0,0 +1,251 @@
+#ifndef __SIM_RP2040_H__
+#define __SIM_RP2040_H__
+#include "simulator.h"
+#include "usb_device.h"
+
+#include "hardware/dma.h"
+#include "hardware/gpio.h"
+#include "hardware/irq.h"
+#include "hardware/pio.h"
+#include "hardware/pwm.h"
+#include "hardware/timer.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace sim {
+
+/**
+ * PIO FIFO (4 entries, 8 when joined)
+ **/
+class Fifo {
+public:
+    void setCapacity(uint capacity) { capacity_ = capacity; clear(); }
+    uint capacity() const { return capacity_; }
+    uint level() const { return count_; }
+    bool empty() const { return count_ == 0; }
+    bool full() const { return count_ >= capacity_; }
+    void clear() { count_ = 0; head_ = 0; }
+    bool push(uint32_t v);
+    uint32_t pop();
+
+private:
+    uint32_t data_[8] = {};
+    uint capacity_ = 4;
+    uint count_ = 0;
+    uint head_ = 0;
+};
+
+/**
+ * Known PIO programs, modelled at bit level by the simulator
+ **/
+enum class PioProgram {
+    Unknown,
+    HdlcRx,
+    ClockTx,
+    HdlcTx,
+    BusIdle,
+};
+
+class Rp2040;
+
+/**
+ * Behaviour model of a state machine program
+ **/
+class PioModel {
+public:
+    virtual ~PioModel() = default;
+
+    /**
+     * Rising edge of the bus clock seen on the input pins
+     * @param data Data line level
+     **/
+    virtual void clockRising(bool data) {}
+
+    /**
+     * Falling edge of the clock generated by the clock program
+     **/
+    virtual void clockFalling() {}
+
+    /**
+     * Level of an input pin changed
+     **/
+    virtual void pinChanged(uint pin, bool level) {}
+
+    /**
+     * Time of the next timed event of the program (ns)
+     **/
+    virtual uint64_t nextEvent() const { return UINT64_MAX; }
+
+    /**
+     * Runs the timed event due at now
+     **/
+    virtual void run(uint64_t now) {}
+
+    /**
+     * Program counter, relative to the program offset
+     **/
+    virtual uint pc() const { return 0; }
+};
+
+struct PioStateMachine {
+    bool claimed = false;
+    bool enabled = false;
+    uint offset = 0;                    // Offset of the program the SM runs
+    PioProgram program = PioProgram::Unknown;
+    pio_sm_config config = {};
+    Fifo rx;
+    Fifo tx;
+    std::unique_ptr<PioModel> model;
+};
+
+struct PioBlock {
+    pio_hw_t* hw = nullptr;
+    uint index = 0;
+    uint32_t usedInstructions = 0;      // Used instruction memory slots
+    struct Loaded {
+        const pio_program_t* program;
+        uint offset;
+    };
+    std::vector<Loaded> programs;       // Programs loaded in instruction memory
+    PioStateMachine sm[NUM_PIO_STATE_MACHINES];
+    uint8_t irqFlags = 0;               // IRQ flags 0 to 7
+    uint32_t inte[2] = {0, 0};          // Interrupt enables for both system IRQs
+};
+
+struct DmaChannel {
+    bool claimed = false;
+    bool busy = false;
+    dma_channel_config config = {};
+    uint32_t reload = 0;                // Transfer count reloaded on trigger
+    uint64_t transfers = 0;             // Number of transfers done
+};
+
+struct PwmSlice {
+    pwm_config config = {};
+    bool enabled = false;
+    uint16_t counter = 0;
+    float fraction = 0.0f;              // Edges accumulated by the divider
+    uint64_t startNs = 0;               // Free running start time
+};
+
+struct TimerAlarm {
+    bool claimed = false;
+    bool armed = false;
+    bool fired = false;                 // Interrupt raised, cleared by the handler
+    uint64_t targetNs = 0;
+    hardware_alarm_callback_t callback = nullptr;
+};
+
+/**
+ * RP2040 peripherals used by the firmware
+ **/
+class Rp2040 : public Component {
+public:
+    Rp2040();
+
+    uint64_t nextEvent() const override;
+    void run(uint64_t now) override;
+
+    // GPIO
+    struct Gpio {
+        bool out = false;               // Output value
+        bool dirOut = false;            // Direction
+        bool in = true;                 // Level driven by the outside
+        gpio_function function = GPIO_FUNC_NULL;
+    };
+    Gpio gpio[NUM_BANK0_GPIOS];
+
+    /**
+     * Gets the level of a pin (output value if it is an output)
+     **/
+    bool pinLevel(uint pin) const;
+
+    /**
+     * Sets the level driven from outside on a pin
+     **/
+    void setInput(uint pin, bool level);
+
+    // PIO
+    PioBlock pio[NUM_PIOS];
+    PioBlock& block(PIO p) { return pio[pio_get_index(p)]; }
+
+    /**
+     * Sets a PIO IRQ flag (raised by a state machine)
+     **/
+    void raisePioIrq(uint pioIndex, uint irq);
+
+    /**
+     * Creates the behaviour model of a state machine
+     **/
+    void createModel(uint pioIndex, uint sm);
+
+    // DMA
+    DmaChannel dma[NUM_DMA_CHANNELS];
+
+    /**
+     * Triggers a DMA channel
+     **/
+    void dmaTrigger(uint channel);
+
+    /**
+     * Runs all DMA transfers whose DREQ is asserted
+     **/
+    void dmaService();
+
+    /**
+     * Updates sniffer with transferred data
+     **/
+    void sniff(uint channel, uint32_t data, dma_channel_transfer_size size);
+
+    // PWM
+    PwmSlice pwm[NUM_PWM_SLICES];
+
+    /**
+     * A rising edge is seen on a GPIO (counts PWM B inputs)
+     **/
+    void risingEdge(uint pin);
+
+    /**
+     * Gets the counter of a free running PWM slice
+     **/
+    uint16_t pwmCounter(uint slice) const;
+
+    // Timer
+    TimerAlarm alarm[NUM_TIMERS];
+
+    // USB vendor interface, scheduled once connected (added as a component)
+    UsbDevice usb;
+
+    // NVIC
+    // The vector table is shared, each core has its own NVIC enables and mask
+    struct IrqLine {
+        std::vector<std::pair<uint8_t, irq_handler_t>> handlers;
+        bool enabled[NUM_CORES] = {false, false};
+        bool softPending[NUM_CORES] = {false, false};
+        uint8_t priority = PICO_DEFAULT_IRQ_PRIORITY;
+    };
+    IrqLine irq[NUM_IRQS];
+    bool interruptsMasked[NUM_CORES] = {false, false};
+
+    /**
+     * Gets if an interrupt is pending for a core
+     **/
+    bool irqPending(uint num, uint core) const;
+
+    /**
+     * Calls handlers of pending and enabled interrupts, on both cores
+     **/
+    void serviceInterrupts();
+
+private:
+    uint32_t dmaRead(uintptr_t addr, dma_channel_transfer_size size, bool& ok);
+    bool dmaWrite(uintptr_t addr, uint32_t value, dma_channel_transfer_size size);
+    bool dreqReady(uint dreq) const;
+    void dmaComplete(uint channel);
+};
+
+}
+
+#endif
@@ -0,0 +1,937 @@
+/**
+ * Pico SDK API implemented on top of the simulated RP2040
+ **/
+#include "rp2040.h"
+
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "pico/sync.h"
+#include "pico/stdio_usb.h"
+#include "tusb.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/pio.h"
+#include "hardware/pwm.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using sim::Simulator;
+
+static sim::Rp2040& mcu()
+{
+    return Simulator::instance().mcu();
+}
+
+// ---------------------------------------------------------------- pico
+
+extern "C" void tight_loop_contents(void)
+{
+    Simulator::instance().poll();
+}
+
+extern "C" void __wfe(void)
+{
+    Simulator::instance().waitForEvent(UINT64_MAX);
+}
+
+extern "C" void __wfi(void)
+{
+    Simulator::instance().waitForEvent(UINT64_MAX);
+}
+
+extern "C" void __sev(void)
+{
+    Simulator::instance().sendEvent();
+}
+
+extern "C" void panic(const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "*** PANIC ***\n");
+    vfprintf(stderr, fmt, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    abort();
+}
+
+extern "C" uint get_core_num(void)
+{
+    return Simulator::instance().core();
+}
+
+struct stdio_driver {};
+stdio_driver_t stdio_usb;
+
+extern "C" bool stdio_init_all(void)
+{
+    return true;
+}
+
+extern "C" void stdio_set_translate_crlf(stdio_driver_t* driver, bool translate)
+{
+}
+
+extern "C" int getchar_timeout_us(uint32_t timeout_us)
+{
+    Simulator& s = Simulator::instance();
+    int c = s.consoleRead();
+    if(c < 0){
+        //A poll still runs the USB stack for a few microseconds
+        s.advance(timeout_us ? timeout_us * 1000ull : 5000);
+        c = s.consoleRead();
+    }
+    return c < 0 ? PICO_ERROR_TIMEOUT : c;
+}
+
+// ---------------------------------------------------------------- tinyusb
+
+extern "C" bool tusb_init(void)
+{
+    return true;
+}
+
+extern "C" void tud_task(void)
+{
+}
+
+extern "C" bool tud_vendor_mounted(void)
+{
+    return mcu().usb.mounted();
+}
+
+extern "C" uint32_t tud_vendor_available(void)
+{
+    return mcu().usb.available();
+}
+
+extern "C" uint32_t tud_vendor_read(void* buffer, uint32_t bufsize)
+{
+    return mcu().usb.read(buffer, bufsize);
+}
+
+extern "C" uint32_t tud_vendor_write_available(void)
+{
+    return mcu().usb.writeAvailable();
+}
+
+extern "C" uint32_t tud_vendor_write(const void* buffer, uint32_t bufsize)
+{
+    return mcu().usb.write(buffer, bufsize);
+}
+
+extern "C" uint32_t tud_vendor_write_flush(void)
+{
+    mcu().usb.flush();
+    return 0;
+}
+
+// ---------------------------------------------------------------- multicore
+
+extern "C" void multicore_reset_core1(void)
+{
+    Simulator::instance().resetCore1();
+}
+
+extern "C" void multicore_launch_core1(void (*entry)(void))
+{
+    Simulator::instance().launchCore1(entry);
+}
+
+// ---------------------------------------------------------------- time
+
+extern "C" uint64_t time_us_64(void)
+{
+    Simulator& s = Simulator::instance();
+    if(!s.inIsr()){
+        s.poll();
+    }
+    return s.now() / 1000;
+}
+
+extern "C" absolute_time_t get_absolute_time(void)
+{
+    return time_us_64();
+}
+
+extern "C" void busy_wait_us(uint64_t delay_us)
+{
+    Simulator& s = Simulator::instance();
+    s.advance(delay_us * 1000);
+}
+
+extern "C" void sleep_until(absolute_time_t target)
+{
+    Simulator& s = Simulator::instance();
+    s.advanceTo(target * 1000);
+}
+
+extern "C" bool best_effort_wfe_or_timeout(absolute_time_t timeout_timestamp)
+{
+    if(time_reached(timeout_timestamp)){
+        return true;
+    }
+    //The SDK wakes the core with an alarm at the timeout
+    Simulator::instance().waitForEvent(timeout_timestamp * 1000);
+    return time_reached(timeout_timestamp);
+}
+
+extern "C" void sleep_us(uint64_t us)
+{
+    Simulator::instance().advance(us * 1000);
+}
+
+extern "C" void sleep_ms(uint32_t ms)
+{
+    Simulator::instance().advance(ms * 1000000ull);
+}
+
+// ---------------------------------------------------------------- sync
+
+/**
+ * Handler of the timer interrupts, calls the callback of the alarm
+ **/
+static void alarmIrqHandler()
+{
+    for(uint n = 0; n < NUM_TIMERS; ++n){
+        sim::TimerAlarm& a = mcu().alarm[n];
+        if(a.fired && mcu().irq[TIMER_IRQ_0 + n].enabled[get_core_num()]){
+            a.fired = false;
+            if(a.callback != nullptr){
+                a.callback(n);
+            }
+        }
+    }
+}
+
+extern "C" void hardware_alarm_claim(uint alarm_num)
+{
+    if(mcu().alarm[alarm_num].claimed){
+        panic("Hardware alarm %u already claimed", alarm_num);
+    }
+    mcu().alarm[alarm_num].claimed = true;
+}
+
+extern "C" int hardware_alarm_claim_unused(bool required)
+{
+    for(uint n = 0; n < NUM_TIMERS; ++n){
+        if(!mcu().alarm[n].claimed){
+            mcu().alarm[n].claimed = true;
+            return n;
+        }
+    }
+    if(required){
+        panic("No hardware alarms available");
+    }
+    return -1;
+}
+
+extern "C" void hardware_alarm_unclaim(uint alarm_num)
+{
+    mcu().alarm[alarm_num] = sim::TimerAlarm();
+}
+
+extern "C" bool hardware_alarm_is_claimed(uint alarm_num)
+{
+    return mcu().alarm[alarm_num].claimed;
+}
+
+extern "C" void hardware_alarm_set_callback(uint alarm_num, hardware_alarm_callback_t callback)
+{
+    sim::TimerAlarm& a = mcu().alarm[alarm_num];
+    uint num = TIMER_IRQ_0 + alarm_num;
+    if(callback != nullptr){
+        a.callback = callback;
+        if(mcu().irq[num].handlers.empty()){
+            irq_set_exclusive_handler(num, alarmIrqHandler);
+        }
+        irq_set_enabled(num, true);
+    }else{
+        irq_set_enabled(num, false);
+        irq_remove_handler(num, alarmIrqHandler);
+        a = sim::TimerAlarm();
+        a.claimed = true;
+    }
+}
+
+extern "C" bool hardware_alarm_set_target(uint alarm_num, absolute_time_t t)
+{
+    sim::TimerAlarm& a = mcu().alarm[alarm_num];
+    uint64_t targetNs = t * 1000;
+    if(targetNs <= Simulator::instance().now()){
+        //Missed, like the SDK the callback is not called
+        a.armed = false;
+        return true;
+    }
+    a.targetNs = targetNs;
+    a.armed = true;
+    return false;
+}
+
+extern "C" void hardware_alarm_cancel(uint alarm_num)
+{
+    mcu().alarm[alarm_num].armed = false;
+    mcu().alarm[alarm_num].fired = false;
+}
+
+extern "C" void hardware_alarm_force_irq(uint alarm_num)
+{
+    mcu().alarm[alarm_num].armed = false;
+    mcu().alarm[alarm_num].fired = true;
+}
+
+extern "C" uint32_t save_and_disable_interrupts(void)
+{
+    bool& masked = mcu().interruptsMasked[get_core_num()];
+    uint32_t status = masked ? 1 : 0;
+    masked = true;
+    return status;
+}
+
+extern "C" void restore_interrupts(uint32_t status)
+{
+    mcu().interruptsMasked[get_core_num()] = status != 0;
+    if(!status){
+        Simulator::instance().serviceInterrupts();
+    }
+}
+
+// ---------------------------------------------------------------- gpio
+
+extern "C" void gpio_init(uint gpio)
+{
+    sim::Rp2040::Gpio& g = mcu().gpio[gpio];
+    g.dirOut = false;
+    g.out = false;
+    g.function = GPIO_FUNC_SIO;
+}
+
+extern "C" void gpio_set_function(uint gpio, enum gpio_function fn)
+{
+    mcu().gpio[gpio].function = fn;
+}
+
+extern "C" enum gpio_function gpio_get_function(uint gpio)
+{
+    return mcu().gpio[gpio].function;
+}
+
+extern "C" void gpio_set_dir(uint gpio, bool out)
+{
+    mcu().gpio[gpio].dirOut = out;
+}
+
+extern "C" bool gpio_is_dir_out(uint gpio)
+{
+    return mcu().gpio[gpio].dirOut;
+}
+
+extern "C" void gpio_put(uint gpio, bool value)
+{
+    mcu().gpio[gpio].out = value;
+}
+
+extern "C" bool gpio_get(uint gpio)
+{
+    return mcu().pinLevel(gpio);
+}
+
+extern "C" void gpio_set_pulls(uint gpio, bool up, bool down)
+{
+}
+
+// ---------------------------------------------------------------- irq
+
+extern "C" void irq_set_exclusive_handler(uint num, irq_handler_t handler)
+{
+    auto& line = mcu().irq[num];
+    if(!line.handlers.empty()){
+        panic("Exclusive handler on IRQ %u already set", num);
+    }
+    line.handlers.push_back({PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY, handler});
+}
+
+extern "C" void irq_add_shared_handler(uint num, irq_handler_t handler, uint8_t order_priority)
+{
+    auto& handlers = mcu().irq[num].handlers;
+    auto it = handlers.begin();
+    while(it != handlers.end() && it->first >= order_priority){
+        ++it;
+    }
+    handlers.insert(it, {order_priority, handler});
+}
+
+extern "C" void irq_remove_handler(uint num, irq_handler_t handler)
+{
+    auto& handlers = mcu().irq[num].handlers;
+    for(auto it = handlers.begin(); it != handlers.end(); ++it){
+        if(it->second == handler){
+            handlers.erase(it);
+            return;
+        }
+    }
+}
+
+extern "C" void irq_set_enabled(uint num, bool enabled)
+{
+    mcu().irq[num].enabled[get_core_num()] = enabled;
+}
+
+extern "C" bool irq_is_enabled(uint num)
+{
+    return mcu().irq[num].enabled[get_core_num()];
+}
+
+extern "C" void irq_set_priority(uint num, uint8_t hardware_priority)
+{
+    mcu().irq[num].priority = hardware_priority;
+}
+
+extern "C" void irq_set_pending(uint num)
+{
+    mcu().irq[num].softPending[get_core_num()] = true;
+}
+
+// ---------------------------------------------------------------- pio
+
+extern "C" pio_sm_config pio_get_default_sm_config(void)
+{
+    pio_sm_config c;
+    memset(&c, 0, sizeof(c));
+    c.clkdiv = 1.0f;
+    c.wrap = 31;
+    c.in_shift_right = true;
+    c.out_shift_right = true;
+    c.push_threshold = 32;
+    c.pull_threshold = 32;
+    return c;
+}
+
+/**
+ * Finds a free location for a program
+ * @return offset, -1 if it doesn't fit
+ **/
+static int findOffset(const sim::PioBlock& p, const pio_program_t* program)
+{
+    uint32_t mask = (program->length >= 32) ? 0xFFFFFFFFu : ((1u << program->length) - 1);
+    if(program->origin >= 0){
+        return ((p.usedInstructions & (mask << program->origin)) == 0) ? program->origin : -1;
+    }
+    for(int offset = 32 - program->length; offset >= 0; --offset){
+        if((p.usedInstructions & (mask << offset)) == 0){
+            return offset;
+        }
+    }
+    return -1;
+}
+
+extern "C" bool pio_can_add_program(PIO pio, const pio_program_t* program)
+{
+    return findOffset(mcu().block(pio), program) >= 0;
+}
+
+extern "C" uint pio_add_program(PIO pio, const pio_program_t* program)
+{
+    sim::PioBlock& p = mcu().block(pio);
+    int offset = findOffset(p, program);
+    if(offset < 0){
+        panic("No program space");
+    }
+    uint32_t mask = (program->length >= 32) ? 0xFFFFFFFFu : ((1u << program->length) - 1);
+    p.usedInstructions |= mask << offset;
+    for(uint i = 0; i < program->length; ++i){
+        p.hw->instr_mem[offset + i] = program->instructions[i];
+    }
+    p.programs.push_back({program, static_cast<uint>(offset)});
+    return offset;
+}
+
+extern "C" void pio_remove_program(PIO pio, const pio_program_t* program, uint loaded_offset)
+{
+    sim::PioBlock& p = mcu().block(pio);
+    uint32_t mask = (program->length >= 32) ? 0xFFFFFFFFu : ((1u << program->length) - 1);
+    p.usedInstructions &= ~(mask << loaded_offset);
+    for(auto it = p.programs.begin(); it != p.programs.end(); ++it){
+        if(it->program == program && it->offset == loaded_offset){
+            p.programs.erase(it);
+            break;
+        }
+    }
+}
+
+extern "C" void pio_clear_instruction_memory(PIO pio)
+{
+    sim::PioBlock& p = mcu().block(pio);
+    p.usedInstructions = 0;
+    p.programs.clear();
+}
+
+/**
+ * Finds the program running from a given PC
+ **/
+static sim::PioProgram programAt(const sim::PioBlock& p, uint pc, uint& offset)
+{
+    for(const auto& l : p.programs){
+        if(pc >= l.offset && pc < l.offset + l.program->length){
+            offset = l.offset;
+            const char* name = l.program->name ? l.program->name : "";
+            if(strcmp(name, "hdlc_rx") == 0){
+                return sim::PioProgram::HdlcRx;
+            }
+            if(strcmp(name, "hdlc_tx") == 0){
+                return sim::PioProgram::HdlcTx;
+            }
+            if(strcmp(name, "clock_tx") == 0){
+                return sim::PioProgram::ClockTx;
+            }
+            if(strcmp(name, "bus_idle") == 0){
+                return sim::PioProgram::BusIdle;
+            }
+            return sim::PioProgram::Unknown;
+        }
+    }
+    return sim::PioProgram::Unknown;
+}
+
+extern "C" void pio_sm_set_config(PIO pio, uint sm, const pio_sm_config* config)
+{
+    sim::PioStateMachine& s = mcu().block(pio).sm[sm];
+    s.config = *config;
+    uint depth = (config->fifo_join == PIO_FIFO_JOIN_NONE) ? 4 : 8;
+    s.rx.setCapacity(config->fifo_join == PIO_FIFO_JOIN_TX ? 0 : depth);
+    s.tx.setCapacity(config->fifo_join == PIO_FIFO_JOIN_RX ? 0 : depth);
+}
+
+extern "C" void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config* config)
+{
+    sim::PioBlock& p = mcu().block(pio);
+    sim::PioStateMachine& s = p.sm[sm];
+    s.enabled = false;
+    pio_sm_set_config(pio, sm, config);
+    s.program = programAt(p, initial_pc, s.offset);
+    mcu().createModel(p.index, sm);
+}
+
+extern "C" void pio_sm_set_enabled(PIO pio, uint sm, bool enabled)
+{
+    mcu().block(pio).sm[sm].enabled = enabled;
+}
+
+extern "C" void pio_sm_restart(PIO pio, uint sm)
+{
+    sim::PioBlock& p = mcu().block(pio);
+    mcu().createModel(p.index, sm);
+}
+
+extern "C" void pio_sm_set_clkdiv(PIO pio, uint sm, float div)
+{
+    mcu().block(pio).sm[sm].config.clkdiv = div;
+}
+
+extern "C" void pio_sm_set_jmp_pin(PIO pio, uint sm, uint pin)
+{
+    mcu().block(pio).sm[sm].config.jmp_pin = pin;
+}
+
+extern "C" void pio_sm_set_consecutive_pindirs(PIO pio, uint sm, uint pin_base, uint pin_count, bool is_out)
+{
+    for(uint i = 0; i < pin_count; ++i){
+        mcu().gpio[(pin_base + i) % NUM_BANK0_GPIOS].dirOut = is_out;
+    }
+}
+
+extern "C" void pio_sm_set_pins(PIO pio, uint sm, uint32_t pin_values)
+{
+    for(uint i = 0; i < NUM_BANK0_GPIOS; ++i){
+        if(mcu().gpio[i].function == GPIO_FUNC_PIO0 + pio_get_index(pio)){
+            mcu().gpio[i].out = (pin_values >> i) & 1;
+        }
+    }
+}
+
+extern "C" void pio_sm_exec(PIO pio, uint sm, uint instr)
+{
+}
+
+extern "C" uint8_t pio_sm_get_pc(PIO pio, uint sm)
+{
+    const sim::PioStateMachine& s = mcu().block(pio).sm[sm];
+    return s.offset + (s.model ? s.model->pc() : 0);
+}
+
+extern "C" void pio_gpio_init(PIO pio, uint pin)
+{
+    mcu().gpio[pin].function = static_cast<gpio_function>(GPIO_FUNC_PIO0 + pio_get_index(pio));
+}
+
+extern "C" void pio_sm_claim(PIO pio, uint sm)
+{
+    sim::PioStateMachine& s = mcu().block(pio).sm[sm];
+    if(s.claimed){
+        panic("PIO %u SM %u already claimed", pio_get_index(pio), sm);
+    }
+    s.claimed = true;
+}
+
+extern "C" void pio_sm_unclaim(PIO pio, uint sm)
+{
+    mcu().block(pio).sm[sm].claimed = false;
+}
+
+extern "C" int pio_claim_unused_sm(PIO pio, bool required)
+{
+    sim::PioBlock& p = mcu().block(pio);
+    for(uint i = 0; i < NUM_PIO_STATE_MACHINES; ++i){
+        if(!p.sm[i].claimed){
+            p.sm[i].claimed = true;
+            return i;
+        }
+    }
+    if(required){
+        panic("No PIO state machines are available");
+    }
+    return -1;
+}
+
+extern "C" bool pio_sm_is_claimed(PIO pio, uint sm)
+{
+    return mcu().block(pio).sm[sm].claimed;
+}
+
+extern "C" void pio_sm_put(PIO pio, uint sm, uint32_t data)
+{
+    mcu().block(pio).sm[sm].tx.push(data);
+}
+
+extern "C" void pio_sm_put_blocking(PIO pio, uint sm, uint32_t data)
+{
+    while(mcu().block(pio).sm[sm].tx.full()){
+        Simulator::instance().poll();
+    }
+    pio_sm_put(pio, sm, data);
+}
+
+extern "C" uint32_t pio_sm_get(PIO pio, uint sm)
+{
+    uint32_t v = mcu().block(pio).sm[sm].rx.pop();
+    return v;
+}
+
+extern "C" uint32_t pio_sm_get_blocking(PIO pio, uint sm)
+{
+    while(mcu().block(pio).sm[sm].rx.empty()){
+        Simulator::instance().poll();
+    }
+    return pio_sm_get(pio, sm);
+}
+
+extern "C" bool pio_sm_is_rx_fifo_full(PIO pio, uint sm)
+{
+    return mcu().block(pio).sm[sm].rx.full();
+}
+
+extern "C" bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm)
+{
+    return mcu().block(pio).sm[sm].rx.empty();
+}
+
+extern "C" uint pio_sm_get_rx_fifo_level(PIO pio, uint sm)
+{
+    return mcu().block(pio).sm[sm].rx.level();
+}
+
+extern "C" bool pio_sm_is_tx_fifo_full(PIO pio, uint sm)
+{
+    return mcu().block(pio).sm[sm].tx.full();
+}
+
+extern "C" bool pio_sm_is_tx_fifo_empty(PIO pio, uint sm)
+{
+    return mcu().block(pio).sm[sm].tx.empty();
+}
+
+extern "C" uint pio_sm_get_tx_fifo_level(PIO pio, uint sm)
+{
+    return mcu().block(pio).sm[sm].tx.level();
+}
+
+extern "C" void pio_sm_clear_fifos(PIO pio, uint sm)
+{
+    sim::PioStateMachine& s = mcu().block(pio).sm[sm];
+    s.rx.clear();
+    s.tx.clear();
+}
+
+extern "C" void pio_sm_drain_tx_fifo(PIO pio, uint sm)
+{
+    mcu().block(pio).sm[sm].tx.clear();
+}
+
+extern "C" void pio_set_irq0_source_enabled(PIO pio, enum pio_interrupt_source source, bool enabled)
+{
+    sim::PioBlock& p = mcu().block(pio);
+    if(enabled){
+        p.inte[0] |= 1u << source;
+    }else{
+        p.inte[0] &= ~(1u << source);
+    }
+    p.hw->inte0_ctrl.inte = p.inte[0];
+}
+
+extern "C" void pio_set_irq1_source_enabled(PIO pio, enum pio_interrupt_source source, bool enabled)
+{
+    sim::PioBlock& p = mcu().block(pio);
+    if(enabled){
+        p.inte[1] |= 1u << source;
+    }else{
+        p.inte[1] &= ~(1u << source);
+    }
+    p.hw->inte1_ctrl.inte = p.inte[1];
+}
+
+extern "C" bool pio_interrupt_get(PIO pio, uint pio_interrupt_num)
+{
+    return (mcu().block(pio).irqFlags >> pio_interrupt_num) & 1;
+}
+
+extern "C" void pio_interrupt_clear(PIO pio, uint pio_interrupt_num)
+{
+    sim::PioBlock& p = mcu().block(pio);
+    p.irqFlags &= ~(1u << pio_interrupt_num);
+    p.hw->irq = p.irqFlags;
+}
+
+// ---------------------------------------------------------------- dma
+
+extern "C" void dma_channel_claim(uint channel)
+{
+    if(mcu().dma[channel].claimed){
+        panic("DMA channel %u is already claimed", channel);
+    }
+    mcu().dma[channel].claimed = true;
+}
+
+extern "C" void dma_channel_unclaim(uint channel)
+{
+    mcu().dma[channel].claimed = false;
+}
+
+extern "C" int dma_claim_unused_channel(bool required)
+{
+    for(uint i = 0; i < NUM_DMA_CHANNELS; ++i){
+        if(!mcu().dma[i].claimed){
+            mcu().dma[i].claimed = true;
+            return i;
+        }
+    }
+    if(required){
+        panic("No DMA channels are available");
+    }
+    return -1;
+}
+
+extern "C" bool dma_channel_is_claimed(uint channel)
+{
+    return mcu().dma[channel].claimed;
+}
+
+extern "C" dma_channel_config dma_channel_get_default_config(uint channel)
+{
+    dma_channel_config c;
+    memset(&c, 0, sizeof(c));
+    c.enable = true;
+    c.size = DMA_SIZE_32;
+    c.read_increment = true;
+    c.write_increment = false;
+    c.chain_to = channel;
+    c.dreq = DREQ_FORCE;
+    return c;
+}
+
+extern "C" dma_channel_config dma_get_channel_config(uint channel)
+{
+    return mcu().dma[channel].config;
+}
+
+extern "C" void dma_channel_set_config(uint channel, const dma_channel_config* config, bool trigger)
+{
+    mcu().dma[channel].config = *config;
+    if(trigger){
+        mcu().dmaTrigger(channel);
+    }
+}
+
+extern "C" void dma_channel_set_read_addr(uint channel, const volatile void* read_addr, bool trigger)
+{
+    sim_dma_hw.ch[channel].read_addr = reinterpret_cast<uintptr_t>(read_addr);
+    if(trigger){
+        mcu().dmaTrigger(channel);
+    }
+}
+
+extern "C" void dma_channel_set_write_addr(uint channel, volatile void* write_addr, bool trigger)
+{
+    sim_dma_hw.ch[channel].write_addr = reinterpret_cast<uintptr_t>(write_addr);
+    if(trigger){
+        mcu().dmaTrigger(channel);
+    }
+}
+
+extern "C" void dma_channel_set_trans_count(uint channel, uint32_t trans_count, bool trigger)
+{
+    mcu().dma[channel].reload = trans_count;
+    if(trigger){
+        mcu().dmaTrigger(channel);
+    }
+}
+
+extern "C" void dma_channel_configure(uint channel, const dma_channel_config* config, volatile void* write_addr,
+                                      const volatile void* read_addr, uint transfer_count, bool trigger)
+{
+    dma_channel_set_read_addr(channel, read_addr, false);
+    dma_channel_set_write_addr(channel, write_addr, false);
+    dma_channel_set_trans_count(channel, transfer_count, false);
+    dma_channel_set_config(channel, config, trigger);
+}
+
+extern "C" void dma_channel_transfer_from_buffer_now(uint channel, const volatile void* read_addr, uint32_t transfer_count)
+{
+    dma_channel_set_read_addr(channel, read_addr, false);
+    dma_channel_set_trans_count(channel, transfer_count, true);
+}
+
+extern "C" void dma_channel_transfer_to_buffer_now(uint channel, volatile void* write_addr, uint32_t transfer_count)
+{
+    dma_channel_set_write_addr(channel, write_addr, false);
+    dma_channel_set_trans_count(channel, transfer_count, true);
+}
+
+extern "C" void dma_start_channel_mask(uint32_t chan_mask)
+{
+    for(uint i = 0; i < NUM_DMA_CHANNELS; ++i){
+        if(chan_mask & (1u << i)){
+            mcu().dmaTrigger(i);
+        }
+    }
+}
+
+extern "C" void dma_channel_abort(uint channel)
+{
+    mcu().dma[channel].busy = false;
+}
+
+extern "C" bool dma_channel_is_busy(uint channel)
+{
+    return mcu().dma[channel].busy;
+}
+
+extern "C" void dma_channel_wait_for_finish_blocking(uint channel)
+{
+    while(mcu().dma[channel].busy){
+        Simulator::instance().poll();
+    }
+}
+
+extern "C" void dma_channel_set_irq0_enabled(uint channel, bool enabled)
+{
+    if(enabled){
+        sim_dma_hw.inte0 |= 1u << channel;
+    }else{
+        sim_dma_hw.inte0 &= ~(1u << channel);
+    }
+}
+
+extern "C" void dma_channel_set_irq1_enabled(uint channel, bool enabled)
+{
+    if(enabled){
+        sim_dma_hw.inte1 |= 1u << channel;
+    }else{
+        sim_dma_hw.inte1 &= ~(1u << channel);
+    }
+}
+
+extern "C" bool dma_channel_get_irq0_status(uint channel)
+{
+    return (sim_dma_hw.intr & sim_dma_hw.inte0) & (1u << channel);
+}
+
+extern "C" bool dma_channel_get_irq1_status(uint channel)
+{
+    return (sim_dma_hw.intr & sim_dma_hw.inte1) & (1u << channel);
+}
+
+extern "C" void dma_channel_acknowledge_irq0(uint channel)
+{
+    sim_dma_hw.intr &= ~(1u << channel);
+}
+
+extern "C" void dma_channel_acknowledge_irq1(uint channel)
+{
+    sim_dma_hw.intr &= ~(1u << channel);
+}
+
+extern "C" void dma_sniffer_enable(uint channel, uint mode, bool force_channel_enable)
+{
+    if(force_channel_enable){
+        mcu().dma[channel].config.sniff_enable = true;
+    }
+    sim_dma_hw.sniff_ctrl = DMA_SNIFF_CTRL_EN_BITS |
+                            (channel << DMA_SNIFF_CTRL_DMACH_LSB) |
+                            (mode << DMA_SNIFF_CTRL_CALC_LSB);
+}
+
+extern "C" void dma_sniffer_set_byte_swap_enabled(bool swap)
+{
+    if(swap){
+        sim_dma_hw.sniff_ctrl |= DMA_SNIFF_CTRL_BSWAP_BITS;
+    }else{
+        sim_dma_hw.sniff_ctrl &= ~DMA_SNIFF_CTRL_BSWAP_BITS;
+    }
+}
+
+extern "C" void dma_sniffer_disable(void)
+{
+    sim_dma_hw.sniff_ctrl = 0;
+}
+
+// ---------------------------------------------------------------- pwm
+
+extern "C" void pwm_init(uint slice_num, pwm_config* c, bool start)
+{
+    sim::PwmSlice& s = mcu().pwm[slice_num];
+    s.config = *c;
+    s.counter = 0;
+    s.fraction = 0.0f;
+    s.startNs = Simulator::instance().now();
+    s.enabled = start;
+}
+
+extern "C" void pwm_set_enabled(uint slice_num, bool enabled)
+{
+    sim::PwmSlice& s = mcu().pwm[slice_num];
+    if(enabled && !s.enabled){
+        s.startNs = Simulator::instance().now();
+    }
+    s.enabled = enabled;
+}
+
+extern "C" void pwm_set_wrap(uint slice_num, uint16_t wrap)
+{
+    mcu().pwm[slice_num].config.top = wrap;
+}
+
+extern "C" void pwm_set_counter(uint slice_num, uint16_t c)
+{
+    sim::PwmSlice& s = mcu().pwm[slice_num];
+    s.counter = c;
+    s.fraction = 0.0f;
+    s.startNs = Simulator::instance().now();
+}
+
+extern "C" uint16_t pwm_get_counter(uint slice_num)
+{
+    return mcu().pwmCounter(slice_num);
+}
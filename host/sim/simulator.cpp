@@ -0,0 +1,296 @@
+#include "simulator.h"
+#include "rp2040.h"
+
+#include <ctime>
+#include <ucontext.h>
+#include <vector>
+
+namespace sim {
+
+/**
+ * Second core, firmware code running in its own fiber
+ **/
+class Core1 : public Component {
+public:
+    explicit Core1(void (*entry)(void)) : entry_(entry), stack_(1 << 20)
+    {
+        getcontext(&ctx_);
+        ctx_.uc_stack.ss_sp = stack_.data();
+        ctx_.uc_stack.ss_size = stack_.size();
+        ctx_.uc_link = &caller_;
+        uintptr_t self = reinterpret_cast<uintptr_t>(this);
+        makecontext(&ctx_, reinterpret_cast<void (*)()>(&Core1::trampoline), 2,
+                    static_cast<uint32_t>(self >> 32), static_cast<uint32_t>(self));
+        wake_ = Simulator::instance().now();
+    }
+
+    // Not resumed while an interrupt handler runs (handlers are not preempted)
+    uint64_t nextEvent() const override
+    {
+        return (done_ || running_ || Simulator::instance().inIsr()) ? UINT64_MAX : wake_;
+    }
+
+    void run(uint64_t now) override
+    {
+        Simulator& s = Simulator::instance();
+        uint core = s.core_;
+        s.core_ = 1;
+        running_ = true;
+        lastResume_ = Simulator::hostNs();
+        swapcontext(&caller_, &ctx_);
+        s.cpu_.threadNs += Simulator::hostNs() - lastResume_;
+        running_ = false;
+        s.core_ = core;
+    }
+
+    /**
+     * Core 1 waits until given time
+     * Events are processed from core 1 while core 0 is not due, otherwise
+     * control goes back to core 0 (context switches are expensive)
+     **/
+    void wait(uint64_t t)
+    {
+        Simulator& s = Simulator::instance();
+        if(t <= s.runTarget_){
+            uint64_t now = Simulator::hostNs();
+            s.cpu_.threadNs += now - lastResume_;
+            s.core_ = 0;
+            s.runUntil(t, true);
+            s.core_ = 1;
+            lastResume_ = Simulator::hostNs();
+            if(s.now_ < t && !(s.eventWait_[1] && s.event_[1])){
+                //Core 0 was woken up first, core 1 goes on waiting
+                wake_ = t;
+                swapcontext(&ctx_, &caller_);
+            }
+        }else{
+            wake_ = t;
+            swapcontext(&ctx_, &caller_);
+        }
+        if(s.now_ >= s.stopTime_){
+            throw Stop();
+        }
+    }
+
+    /**
+     * An event ends the wait of core 1 now
+     **/
+    void wakeUp(uint64_t now)
+    {
+        if(wake_ > now){
+            wake_ = now;
+        }
+    }
+
+    void stop() { done_ = true; }
+
+private:
+    static void trampoline(uint32_t hi, uint32_t lo)
+    {
+        Core1* self = reinterpret_cast<Core1*>((static_cast<uintptr_t>(hi) << 32) | lo);
+        try{
+            self->entry_();
+        }catch(const Stop&){
+        }
+        self->done_ = true;
+    }
+
+    void (*entry_)(void);
+    std::vector<char> stack_;
+    ucontext_t ctx_;
+    ucontext_t caller_;
+    uint64_t wake_ = 0;
+    uint64_t lastResume_ = 0;           // Host time core 1 code was resumed
+    bool done_ = false;
+    bool running_ = false;
+};
+
+
+Simulator& Simulator::instance()
+{
+    static Simulator simulator;
+    return simulator;
+}
+
+Rp2040& Simulator::mcu()
+{
+    static Rp2040 chip;
+    static bool registered = false;
+    if(!registered){
+        registered = true;
+        addComponent(&chip);
+    }
+    return chip;
+}
+
+void Simulator::addComponent(Component* component)
+{
+    components_.push_back(component);
+}
+
+uint64_t Simulator::hostNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+void Simulator::firmwareEnter()
+{
+    cpu_.running = true;
+    cpu_.lastExit = hostNs();
+}
+
+void Simulator::firmwareExit()
+{
+    if(cpu_.running){
+        cpu_.threadNs += hostNs() - cpu_.lastExit;
+        cpu_.running = false;
+    }
+}
+
+void Simulator::advance(uint64_t ns)
+{
+    advanceTo(now_ + ns);
+}
+
+void Simulator::poll()
+{
+    advance(pollQuantum_);
+}
+
+bool Simulator::waitForEvent(uint64_t t)
+{
+    uint core = core_;
+    if(inIsr()){
+        return true;
+    }
+    if(!event_[core]){
+        eventWait_[core] = true;
+        advanceTo(t);
+        eventWait_[core] = false;
+    }
+    bool woken = event_[core];
+    event_[core] = false;
+    return woken;
+}
+
+void Simulator::sendEvent()
+{
+    signalEvent(0);
+    signalEvent(1);
+}
+
+void Simulator::signalEvent(uint core)
+{
+    event_[core] = true;
+    if(core == 1 && eventWait_[1] && core1_ != nullptr){
+        core1_->wakeUp(now_);
+    }
+}
+
+/**
+ * Gets if the running loop must return as a sleeping core was woken up
+ * @param forCore1 Loop run by core 1 waiting on behalf of core 0
+ **/
+bool Simulator::eventWoken(bool forCore1) const
+{
+    return (eventWait_[0] && event_[0]) || (forCore1 && eventWait_[1] && event_[1]);
+}
+
+void Simulator::launchCore1(void (*entry)(void))
+{
+    resetCore1();
+    core1_ = new Core1(entry);
+    addComponent(core1_);
+}
+
+int Simulator::consoleRead()
+{
+    if(console_.empty()){
+        return -1;
+    }
+    int c = static_cast<unsigned char>(console_[0]);
+    console_.erase(0, 1);
+    return c;
+}
+
+void Simulator::resetCore1()
+{
+    if(core1_ != nullptr){
+        core1_->stop();
+    }
+}
+
+void Simulator::advanceTo(uint64_t t)
+{
+    if(core_ == 1 && !inIsr() && core1_ != nullptr){
+        core1_->wait(t);
+        return;
+    }
+    bool fromThread = cpu_.running && !inIsr();
+    if(fromThread){
+        cpu_.threadNs += hostNs() - cpu_.lastExit;
+    }
+    runUntil(t);
+    if(fromThread){
+        cpu_.lastExit = hostNs();
+    }
+    if(!inIsr() && (now_ >= stopTime_)){
+        throw Stop();
+    }
+}
+
+void Simulator::runUntil(uint64_t t, bool forCore1)
+{
+    uint64_t target = runTarget_;
+    runTarget_ = t;
+    serviceInterrupts();
+    while(!eventWoken(forCore1) && (inIsr() || (now_ < stopTime_))){
+        Component* next = nullptr;
+        uint64_t best = t;
+        for(Component* c : components_){
+            uint64_t e = c->nextEvent();
+            if((e <= best) && (next == nullptr || e < best)){
+                best = e;
+                next = c;
+            }
+        }
+        if(next == nullptr){
+            break;
+        }
+        if(best > now_){
+            now_ = best;
+        }
+        next->run(now_);
+        serviceInterrupts();
+    }
+    if(now_ < t && !eventWoken(forCore1)){
+        now_ = (inIsr() || t < stopTime_) ? t : stopTime_;
+    }
+    runTarget_ = target;
+}
+
+void Simulator::serviceInterrupts()
+{
+    if(servicing_ || inIsr()){
+        return;
+    }
+    servicing_ = true;
+    mcu().serviceInterrupts();
+    servicing_ = false;
+}
+
+void Simulator::callHandler(void (*handler)(void))
+{
+    ++isrDepth_;
+    uint64_t start = hostNs();
+    handler();
+    cpu_.isrNs += hostNs() - start;
+    ++cpu_.isrCalls;
+    --isrDepth_;
+    //Exception entry wakes a core sleeping in WFE
+    signalEvent(core_);
+}
+
+}
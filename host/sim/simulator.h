@@ -0,0 +1,208 @@
+#ifndef __SIM_SIMULATOR_H__
+#define __SIM_SIMULATOR_H__
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+namespace sim {
+
+class Rp2040;
+class Core1;
+
+/**
+ * Thrown from a waiting SDK call when the simulation reached its stop time
+ **/
+struct Stop {};
+
+/**
+ * Something able to schedule events in simulated time
+ **/
+class Component {
+public:
+    virtual ~Component() = default;
+
+    /**
+     * Gets the next time the component needs to run
+     * @return Time in ns, UINT64_MAX if nothing is scheduled
+     **/
+    virtual uint64_t nextEvent() const = 0;
+
+    /**
+     * Runs the component event scheduled at current time
+     * @param now Current simulated time in ns
+     **/
+    virtual void run(uint64_t now) = 0;
+};
+
+/**
+ * Host CPU time accounting of the firmware code
+ * Time spent outside the simulator is firmware (thread) time, time spent
+ * in interrupt handlers is accounted separately. The monotonic clock is
+ * used as it is much cheaper to read than the thread CPU clock
+ **/
+struct CpuMeter {
+    uint64_t threadNs = 0;      // Firmware CPU time outside interrupt handlers
+    uint64_t isrNs = 0;         // Firmware CPU time in interrupt handlers
+    uint64_t isrCalls = 0;      // Number of interrupt handler calls
+    uint64_t lastExit = 0;      // Last time the simulator gave back control to firmware
+    bool running = false;       // Firmware code is running
+};
+
+/**
+ * Discrete event simulator running the firmware against the simulated chip
+ * The firmware executes in zero simulated time, time only advances when it
+ * waits (sleep, tight loop, blocking SDK calls or time reads)
+ **/
+class Simulator {
+public:
+    static Simulator& instance();
+
+    /**
+     * Gets current simulated time in ns
+     **/
+    uint64_t now() const { return now_; }
+
+    /**
+     * Registers a component producing events
+     **/
+    void addComponent(Component* component);
+
+    /**
+     * Firmware waits for a given duration
+     * @param ns Duration in ns
+     **/
+    void advance(uint64_t ns);
+
+    /**
+     * Firmware waits until an absolute time
+     * @param t Time in ns
+     **/
+    void advanceTo(uint64_t t);
+
+    /**
+     * Firmware polls something (one poll quantum elapses)
+     **/
+    void poll();
+
+    /**
+     * Firmware sleeps (WFE) until an event or a given time
+     * Interrupt handlers run on the core and SEV of either core are events,
+     * an event left from before returns at once
+     * @param t Time in ns, UINT64_MAX to wait for an event only
+     * @return true if woken by an event
+     **/
+    bool waitForEvent(uint64_t t);
+
+    /**
+     * Signals an event to both cores (SEV)
+     **/
+    void sendEvent();
+
+    /**
+     * Sets the time of a single polling iteration
+     **/
+    void setPollQuantum(uint64_t ns) { pollQuantum_ = ns; }
+
+    /**
+     * Sets when the simulation stops (sim::Stop is thrown to firmware)
+     **/
+    void setStopTime(uint64_t t) { stopTime_ = t; }
+
+    uint64_t stopTime() const { return stopTime_; }
+
+    /**
+     * Gets the simulated chip
+     **/
+    Rp2040& mcu();
+
+    /**
+     * Calls pending interrupt handlers
+     **/
+    void serviceInterrupts();
+
+    /**
+     * Firmware code begins (starts CPU accounting)
+     **/
+    void firmwareEnter();
+
+    /**
+     * Firmware code stopped (ends CPU accounting)
+     **/
+    void firmwareExit();
+
+    const CpuMeter& cpu() const { return cpu_; }
+
+    /**
+     * Gets if an interrupt handler is currently executing
+     **/
+    bool inIsr() const { return isrDepth_ > 0; }
+
+    /**
+     * Calls an interrupt handler, accounting its CPU time
+     **/
+    void callHandler(void (*handler)(void));
+
+    /**
+     * Gets host time in ns
+     **/
+    static uint64_t hostNs();
+
+    /**
+     * Gets the core executing firmware code
+     **/
+    uint core() const { return core_; }
+
+    /**
+     * Sets the core executing firmware code (interrupt handlers)
+     **/
+    void setCore(uint core) { core_ = core; }
+
+    /**
+     * Starts firmware code on the second core
+     * Both cores are cooperative fibers : a core runs until it waits, the
+     * other one is resumed when its wait time is reached
+     **/
+    void launchCore1(void (*entry)(void));
+
+    /**
+     * Stops the second core
+     **/
+    void resetCore1();
+
+    /**
+     * Queues characters read by the firmware from the console
+     **/
+    void consoleInput(const std::string& text) { console_ += text; }
+
+    /**
+     * Gets next console character
+     * @return Character, -1 if none
+     **/
+    int consoleRead();
+
+private:
+    friend class Core1;
+    Simulator() = default;
+    void runUntil(uint64_t t, bool forCore1 = false);
+    void signalEvent(uint core);
+    bool eventWoken(bool forCore1) const;
+
+    uint64_t now_ = 0;
+    uint64_t pollQuantum_ = 200;
+    uint64_t stopTime_ = UINT64_MAX;
+    int isrDepth_ = 0;
+    bool servicing_ = false;
+    uint64_t runTarget_ = 0;        // Time the running event loop returns to core 0
+    uint core_ = 0;
+    bool event_[2] = {false, false};        // Event register of each core
+    bool eventWait_[2] = {false, false};    // Core sleeping until an event
+    Core1* core1_ = nullptr;
+    std::string console_;
+    std::vector<Component*> components_;
+    CpuMeter cpu_;
+};
+
+}
+
+#endif
@@ -0,0 +1,620 @@
+#include "station.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "src/picoreseau.hxx"
+#include "src/protocol.h"
+
+namespace sim {
+
+Station::Station(const std::string& name, Bus& bus, uint8_t address) :
+    BusNode(name), bus_(bus), address_(address)
+{
+}
+
+void Station::send(const std::vector<uint8_t>& bytes, uint64_t minIdle, Damage damage)
+{
+    tx_.clear();
+    if(damage == Damage::Abort){
+        tx_.abortedFrame(bytes);
+    }else{
+        tx_.frame(bytes, damage == Damage::BadCrc);
+    }
+    pending_ = true;
+    minIdle_ = minIdle;
+}
+
+void Station::sendEcho(uint64_t duration, uint64_t minIdle)
+{
+    tx_.clear();
+    uint64_t nbFlags = duration / (8 * bus_.bitPeriod());
+    for(uint64_t i = 0; i < (nbFlags ? nbFlags : 1); ++i){
+        tx_.flag();
+    }
+    pending_ = true;
+    minIdle_ = minIdle;
+}
+
+bool Station::wantsBus(uint64_t now)
+{
+    return transmitting_ || (pending_ && (bus_.idleTime(now) >= minIdle_));
+}
+
+uint64_t Station::nextWake() const
+{
+    uint64_t t = timeout_;
+    if(pending_ && !bus_.busy()){
+        uint64_t ready = bus_.lastActivity() + minIdle_;
+        if(ready < t){
+            t = ready;
+        }
+    }
+    return t;
+}
+
+void Station::wake(uint64_t now)
+{
+    if(timeout_ <= now){
+        timeout_ = UINT64_MAX;
+        onTimeout(now);
+    }
+}
+
+bool Station::drive(uint64_t now, bool& bit)
+{
+    if(!transmitting_){
+        if(!pending_ || (bus_.idleTime(now) < minIdle_)){
+            return false;
+        }
+        transmitting_ = true;
+        pending_ = false;
+    }
+    if(tx_.empty()){
+        transmitting_ = false;
+        ++framesSent;
+        onTxDone(now);
+        return false;
+    }
+    bit = tx_.next();
+    return true;
+}
+
+void Station::sample(uint64_t now, bool bit, int drivers, BusNode* driver)
+{
+    if(driver == this && drivers == 1){
+        return;
+    }
+    onActivity(now, driver);
+    HdlcDecoder::Event e = rx_.push(bit);
+    if(e == HdlcDecoder::Event::Frame){
+        bool ok = rx_.crcOk();
+        if(ok){
+            ++framesReceived;
+        }else{
+            ++badFrames;
+        }
+        onFrame(now, rx_.frame(), ok);
+    }
+}
+
+void Station::released(uint64_t now)
+{
+    onReleased(now);
+}
+
+ClientStation::ClientStation(Bus& bus, uint8_t address, const ClientConfig& config) :
+    Station("station" + std::to_string(address), bus, address), config_(config), rng_(config.seed)
+{
+    thinkUntil_ = config_.startNs + random(0, config_.thinkMaxNs);
+}
+
+uint64_t ClientStation::random(uint64_t min, uint64_t max)
+{
+    if(max <= min){
+        return min;
+    }
+    std::uniform_int_distribution<uint64_t> d(min, max);
+    return d(rng_);
+}
+
+uint64_t ClientStation::nextWake() const
+{
+    uint64_t t = Station::nextWake();
+    if(phase_ == Think && thinkUntil_ < t){
+        t = thinkUntil_;
+    }
+    return t;
+}
+
+void ClientStation::wake(uint64_t now)
+{
+    Station::wake(now);
+    if(phase_ == Think && thinkUntil_ <= now){
+        thinkUntil_ = UINT64_MAX;
+        phase_ = Call;
+        callStart_ = now;
+        // Initial call announcing a 12 bytes consigne
+        send({0x00, static_cast<uint8_t>(MCAPI | 3), address_},
+             config_.callIdleNs + random(0, config_.callJitterNs));
+    }
+}
+
+void ClientStation::think(uint64_t now, bool failed)
+{
+    clearTimeout();
+    phase_ = Think;
+    thinkUntil_ = now + random(config_.thinkMinNs, config_.thinkMaxNs);
+    if(failed){
+        // Back off a little more after a failure
+        thinkUntil_ += random(0, config_.thinkMinNs);
+    }
+}
+
+void ClientStation::onTxDone(uint64_t now)
+{
+    txEnd_ = now;
+    switch(phase_){
+    case Call:
+        phase_ = WaitEcho;
+        echoSeen_ = false;
+        setTimeout(now + config_.echoTimeoutNs);
+        break;
+    case SendConsigne:
+        phase_ = WaitAck;
+        setTimeout(now + config_.replyTimeoutNs);
+        break;
+    case SendWait:
+        phase_ = WaitCall;
+        waitEnd_ = now;
+        setTimeout(now + config_.callTimeoutNs);
+        break;
+    case Echo:
+        if(exchange_){
+            // The master tells which way the message goes
+            exchange_ = false;
+            phase_ = WaitData;
+            setTimeout(now + config_.replyTimeoutNs);
+            break;
+        }
+        ++transactions;
+        transactionLatency.add(now - callStart_);
+        think(now, false);
+        break;
+    case AckData:
+        if(msgPos_ >= transfer_.length){
+            endTransfer(now, transfer_.ok);
+        }else{
+            phase_ = ReceiveData;
+            setTimeout(now + config_.replyTimeoutNs);
+        }
+        break;
+    case SendData:
+        if(msgPos_ == 0){
+            transfer_.firstByteNs = now - waitEnd_;
+        }
+        phase_ = WaitDataOk;
+        setTimeout(now + config_.replyTimeoutNs);
+        break;
+    default:
+        break;
+    }
+}
+
+void ClientStation::onActivity(uint64_t now, BusNode* driver)
+{
+    if(phase_ == WaitEcho && !echoSeen_){
+        echoSeen_ = true;
+        echoLatency.add(now - txEnd_);
+    }else if(phase_ == ReceiveData || phase_ == WaitDataOk){
+        // Data frames are long, the reply delay starts at their end
+        setTimeout(now + config_.replyTimeoutNs);
+    }
+}
+
+void ClientStation::onReleased(uint64_t now)
+{
+    if(phase_ == WaitEcho && echoSeen_){
+        clearTimeout();
+        phase_ = SendConsigne;
+        // Consigne : header, destination, tasks, message length, page, address, computer, application
+        uint16_t len = config_.msgLens[consignes_++ % config_.msgLens.size()];
+        transfer_ = Transfer();
+        transfer_.length = len;
+        send({0x00, 0x00, address_, 0x00,
+              0x00, 0x01, 0x02, static_cast<uint8_t>(len >> 8), static_cast<uint8_t>(len), 0x00, 0x00, 0x60, 0x00, 0x01},
+             config_.responseIdleNs);
+    }
+}
+
+void ClientStation::onFrame(uint64_t now, const std::vector<uint8_t>& frame, bool crcOk)
+{
+    if(!crcOk || frame.size() < 3 || frame[0] != address_){
+        return;
+    }
+    uint8_t ctrl = frame[1] & 0xF0;
+    if(phase_ == WaitAck && ctrl == MCPCH){
+        ackLatency.add(now - txEnd_);
+        clearTimeout();
+        phase_ = SendWait;
+        msgNum_ = (msgNum_ + 1) & 0xF;
+        send({0x00, static_cast<uint8_t>(MCAMA | msgNum_), address_}, config_.responseIdleNs);
+    }else if(phase_ == WaitCall && (ctrl == MCDISC || ctrl == MCAPA)){
+        clearTimeout();
+        phase_ = Echo;
+        exchange_ = ctrl == MCAPA;
+        sendEcho(config_.echoNs, config_.responseIdleNs);
+    }else if(phase_ >= WaitData && ctrl == MCDISC){
+        // Message given up by the master
+        endTransfer(now, false);
+        clearTimeout();
+        phase_ = Echo;
+        sendEcho(config_.echoNs, config_.responseIdleNs);
+    }else if(phase_ == WaitData && (ctrl == MCVR || ctrl == MCVE)){
+        msgPos_ = 0;
+        transfer_.toStation = ctrl == MCVR;
+        transfer_.ok = true;
+        if(transfer_.toStation){
+            phase_ = ReceiveData;
+            setTimeout(now + config_.replyTimeoutNs);
+        }else{
+            clearTimeout();
+            sendChunk();
+        }
+    }else if(phase_ == ReceiveData && (frame[1] & 0x80) == 0 && frame.size() >= 6){
+        // Address, header and data, then the CRC
+        clearTimeout();
+        if(msgPos_ == 0){
+            transfer_.firstByteNs = now - waitEnd_;
+        }
+        for(size_t i = 4; i < frame.size() - 2; ++i, ++msgPos_){
+            if(msgPos_ >= transfer_.length || frame[i] != messageByte(address_, msgPos_)){
+                transfer_.ok = false;
+            }
+        }
+        phase_ = AckData;
+        send({0x00, MCOK, address_}, config_.responseIdleNs);
+    }else if(phase_ == WaitDataOk && ctrl == MCOK){
+        clearTimeout();
+        msgPos_ += chunkLen_;
+        if(msgPos_ >= transfer_.length){
+            endTransfer(now, true);
+        }else{
+            sendChunk();
+        }
+    }
+}
+
+void ClientStation::sendChunk()
+{
+    chunkLen_ = std::min<uint32_t>(NR_DATA_CHUNK, transfer_.length - msgPos_);
+    std::vector<uint8_t> frame = {0x00, 0x00, address_, 0x00};
+    for(uint32_t i = 0; i < chunkLen_; ++i){
+        frame.push_back(messageByte(address_, msgPos_ + i));
+    }
+    phase_ = SendData;
+    send(frame, config_.responseIdleNs);
+}
+
+void ClientStation::endTransfer(uint64_t now, bool ok)
+{
+    transfer_.ok = ok && msgPos_ >= transfer_.length;
+    transfer_.durationNs = now - waitEnd_;
+    transfers.push_back(transfer_);
+    // The master disconnects
+    phase_ = WaitCall;
+    setTimeout(now + config_.callTimeoutNs);
+}
+
+void ClientStation::onTimeout(uint64_t now)
+{
+    switch(phase_){
+    case WaitEcho:
+        ++echoTimeouts;
+        break;
+    case WaitAck:
+        ++replyTimeouts;
+        break;
+    case WaitCall:
+        ++callTimeouts;
+        break;
+    case WaitData:
+    case ReceiveData:
+    case WaitDataOk:
+        ++dataTimeouts;
+        transfer_.ok = false;
+        transfers.push_back(transfer_);
+        break;
+    default:
+        break;
+    }
+    think(now, true);
+}
+
+ReplayStation::ReplayStation(Bus& bus, uint64_t startNs, uint64_t minIdleNs) :
+    Station("replay", bus, 0xFF), startNs_(startNs), minIdleNs_(minIdleNs)
+{
+}
+
+bool ReplayStation::load(const std::string& path, uint64_t maxGapNs)
+{
+    entries_.clear();
+    master_.clear();
+    next_ = 0;
+    if(!(CaptureFile::detect(path) ? loadCapture(path) : loadText(path))){
+        return false;
+    }
+    if(maxGapNs){
+        // Timing of exchanges is kept, only idle times are shortened
+        uint64_t shift = 0;
+        uint64_t previous = 0;
+        for(Entry& e : entries_){
+            uint64_t gap = e.time - previous;
+            previous = e.time;
+            if(gap > maxGapNs){
+                shift += gap - maxGapNs;
+            }
+            e.time -= shift;
+        }
+    }
+    return true;
+}
+
+bool ReplayStation::loadCapture(const std::string& path)
+{
+    CaptureFile file;
+    if(!file.open(path)){
+        return false;
+    }
+    for(uint32_t i = 0; i < file.size(); ++i){
+        const NrcRecord& r = file.record(i);
+        if(r.flags & NRC_MASTER){
+            if(r.kind == NRC_FRAME && !(r.flags & (NRC_BAD_CRC | NRC_ABORTED))){
+                master_.emplace_back(file.bytes(i), file.bytes(i) + r.length);
+            }
+            continue;
+        }
+        Entry e;
+        e.time = r.timeUs * 1000;
+        e.echo = r.kind == NRC_ECHO;
+        e.echoNs = r.durationUs * 1000ull;
+        e.damage = (r.flags & NRC_ABORTED) ? Damage::Abort : (r.flags & NRC_BAD_CRC) ? Damage::BadCrc : Damage::None;
+        e.bytes.assign(file.bytes(i), file.bytes(i) + r.length);
+        if(!e.echo && e.bytes.empty()){
+            return false;
+        }
+        entries_.push_back(e);
+    }
+    return true;
+}
+
+bool ReplayStation::loadText(const std::string& path)
+{
+    std::ifstream in(path);
+    if(!in){
+        return false;
+    }
+    std::string line;
+    while(std::getline(in, line)){
+        size_t c = line.find('#');
+        if(c != std::string::npos){
+            line = line.substr(0, c);
+        }
+        std::istringstream ss(line);
+        Entry e;
+        if(!(ss >> e.time)){
+            continue;
+        }
+        e.time *= 1000;
+        e.echo = false;
+        e.echoNs = 0;
+        e.damage = Damage::None;
+        std::string tok;
+        while(ss >> tok){
+            if(tok == "echo"){
+                uint64_t us = 0;
+                if(!(ss >> us)){
+                    return false;
+                }
+                e.echo = true;
+                e.echoNs = us * 1000;
+                break;
+            }
+            for(size_t i = 0; i + 1 < tok.size(); i += 2){
+                e.bytes.push_back(static_cast<uint8_t>(std::stoul(tok.substr(i, 2), nullptr, 16)));
+            }
+        }
+        if(!e.echo && e.bytes.empty()){
+            return false;
+        }
+        entries_.push_back(e);
+    }
+    return true;
+}
+
+uint64_t ReplayStation::nextWake() const
+{
+    uint64_t t = Station::nextWake();
+    if(!busy_ && next_ < entries_.size()){
+        uint64_t due = startNs_ + entries_[next_].time;
+        if(due < t){
+            t = due;
+        }
+    }
+    return t;
+}
+
+void ReplayStation::wake(uint64_t now)
+{
+    Station::wake(now);
+    if(!busy_ && next_ < entries_.size() && (startNs_ + entries_[next_].time <= now)){
+        const Entry& e = entries_[next_++];
+        busy_ = true;
+        if(e.echo){
+            sendEcho(e.echoNs, minIdleNs_);
+        }else{
+            send(e.bytes, minIdleNs_, e.damage);
+        }
+    }
+}
+
+void ReplayStation::onTxDone(uint64_t now)
+{
+    busy_ = false;
+    ++framesReplayed;
+}
+
+TrafficStation::TrafficStation(Bus& bus, const TrafficConfig& config) :
+    Station("traffic", bus, 0xFE), config_(config), rng_(config.seed)
+{
+}
+
+uint64_t TrafficStation::nextWake() const
+{
+    uint64_t t = Station::nextWake();
+    if(!busy_ && config_.startNs < config_.stopNs && config_.startNs < t){
+        t = config_.startNs;
+    }
+    return t;
+}
+
+void TrafficStation::wake(uint64_t now)
+{
+    Station::wake(now);
+    if(busy_ || now < config_.startNs || now >= config_.stopNs){
+        return;
+    }
+    std::uniform_int_distribution<unsigned> len(config_.minLen, config_.maxLen);
+    std::uniform_int_distribution<unsigned> byte(0, 255);
+    std::uniform_int_distribution<unsigned> percent(0, 99);
+    std::vector<uint8_t> bytes(len(rng_));
+    for(uint8_t& b : bytes){
+        b = byte(rng_);
+    }
+    bytes[0] &= NR_MAX_STATIONS - 1;
+    unsigned p = percent(rng_);
+    damage_ = Damage::None;
+    if(p < config_.abortPercent){
+        damage_ = Damage::Abort;
+    }else if(p < config_.abortPercent + config_.badCrcPercent){
+        damage_ = Damage::BadCrc;
+    }
+    busy_ = true;
+    send(bytes, config_.gapNs, damage_);
+}
+
+void TrafficStation::onTxDone(uint64_t now)
+{
+    busy_ = false;
+    config_.startNs = now;
+    if(damage_ == Damage::Abort){
+        ++aborted;
+    }else if(damage_ == Damage::BadCrc){
+        ++badCrc;
+    }else{
+        ++frames;
+    }
+}
+
+BusMonitor::BusMonitor(Bus& bus, BusNode* dut) :
+    BusNode("monitor"), bus_(bus), dut_(dut)
+{
+}
+
+void BusMonitor::startMeasure(uint64_t now)
+{
+    measuring_ = true;
+    measureStart_ = now;
+    frames = badFrames = aborts = bytes = collisions = dutCollisions = busyNs = 0;
+    dutTurnaround = LatencyStats();
+    stationTurnaround = LatencyStats();
+}
+
+void BusMonitor::sample(uint64_t now, bool bit, int drivers, BusNode* driver)
+{
+    uint64_t half = bus_.bitPeriod() / 2;
+    if(inSpan_ && driver != spanDriver_){
+        endSpan(now - half);
+    }
+    if(!inSpan_){
+        inSpan_ = true;
+        spanDriver_ = driver;
+        spanStart_ = now - half;
+        spanCollision_ = false;
+        spanDutCollision_ = false;
+        spanFrame_ = false;
+        if(measuring_ && lastDriver_ != nullptr && lastDriver_ != driver){
+            uint64_t gap = spanStart_ - lastEnd_;
+            if(driver == dut_){
+                dutTurnaround.add(gap);
+            }else if(lastDriver_ == dut_){
+                stationTurnaround.add(gap);
+            }
+        }
+    }
+    if(drivers > 1){
+        spanCollision_ = true;
+        spanDutCollision_ = spanDutCollision_ || bus_.drives(dut_);
+    }
+    spanEnd_ = now + half;
+    HdlcDecoder::Event e = decoder_.push(bit);
+    if(!measuring_){
+        return;
+    }
+    if(e == HdlcDecoder::Event::Frame){
+        bool ok = decoder_.crcOk();
+        if(ok){
+            ++frames;
+            bytes += decoder_.frame().size();
+        }else{
+            ++badFrames;
+        }
+        spanFrame_ = true;
+        const std::vector<uint8_t>& f = decoder_.frame();
+        size_t len = f.size() >= 2 ? f.size() - 2 : 0;
+        if(recorder_ != nullptr){
+            uint8_t flags = (driver == dut_ ? NRC_MASTER : 0) | (ok ? 0 : NRC_BAD_CRC);
+            recorder_->frame(recordTime(), f.data(), len, flags);
+        }
+        if(dutLog_ != nullptr && driver == dut_ && ok){
+            dutLog_->emplace_back(f.begin(), f.begin() + len);
+        }
+    }else if(e == HdlcDecoder::Event::Abort){
+        ++aborts;
+    }
+}
+
+uint64_t BusMonitor::recordTime() const
+{
+    return spanStart_ > measureStart_ ? (spanStart_ - measureStart_) / 1000 : 0;
+}
+
+void BusMonitor::endSpan(uint64_t now)
+{
+    if(!inSpan_){
+        return;
+    }
+    inSpan_ = false;
+    lastDriver_ = spanDriver_;
+    lastEnd_ = spanEnd_;
+    if(measuring_ && recorder_ != nullptr && !spanFrame_ && !spanCollision_){
+        // Flags only : an echo
+        recorder_->echo(recordTime(), static_cast<uint32_t>((spanEnd_ - spanStart_) / 1000),
+                        spanDriver_ == dut_ ? NRC_MASTER : 0);
+    }
+    if(measuring_){
+        busyNs += spanEnd_ - spanStart_;
+        if(spanCollision_){
+            ++collisions;
+            dutCollisions += spanDutCollision_;
+        }
+    }
+}
+
+void BusMonitor::released(uint64_t now)
+{
+    endSpan(now);
+}
+
+}
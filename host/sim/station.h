@@ -0,0 +1,320 @@
+#ifndef __SIM_STATION_H__
+#define __SIM_STATION_H__
+#include "bus.h"
+#include "capture_file.h"
+#include "hdlc_bits.h"
+#include "stats.h"
+
+#include <random>
+#include <string>
+#include <vector>
+
+namespace sim {
+
+/**
+ * Base of simulated bus stations : half-duplex HDLC transmitter with
+ * carrier sense and a receiver decoding frames from other nodes
+ **/
+class Station : public BusNode {
+public:
+    Station(const std::string& name, Bus& bus, uint8_t address);
+
+    uint8_t address() const { return address_; }
+
+    bool wantsBus(uint64_t now) override;
+    uint64_t nextWake() const override;
+    void wake(uint64_t now) override;
+    bool drive(uint64_t now, bool& bit) override;
+    void sample(uint64_t now, bool bit, int drivers, BusNode* driver) override;
+    void released(uint64_t now) override;
+
+    uint64_t framesSent = 0;
+    uint64_t framesReceived = 0;
+    uint64_t badFrames = 0;
+
+protected:
+    enum class Damage { None, BadCrc, Abort };
+
+    /**
+     * Queues a frame, sent once the bus is idle
+     * @param bytes Frame (address first) without CRC
+     * @param minIdle Time the bus must be idle before sending
+     * @param damage Sends a wrong CRC, or an abort instead of the CRC
+     **/
+    void send(const std::vector<uint8_t>& bytes, uint64_t minIdle, Damage damage = Damage::None);
+
+    /**
+     * Queues an echo (clock with flags) of a given duration
+     **/
+    void sendEcho(uint64_t duration, uint64_t minIdle);
+
+    /**
+     * Arms a timer calling onTimeout
+     **/
+    void setTimeout(uint64_t t) { timeout_ = t; }
+    void clearTimeout() { timeout_ = UINT64_MAX; }
+
+    virtual void onFrame(uint64_t now, const std::vector<uint8_t>& frame, bool crcOk) {}
+    virtual void onTxDone(uint64_t now) {}
+    virtual void onActivity(uint64_t now, BusNode* driver) {}
+    virtual void onReleased(uint64_t now) {}
+    virtual void onTimeout(uint64_t now) {}
+
+    Bus& bus_;
+    uint8_t address_;
+
+private:
+    HdlcEncoder tx_;
+    HdlcDecoder rx_;
+    bool pending_ = false;
+    bool transmitting_ = false;
+    uint64_t minIdle_ = 0;
+    uint64_t timeout_ = UINT64_MAX;
+};
+
+/**
+ * Parameters of a simulated TO7/MO5 client station
+ **/
+struct ClientConfig {
+    uint64_t startNs = 0;               // Time of first call
+    uint64_t thinkMinNs = 2000000;      // Minimum time between transactions
+    uint64_t thinkMaxNs = 20000000;     // Maximum time between transactions
+    uint64_t callIdleNs = 500000;       // Idle time required before an initial call
+    uint64_t callJitterNs = 200000;     // Random extra idle time before an initial call
+    uint64_t responseIdleNs = 50000;    // Turnaround before answering the master
+    uint64_t echoNs = 300000;           // Duration of our echo
+    uint64_t echoTimeoutNs = 2000000;   // Maximum wait for the master echo
+    uint64_t replyTimeoutNs = 10000000; // Maximum wait for a master reply
+    uint64_t callTimeoutNs = 50000000;  // Maximum wait for the master call after MCAMA
+    std::vector<uint16_t> msgLens = {4};// Message length announced by successive consignes
+    uint32_t seed = 1;
+};
+
+/**
+ * Simulated client station doing complete transactions with the master :
+ * MCAPI -> echo -> consigne -> MCPCH -> MCAMA -> MCDISC/MCAPA -> echo
+ * After MCAPA, the message announced by the consigne is received (MCVR)
+ * or sent (MCVE) in data frames of NR_DATA_CHUNK bytes, each one
+ * acknowledged with MCOK, until the master disconnects (MCDISC -> echo).
+ * Message bytes follow messageByte, received ones are checked.
+ **/
+class ClientStation : public Station {
+public:
+    ClientStation(Bus& bus, uint8_t address, const ClientConfig& config);
+
+    uint64_t nextWake() const override;
+    void wake(uint64_t now) override;
+
+    /**
+     * Byte of the message of a station at a position
+     **/
+    static uint8_t messageByte(uint8_t station, uint32_t pos)
+    {
+        return static_cast<uint8_t>(pos * 31 + (pos >> 8) + station);
+    }
+
+    /**
+     * Message exchanged after MCAPA
+     **/
+    struct Transfer {
+        uint16_t length;                // Announced by the consigne
+        bool toStation;                 // Received by the station (MCVR), else sent (MCVE)
+        bool ok;                        // All bytes exchanged, received ones as expected
+        uint64_t firstByteNs;           // End of MCAMA to the end of the first data frame
+        uint64_t durationNs;            // End of MCAMA to the last data frame acknowledged
+    };
+    std::vector<Transfer> transfers;
+
+    uint64_t transactions = 0;          // Completed transactions
+    uint64_t echoTimeouts = 0;          // No echo after initial call
+    uint64_t replyTimeouts = 0;         // No MCPCH after consigne
+    uint64_t callTimeouts = 0;          // No call after MCAMA
+    uint64_t dataTimeouts = 0;          // No data or acknowledge during a message
+    LatencyStats transactionLatency;    // Initial call to final echo
+    LatencyStats echoLatency;           // End of MCAPI to start of master echo
+    LatencyStats ackLatency;            // End of consigne to MCPCH
+
+protected:
+    void onFrame(uint64_t now, const std::vector<uint8_t>& frame, bool crcOk) override;
+    void onTxDone(uint64_t now) override;
+    void onActivity(uint64_t now, BusNode* driver) override;
+    void onReleased(uint64_t now) override;
+    void onTimeout(uint64_t now) override;
+
+private:
+    enum Phase { Think, Call, WaitEcho, SendConsigne, WaitAck, SendWait, WaitCall, Echo,
+                 WaitData, ReceiveData, AckData, SendData, WaitDataOk };
+    void think(uint64_t now, bool failed);
+    void sendChunk();
+    void endTransfer(uint64_t now, bool ok);
+    uint64_t random(uint64_t min, uint64_t max);
+
+    ClientConfig config_;
+    std::mt19937 rng_;
+    Phase phase_ = Think;
+    uint64_t thinkUntil_ = UINT64_MAX;
+    uint64_t callStart_ = 0;
+    uint64_t txEnd_ = 0;
+    bool echoSeen_ = false;
+    uint8_t msgNum_ = 0;
+    bool exchange_ = false;             // Called back with MCAPA
+    size_t consignes_ = 0;
+    Transfer transfer_ = {};
+    uint64_t waitEnd_ = 0;              // End of MCAMA
+    uint32_t msgPos_ = 0;               // Message bytes exchanged
+    uint32_t chunkLen_ = 0;             // Bytes of the data frame sent
+};
+
+/**
+ * Station replaying recorded traffic
+ * Text file format, one entry per line (# starts a comment) :
+ *   <time_us> <hex bytes>     sends a frame (address first, without CRC)
+ *   <time_us> echo <dur_us>   sends an echo
+ * Capture files (.nrc) are also accepted, frames of the master are not
+ * sent but kept to check the answers of the firmware.
+ * Times are relative to the replay start, entries are sent in order once
+ * the bus is idle
+ **/
+class ReplayStation : public Station {
+public:
+    ReplayStation(Bus& bus, uint64_t startNs, uint64_t minIdleNs = 20000);
+
+    /**
+     * Loads a replay file (text or capture file)
+     * @param maxGapNs Longer idle times between entries are shortened to it
+     * (accelerated replay), 0 keeps the original timing
+     * @return false on error
+     **/
+    bool load(const std::string& path, uint64_t maxGapNs = 0);
+
+    uint64_t nextWake() const override;
+    void wake(uint64_t now) override;
+
+    bool done() const { return next_ >= entries_.size() && !busy_; }
+    uint64_t framesReplayed = 0;
+
+    /**
+     * Frames of the master found in the capture file, in order
+     **/
+    const std::vector<std::vector<uint8_t>>& masterFrames() const { return master_; }
+
+protected:
+    void onTxDone(uint64_t now) override;
+
+private:
+    struct Entry {
+        uint64_t time;
+        bool echo;
+        uint64_t echoNs;
+        Damage damage;
+        std::vector<uint8_t> bytes;
+    };
+    bool loadText(const std::string& path);
+    bool loadCapture(const std::string& path);
+    std::vector<Entry> entries_;
+    std::vector<std::vector<uint8_t>> master_;
+    size_t next_ = 0;
+    uint64_t startNs_;
+    uint64_t minIdleNs_;
+    bool busy_ = false;
+};
+
+/**
+ * Parameters of the traffic generator
+ **/
+struct TrafficConfig {
+    uint64_t startNs = 0;
+    uint64_t stopNs = UINT64_MAX;       // No frame started after this time
+    uint64_t gapNs = 20000;             // Bus idle between frames
+    unsigned minLen = 3;                // Frame bytes (address included, CRC excluded)
+    unsigned maxLen = 64;
+    unsigned badCrcPercent = 2;         // Frames sent with a wrong CRC
+    unsigned abortPercent = 1;          // Frames ended by an abort
+    uint32_t seed = 1;
+};
+
+/**
+ * Station sending random frames back to back to random addresses, some
+ * damaged, to load the bus (capture tests)
+ **/
+class TrafficStation : public Station {
+public:
+    TrafficStation(Bus& bus, const TrafficConfig& config);
+
+    uint64_t nextWake() const override;
+    void wake(uint64_t now) override;
+
+    uint64_t frames = 0;                // Valid frames sent
+    uint64_t badCrc = 0;
+    uint64_t aborted = 0;
+
+protected:
+    void onTxDone(uint64_t now) override;
+
+private:
+    TrafficConfig config_;
+    std::mt19937 rng_;
+    Damage damage_ = Damage::None;
+    bool busy_ = false;
+};
+
+/**
+ * Passive probe decoding all bus traffic
+ **/
+class BusMonitor : public BusNode {
+public:
+    explicit BusMonitor(Bus& bus, BusNode* dut);
+
+    void sample(uint64_t now, bool bit, int drivers, BusNode* driver) override;
+    void released(uint64_t now) override;
+
+    /**
+     * Starts measurements (previous traffic is not accounted)
+     **/
+    void startMeasure(uint64_t now);
+
+    /**
+     * Records the traffic seen once measures started (aborts are not kept)
+     **/
+    void setRecorder(CaptureWriter* recorder) { recorder_ = recorder; }
+
+    /**
+     * Keeps the frames sent by the DUT once measures started
+     **/
+    void setDutLog(std::vector<std::vector<uint8_t>>* log) { dutLog_ = log; }
+
+    uint64_t frames = 0;                // Valid frames
+    uint64_t badFrames = 0;             // Frames with a bad CRC
+    uint64_t aborts = 0;                // Aborted frames
+    uint64_t bytes = 0;                 // Bytes of valid frames
+    uint64_t collisions = 0;            // Transmissions with more than one driver
+    uint64_t dutCollisions = 0;         // Collisions the DUT took part in
+    uint64_t busyNs = 0;                // Time the bus was driven
+    LatencyStats dutTurnaround;         // Station transmission end to DUT transmission start
+    LatencyStats stationTurnaround;     // DUT transmission end to station transmission start
+
+private:
+    void endSpan(uint64_t now);
+    uint64_t recordTime() const;        // Start of the span from the measure start (us)
+
+    Bus& bus_;
+    BusNode* dut_;
+    HdlcDecoder decoder_;
+    bool measuring_ = false;
+    bool inSpan_ = false;
+    bool spanCollision_ = false;
+    bool spanDutCollision_ = false;
+    BusNode* spanDriver_ = nullptr;
+    uint64_t spanStart_ = 0;
+    uint64_t spanEnd_ = 0;
+    BusNode* lastDriver_ = nullptr;
+    uint64_t lastEnd_ = 0;
+    bool spanFrame_ = false;            // A frame was decoded in the span
+    uint64_t measureStart_ = 0;
+    CaptureWriter* recorder_ = nullptr;
+    std::vector<std::vector<uint8_t>>* dutLog_ = nullptr;
+};
+
+}
+
+#endif
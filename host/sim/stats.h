@@ -0,0 +1,48 @@
+#ifndef __SIM_STATS_H__
+#define __SIM_STATS_H__
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace sim {
+
+/**
+ * Latency samples accumulator
+ **/
+class LatencyStats {
+public:
+    void add(uint64_t ns)
+    {
+        samples_.push_back(ns);
+        sum_ += ns;
+    }
+
+    size_t count() const { return samples_.size(); }
+    uint64_t min() const { return samples_.empty() ? 0 : *std::min_element(samples_.begin(), samples_.end()); }
+    uint64_t max() const { return samples_.empty() ? 0 : *std::max_element(samples_.begin(), samples_.end()); }
+    double mean() const { return samples_.empty() ? 0.0 : static_cast<double>(sum_) / samples_.size(); }
+
+    /**
+     * Gets a percentile (0 to 100)
+     **/
+    uint64_t percentile(double p) const
+    {
+        if(samples_.empty()){
+            return 0;
+        }
+        std::vector<uint64_t> s = samples_;
+        size_t idx = static_cast<size_t>((p / 100.0) * (s.size() - 1) + 0.5);
+        std::nth_element(s.begin(), s.begin() + idx, s.end());
+        return s[idx];
+    }
+
+    const std::vector<uint64_t>& samples() const { return samples_; }
+
+private:
+    std::vector<uint64_t> samples_;
+    uint64_t sum_ = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,106 @@
+#include "usb_device.h"
+
+#include "src/tusb_config.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define USB_FRAME_NS 1000000            // Full speed frame
+#define USB_PACKETS_PER_FRAME 19        // Bulk packets of 64 bytes in a frame
+#define USB_PACKET_SIZE CFG_TUD_VENDOR_EPSIZE
+
+namespace sim {
+
+void UsbDevice::connect(int readFd, int writeFd)
+{
+    readFd_ = readFd;
+    writeFd_ = writeFd;
+    fcntl(readFd_, F_SETFL, fcntl(readFd_, F_GETFL) | O_NONBLOCK);
+    fcntl(writeFd_, F_SETFL, fcntl(writeFd_, F_GETFL) | O_NONBLOCK);
+    rx_.clear();
+    tx_.clear();
+    flushed_ = false;
+    uint64_t now = Simulator::instance().now();
+    nextFrame_ = (now / USB_FRAME_NS + 1) * USB_FRAME_NS;
+}
+
+void UsbDevice::disconnect()
+{
+    readFd_ = -1;
+    writeFd_ = -1;
+}
+
+uint64_t UsbDevice::nextEvent() const
+{
+    return mounted() ? nextFrame_ : UINT64_MAX;
+}
+
+void UsbDevice::run(uint64_t now)
+{
+    nextFrame_ += USB_FRAME_NS;
+    unsigned budget = USB_PACKETS_PER_FRAME;
+    uint8_t packet[USB_PACKET_SIZE];
+    //OUT : the host program wrote, packets are taken while the FIFO has room
+    while(budget > 0 && CFG_TUD_VENDOR_RX_BUFSIZE - rx_.size() >= USB_PACKET_SIZE){
+        ssize_t n = ::read(readFd_, packet, sizeof(packet));
+        if(n <= 0){
+            break;
+        }
+        rx_.insert(rx_.end(), packet, packet + n);
+        ++outPackets;
+        outBytes += n;
+        --budget;
+    }
+    //IN : whole packets, a short one once flushed
+    while(budget > 0 && !tx_.empty()){
+        size_t n = std::min<size_t>(USB_PACKET_SIZE, tx_.size());
+        if(n < USB_PACKET_SIZE && !flushed_){
+            break;
+        }
+        std::copy(tx_.begin(), tx_.begin() + n, packet);
+        if(::write(writeFd_, packet, n) != static_cast<ssize_t>(n)){
+            //Host program not reading, the packet is NAKed
+            ++nakFrames;
+            break;
+        }
+        tx_.erase(tx_.begin(), tx_.begin() + n);
+        ++inPackets;
+        inBytes += n;
+        --budget;
+        if(n < USB_PACKET_SIZE || (tx_.empty() && flushed_)){
+            ++inTransfers;
+            flushed_ = false;
+        }
+    }
+}
+
+uint32_t UsbDevice::read(void* buffer, uint32_t size)
+{
+    uint32_t n = std::min<uint32_t>(size, rx_.size());
+    std::copy(rx_.begin(), rx_.begin() + n, static_cast<uint8_t*>(buffer));
+    rx_.erase(rx_.begin(), rx_.begin() + n);
+    return n;
+}
+
+uint32_t UsbDevice::writeAvailable() const
+{
+    return mounted() ? CFG_TUD_VENDOR_TX_BUFSIZE - static_cast<uint32_t>(tx_.size()) : 0;
+}
+
+uint32_t UsbDevice::write(const void* buffer, uint32_t size)
+{
+    uint32_t n = std::min(size, writeAvailable());
+    const uint8_t* p = static_cast<const uint8_t*>(buffer);
+    tx_.insert(tx_.end(), p, p + n);
+    return n;
+}
+
+void UsbDevice::flush()
+{
+    if(!tx_.empty()){
+        flushed_ = true;
+    }
+}
+
+}
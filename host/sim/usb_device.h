@@ -0,0 +1,63 @@
+#ifndef __SIM_USB_DEVICE_H__
+#define __SIM_USB_DEVICE_H__
+#include "simulator.h"
+
+#include <cstdint>
+#include <deque>
+
+namespace sim {
+
+/**
+ * Full speed USB link of the vendor interface (tud_vendor_* API)
+ * The host side is a pair of file descriptors (pipe, socket or pty), a
+ * host program speaks to the firmware through them. Once per 1 ms USB
+ * frame, up to USB_PACKETS_PER_FRAME bulk packets of 64 bytes move between
+ * the descriptors and the device FIFOs, OUT first. A packet is only read
+ * when the RX FIFO has room for it (NAK otherwise), a short IN packet is
+ * only sent once the firmware flushed. FIFO sizes are the firmware ones.
+ **/
+class UsbDevice : public Component {
+public:
+    /**
+     * Connects the host side, the device is then mounted
+     * @param readFd OUT data written by the host program
+     * @param writeFd IN data read by the host program
+     **/
+    void connect(int readFd, int writeFd);
+
+    /**
+     * Disconnects the host side (the descriptors are not closed)
+     **/
+    void disconnect();
+
+    bool mounted() const { return readFd_ >= 0; }
+
+    uint64_t nextEvent() const override;
+    void run(uint64_t now) override;
+
+    // tud_vendor_* API
+    uint32_t available() const { return static_cast<uint32_t>(rx_.size()); }
+    uint32_t read(void* buffer, uint32_t size);
+    uint32_t writeAvailable() const;
+    uint32_t write(const void* buffer, uint32_t size);
+    void flush();
+
+    uint64_t inPackets = 0;             // Device to host
+    uint64_t inTransfers = 0;           // Ended by a short packet or a flush
+    uint64_t inBytes = 0;
+    uint64_t outPackets = 0;            // Host to device
+    uint64_t outBytes = 0;
+    uint64_t nakFrames = 0;             // Frames with IN data the host did not take
+
+private:
+    int readFd_ = -1;
+    int writeFd_ = -1;
+    uint64_t nextFrame_ = 0;
+    bool flushed_ = false;              // The FIFO content ends a transfer
+    std::deque<uint8_t> rx_;
+    std::deque<uint8_t> tx_;
+};
+
+}
+
+#endif
@@ -0,0 +1,394 @@
+/**
+ * Protocol engine tests
+ * protocol_frame and protocol_poll are driven directly from core 0 : frames
+ * of a station are given as the receiver does (pool buffers, bytes
+ * following the address), the loop of the bus engine runs in between and
+ * the frames the engine answers are read on the simulated bus. Each case
+ * walks a path of the (state, event) table : a whole transaction, reply
+ * timeouts, frames sent again, call backs not echoed and frames out of
+ * order. Engine logs are printed as they come (core 0). Without arguments
+ * every case runs, one after the other on the same simulated time line;
+ * ctest runs them one by one.
+ **/
+#include "sim/bus.h"
+#include "sim/dut_port.h"
+#include "sim/rp2040.h"
+#include "sim/simulator.h"
+#include "sim/station.h"
+#include "src/bus_stats.h"
+#include "src/clock_detect.h"
+#include "src/frame_pool.h"
+#include "src/hdlc_rx.h"
+#include "src/protocol.h"
+#include "src/scheduler.h"
+#include "src/transceiver.h"
+#include "src/wake.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define DATA_RX_PIN 0
+#define CLK_RX_PIN 1
+#define RX_TRCV_ENABLE_PIN 2
+#define DATA_TX_PIN 3
+#define CLK_TX_PIN 4
+#define TX_TRCV_ENABLE_PIN 5
+#define STATION 3
+#define CASE_TIME_MS 1000           // Simulated time left to each case
+
+namespace {
+
+uint32_t failures = 0;
+std::vector<std::vector<uint8_t>> sent;     // Frames of the engine on the bus (address first, no CRC)
+
+#define CHECK(c) check((c), #c, __LINE__)
+
+void check(bool ok, const char* what, int line)
+{
+    if(!ok){
+        printf("  FAILED line %d : %s\n", line, what);
+        ++failures;
+    }
+}
+
+/**
+ * Gives a frame of the station to the engine, as received now
+ * @param bytes Frame following the address
+ * @param ageUs Time since the end of the frame
+ **/
+void deliver(const std::vector<uint8_t>& bytes, uint32_t ageUs = 0)
+{
+    uint8_t* frame = pool_alloc(bytes.size());
+    memcpy(frame, bytes.data(), bytes.size());
+    protocol_frame(frame, bytes.size(), time_us_32() - ageUs);
+    pool_release(frame);
+}
+
+/**
+ * Control word of the station
+ **/
+void control(uint8_t ctrl)
+{
+    deliver({ctrl, STATION});
+}
+
+/**
+ * Consigne of the station asking for a message of a given length
+ **/
+void consigne(uint16_t len = 4)
+{
+    deliver({0x00, STATION, 0x00, 0x00, 0x01, 0x02, static_cast<uint8_t>(len >> 8), static_cast<uint8_t>(len),
+             0x00, 0x00, 0x60, 0x00, 0x01});
+}
+
+/**
+ * Runs the loop of the bus engine for a given time : events, deadlines and
+ * call backs, sleeping in between
+ **/
+void run(uint32_t us)
+{
+    absolute_time_t end = make_timeout_time_us(us);
+    while(absolute_time_diff_us(get_absolute_time(), end) > 0){
+        wake_service();
+        protocol_poll();
+        wake_sleep(end);
+    }
+}
+
+NR_STATE state()
+{
+    return protocol_session(STATION)->state;
+}
+
+/**
+ * Counts the control words sent to the station
+ **/
+uint32_t sentCount(uint8_t ctrl)
+{
+    uint32_t n = 0;
+    for(const std::vector<uint8_t>& f : sent){
+        if(f.size() == 3 && f[0] == STATION && (f[1] & 0xF0) == ctrl){
+            ++n;
+        }
+    }
+    return n;
+}
+
+/**
+ * Initial call and echo, the station is SELECTED
+ **/
+void select()
+{
+    control(MCAPI | 3);
+    CHECK(state() == CALLED);
+    run(ECHO_TURNAROUND_US + ECHO_DURATION_US + 1000);
+    CHECK(state() == SELECTED);
+}
+
+/**
+ * Selected station asks for a message and waits to be called back
+ **/
+void wait()
+{
+    select();
+    consigne();
+    CHECK(state() == ACK);
+    control(MCAMA | 5);
+    CHECK(state() == WAITING);
+}
+
+/**
+ * Initial call, consigne, notice of waiting, call back and its answer
+ **/
+void testTransaction()
+{
+    select();
+    consigne();
+    CHECK(state() == ACK);
+    run(1000);
+    CHECK(sentCount(MCPCH) == 1);
+    control(MCAMA | 5);
+    CHECK(state() == WAITING);
+    run(CALL_TURNAROUND_US + BUS_IDLE_US + 1000);
+    CHECK(state() == CALL);
+    CHECK(sentCount(MCDISC) == 1);
+    control(MCUA);
+    CHECK(state() == IDLE);
+    CHECK(busStats.replyTimeouts == 0 && busStats.echoTimeouts == 0);
+    CHECK(busStats.retransmissions == 0 && busStats.callRetries == 0);
+    CHECK(protocol_latency().echo.count == 1 && protocol_latency().ack.count == 1);
+}
+
+/**
+ * No consigne after the echo, no notice of waiting after MCPCH
+ **/
+void testTimeouts()
+{
+    select();
+    run(REPLY_TIMEOUT_US - 1000);
+    CHECK(state() == SELECTED);
+    run(2000);
+    CHECK(state() == IDLE);
+    CHECK(busStats.stations[STATION].replyTimeouts == 1);
+    select();
+    consigne();
+    run(REPLY_TIMEOUT_US + 1000);
+    CHECK(state() == IDLE);
+    CHECK(sentCount(MCPCH) == 1);
+    CHECK(busStats.stations[STATION].replyTimeouts == 2);
+    CHECK(busStats.echoTimeouts == 0);
+}
+
+/**
+ * Initial call sent again before the echo, consigne sent again as MCPCH
+ * was lost, initial call sent again while waiting
+ **/
+void testRetransmissions()
+{
+    control(MCAPI | 3);
+    run(ECHO_TURNAROUND_US / 2);
+    control(MCAPI | 3);
+    CHECK(state() == CALLED);
+    CHECK(busStats.stations[STATION].retransmissions == 1);
+    run(ECHO_TURNAROUND_US + ECHO_DURATION_US + 1000);
+    CHECK(state() == SELECTED);
+    consigne();
+    run(1000);
+    consigne();
+    CHECK(state() == ACK);
+    run(1000);
+    CHECK(sentCount(MCPCH) == 2);
+    CHECK(busStats.stations[STATION].retransmissions == 2);
+    control(MCAMA | 5);
+    CHECK(state() == WAITING);
+    control(MCAPI | 3);
+    CHECK(state() == CALLED);
+    CHECK(busStats.stations[STATION].retransmissions == 3);
+    CHECK(protocol_session(STATION)->consigneFrame == nullptr);
+    run(ECHO_TURNAROUND_US + ECHO_DURATION_US + 1000);
+    CHECK(state() == SELECTED);
+}
+
+/**
+ * Call backs not echoed are sent again after a growing backoff, then the
+ * station is dropped
+ **/
+void testCallRetries()
+{
+    RetryPolicy policy = {2, 2000, 1000, 1500};
+    protocol_set_retry_policy(policy);
+    wait();
+    run(CALL_TURNAROUND_US + BUS_IDLE_US + 1000);
+    CHECK(state() == CALL);
+    CHECK(sentCount(MCDISC) == 1);
+    // Echo timeout, then the backoff
+    run(policy.echoTimeoutUs);
+    CHECK(state() == WAITING);
+    CHECK(busStats.stations[STATION].callRetries == 1);
+    run(policy.backoffUs + CALL_TURNAROUND_US + BUS_IDLE_US);
+    CHECK(state() == CALL);
+    CHECK(sentCount(MCDISC) == 2);
+    run(policy.echoTimeoutUs + policy.maxBackoffUs + CALL_TURNAROUND_US + BUS_IDLE_US);
+    CHECK(sentCount(MCDISC) == 3);
+    CHECK(busStats.stations[STATION].callRetries == 2);
+    run(policy.echoTimeoutUs + 1000);
+    CHECK(state() == IDLE);
+    CHECK(sentCount(MCDISC) == 3);
+    CHECK(busStats.stations[STATION].echoTimeouts == 1);
+    protocol_set_retry_policy({CALL_RETRIES, CALL_ECHO_TIMEOUT_US, CALL_BACKOFF_US, CALL_BACKOFF_MAX_US});
+}
+
+/**
+ * Frames not expected in the state of the session are ignored, as are
+ * malformed ones
+ **/
+void testOutOfOrder()
+{
+    control(MCAMA | 5);
+    control(MCUA);
+    consigne();
+    deliver({0x00, STATION, 0x00, 0x01, 0x02});
+    CHECK(state() == IDLE);
+    // Station out of range, control word with extra bytes, too short
+    deliver({MCAPI | 3, NR_MAX_STATIONS});
+    deliver({MCAPI | 3, STATION, 0x00});
+    deliver({MCAPI | 3});
+    CHECK(state() == IDLE);
+    select();
+    control(MCAMA | 5);
+    control(MCUA);
+    CHECK(state() == SELECTED);
+    // Consigne shorter than announced, the transaction is dropped
+    deliver({0x00, STATION, 0x00, 0x00, 0x01, 0x02, 0x00, 0x04, 0x00, 0x00, 0x60, 0x00});
+    CHECK(state() == IDLE);
+    select();
+    consigne();
+    CHECK(state() == ACK);
+    control(MCUA);
+    CHECK(state() == ACK);
+    control(MCAMA | 5);
+    CHECK(state() == WAITING);
+    control(MCUA);
+    consigne();
+    CHECK(state() == WAITING);
+    run(CALL_TURNAROUND_US + BUS_IDLE_US + 1000);
+    CHECK(state() == CALL);
+    consigne();
+    control(MCAMA | 5);
+    CHECK(state() == CALL);
+    control(MCUA);
+    CHECK(state() == IDLE);
+    CHECK(sentCount(MCPCH) == 1 && sentCount(MCDISC) == 1 && sent.size() == 2);
+    CHECK(busStats.retransmissions == 0 && busStats.replyTimeouts == 0);
+}
+
+/**
+ * Deadline already reached when armed : a frame handled after the poll of
+ * the loop arms it in the past, the loop must not sleep past it
+ **/
+void testPastDeadline()
+{
+    run(1000);
+    // Loop iteration : events taken, sessions polled, then the frame
+    wake_service();
+    protocol_poll();
+    deliver({MCAPI | 3, STATION}, ECHO_TURNAROUND_US * 2);
+    CHECK(state() == CALLED);
+    uint32_t start = time_us_32();
+    wake_sleep(make_timeout_time_ms(100));
+    CHECK(time_us_32() - start < 100);
+    run(ECHO_DURATION_US + 1000);
+    CHECK(state() == SELECTED);
+    CHECK(protocol_latency().echo.count == 1);
+}
+
+struct TestCase {
+    const char* name;
+    void (*run)();
+};
+
+const TestCase cases[] = {
+    {"transaction", testTransaction},
+    {"timeouts", testTimeouts},
+    {"retransmissions", testRetransmissions},
+    {"call_retries", testCallRetries},
+    {"out_of_order", testOutOfOrder},
+    {"past_deadline", testPastDeadline},
+};
+
+/**
+ * Runs a case from idle sessions and cleared statistics
+ **/
+void runCase(const TestCase& c)
+{
+    uint32_t before = failures;
+    protocol_init(0);
+    bus_stats_reset();
+    memset(&protocol_latency(), 0, sizeof(ReplyLatencyReport));
+    run(1000);
+    sent.clear();
+    sim::Simulator& s = sim::Simulator::instance();
+    s.setStopTime(s.now() + CASE_TIME_MS * 1000000ull);
+    c.run();
+    printf("%-16s %s\n", c.name, failures == before ? "ok" : "FAILED");
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<const TestCase*> selected;
+    for(int i = 1; i < argc; ++i){
+        std::string a = argv[i];
+        const TestCase* found = nullptr;
+        for(const TestCase& c : cases){
+            if(a == c.name){
+                found = &c;
+            }
+        }
+        if(found == nullptr){
+            fprintf(stderr, "Usage: %s [case...]\nCases:", argv[0]);
+            for(const TestCase& c : cases){
+                fprintf(stderr, " %s", c.name);
+            }
+            fprintf(stderr, "\n");
+            return 2;
+        }
+        selected.push_back(found);
+    }
+    if(selected.empty()){
+        for(const TestCase& c : cases){
+            selected.push_back(&c);
+        }
+    }
+
+    sim::Simulator& s = sim::Simulator::instance();
+    sim::Bus bus(BusConfig::bitNs);
+    sim::DutPort dut(s.mcu(), DATA_RX_PIN, CLK_RX_PIN, TX_TRCV_ENABLE_PIN);
+    sim::BusMonitor monitor(bus, &dut);
+    bus.attach(&dut);
+    bus.attach(&monitor);
+    s.addComponent(&bus);
+    monitor.startMeasure(0);
+    monitor.setDutLog(&sent);
+
+    s.firmwareEnter();
+    try{
+        // Same setup as the bus engine, on this core
+        TransceiverPins pins = {DATA_RX_PIN, RX_TRCV_ENABLE_PIN, DATA_TX_PIN, CLK_TX_PIN, TX_TRCV_ENABLE_PIN};
+        configureTransceiver(0, pins);
+        setReceiverAddress(0);
+        enableReceiver(true);
+        wake_init();
+        for(const TestCase* c : selected){
+            runCase(*c);
+        }
+    }catch(const sim::Stop&){
+        printf("Simulated time out\n");
+        ++failures;
+    }
+    s.firmwareExit();
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,195 @@
+/**
+ * Capture file (.nrc) tool
+ *   nrc_convert capture.pcap out.nrc   converts a firmware capture (console 'c')
+ *   nrc_convert --dump file.nrc        prints records in the replay text format
+ * The firmware capture has no echoes (flags only), a station echo is added
+ * after each call back of the master so the replay completes transactions.
+ **/
+#include "sim/capture_file.h"
+#include "src/capture.h"
+#include "src/picoreseau.hxx"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Options {
+    std::string input;
+    std::string output;
+    bool dump = false;
+    uint64_t bitNs = 2000;          // Bus bit period, gives the frame start from its end
+    uint32_t echoUs = 300;          // Station echo added after call backs, 0 : none
+    uint32_t turnaroundUs = 50;     // Idle time before the added echo
+};
+
+void usage(const char* prog)
+{
+    fprintf(stderr,
+        "Usage: %s [options] capture.pcap out.nrc\n"
+        "       %s --dump file.nrc\n"
+        "  --bit-ns NS       Bus bit period (default 2000, 500 kbit/s)\n"
+        "  --echo-us US      Station echo added after call backs (default 300, 0 for none)\n", prog, prog);
+}
+
+bool parse(int argc, char** argv, Options& o)
+{
+    std::vector<std::string> files;
+    for(int i = 1; i < argc; ++i){
+        std::string a = argv[i];
+        if(a == "--dump"){
+            o.dump = true;
+        }else if(a == "--bit-ns" && i + 1 < argc){
+            o.bitNs = strtoull(argv[++i], nullptr, 0);
+        }else if(a == "--echo-us" && i + 1 < argc){
+            o.echoUs = strtoul(argv[++i], nullptr, 0);
+        }else if(a.size() > 1 && a[0] == '-'){
+            return false;
+        }else{
+            files.push_back(a);
+        }
+    }
+    if(o.dump){
+        if(files.size() != 1){
+            return false;
+        }
+        o.input = files[0];
+        return true;
+    }
+    if(files.size() != 2){
+        return false;
+    }
+    o.input = files[0];
+    o.output = files[1];
+    return true;
+}
+
+bool readFile(const std::string& path, std::vector<uint8_t>& data)
+{
+    FILE* f = fopen(path.c_str(), "rb");
+    if(f == nullptr){
+        return false;
+    }
+    uint8_t buffer[4096];
+    size_t n;
+    while((n = fread(buffer, 1, sizeof(buffer), f)) > 0){
+        data.insert(data.end(), buffer, buffer + n);
+    }
+    fclose(f);
+    return true;
+}
+
+/**
+ * Converts a firmware pcap capture
+ **/
+int convert(const Options& opt)
+{
+    std::vector<uint8_t> data;
+    if(!readFile(opt.input, data)){
+        fprintf(stderr, "Unable to read %s\n", opt.input.c_str());
+        return 1;
+    }
+    PcapHeader h;
+    if(data.size() < sizeof(h) || (memcpy(&h, data.data(), sizeof(h)), h.magic != 0xa1b2c3d4) ||
+       h.linkType != CAPTURE_LINKTYPE){
+        fprintf(stderr, "%s is not a picoreseau capture\n", opt.input.c_str());
+        return 1;
+    }
+    sim::CaptureWriter out;
+    size_t pos = sizeof(h);
+    uint64_t origin = UINT64_MAX;
+    uint32_t skipped = 0;
+    while(pos + sizeof(PcapRecord) <= data.size()){
+        PcapRecord r;
+        memcpy(&r, &data[pos], sizeof(r));
+        pos += sizeof(r);
+        if(r.inclLen == 0 || pos + r.inclLen > data.size()){
+            break;
+        }
+        uint8_t flags = data[pos];
+        const uint8_t* frame = &data[pos + 1];
+        uint32_t len = r.inclLen - 1;
+        pos += r.inclLen;
+        if((flags & (CAPTURE_SHORT | CAPTURE_OVERRUN)) || r.inclLen != r.origLen || len == 0){
+            ++skipped;
+            continue;
+        }
+        uint8_t nrcFlags = frame[0] != 0 ? sim::NRC_MASTER : 0;
+        if(flags & CAPTURE_ABORTED){
+            nrcFlags |= sim::NRC_ABORTED;
+        }else{
+            if(len < 3){
+                ++skipped;
+                continue;
+            }
+            len -= 2;
+            if(!(flags & CAPTURE_CRC_OK)){
+                nrcFlags |= sim::NRC_BAD_CRC;
+            }
+        }
+        // Timestamp is the closing flag, records start with the opening flag
+        uint64_t end = r.tsSec * 1000000ull + r.tsUsec;
+        uint64_t bits = (len + 4) * 8 + (len + 2) * 8 / 5 / 4;      // Flags, CRC and some stuffing
+        uint64_t startUs = end - bits * opt.bitNs / 1000;
+        if(origin == UINT64_MAX){
+            origin = startUs;
+        }
+        uint64_t t = startUs > origin ? startUs - origin : 0;
+        out.frame(t, frame, len, nrcFlags);
+        bool callBack = (nrcFlags == sim::NRC_MASTER) && len >= 2 &&
+            ((frame[1] & 0xF0) == MCAPA || frame[1] == MCDISC);
+        if(callBack && opt.echoUs){
+            out.echo(end + opt.turnaroundUs - origin, opt.echoUs, 0);
+        }
+    }
+    if(!out.write(opt.output)){
+        fprintf(stderr, "Unable to write %s\n", opt.output.c_str());
+        return 1;
+    }
+    printf("%u records written, %u frames skipped (short, overrun or truncated)\n", out.size(), skipped);
+    return 0;
+}
+
+/**
+ * Prints a capture file, station records use the replay text format
+ **/
+int dump(const Options& opt)
+{
+    sim::CaptureFile file;
+    if(!file.open(opt.input)){
+        fprintf(stderr, "%s is not a valid capture file\n", opt.input.c_str());
+        return 1;
+    }
+    printf("# %u records, %lu us\n", file.size(), static_cast<unsigned long>(file.header().durationUs));
+    for(uint32_t i = 0; i < file.size(); ++i){
+        const sim::NrcRecord& r = file.record(i);
+        bool master = r.flags & sim::NRC_MASTER;
+        printf("%s%-8lu", master ? "# " : "", static_cast<unsigned long>(r.timeUs));
+        if(r.kind == sim::NRC_ECHO){
+            printf("echo %u", r.durationUs);
+        }else{
+            const uint8_t* b = file.bytes(i);
+            for(uint16_t j = 0; j < r.length; ++j){
+                printf("%02x", b[j]);
+            }
+        }
+        printf("%s%s%s\n", master ? "    master" : "", (r.flags & sim::NRC_BAD_CRC) ? " bad CRC" : "",
+               (r.flags & sim::NRC_ABORTED) ? " aborted" : "");
+    }
+    return 0;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    if(!parse(argc, argv, opt)){
+        usage(argv[0]);
+        return 1;
+    }
+    return opt.dump ? dump(opt) : convert(opt);
+}
@@ -0,0 +1,471 @@
+/**
+ * Cycle level timing of the HDLC PIO programs
+ * Runs the assembled hdlc_rx and clock_tx/hdlc_tx programs on the PIO
+ * interpreter against synthetic bus waveforms, checks every frame and
+ * reports instructions per bit, slack against the bit period and the
+ * highest bit rate each program sustains. Frames are random payloads and
+ * stuffing heavy patterns (runs of 0xFF, 0x7E), with aborted frames for RX.
+ **/
+#include "sim/hdlc_bits.h"
+#include "sim/pio_cpu.h"
+#include "src/bus_timing.h"
+
+#include "hdlc_rx.pio.h"
+#include "hdlc_tx.pio.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+#define DATA_PIN 0          // RX data in / TX data out
+#define CLK_PIN 1           // RX clock in (data pin + 1) / TX clock out
+#define TX_EN_PIN 2         // TX clock enable
+
+// IRQ numbers of hdlc_rx.pio (state machine 0) and hdlc_tx.pio (state machine 1)
+#define RX_ABORT_INT 0
+#define RX_DATA_DONE 1
+#define FLAG_SENT_IRQ 1
+
+struct Options {
+    double sysMHz = 125.0;
+    float clkdiv = 1.0f;            // Divider of the hdlc_rx state machine, least one of hdlc_tx
+    double rateKbps = BUS_BIT_RATE / 1000.0;     // Bus rate the slack is reported for
+    uint frames = 200;              // Frames checked for each tried bit rate
+    uint maxLen = 64;
+    uint32_t seed = 1;
+    bool rx = true;
+    bool tx = true;
+};
+
+struct Frame {
+    std::vector<uint8_t> bytes;     // Without CRC
+    bool aborted;
+};
+
+/**
+ * Payloads : random, stuffing heavy runs and short frames
+ **/
+std::vector<Frame> makeFrames(const Options& opt, uint count, std::mt19937& rng, bool aborts)
+{
+    static const uint8_t patterns[] = {0xFF, 0x7E, 0x7F, 0xFE, 0x3F, 0xF8};
+    std::vector<Frame> frames;
+    for(uint i = 0; i < count; ++i){
+        Frame f;
+        uint len = 1 + rng() % opt.maxLen;
+        uint kind = rng() % 8;
+        for(uint j = 0; j < len; ++j){
+            uint8_t b;
+            switch(kind){
+            case 0: b = 0xFF; break;
+            case 1: b = 0x7E; break;
+            case 2: b = (j & 1) ? 0x7E : 0xFF; break;
+            case 3: b = patterns[rng() % sizeof(patterns)]; break;
+            default: b = static_cast<uint8_t>(rng()); break;
+            }
+            f.bytes.push_back(b);
+        }
+        f.aborted = aborts && (rng() % 10) == 0;
+        frames.push_back(f);
+    }
+    return frames;
+}
+
+std::vector<uint8_t> withCrc(const std::vector<uint8_t>& bytes)
+{
+    std::vector<uint8_t> out = bytes;
+    uint16_t crc = sim::crc16X25(bytes.data(), bytes.size());
+    out.push_back(crc & 0xFF);
+    out.push_back(crc >> 8);
+    return out;
+}
+
+struct Timing {
+    bool ok = true;
+    std::string error;
+    uint64_t bits = 0;
+    uint64_t frames = 0;
+    uint64_t aborts = 0;
+    uint64_t instructions = 0;      // Instructions executed by the measured program
+    uint minInstr = UINT32_MAX;     // Instructions per bit
+    uint maxInstr = 0;
+    uint maxRead = 0;               // RX : clock edge to the last data read (cycles)
+    uint maxReady = 0;              // RX : clock edge to waiting for the next bit
+    uint maxWrite = 0;              // TX : clock falling edge to the data written
+    uint minSetup = UINT32_MAX;     // TX : data written to the clock rising edge
+};
+
+void perBit(Timing& t, uint instructions)
+{
+    t.minInstr = std::min(t.minInstr, instructions);
+    t.maxInstr = std::max(t.maxInstr, instructions);
+    t.instructions += instructions;
+}
+
+/**
+ * Receives frames with hdlc_rx configured as hdlc_rx_program_init does
+ * The clock has a 50 % duty cycle, data changes on its falling edge
+ **/
+Timing runRx(const Options& opt, uint bitCycles, uint count, uint32_t seed)
+{
+    Timing t;
+    std::mt19937 rng(seed);
+    std::vector<Frame> frames = makeFrames(opt, count, rng, true);
+    sim::PioCpu cpu;
+    uint offset = cpu.load(hdlc_rx_program);
+    pio_sm_config c = hdlc_rx_program_get_default_config(offset);
+    sm_config_set_in_pins(&c, DATA_PIN);
+    sm_config_set_jmp_pin(&c, DATA_PIN);
+    sm_config_set_fifo_join(&c, PIO_FIFO_JOIN_RX);
+    sm_config_set_in_shift(&c, true, false, 8);
+    sm_config_set_clkdiv(&c, opt.clkdiv);
+    cpu.start(0, offset, c);
+    const sim::PioCpu::StateMachine& sm = cpu.sm(0);
+
+    uint high = bitCycles / 2;
+    std::vector<uint8_t> segment;
+    size_t expected = 0;                // Next frame to check
+    uint64_t edge = 0;                  // Cycle of the last rising edge
+    uint64_t edgeInstr = 0;
+    bool measuring = false;             // Until the state machine waits again
+    bool started = false;               // Bit processing started
+    bool edgeSeen = false;
+
+    auto run = [&](uint cycles){
+        for(uint i = 0; i < cycles && t.ok; ++i){
+            cpu.step();
+            if(measuring){
+                if(sm.last.readData){
+                    t.maxRead = std::max(t.maxRead, static_cast<uint>(cpu.cycle() - edge));
+                }
+                // The edge is seen once the wait for it completes
+                started = started || sm.last.executed;
+                if(started && sm.last.stalled && (sm.last.instr >> 13) == 1){
+                    t.maxReady = std::max(t.maxReady, static_cast<uint>(cpu.cycle() - edge));
+                    perBit(t, static_cast<uint>(sm.instructions - edgeInstr));
+                    measuring = false;
+                }
+            }
+            sim::PioCpu::StateMachine& s = cpu.sm(0);
+            while(!s.rx.empty()){
+                segment.push_back(s.rx.pop() >> 24);
+            }
+            if(cpu.irqFlags() & (1u << RX_ABORT_INT)){
+                cpu.clearIrq(RX_ABORT_INT);
+                if(expected >= frames.size() || !frames[expected].aborted){
+                    t.ok = false;
+                    t.error = "unexpected abort before frame " + std::to_string(expected);
+                }
+                ++expected;
+                ++t.aborts;
+                segment.clear();
+            }
+            if(cpu.irqFlags() & (1u << RX_DATA_DONE)){
+                cpu.clearIrq(RX_DATA_DONE);
+                if(!segment.empty()){
+                    if(expected >= frames.size() || frames[expected].aborted ||
+                       segment != withCrc(frames[expected].bytes)){
+                        t.ok = false;
+                        t.error = "frame " + std::to_string(expected) + " received wrong";
+                    }
+                    ++expected;
+                    ++t.frames;
+                }
+                segment.clear();
+            }
+        }
+    };
+
+    for(const Frame& f : frames){
+        sim::HdlcEncoder enc;
+        if(f.aborted){
+            enc.abortedFrame(f.bytes);
+            enc.flag();                 // Its first zero ends the abort
+        }else{
+            enc.frame(f.bytes);
+        }
+        while(!enc.empty() && t.ok){
+            // Falling edge : data changes
+            cpu.setInput(CLK_PIN, false);
+            cpu.setInput(DATA_PIN, enc.next());
+            run(bitCycles - high);
+            cpu.setInput(CLK_PIN, true);
+            if(measuring && edgeSeen){
+                // Still busy with the previous bit
+                t.maxReady = std::max(t.maxReady, bitCycles);
+            }
+            edge = cpu.cycle();
+            edgeInstr = sm.instructions;
+            measuring = true;
+            started = false;
+            edgeSeen = true;
+            run(high);
+            ++t.bits;
+        }
+        // Idle bus (no clock), random length to vary the phase of the divider
+        cpu.setInput(CLK_PIN, false);
+        run(bitCycles * 4 + rng() % 64);
+    }
+    if(t.ok && expected != frames.size()){
+        t.ok = false;
+        t.error = std::to_string(frames.size() - expected) + " frames not received";
+    }
+    return t;
+}
+
+/**
+ * Sends frames with clock_tx and hdlc_tx configured as hdlc_tx.pio does
+ * Frames are chained as the firmware does, a third of them start a new
+ * transmission. The data pin is sampled on the clock rising edge.
+ * @param clockDiv clock_tx divider (4 cycles per bit)
+ **/
+Timing runTx(const Options& opt, float clockDiv, uint count, uint32_t seed)
+{
+    Timing t;
+    std::mt19937 rng(seed);
+    std::vector<Frame> frames = makeFrames(opt, count, rng, false);
+    sim::PioCpu cpu;
+    uint clockOffset = cpu.load(clock_tx_program);
+    pio_sm_config cc = clock_tx_program_get_default_config(clockOffset);
+    sm_config_set_sideset_pins(&cc, CLK_PIN);
+    sm_config_set_in_pins(&cc, TX_EN_PIN);
+    sm_config_set_clkdiv(&cc, clockDiv);
+    uint dataOffset = cpu.load(hdlc_tx_program);
+    pio_sm_config dc = hdlc_tx_program_get_default_config(dataOffset);
+    sm_config_set_set_pins(&dc, DATA_PIN, 1);
+    sm_config_set_in_pins(&dc, TX_EN_PIN);
+    // Ones read back from the data pin itself, no collision
+    sm_config_set_jmp_pin(&dc, DATA_PIN);
+    sm_config_set_fifo_join(&dc, PIO_FIFO_JOIN_TX);
+    sm_config_set_out_shift(&dc, true, true, 8);
+    // Divided as the firmware does unless the bit is shorter than HDLC_TX_BIT_CYCLES
+    sm_config_set_clkdiv(&dc, std::max(opt.clkdiv, clockDiv * 4 / HDLC_TX_BIT_CYCLES));
+    cpu.setPinDir(DATA_PIN, true);
+    cpu.setPinDir(CLK_PIN, true);
+    cpu.start(0, clockOffset, cc);
+    cpu.start(1, dataOffset, dc);
+    const sim::PioCpu::StateMachine& data = cpu.sm(1);
+
+    sim::HdlcDecoder decoder;
+    size_t next = 0;                    // Next frame given to the "DMA"
+    size_t checked = 0;
+    std::vector<uint8_t> pending;       // Bytes not yet in the TX FIFO
+    bool lastFrame = false;             // All bytes of the current frame queued
+    bool clock = false;
+    uint64_t falling = 0;
+    uint64_t fallingInstr = 0;
+    uint64_t written = 0;               // Last data write
+    bool measure = false;
+    bool dataLevel = false;             // Data pin during the previous cycle
+    uint64_t resumeAt = 0;              // End of the idle time between transmissions
+    uint64_t timeout = static_cast<uint64_t>(count) * ((opt.maxLen + 4) * 10 + 256) *
+        static_cast<uint64_t>(clockDiv * 4 + opt.clkdiv * 16);
+
+    auto startFrame = [&](){
+        pending = withCrc(frames[next].bytes);
+        ++next;
+        lastFrame = false;
+    };
+    startFrame();
+    cpu.setInput(TX_EN_PIN, true);
+    while(checked < frames.size() && t.ok){
+        // DMA : keeps the FIFO full
+        sim::PioCpu::StateMachine& s = cpu.sm(1);
+        while(!pending.empty() && !s.tx.full()){
+            s.tx.push(pending.front());
+            pending.erase(pending.begin());
+        }
+        if(pending.empty()){
+            lastFrame = true;
+        }
+        if(resumeAt && cpu.cycle() >= resumeAt){
+            cpu.setInput(TX_EN_PIN, true);
+            resumeAt = 0;
+        }
+        dataLevel = cpu.pin(DATA_PIN);
+        cpu.step();
+        if(data.last.wrotePins){
+            written = cpu.cycle();
+            if(measure){
+                t.maxWrite = std::max(t.maxWrite, static_cast<uint>(written - falling));
+                if(clock){
+                    t.minSetup = 0;     // Written after the rising edge
+                }
+            }
+        }
+        bool level = cpu.pin(CLK_PIN);
+        if(level != clock){
+            clock = level;
+            if(!clock){
+                if(measure){
+                    perBit(t, static_cast<uint>(data.instructions - fallingInstr));
+                }
+                falling = cpu.cycle();
+                fallingInstr = data.instructions;
+                measure = true;
+            }else{
+                // No write after the flag, the pin keeps its last zero
+                if(measure && written > falling){
+                    t.minSetup = std::min(t.minSetup, static_cast<uint>(cpu.cycle() - written));
+                }
+                ++t.bits;
+                // At least one cycle of setup time
+                if(decoder.push(dataLevel) == sim::HdlcDecoder::Event::Frame){
+                    if(decoder.frame() != withCrc(frames[checked].bytes)){
+                        t.ok = false;
+                        t.error = "frame " + std::to_string(checked) + " sent wrong";
+                    }
+                    ++checked;
+                    ++t.frames;
+                }
+            }
+        }
+        // FLAG_SENT : the firmware chains the next frame or stops the clock
+        if(cpu.irqFlags() & (1u << FLAG_SENT_IRQ)){
+            cpu.clearIrq(FLAG_SENT_IRQ);
+            if(lastFrame && s.tx.empty() && next < frames.size()){
+                startFrame();
+                if(rng() % 3 == 0){
+                    cpu.setInput(TX_EN_PIN, false);
+                    resumeAt = cpu.cycle() + 64 + rng() % 64;
+                    measure = false;
+                }
+            }else if(lastFrame && next >= frames.size()){
+                cpu.setInput(TX_EN_PIN, false);
+            }
+        }
+        if(cpu.cycle() > timeout){
+            t.ok = false;
+            t.error = std::to_string(frames.size() - checked) + " frames not sent";
+        }
+    }
+    return t;
+}
+
+void printTiming(const char* name, uint length, const Options& opt, const Timing& t)
+{
+    printf("%s  %u instructions, clkdiv %.2f (%.2f MHz)\n", name, length, opt.clkdiv, opt.sysMHz / opt.clkdiv);
+    printf("  Instructions per bit      min %u  avg %.2f  max %u\n", t.minInstr,
+           t.bits ? static_cast<double>(t.instructions) / t.bits : 0.0, t.maxInstr);
+}
+
+void rxReport(const Options& opt)
+{
+    uint refCycles = static_cast<uint>(opt.sysMHz * 1000.0 / opt.rateKbps + 0.5);
+    Timing ref = runRx(opt, refCycles, opt.frames, opt.seed);
+    printTiming("hdlc_rx", sizeof(hdlc_rx_program_instructions) / 2, opt, ref);
+    printf("  Clock edge to data read   max %u cycles (input synchronizer included)\n", ref.maxRead);
+    printf("  Clock edge to next wait   max %u cycles\n", ref.maxReady);
+    int slack = static_cast<int>(refCycles) - static_cast<int>(ref.maxReady);
+    int readSlack = static_cast<int>(refCycles / 2) - static_cast<int>(ref.maxRead);
+    printf("  At %.1f kbit/s           %u cycles per bit, slack %d cycles (%.1f %%), data read slack %d cycles\n",
+           opt.rateKbps, refCycles, slack, 100.0 * slack / refCycles, readSlack);
+    printf("  Check at %.1f kbit/s      %s, %lu frames, %lu aborts, %lu bits%s%s\n", opt.rateKbps,
+           ref.ok ? "passed" : "FAILED", static_cast<unsigned long>(ref.frames), static_cast<unsigned long>(ref.aborts),
+           static_cast<unsigned long>(ref.bits), ref.ok ? "" : " : ", ref.error.c_str());
+    // Shortest bit period receiving every frame, then confirmed on a few longer ones
+    uint lo = 2;
+    uint hi = refCycles;
+    while(lo + 1 < hi){
+        uint mid = (lo + hi) / 2;
+        if(runRx(opt, mid, opt.frames, opt.seed + mid).ok){
+            hi = mid;
+        }else{
+            lo = mid;
+        }
+    }
+    for(uint c = hi + 1; c <= hi + 4 && c < refCycles; ++c){
+        if(!runRx(opt, c, opt.frames, opt.seed + c).ok){
+            hi = c + 1;
+        }
+    }
+    printf("  Maximum bit rate          %.1f kbit/s (%u cycles per bit)\n", opt.sysMHz * 1000.0 / hi, hi);
+    if(opt.clkdiv == 1.0f && hi > HDLC_RX_MIN_CYCLES){
+        printf("  HDLC_RX_MIN_CYCLES (%u) of bus_timing.h is below this limit, update it\n", HDLC_RX_MIN_CYCLES);
+    }
+    printf("\n");
+}
+
+void txReport(const Options& opt)
+{
+    // clock_tx runs 4 cycles per bit
+    float refDiv = static_cast<float>(opt.sysMHz * 1000.0 / opt.rateKbps / 4.0);
+    Timing ref = runTx(opt, refDiv, opt.frames, opt.seed);
+    printTiming("hdlc_tx", sizeof(hdlc_tx_program_instructions) / 2, opt, ref);
+    printf("  Clock fall to data write  max %u cycles\n", ref.maxWrite);
+    uint bitCycles = static_cast<uint>(refDiv * 4 + 0.5f);
+    printf("  At %.1f kbit/s           %u cycles per bit (clock_tx clkdiv %.2f), setup slack %u cycles (%.1f %% of the bit)\n",
+           opt.rateKbps, bitCycles, refDiv, ref.minSetup, 100.0 * ref.minSetup / bitCycles);
+    printf("  Check at %.1f kbit/s      %s, %lu frames, %lu bits%s%s\n", opt.rateKbps, ref.ok ? "passed" : "FAILED",
+           static_cast<unsigned long>(ref.frames), static_cast<unsigned long>(ref.bits),
+           ref.ok ? "" : " : ", ref.error.c_str());
+    // Smallest clock_tx divider (1/256 steps) sending every frame
+    uint lo = 255;
+    uint hi = static_cast<uint>(refDiv * 256);
+    while(lo + 1 < hi){
+        uint mid = (lo + hi) / 2;
+        if(runTx(opt, mid / 256.0f, opt.frames, opt.seed + mid).ok){
+            hi = mid;
+        }else{
+            lo = mid;
+        }
+    }
+    for(uint d = hi + 1; d <= hi + 8; ++d){
+        if(!runTx(opt, d / 256.0f, opt.frames, opt.seed + d).ok){
+            hi = d + 1;
+        }
+    }
+    printf("  Maximum bit rate          %.1f kbit/s (clock_tx clkdiv %.2f, %.1f cycles per bit)\n",
+           opt.sysMHz * 1000.0 / (hi / 64.0), hi / 256.0, hi / 64.0);
+    if(opt.clkdiv == 1.0f && hi > HDLC_TX_MIN_CYCLES * 64){
+        printf("  HDLC_TX_MIN_CYCLES (%u) of bus_timing.h is below this limit, update it\n", HDLC_TX_MIN_CYCLES);
+    }
+    printf("\n");
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    for(int i = 1; i < argc; ++i){
+        std::string a = argv[i];
+        if(a == "--clkdiv" && i + 1 < argc){
+            opt.clkdiv = strtof(argv[++i], nullptr);
+        }else if(a == "--sys-mhz" && i + 1 < argc){
+            opt.sysMHz = strtod(argv[++i], nullptr);
+        }else if(a == "--rate" && i + 1 < argc){
+            opt.rateKbps = strtod(argv[++i], nullptr);
+        }else if(a == "--frames" && i + 1 < argc){
+            opt.frames = strtoul(argv[++i], nullptr, 0);
+        }else if(a == "--max-len" && i + 1 < argc){
+            opt.maxLen = strtoul(argv[++i], nullptr, 0);
+        }else if(a == "--seed" && i + 1 < argc){
+            opt.seed = strtoul(argv[++i], nullptr, 0);
+        }else if(a == "--rx"){
+            opt.tx = false;
+        }else if(a == "--tx"){
+            opt.rx = false;
+        }else{
+            fprintf(stderr, "Usage: %s [--rx|--tx] [--clkdiv DIV] [--rate KBPS] [--sys-mhz MHZ] "
+                            "[--frames N] [--max-len BYTES] [--seed N]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(opt.clkdiv < 1.0f || opt.frames == 0 || opt.maxLen == 0){
+        fprintf(stderr, "Invalid options\n");
+        return 1;
+    }
+    printf("System clock %.1f MHz, %u frames of 1 to %u bytes per tried bit rate\n\n", opt.sysMHz, opt.frames, opt.maxLen);
+    if(opt.rx){
+        rxReport(opt);
+    }
+    if(opt.tx){
+        txReport(opt);
+    }
+    return 0;
+}
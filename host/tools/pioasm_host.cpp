@@ -0,0 +1,561 @@
+/**
+ * Minimal PIO assembler used by the host build
+ * It understands the subset of the pioasm syntax used by this project and
+ * generates a C header compatible with pico_generate_pio_header output
+ * (with an extra program name field used by the simulator)
+ **/
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Instruction {
+    std::vector<std::string> tokens;    // Instruction tokens (without side-set/delay)
+    std::string sideSet;                // Side-set expression
+    std::string delay;                  // Delay expression
+    std::string source;                 // Source line (for listing)
+    int line = 0;
+};
+
+struct Program {
+    std::string name;
+    int sideSetCount = 0;
+    bool sideSetOpt = false;
+    bool sideSetPinDirs = false;
+    int wrapTarget = -1;
+    int wrap = -1;
+    int origin = -1;
+    std::map<std::string, int> labels;
+    std::map<std::string, int> defines;
+    std::map<std::string, int> publicDefines;
+    std::vector<Instruction> instructions;
+    std::vector<uint16_t> code;
+    std::string cSdk;
+};
+
+std::string fileName;
+std::map<std::string, int> globalDefines;
+
+[[noreturn]] void fail(int line, const std::string& msg)
+{
+    std::cerr << fileName << ":" << line << ": error: " << msg << std::endl;
+    exit(1);
+}
+
+std::string trim(const std::string& s)
+{
+    size_t b = s.find_first_not_of(" \t\r\n");
+    if(b == std::string::npos){
+        return "";
+    }
+    size_t e = s.find_last_not_of(" \t\r\n");
+    return s.substr(b, e - b + 1);
+}
+
+std::string lower(std::string s)
+{
+    for(auto& c : s){
+        c = std::tolower(static_cast<unsigned char>(c));
+    }
+    return s;
+}
+
+std::vector<std::string> split(const std::string& s)
+{
+    std::vector<std::string> ret;
+    std::string cur;
+    for(char c : s){
+        if(std::isspace(static_cast<unsigned char>(c)) || c == ','){
+            if(!cur.empty()){
+                ret.push_back(cur);
+                cur.clear();
+            }
+        }else{
+            cur += c;
+        }
+    }
+    if(!cur.empty()){
+        ret.push_back(cur);
+    }
+    return ret;
+}
+
+/**
+ * Evaluates a simple expression (number, define or label, with optional
+ * leading '-' or '!'/'~' for bitwise inversion)
+ **/
+int evaluate(const Program& p, const std::string& expr, int line)
+{
+    std::string e = trim(expr);
+    if(e.empty()){
+        fail(line, "empty expression");
+    }
+    if(e.front() == '(' && e.back() == ')'){
+        return evaluate(p, e.substr(1, e.size() - 2), line);
+    }
+    if(e[0] == '-'){
+        return -evaluate(p, e.substr(1), line);
+    }
+    if(e[0] == '~' || e[0] == '!'){
+        return ~evaluate(p, e.substr(1), line);
+    }
+    size_t plus = e.find('+');
+    if(plus != std::string::npos && plus > 0){
+        return evaluate(p, e.substr(0, plus), line) + evaluate(p, e.substr(plus + 1), line);
+    }
+    if(std::isdigit(static_cast<unsigned char>(e[0]))){
+        char* end = nullptr;
+        long v;
+        if(e.size() > 2 && e[0] == '0' && (e[1] == 'b' || e[1] == 'B')){
+            v = strtol(e.c_str() + 2, &end, 2);
+        }else{
+            v = strtol(e.c_str(), &end, 0);
+        }
+        if(*end != '\0'){
+            fail(line, "invalid number '" + e + "'");
+        }
+        return static_cast<int>(v);
+    }
+    auto it = p.defines.find(e);
+    if(it != p.defines.end()){
+        return it->second;
+    }
+    it = globalDefines.find(e);
+    if(it != globalDefines.end()){
+        return it->second;
+    }
+    it = p.labels.find(e);
+    if(it != p.labels.end()){
+        return it->second;
+    }
+    fail(line, "unknown symbol '" + e + "'");
+}
+
+int lookup(const std::map<std::string, int>& table, const std::string& key, int line, const char* what)
+{
+    auto it = table.find(lower(key));
+    if(it == table.end()){
+        fail(line, std::string("invalid ") + what + " '" + key + "'");
+    }
+    return it->second;
+}
+
+/**
+ * Parses the IRQ index (with optional rel modifier)
+ **/
+int irqIndex(const Program& p, const std::vector<std::string>& tokens, size_t from, int line)
+{
+    if(from >= tokens.size()){
+        fail(line, "missing IRQ number");
+    }
+    int idx = evaluate(p, tokens[from], line);
+    if(idx < 0 || idx > 7){
+        fail(line, "IRQ number out of range");
+    }
+    if((from + 1 < tokens.size()) && (lower(tokens[from + 1]) == "rel")){
+        idx |= 0x10;
+    }
+    return idx;
+}
+
+uint16_t encode(const Program& p, const Instruction& ins)
+{
+    static const std::map<std::string, int> jmpCond = {
+        {"!x", 1}, {"x--", 2}, {"!y", 3}, {"y--", 4}, {"x!=y", 5}, {"pin", 6}, {"!osre", 7}};
+    static const std::map<std::string, int> inSrc = {
+        {"pins", 0}, {"x", 1}, {"y", 2}, {"null", 3}, {"isr", 6}, {"osr", 7}};
+    static const std::map<std::string, int> outDst = {
+        {"pins", 0}, {"x", 1}, {"y", 2}, {"null", 3}, {"pindirs", 4}, {"pc", 5}, {"isr", 6}, {"exec", 7}};
+    static const std::map<std::string, int> movDst = {
+        {"pins", 0}, {"x", 1}, {"y", 2}, {"exec", 4}, {"pc", 5}, {"isr", 6}, {"osr", 7}};
+    static const std::map<std::string, int> movSrc = {
+        {"pins", 0}, {"x", 1}, {"y", 2}, {"null", 3}, {"status", 5}, {"isr", 6}, {"osr", 7}};
+    static const std::map<std::string, int> setDst = {
+        {"pins", 0}, {"x", 1}, {"y", 2}, {"pindirs", 4}};
+
+    const auto& t = ins.tokens;
+    std::string op = lower(t[0]);
+    uint16_t code = 0;
+    if(op == "nop"){
+        code = 0xa042;      // mov y, y
+    }else if(op == "jmp"){
+        int cond = 0;
+        size_t target = 1;
+        if(t.size() == 3){
+            cond = lookup(jmpCond, t[1], ins.line, "jmp condition");
+            target = 2;
+        }else if(t.size() != 2){
+            fail(ins.line, "invalid jmp");
+        }
+        code = (0u << 13) | (cond << 5) | (evaluate(p, t[target], ins.line) & 0x1f);
+    }else if(op == "wait"){
+        if(t.size() < 4){
+            fail(ins.line, "invalid wait");
+        }
+        int pol = evaluate(p, t[1], ins.line) & 1;
+        std::string src = lower(t[2]);
+        int source = 0;
+        int index = 0;
+        if(src == "gpio"){
+            source = 0;
+            index = evaluate(p, t[3], ins.line) & 0x1f;
+        }else if(src == "pin"){
+            source = 1;
+            index = evaluate(p, t[3], ins.line) & 0x1f;
+        }else if(src == "irq"){
+            source = 2;
+            index = irqIndex(p, t, 3, ins.line);
+        }else{
+            fail(ins.line, "invalid wait source '" + t[2] + "'");
+        }
+        code = (1u << 13) | (pol << 7) | (source << 5) | index;
+    }else if(op == "in" || op == "out"){
+        if(t.size() != 3){
+            fail(ins.line, "invalid " + op);
+        }
+        int count = evaluate(p, t[2], ins.line);
+        if(count < 1 || count > 32){
+            fail(ins.line, "bit count out of range");
+        }
+        if(op == "in"){
+            code = (2u << 13) | (lookup(inSrc, t[1], ins.line, "in source") << 5) | (count & 0x1f);
+        }else{
+            code = (3u << 13) | (lookup(outDst, t[1], ins.line, "out destination") << 5) | (count & 0x1f);
+        }
+    }else if(op == "push" || op == "pull"){
+        bool block = true;
+        bool cond = false;
+        for(size_t i = 1; i < t.size(); ++i){
+            std::string m = lower(t[i]);
+            if(m == "block"){
+                block = true;
+            }else if(m == "noblock"){
+                block = false;
+            }else if(m == "iffull" || m == "ifempty"){
+                cond = true;
+            }else{
+                fail(ins.line, "invalid " + op + " modifier '" + t[i] + "'");
+            }
+        }
+        code = (4u << 13) | ((op == "pull") << 7) | (cond << 6) | (block << 5);
+    }else if(op == "mov"){
+        if(t.size() != 3){
+            fail(ins.line, "invalid mov");
+        }
+        std::string src = lower(t[2]);
+        int mop = 0;
+        if(src.rfind("::", 0) == 0){
+            mop = 2;
+            src = src.substr(2);
+        }else if(!src.empty() && (src[0] == '!' || src[0] == '~')){
+            mop = 1;
+            src = src.substr(1);
+        }
+        code = (5u << 13) | (lookup(movDst, t[1], ins.line, "mov destination") << 5) |
+               (mop << 3) | lookup(movSrc, src, ins.line, "mov source");
+    }else if(op == "irq"){
+        int clr = 0;
+        int wait = 0;
+        size_t idx = 1;
+        if(t.size() > 1){
+            std::string m = lower(t[1]);
+            if(m == "wait"){
+                wait = 1;
+                idx = 2;
+            }else if(m == "clear"){
+                clr = 1;
+                idx = 2;
+            }else if(m == "nowait" || m == "set"){
+                idx = 2;
+            }
+        }
+        code = (6u << 13) | (clr << 6) | (wait << 5) | irqIndex(p, t, idx, ins.line);
+    }else if(op == "set"){
+        if(t.size() != 3){
+            fail(ins.line, "invalid set");
+        }
+        code = (7u << 13) | (lookup(setDst, t[1], ins.line, "set destination") << 5) |
+               (evaluate(p, t[2], ins.line) & 0x1f);
+    }else{
+        fail(ins.line, "unknown instruction '" + t[0] + "'");
+    }
+
+    // Delay and side-set field
+    int delayBits = 5 - p.sideSetCount - (p.sideSetOpt ? 1 : 0);
+    int field = 0;
+    if(!ins.delay.empty()){
+        int d = evaluate(p, ins.delay, ins.line);
+        if(d < 0 || d >= (1 << delayBits)){
+            fail(ins.line, "delay out of range");
+        }
+        field |= d;
+    }
+    if(!ins.sideSet.empty()){
+        if(p.sideSetCount == 0){
+            fail(ins.line, "side-set used without .side_set");
+        }
+        int v = evaluate(p, ins.sideSet, ins.line) & ((1 << p.sideSetCount) - 1);
+        if(p.sideSetOpt){
+            field |= (1 << 4) | (v << (4 - p.sideSetCount));
+        }else{
+            field |= v << (5 - p.sideSetCount);
+        }
+    }else if(p.sideSetCount && !p.sideSetOpt){
+        fail(ins.line, "instruction requires side-set");
+    }
+    return code | (field << 8);
+}
+
+/**
+ * Parses an instruction line (after label removal)
+ **/
+Instruction parseInstruction(const std::string& text, int line)
+{
+    Instruction ins;
+    ins.line = line;
+    ins.source = text;
+    std::string body = text;
+    size_t br = body.find('[');
+    if(br != std::string::npos){
+        size_t end = body.find(']', br);
+        if(end == std::string::npos){
+            fail(line, "missing ']'");
+        }
+        ins.delay = body.substr(br + 1, end - br - 1);
+        body = body.substr(0, br) + body.substr(end + 1);
+    }
+    std::vector<std::string> tokens = split(body);
+    for(size_t i = 0; i < tokens.size(); ++i){
+        if(lower(tokens[i]) == "side" || lower(tokens[i]) == "sideset"){
+            if(i + 1 >= tokens.size()){
+                fail(line, "missing side-set value");
+            }
+            ins.sideSet = tokens[i + 1];
+            tokens.erase(tokens.begin() + i, tokens.begin() + i + 2);
+            break;
+        }
+    }
+    if(tokens.empty()){
+        fail(line, "empty instruction");
+    }
+    ins.tokens = tokens;
+    return ins;
+}
+
+std::vector<Program> parse(std::istream& in)
+{
+    std::vector<Program> programs;
+    std::string raw;
+    int line = 0;
+    bool inCode = false;
+    std::string codeLang;
+    while(std::getline(in, raw)){
+        ++line;
+        if(inCode){
+            if(trim(raw) == "%}"){
+                inCode = false;
+            }else if(codeLang == "c-sdk" && !programs.empty()){
+                programs.back().cSdk += raw + "\n";
+            }
+            continue;
+        }
+        std::string text = raw;
+        size_t c = text.find(';');
+        if(c != std::string::npos){
+            text = text.substr(0, c);
+        }
+        c = text.find("//");
+        if(c != std::string::npos){
+            text = text.substr(0, c);
+        }
+        text = trim(text);
+        if(text.empty()){
+            continue;
+        }
+        if(text[0] == '%'){
+            std::istringstream ss(text.substr(1));
+            ss >> codeLang;
+            inCode = true;
+            continue;
+        }
+        if(text[0] == '.'){
+            std::vector<std::string> t = split(text);
+            std::string d = lower(t[0]);
+            if(d == ".program"){
+                if(t.size() != 2){
+                    fail(line, "invalid .program");
+                }
+                programs.emplace_back();
+                programs.back().name = t[1];
+            }else if(d == ".define"){
+                size_t idx = 1;
+                bool pub = false;
+                if(t.size() > 1 && lower(t[1]) == "public"){
+                    pub = true;
+                    idx = 2;
+                }
+                if(t.size() != idx + 2){
+                    fail(line, "invalid .define");
+                }
+                Program dummy;
+                if(!programs.empty()){
+                    dummy.defines = programs.back().defines;
+                }
+                dummy.defines.insert(globalDefines.begin(), globalDefines.end());
+                int v = evaluate(dummy, t[idx + 1], line);
+                if(programs.empty()){
+                    globalDefines[t[idx]] = v;
+                }else{
+                    programs.back().defines[t[idx]] = v;
+                    if(pub){
+                        programs.back().publicDefines[t[idx]] = v;
+                    }
+                }
+            }else{
+                if(programs.empty()){
+                    fail(line, "directive outside of a program");
+                }
+                Program& p = programs.back();
+                int pc = static_cast<int>(p.instructions.size());
+                if(d == ".side_set"){
+                    if(t.size() < 2){
+                        fail(line, "invalid .side_set");
+                    }
+                    p.sideSetCount = evaluate(p, t[1], line);
+                    for(size_t i = 2; i < t.size(); ++i){
+                        if(lower(t[i]) == "opt"){
+                            p.sideSetOpt = true;
+                        }else if(lower(t[i]) == "pindirs"){
+                            p.sideSetPinDirs = true;
+                        }
+                    }
+                }else if(d == ".wrap_target"){
+                    p.wrapTarget = pc;
+                }else if(d == ".wrap"){
+                    p.wrap = pc - 1;
+                }else if(d == ".origin"){
+                    p.origin = evaluate(p, t[1], line);
+                }else{
+                    fail(line, "unsupported directive " + t[0]);
+                }
+            }
+            continue;
+        }
+        if(programs.empty()){
+            fail(line, "instruction outside of a program");
+        }
+        Program& p = programs.back();
+        // Labels
+        size_t colon = text.find(':');
+        while(colon != std::string::npos && text.compare(colon, 2, "::") != 0){
+            std::vector<std::string> lt = split(text.substr(0, colon));
+            if(lt.empty()){
+                fail(line, "invalid label");
+            }
+            p.labels[lt.back()] = static_cast<int>(p.instructions.size());
+            text = trim(text.substr(colon + 1));
+            colon = text.find(':');
+        }
+        if(!text.empty()){
+            p.instructions.push_back(parseInstruction(text, line));
+        }
+    }
+    for(Program& p : programs){
+        if(p.instructions.size() > 32){
+            fail(line, "program " + p.name + " is too large");
+        }
+        if(p.wrapTarget < 0){
+            p.wrapTarget = 0;
+        }
+        if(p.wrap < 0){
+            p.wrap = static_cast<int>(p.instructions.size()) - 1;
+        }
+        for(const Instruction& ins : p.instructions){
+            p.code.push_back(encode(p, ins));
+        }
+    }
+    return programs;
+}
+
+void writeHeader(std::ostream& out, const std::vector<Program>& programs)
+{
+    out << "// -------------------------------------------------- //\n"
+           "// This file is autogenerated by pioasm; do not edit! //\n"
+           "// -------------------------------------------------- //\n\n"
+           "#pragma once\n\n"
+           "#if !PICO_NO_HARDWARE\n"
+           "#include \"hardware/pio.h\"\n"
+           "#endif\n\n";
+    for(const Program& p : programs){
+        std::string bar(p.name.size(), '-');
+        out << "// " << bar << " //\n// " << p.name << " //\n// " << bar << " //\n\n";
+        out << "#define " << p.name << "_wrap_target " << p.wrapTarget << "\n";
+        out << "#define " << p.name << "_wrap " << p.wrap << "\n";
+        for(const auto& d : p.publicDefines){
+            out << "#define " << p.name << "_" << d.first << " " << d.second << "\n";
+        }
+        out << "\nstatic const uint16_t " << p.name << "_program_instructions[] = {\n";
+        for(size_t i = 0; i < p.code.size(); ++i){
+            if(static_cast<int>(i) == p.wrapTarget){
+                out << "            //     .wrap_target\n";
+            }
+            char buf[32];
+            snprintf(buf, sizeof(buf), "    0x%04x, // %2zu: ", p.code[i], i);
+            out << buf << p.instructions[i].source << "\n";
+            if(static_cast<int>(i) == p.wrap){
+                out << "            //     .wrap\n";
+            }
+        }
+        out << "};\n\n#if !PICO_NO_HARDWARE\n";
+        out << "static const struct pio_program " << p.name << "_program = {\n"
+            << "    .instructions = " << p.name << "_program_instructions,\n"
+            << "    .length = " << p.code.size() << ",\n"
+            << "    .origin = " << p.origin << ",\n"
+            << "    .name = \"" << p.name << "\",\n"
+            << "};\n\n";
+        out << "static inline pio_sm_config " << p.name << "_program_get_default_config(uint offset) {\n"
+            << "    pio_sm_config c = pio_get_default_sm_config();\n"
+            << "    sm_config_set_wrap(&c, offset + " << p.name << "_wrap_target, offset + " << p.name << "_wrap);\n";
+        if(p.sideSetCount){
+            out << "    sm_config_set_sideset(&c, " << (p.sideSetCount + (p.sideSetOpt ? 1 : 0)) << ", "
+                << (p.sideSetOpt ? "true" : "false") << ", " << (p.sideSetPinDirs ? "true" : "false") << ");\n";
+        }
+        out << "    return c;\n}\n";
+        if(!p.cSdk.empty()){
+            out << "\n" << p.cSdk;
+        }
+        out << "#endif\n\n";
+    }
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    if(argc != 3){
+        std::cerr << "Usage: " << argv[0] << " <input.pio> <output.h>" << std::endl;
+        return 1;
+    }
+    fileName = argv[1];
+    std::ifstream in(argv[1]);
+    if(!in){
+        std::cerr << "Unable to open " << argv[1] << std::endl;
+        return 1;
+    }
+    std::vector<Program> programs = parse(in);
+    std::ofstream out(argv[2]);
+    if(!out){
+        std::cerr << "Unable to write " << argv[2] << std::endl;
+        return 1;
+    }
+    writeHeader(out, programs);
+    return 0;
+}
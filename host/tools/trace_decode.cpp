@@ -0,0 +1,343 @@
+/**
+ * Decodes the hot path trace printed by the firmware (USE_TRACE)
+ * Reads a console capture, prints latency histograms of interrupts and
+ * protocol states, and optionally writes a Chrome/Perfetto trace
+ * (chrome://tracing or ui.perfetto.dev)
+ **/
+#include "src/trace.h"
+#include "src/picoreseau.hxx"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+
+const char* isrNames[TR_ISR_COUNT] = {"pio0_isr", "rx_dma_isr", "pio1_isr", "tx_dma_isr", "bus_idle_isr"};
+const char* stateNames[NR_STATE_COUNT] = {"IDLE", "CALLED", "ECHO", "SELECTED", "ACK", "WAITING", "CALL",
+                                          "GET_DATA", "SEND_DATA"};
+
+struct Event {
+    uint64_t time;      // us, unwrapped
+    uint8_t id;
+    uint8_t core;
+    uint16_t payload;
+};
+
+/**
+ * Duration accumulator with power of 2 buckets (us)
+ **/
+struct Histogram {
+    static constexpr int BUCKETS = 24;
+    uint64_t buckets[BUCKETS] = {};
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+    uint64_t min = UINT64_MAX;
+
+    void add(uint64_t us)
+    {
+        int b = 0;
+        while(b < BUCKETS - 1 && (1ull << b) <= us){
+            ++b;
+        }
+        ++buckets[b];
+        ++count;
+        sum += us;
+        max = us > max ? us : max;
+        min = us < min ? us : min;
+    }
+
+    void print(const std::string& name) const
+    {
+        printf("%-22s n=%-8" PRIu64 " min=%-6" PRIu64 " avg=%-8.1f max=%" PRIu64 " us\n", name.c_str(), count,
+               count ? min : 0, count ? static_cast<double>(sum) / count : 0.0, max);
+        uint64_t peak = 0;
+        for(uint64_t b : buckets){
+            peak = b > peak ? b : peak;
+        }
+        for(int b = 0; b < BUCKETS; ++b){
+            if(buckets[b] == 0){
+                continue;
+            }
+            uint64_t lo = b == 0 ? 0 : (1ull << (b - 1));
+            int bar = static_cast<int>(40 * buckets[b] / peak);
+            printf("    [%6" PRIu64 ", %6" PRIu64 ") %8" PRIu64 " %s\n", lo, 1ull << b, buckets[b],
+                   std::string(bar ? bar : 1, '#').c_str());
+        }
+    }
+};
+
+struct Options {
+    std::string input;
+    std::string chrome;
+    double bitUs = 2.0;
+};
+
+void usage(const char* prog)
+{
+    fprintf(stderr,
+        "Usage: %s [options] [capture]\n"
+        "  capture           Console output of the firmware (default stdin)\n"
+        "  --chrome FILE     Writes a Chrome/Perfetto JSON trace\n"
+        "  --bit-us US       Bus bit period for the RX deadline (default 2)\n", prog);
+}
+
+int hexValue(char c)
+{
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * Parses a "@T" line, events are 8 bytes little endian
+ **/
+bool parseLine(const std::string& line, std::vector<TraceEvent>& out)
+{
+    std::string hex = line.substr(3);
+    while(!hex.empty() && (hex.back() == '\r' || hex.back() == ' ')){
+        hex.pop_back();
+    }
+    if(hex.size() % 16 != 0){
+        return false;
+    }
+    for(size_t i = 0; i < hex.size(); i += 16){
+        uint8_t b[8];
+        for(int j = 0; j < 8; ++j){
+            int hi = hexValue(hex[i + 2 * j]);
+            int lo = hexValue(hex[i + 2 * j + 1]);
+            if(hi < 0 || lo < 0){
+                return false;
+            }
+            b[j] = static_cast<uint8_t>((hi << 4) | lo);
+        }
+        TraceEvent e;
+        e.time = b[0] | (b[1] << 8) | (b[2] << 16) | (static_cast<uint32_t>(b[3]) << 24);
+        e.id = b[4];
+        e.core = b[5];
+        e.payload = static_cast<uint16_t>(b[6] | (b[7] << 8));
+        out.push_back(e);
+    }
+    return true;
+}
+
+void writeChrome(const std::string& path, const std::vector<Event>& events)
+{
+    FILE* f = fopen(path.c_str(), "w");
+    if(f == nullptr){
+        fprintf(stderr, "Unable to write %s\n", path.c_str());
+        exit(1);
+    }
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"interrupts\"}},\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":2,\"args\":{\"name\":\"stations\"}},\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":3,\"args\":{\"name\":\"bus\"}}");
+    std::map<int, std::pair<uint64_t, int>> stationState;      // station -> (since, state)
+    for(const Event& e : events){
+        switch(e.id){
+        case TR_ISR_ENTER:
+        case TR_ISR_EXIT:
+            if(e.payload < TR_ISR_COUNT){
+                fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%" PRIu64 ",\"pid\":1,\"tid\":%u}",
+                        isrNames[e.payload], e.id == TR_ISR_ENTER ? "B" : "E", e.time, e.core);
+            }
+            break;
+        case TR_RX_FRAME:
+            fprintf(f, ",\n{\"name\":\"rx frame\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%" PRIu64 ",\"pid\":3,\"tid\":0,"
+                    "\"args\":{\"len\":%u}}", e.time, e.payload);
+            break;
+        case TR_CRC:
+            fprintf(f, ",\n{\"name\":\"crc %s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%" PRIu64 ",\"pid\":3,\"tid\":0,"
+                    "\"args\":{\"sniffer\":%u}}", (e.payload & 1) ? "ok" : "bad", e.time, (e.payload >> 1) & 1);
+            break;
+        case TR_TX_START:
+            fprintf(f, ",\n{\"name\":\"tx frame\",\"ph\":\"B\",\"ts\":%" PRIu64 ",\"pid\":3,\"tid\":1,"
+                    "\"args\":{\"len\":%u}}", e.time, e.payload);
+            break;
+        case TR_TX_END:
+            fprintf(f, ",\n{\"name\":\"tx frame\",\"ph\":\"E\",\"ts\":%" PRIu64 ",\"pid\":3,\"tid\":1}", e.time);
+            break;
+        case TR_TX_QUEUE:
+            fprintf(f, ",\n{\"name\":\"tx queue\",\"ph\":\"C\",\"ts\":%" PRIu64 ",\"pid\":3,\"args\":{\"frames\":%u}}",
+                    e.time, e.payload);
+            break;
+        case TR_TX_COLLISION:
+            fprintf(f, ",\n{\"name\":\"tx frame\",\"ph\":\"E\",\"ts\":%" PRIu64 ",\"pid\":3,\"tid\":1}", e.time);
+            fprintf(f, ",\n{\"name\":\"collision\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%" PRIu64 ",\"pid\":3,\"tid\":1,"
+                    "\"args\":{\"attempt\":%u}}", e.time, e.payload);
+            break;
+        case TR_STATE:{
+            int station = e.payload >> 8;
+            auto it = stationState.find(station);
+            if(it != stationState.end() && it->second.second != IDLE && it->second.second < NR_STATE_COUNT){
+                fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%" PRIu64 ",\"dur\":%" PRIu64 ",\"pid\":2,\"tid\":%d}",
+                        stateNames[it->second.second], it->second.first, e.time - it->second.first, station);
+            }
+            stationState[station] = {e.time, e.payload & 0xFF};
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    for(int i = 1; i < argc; ++i){
+        std::string a = argv[i];
+        if(a == "--chrome" && i + 1 < argc){
+            opt.chrome = argv[++i];
+        }else if(a == "--bit-us" && i + 1 < argc){
+            opt.bitUs = strtod(argv[++i], nullptr);
+        }else if(a[0] != '-' && opt.input.empty()){
+            opt.input = a;
+        }else{
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    std::ifstream file;
+    if(!opt.input.empty()){
+        file.open(opt.input);
+        if(!file){
+            fprintf(stderr, "Unable to read %s\n", opt.input.c_str());
+            return 1;
+        }
+    }
+    std::istream& in = opt.input.empty() ? std::cin : file;
+
+    // Events of each core are in order, both cores are merged by time
+    std::vector<TraceEvent> raw;
+    uint64_t dropped = 0, badLines = 0;
+    std::string line;
+    while(std::getline(in, line)){
+        size_t p = line.find("@T ");
+        if(p != std::string::npos){
+            if(!parseLine(line.substr(p), raw)){
+                ++badLines;
+            }
+        }else if((p = line.find("@D ")) != std::string::npos){
+            dropped = strtoull(line.c_str() + p + 3, nullptr, 10);
+        }
+    }
+    std::vector<Event> events;
+    events.reserve(raw.size());
+    uint32_t last[2] = {0, 0};
+    uint64_t high[2] = {0, 0};
+    for(const TraceEvent& r : raw){
+        int c = r.core & 1;
+        if(r.time < last[c] && (last[c] - r.time) > 0x80000000u){
+            high[c] += 1ull << 32;
+        }
+        last[c] = r.time;
+        events.push_back({high[c] + r.time, r.id, r.core, r.payload});
+    }
+    std::stable_sort(events.begin(), events.end(), [](const Event& a, const Event& b){ return a.time < b.time; });
+
+    Histogram isr[TR_ISR_COUNT];
+    Histogram states[NR_STATE_COUNT];
+    Histogram txFrame;
+    std::vector<std::pair<int, uint64_t>> stack[2];             // Nested interrupts per core
+    std::map<int, std::pair<uint64_t, int>> stationState;
+    uint64_t txStart = 0, crcOk = 0, crcBad = 0, rxFrames = 0, maxQueue = 0, collisions = 0;
+    bool inTx = false;
+    for(const Event& e : events){
+        auto& st = stack[e.core & 1];
+        switch(e.id){
+        case TR_ISR_ENTER:
+            st.push_back({e.payload, e.time});
+            break;
+        case TR_ISR_EXIT:
+            if(!st.empty() && st.back().first == e.payload){
+                if(e.payload < TR_ISR_COUNT){
+                    isr[e.payload].add(e.time - st.back().second);
+                }
+                st.pop_back();
+            }
+            break;
+        case TR_RX_FRAME:
+            ++rxFrames;
+            break;
+        case TR_CRC:
+            (e.payload & 1) ? ++crcOk : ++crcBad;
+            break;
+        case TR_TX_START:
+            txStart = e.time;
+            inTx = true;
+            break;
+        case TR_TX_END:
+            if(inTx){
+                txFrame.add(e.time - txStart);
+                inTx = false;
+            }
+            break;
+        case TR_TX_QUEUE:
+            maxQueue = e.payload > maxQueue ? e.payload : maxQueue;
+            break;
+        case TR_TX_COLLISION:
+            // The aborted frame is not a frame time
+            inTx = false;
+            ++collisions;
+            break;
+        case TR_STATE:{
+            int station = e.payload >> 8;
+            auto it = stationState.find(station);
+            if(it != stationState.end() && it->second.second < NR_STATE_COUNT){
+                states[it->second.second].add(e.time - it->second.first);
+            }
+            stationState[station] = {e.time, e.payload & 0xFF};
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    printf("Events %zu, dropped %" PRIu64 ", bad lines %" PRIu64 "\n", events.size(), dropped, badLines);
+    if(!events.empty()){
+        printf("Span %.3f ms\n", (events.back().time - events.front().time) / 1000.0);
+    }
+    printf("RX frames %" PRIu64 ", CRC ok %" PRIu64 " bad %" PRIu64 ", TX queue max %" PRIu64 ", TX collisions %" PRIu64 "\n",
+           rxFrames, crcOk, crcBad, maxQueue, collisions);
+    printf("\nInterrupt durations\n");
+    for(int i = 0; i < TR_ISR_COUNT; ++i){
+        if(isr[i].count){
+            isr[i].print(isrNames[i]);
+        }
+    }
+    // Closing flag must be handled before the first byte of the next frame
+    if(isr[TR_PIO0_ISR].count){
+        double deadline = 9 * opt.bitUs;
+        printf("pio0_isr deadline %.1f us, worst margin %.1f us\n", deadline, deadline - isr[TR_PIO0_ISR].max);
+    }
+    printf("\nProtocol state durations\n");
+    for(int i = 0; i < NR_STATE_COUNT; ++i){
+        if(states[i].count && i != IDLE){
+            states[i].print(stateNames[i]);
+        }
+    }
+    if(txFrame.count){
+        printf("\nTX frames\n");
+        txFrame.print("tx frame");
+    }
+    if(!opt.chrome.empty()){
+        writeChrome(opt.chrome, events);
+        printf("\nChrome trace written to %s\n", opt.chrome.c_str());
+    }
+    return 0;
+}
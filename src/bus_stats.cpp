@@ -0,0 +1,94 @@
+#include "bus_stats.h"
+
+BusStats busStats;
+
+void bus_stats_rx(uint8_t station, uint32_t len)
+{
+    stat_add(busStats.rxFrames);
+    stat_add(busStats.rxBytes, len);
+    stat_add(busStats.stations[station].rxFrames);
+    stat_add(busStats.stations[station].rxBytes, len);
+}
+
+void bus_stats_tx(uint8_t station, uint32_t len)
+{
+    stat_add(busStats.txFrames);
+    stat_add(busStats.txBytes, len);
+    if(station < NR_MAX_STATIONS){
+        stat_add(busStats.stations[station].txFrames);
+        stat_add(busStats.stations[station].txBytes, len);
+    }
+}
+
+void bus_stats_timeout(uint8_t station, bool echo)
+{
+    if(echo){
+        stat_add(busStats.echoTimeouts);
+        stat_add(busStats.stations[station].echoTimeouts);
+    }else{
+        stat_add(busStats.replyTimeouts);
+        stat_add(busStats.stations[station].replyTimeouts);
+    }
+}
+
+void bus_stats_retransmission(uint8_t station)
+{
+    stat_add(busStats.retransmissions);
+    stat_add(busStats.stations[station].retransmissions);
+}
+
+void bus_stats_call_retry(uint8_t station)
+{
+    stat_add(busStats.callRetries);
+    stat_add(busStats.stations[station].callRetries);
+}
+
+void bus_stats_turnaround(uint8_t station, uint32_t us)
+{
+    latency_add(busStats.turnaround, us);
+    latency_add(busStats.stations[station].turnaround, us);
+}
+
+/**
+ * Clears the counters of a station
+ **/
+static void reset_station(StationStats& s)
+{
+    s.rxFrames = 0;
+    s.rxBytes = 0;
+    s.txFrames = 0;
+    s.txBytes = 0;
+    s.echoTimeouts = 0;
+    s.replyTimeouts = 0;
+    s.retransmissions = 0;
+    s.callRetries = 0;
+    s.turnaround = LatencyStat();
+}
+
+void bus_stats_reset()
+{
+    busStats.rxFrames = 0;
+    busStats.rxBytes = 0;
+    busStats.txFrames = 0;
+    busStats.txBytes = 0;
+    busStats.crcErrors = 0;
+    busStats.aborts = 0;
+    busStats.shortFrames = 0;
+    busStats.overruns = 0;
+    busStats.filtered = 0;
+    busStats.queueOverflows = 0;
+    busStats.busToHostDrops = 0;
+    busStats.hostToBusDrops = 0;
+    busStats.noBuffer = 0;
+    busStats.collisions = 0;
+    busStats.backoffs = 0;
+    busStats.collisionDrops = 0;
+    busStats.echoTimeouts = 0;
+    busStats.replyTimeouts = 0;
+    busStats.retransmissions = 0;
+    busStats.callRetries = 0;
+    busStats.turnaround = LatencyStat();
+    for(StationStats& s : busStats.stations){
+        reset_station(s);
+    }
+}
@@ -0,0 +1,102 @@
+#ifndef __BUS_STATS_H__
+#define __BUS_STATS_H__
+#include "pico/stdlib.h"
+#include "picoreseau.hxx"
+#include "intercore.h"
+
+#include <atomic>
+
+/**
+ * Bus statistics and health counters, global and per station
+ * Each counter has a single writer (one interrupt or the bus engine loop),
+ * it is updated with atomic loads and stores only (no read-modify-write on
+ * Cortex-M0+) and can be read from any core or interrupt. Latency
+ * statistics are written by the bus engine only.
+ **/
+
+typedef std::atomic<uint32_t> stat_counter;
+
+typedef struct StationStats {
+    stat_counter rxFrames;          // Valid frames from the station
+    stat_counter rxBytes;
+    stat_counter txFrames;          // Frames queued to the station
+    stat_counter txBytes;
+    stat_counter echoTimeouts;      // No echo after a call back
+    stat_counter replyTimeouts;     // No answer in the other phases
+    stat_counter retransmissions;   // Initial call or consigne sent again by the station
+    stat_counter callRetries;       // Call backs sent again, not echoed
+    LatencyStat turnaround;         // Station frame to our answer (echo, MCPCH)
+} StationStats;
+
+typedef struct BusStats {
+    stat_counter rxFrames;          // Valid frames addressed to us
+    stat_counter rxBytes;
+    stat_counter txFrames;
+    stat_counter txBytes;
+    stat_counter crcErrors;
+    stat_counter aborts;            // Frames aborted by the sender (HDLC abort)
+    stat_counter shortFrames;
+    stat_counter overruns;          // Frames overwritten in the RX ring before being read
+    stat_counter filtered;          // Frames for other addresses, our own included
+    stat_counter queueOverflows;    // Frames lost, RX descriptor queue full
+    stat_counter busToHostDrops;    // Messages lost, busToHost full (written by core 1)
+    stat_counter hostToBusDrops;    // Messages lost, hostToBus full (written by core 0)
+    stat_counter noBuffer;          // Frames dropped, no frame pool buffer to copy them
+    stat_counter collisions;        // Frames we aborted, read back differing from what was sent
+    stat_counter backoffs;          // Back-off delays waited (emitter interrupts, they don't nest)
+    stat_counter collisionDrops;    // Frames dropped after TX_MAX_ATTEMPTS collisions
+    stat_counter echoTimeouts;
+    stat_counter replyTimeouts;
+    stat_counter retransmissions;
+    stat_counter callRetries;
+    LatencyStat turnaround;
+    StationStats stations[NR_MAX_STATIONS];
+} BusStats;
+
+extern BusStats busStats;
+
+/**
+ * Adds to a counter, only from its writer
+ **/
+static inline void stat_add(stat_counter& c, uint32_t n = 1)
+{
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+/**
+ * Accounts a valid frame received from a station
+ **/
+void bus_stats_rx(uint8_t station, uint32_t len);
+
+/**
+ * Accounts a frame queued to a station
+ **/
+void bus_stats_tx(uint8_t station, uint32_t len);
+
+/**
+ * Accounts a timeout of a station
+ * @param echo true if the station did not echo a call
+ **/
+void bus_stats_timeout(uint8_t station, bool echo);
+
+/**
+ * Accounts a station sending again an initial call or its consigne
+ **/
+void bus_stats_retransmission(uint8_t station);
+
+/**
+ * Accounts a call back sent again to a station
+ **/
+void bus_stats_call_retry(uint8_t station);
+
+/**
+ * Accounts our answer time to a station frame
+ **/
+void bus_stats_turnaround(uint8_t station, uint32_t us);
+
+/**
+ * Clears all counters, from the bus engine
+ **/
+void bus_stats_reset();
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef __BUS_TIMING_H__
+#define __BUS_TIMING_H__
+#include <stdint.h>
+
+/**
+ * Bus timing configuration
+ * The bus bit rate is chosen at compile time (BUS_BIT_RATE, CMake option
+ * PICORESEAU_BIT_RATE) and everything depending on it is derived here :
+ * clock_tx and hdlc_tx dividers, bus idle detection and protocol
+ * turnarounds, which are expressed in bits. Rates the PIO programs can't meet don't compile.
+ **/
+
+#ifndef BUS_BIT_RATE
+#define BUS_BIT_RATE 500000         // Bus bit rate (bit/s), 500 kbit/s on a stock nanoreseau
+#endif
+
+#define SYS_CLK_HZ 125000000        // System clock (SDK default)
+
+// Shortest bit periods found by host/tools/pio_timing at clkdiv 1 (system clock cycles)
+#define HDLC_RX_MIN_CYCLES 16       // hdlc_rx, longest path of a bit
+#define HDLC_TX_MIN_CYCLES 22       // hdlc_tx, longest path of a bit, its read back included
+#define PIO_TIMING_MARGIN 2         // Bit period must be this many times longer
+
+#define HDLC_TX_BIT_CYCLES 32       // hdlc_tx cycles per bit, bits are read back after half of them
+
+// hdlc_tx waits half of its bit for the read back, the margin applies to the rest of its path
+static_assert((HDLC_TX_MIN_CYCLES - HDLC_TX_BIT_CYCLES / 2) * PIO_TIMING_MARGIN <= HDLC_TX_BIT_CYCLES / 2,
+              "hdlc_tx path after the read back too long for HDLC_TX_BIT_CYCLES");
+
+template<uint32_t BitRate, uint32_t SysClkHz = SYS_CLK_HZ>
+struct BusTiming {
+    static constexpr uint32_t bitRate = BitRate;
+    static constexpr uint32_t sysClkHz = SysClkHz;
+    static constexpr uint32_t bitNs = 1000000000u / BitRate;
+    static constexpr uint32_t cyclesPerBit = SysClkHz / BitRate;
+
+    /**
+     * Duration of a number of bits (us, rounded up)
+     **/
+    static constexpr uint32_t bitsUs(uint32_t bits)
+    {
+        return (uint32_t)(((uint64_t)bits * 1000000u + BitRate - 1) / BitRate);
+    }
+
+    // clock_tx runs 4 cycles per bit, the divider has 8 fractional bits
+    static constexpr uint32_t clockTxDiv256 = (uint32_t)(((uint64_t)SysClkHz * 64 + BitRate / 2) / BitRate);
+    static constexpr float clockTxDiv = clockTxDiv256 / 256.0f;
+    // hdlc_tx runs HDLC_TX_BIT_CYCLES cycles per bit : its read back is in the middle of the bit
+    static constexpr uint32_t hdlcTxDiv256 = clockTxDiv256 * 4 / HDLC_TX_BIT_CYCLES;
+    static constexpr float hdlcTxDiv = hdlcTxDiv256 / 256.0f;
+
+    // Signed like the time differences they are compared with
+    static constexpr int32_t idleUs = bitsUs(2);                // Bus idle without clock edge for 2 bits
+    static constexpr int32_t echoTurnaroundUs = bitsUs(25);     // Bus idle before the echo of an initial call
+    static constexpr int32_t echoDurationUs = bitsUs(150);      // Echo clock
+    static constexpr int32_t callTurnaroundUs = bitsUs(25);     // Bus idle before a call back
+
+    static_assert(cyclesPerBit >= HDLC_RX_MIN_CYCLES * PIO_TIMING_MARGIN, "hdlc_rx can't receive at this bit rate");
+    static_assert(clockTxDiv256 < (65536u << 8), "clock_tx divider out of range, bit rate too low");
+    // hdlc_tx needs HDLC_TX_BIT_CYCLES per bit, its divider at least 1
+    static_assert(hdlcTxDiv256 >= 256, "hdlc_tx can't send at this bit rate");
+    // The fractional divider makes the rate slightly off, at most 0.5 %
+    static_assert((uint64_t)SysClkHz * 64 * 200 / clockTxDiv256 >= (uint64_t)BitRate * 199 &&
+                  (uint64_t)SysClkHz * 64 * 200 / clockTxDiv256 <= (uint64_t)BitRate * 201, "clock_tx can't produce this bit rate");
+    // bus_idle runs 65 cycles during the idle time
+    static_assert((uint64_t)idleUs * SysClkHz / 1000000 / 65 < 65536, "bus_idle divider out of range, bit rate too low");
+};
+
+typedef BusTiming<BUS_BIT_RATE> BusConfig;
+
+#endif
@@ -0,0 +1,135 @@
+#include "capture.h"
+#include "spsc_queue.h"
+
+#include <string.h>
+
+typedef struct CaptureBatch {
+    uint32_t len;
+    uint8_t data[CAPTURE_BATCH_SIZE];
+} CaptureBatch;
+
+static SpscQueue<CaptureBatch, CAPTURE_BATCHES> batches;
+static CaptureBatch* current = nullptr;     // Batch being filled (core 1), nullptr if none is free
+static uint32_t batchStart = 0;             // Time of the first record of the current batch (us)
+static volatile CaptureStats stats;
+
+/**
+ * Gives the current batch to core 0
+ **/
+static void sendBatch()
+{
+    if(current == nullptr || current->len == 0){
+        return;
+    }
+    batches.commit();
+    current = nullptr;
+    stats.batches = stats.batches + 1;
+}
+
+void capture_start()
+{
+    current = nullptr;
+    stats.frames = 0;
+    stats.bytes = 0;
+    stats.dropped = 0;
+    stats.batches = 0;
+}
+
+void capture_stop()
+{
+    sendBatch();
+}
+
+void capture_frame(const RxFrame& frame)
+{
+    uint32_t len = frame.length + 1;
+    uint8_t flags = 0;
+    switch(frame.status){
+    case done:
+        len += 2;
+        flags = CAPTURE_CRC_OK;
+        break;
+    case bad_crc:
+        len += 2;
+        break;
+    case frame_aborted:
+        flags = CAPTURE_ABORTED;
+        break;
+    default:
+        flags = CAPTURE_SHORT;
+        break;
+    }
+    uint32_t incl = len < CAPTURE_SNAPLEN ? len : CAPTURE_SNAPLEN;
+    uint32_t size = sizeof(PcapRecord) + 1 + incl;
+    if(current != nullptr && current->len + size > CAPTURE_BATCH_SIZE){
+        sendBatch();
+    }
+    if(current == nullptr){
+        current = batches.reserve();
+        if(current == nullptr){
+            stats.dropped = stats.dropped + 1;
+            return;
+        }
+        current->len = 0;
+        batchStart = time_us_32();
+    }
+    uint8_t* record = &current->data[current->len];
+    if(copyRawFrame(frame, &record[sizeof(PcapRecord) + 1], incl) == 0){
+        flags |= CAPTURE_OVERRUN;
+        incl = 0;
+    }
+    record[sizeof(PcapRecord)] = flags;
+    //Closing flag time extended to 64 bits
+    uint64_t now = time_us_64();
+    uint64_t t = now - (uint32_t)((uint32_t)now - frame.time);
+    PcapRecord r = {(uint32_t)(t / 1000000), (uint32_t)(t % 1000000), incl + 1, len + 1};
+    memcpy(record, &r, sizeof(r));
+    current->len += sizeof(PcapRecord) + 1 + incl;
+    stats.frames = stats.frames + 1;
+    stats.bytes = stats.bytes + len;
+}
+
+void capture_poll()
+{
+    if(current != nullptr && current->len != 0 && (time_us_32() - batchStart) >= CAPTURE_FLUSH_US){
+        sendBatch();
+    }
+}
+
+bool capture_flush_time(uint32_t& time)
+{
+    time = batchStart + CAPTURE_FLUSH_US;
+    return current != nullptr && current->len != 0;
+}
+
+void capture_header(PcapHeader& header)
+{
+    header.magic = 0xa1b2c3d4;
+    header.versionMajor = 2;
+    header.versionMinor = 4;
+    header.thisZone = 0;
+    header.sigFigs = 0;
+    header.snapLen = CAPTURE_SNAPLEN + 1;
+    header.linkType = CAPTURE_LINKTYPE;
+}
+
+bool capture_get_batch(const uint8_t*& data, uint32_t& len)
+{
+    const CaptureBatch* batch = batches.front();
+    if(batch == nullptr){
+        return false;
+    }
+    data = batch->data;
+    len = batch->len;
+    return true;
+}
+
+void capture_release_batch()
+{
+    batches.release();
+}
+
+const volatile CaptureStats& capture_stats()
+{
+    return stats;
+}
@@ -0,0 +1,101 @@
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+#include "pico/stdlib.h"
+#include "hdlc_rx.h"
+
+/**
+ * Promiscuous capture of the bus
+ * Core 1 writes every received frame (aborted and bad CRC ones included) as
+ * pcap records in large batches, core 0 sends whole batches over USB. The
+ * stream is a pcap file (microsecond timestamps, link type USER0), each
+ * record is a capture_flags byte followed by the frame as seen on the bus :
+ * address, data and CRC.
+ **/
+
+#define CAPTURE_BATCH_SIZE 4096         // Bytes of a batch, sent in one write
+#define CAPTURE_BATCHES 8               // Number of batches (power of 2)
+#define CAPTURE_SNAPLEN 2048            // Frame bytes kept in a record
+#define CAPTURE_FLUSH_US 20000          // A partial batch is sent after this delay
+#define CAPTURE_LINKTYPE 147            // LINKTYPE_USER0
+
+//First byte of a record
+enum capture_flags : uint8_t {
+    CAPTURE_CRC_OK = 0x01,              // CRC of the frame is valid
+    CAPTURE_ABORTED = 0x02,             // Frame ended by an HDLC abort
+    CAPTURE_SHORT = 0x04,               // Frame shorter than address and CRC
+    CAPTURE_OVERRUN = 0x08,             // Frame overwritten in the RX ring, no data
+};
+
+typedef struct __attribute__((packed)) PcapHeader {
+    uint32_t magic;
+    uint16_t versionMajor;
+    uint16_t versionMinor;
+    int32_t thisZone;
+    uint32_t sigFigs;
+    uint32_t snapLen;
+    uint32_t linkType;
+} PcapHeader;
+
+typedef struct __attribute__((packed)) PcapRecord {
+    uint32_t tsSec;
+    uint32_t tsUsec;
+    uint32_t inclLen;                   // Bytes in the record
+    uint32_t origLen;                   // Bytes of the frame, flags byte included
+} PcapRecord;
+
+typedef struct CaptureStats {
+    uint32_t frames;                    // Frames written in batches
+    uint32_t bytes;
+    uint32_t dropped;                   // Frames lost, no free batch
+    uint32_t batches;                   // Batches given to core 0
+} CaptureStats;
+
+/**
+ * Starts capturing, all received frames go to capture_frame (core 1)
+ **/
+void capture_start();
+
+/**
+ * Stops capturing, the current batch is sent (core 1)
+ **/
+void capture_stop();
+
+/**
+ * Writes a received frame in the current batch (core 1)
+ **/
+void capture_frame(const RxFrame& frame);
+
+/**
+ * Sends the current batch once it is old enough (core 1)
+ **/
+void capture_poll();
+
+/**
+ * Gets when capture_poll sends the current batch (core 1)
+ * @param time Time of the flush (us)
+ * @return false if no record waits
+ **/
+bool capture_flush_time(uint32_t& time);
+
+/**
+ * Gets the pcap file header, sent before the first batch
+ **/
+void capture_header(PcapHeader& header);
+
+/**
+ * Gets the next batch to send (core 0)
+ * @return false if none is ready, else the batch must be released
+ **/
+bool capture_get_batch(const uint8_t*& data, uint32_t& len);
+
+/**
+ * Gives back the batch obtained by capture_get_batch (core 0)
+ **/
+void capture_release_batch();
+
+/**
+ * Statistics of the capture (written by core 1)
+ **/
+const volatile CaptureStats& capture_stats();
+
+#endif
@@ -1,37 +1,132 @@
 #include "clock_detect.h"
-#include "hardware/pwm.h"
+#include "hardware/pio.h"
+#include "hardware/irq.h"
 #include "pico/time.h"
+#include "pico/sync.h"
 
 #include <stdio.h>
 #include "pico/stdlib.h"
-#include "hdlc_rx.h"
+#include "clock_detect.pio.h"
+#include "trace.h"
+#include "wake.h"
 
-#define CLK_IN_PIN 1
-#define CLK_FREQ 500
+#define CLK_PIO pio0                //PIO block for bus activity (shared with RX, pio1 state machines are all taken by TX)
 
-static uint slice_num = 0;  //PWM slice number
+static BusActivity activities[NR_SEGMENTS];
+static int clkIdleOffset = -1;      //Program offset, loaded once for all segments
 
+/**
+ * Updates the state of a segment from its state machine position
+ **/
+static inline void __time_critical_func(bus_activity_update)(BusActivity& bus)
+{
+    //Drain the notifications, the position gives the current state
+    while(!pio_sm_is_rx_fifo_empty(bus.pio, bus.sm)){
+        pio_sm_get(bus.pio, bus.sm);
+    }
+    bool idle = pio_sm_get_pc(bus.pio, bus.sm) == bus.offset;
+    if(idle && !bus.busIdle){
+        bus.lastClockTime = time_us_32() - BUS_IDLE_US;
+        bus.busyTime = bus.busyTime + (bus.lastClockTime - bus.activeSince);
+        bus.busIdle = true;
+        bus_idle_callback callback = bus.idleCallback;
+        if(callback != nullptr){
+            callback(bus.idleContext);
+        }
+        wake_post(WAKE_BUS);
+    }else if(!idle && bus.busIdle){
+        bus.activeSince = time_us_32();
+        bus.busIdle = false;
+        wake_post(WAKE_BUS);
+    }
+}
 
-void initialize_clock_detect() {
-    slice_num = pwm_gpio_to_slice_num(CLK_IN_PIN);
+/**
+ * Interrupt service routine on PIO 0 IRQ 1
+ * The bus_idle state machine of a segment pushes a word when the bus becomes
+ * active and another one when it becomes idle. Both may be queued, the state
+ * machine position gives the current state
+ **/
+void __isr __time_critical_func(bus_idle_isr)() {
+    TRACE(TR_ISR_ENTER, TR_BUS_IDLE_ISR);
+    for(uint i = 0; i < NR_SEGMENTS; ++i){
+        if(activities[i].configured && !pio_sm_is_rx_fifo_empty(activities[i].pio, activities[i].sm)){
+            bus_activity_update(activities[i]);
+        }
+    }
+    TRACE(TR_ISR_EXIT, TR_BUS_IDLE_ISR);
+}
 
-    pwm_config cfg = pwm_get_default_config();
-    pwm_config_set_clkdiv_mode(&cfg, PWM_DIV_B_RISING);
-    pwm_config_set_clkdiv(&cfg, 1);
-    pwm_init(slice_num, &cfg, false);
-    gpio_set_function(CLK_IN_PIN, GPIO_FUNC_PWM);
-    pwm_set_enabled(slice_num, true);
+BusActivity& get_bus_activity(uint segment) {
+    return activities[segment];
 }
 
-void wait_for_no_clock() {
-    while(is_clock_detected()){
-        tight_loop_contents();
+void initialize_clock_detect(BusActivity& bus, uint segment, uint clkInPin) {
+    bus.pio = CLK_PIO;
+    if(clkIdleOffset < 0){
+        clkIdleOffset = pio_add_program(CLK_PIO, &bus_idle_program);
     }
+    bus.offset = clkIdleOffset;
+    bus.sm = SEGMENT_IDLE_SM(segment);
+    pio_sm_claim(bus.pio, bus.sm);
+
+    //State machine starts waiting for a clock
+    bus.busIdle = true;
+    bus.lastClockTime = time_us_32();
+    bus.activeSince = bus.lastClockTime;
+    bus.busyTime = 0;
+    bus.configured = true;
+    bus_idle_program_init(bus.pio, bus.sm, bus.offset, clkInPin, BUS_IDLE_US, BusConfig::sysClkHz / 1e6f);
+
+    //The handler serves all segments
+    pio_set_irq1_source_enabled(bus.pio, (pio_interrupt_source)(pis_sm0_rx_fifo_not_empty + bus.sm), true);
+    if(!irq_is_enabled(PIO0_IRQ_1)){
+        irq_set_exclusive_handler(PIO0_IRQ_1, bus_idle_isr);
+        irq_set_enabled(PIO0_IRQ_1, true);
+    }
+}
+
+bool is_bus_idle(const BusActivity& bus) {
+    return bus.busIdle;
+}
+
+uint32_t get_last_clock_time(const BusActivity& bus) {
+    return bus.busIdle ? bus.lastClockTime : time_us_32();
+}
+
+uint32_t get_bus_busy_time(const BusActivity& bus) {
+    uint32_t irqs = save_and_disable_interrupts();
+    uint32_t t = bus.busyTime;
+    if(!bus.busIdle){
+        t += time_us_32() - bus.activeSince;
+    }
+    restore_interrupts(irqs);
+    return t;
+}
+
+void set_bus_idle_callback(BusActivity& bus, bus_idle_callback callback, void* ctx) {
+    uint32_t irqs = save_and_disable_interrupts();
+    bus.idleCallback = callback;
+    bus.idleContext = ctx;
+    restore_interrupts(irqs);
+}
+
+bool is_clock_detected(const BusActivity& bus) {
+    return !bus.busIdle;
+}
+
+bool is_bus_idle() {
+    return is_bus_idle(activities[0]);
+}
+
+uint32_t get_last_clock_time() {
+    return get_last_clock_time(activities[0]);
+}
+
+uint32_t get_bus_busy_time() {
+    return get_bus_busy_time(activities[0]);
 }
 
-bool is_clock_detected(uint nbCycles) {
-    pwm_set_counter(slice_num, 0);
-    sleep_us(1000 / (CLK_FREQ/nbCycles));
-    bool ret =  pwm_get_counter(slice_num) != 0;
-    return ret;
+bool is_clock_detected() {
+    return is_clock_detected(activities[0]);
 }
@@ -1,19 +1,83 @@
 #ifndef __CLOCK_DETECT__
 #define __CLOCK_DETECT__
 #include "pico/types.h"
+#include "hardware/pio.h"
+#include "bus_timing.h"
+#include "transceiver.h"
+
+#define BUS_IDLE_US (BusConfig::idleUs)     // Bus is idle after this time without clock edge (2 bits)
+
+/**
+ * Callback when the bus becomes idle (called from interrupt)
+ * @param ctx Context given with the callback
+ **/
+typedef void (*bus_idle_callback)(void* ctx);
+
+/**
+ * Bus activity of a segment, tracked by a bus_idle state machine
+ **/
+typedef struct BusActivity {
+    PIO pio;                            // PIO block of the state machine (pio0)
+    uint sm;                            // bus_idle state machine number
+    uint offset;                        // Program offset, the state machine waits there while the bus is idle
+    bool configured;
+    volatile bool busIdle;
+    volatile uint32_t lastClockTime;    // Last clock edge (us), valid while the bus is idle
+    volatile uint32_t activeSince;      // Start of the current activity (us)
+    volatile uint32_t busyTime;         // Cumulated activity (us) of ended activities
+    volatile bus_idle_callback idleCallback;
+    void* volatile idleContext;
+} BusActivity;
+
+/**
+ * Gets the bus activity of a segment
+ * @param segment Segment number, less than NR_SEGMENTS
+ **/
+BusActivity& get_bus_activity(uint segment);
+
+/**
+ * Initializes the clock detection of a segment
+ * Bus activity is then tracked continuously by interrupts
+ * @param segment Segment number, gives the state machine
+ * @param clkInPin Received clock pin
+ **/
+void initialize_clock_detect(BusActivity& bus, uint segment, uint clkInPin);
+
+/**
+ * Gets if the bus is idle (no clock edge during BUS_IDLE_US), does not block
+ **/
+bool is_bus_idle(const BusActivity& bus);
+
+/**
+ * Gets the time of the last clock edge (us), current time while the bus is active
+ **/
+uint32_t get_last_clock_time(const BusActivity& bus);
+
+/**
+ * Gets the cumulated time the bus was active (us, wraps around)
+ * Bus utilisation is the difference between two calls over their interval
+ **/
+uint32_t get_bus_busy_time(const BusActivity& bus);
 
 /**
- * Initializes the clock detection
+ * Sets the function called when the bus becomes idle
+ * @param callback Function called from interrupt, nullptr to remove it
+ * @param ctx Context given to the callback
  **/
-void initialize_clock_detect();
+void set_bus_idle_callback(BusActivity& bus, bus_idle_callback callback, void* ctx);
 
 /**
  * Gets if clock is detected
- * @param nbCycles Number of clock cycles to detect
- * @return true if clock is detected during at least 10 clock edges
+ * @return true if a clock edge was seen during the last BUS_IDLE_US
  */
-bool is_clock_detected(uint nbCycles = 2);
+bool is_clock_detected(const BusActivity& bus);
 
-void wait_for_no_clock();
+/**
+ * Same functions on the first segment, the bus of the protocol engine
+ **/
+bool is_bus_idle();
+uint32_t get_last_clock_time();
+uint32_t get_bus_busy_time();
+bool is_clock_detected();
 
-#endif
\ No newline at end of file
+#endif
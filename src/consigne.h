@@ -0,0 +1,86 @@
+#ifndef __CONSIGNE_H__
+#define __CONSIGNE_H__
+#include <stdint.h>
+
+/**
+ * Reads a 16 bits value sent MSB first
+ **/
+static inline uint16_t read_u16_be(const uint8_t* p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+/**
+ * Reads a 16 bits value sent LSB first
+ **/
+static inline uint16_t read_u16_le(const uint8_t* p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+/**
+ * Nanoreseau consigne, read in place from a received frame
+ * Frame layout (bytes following the address) :
+ *  3 header bytes, then the consigne itself : destination, network task,
+ *  application task, message length, page, message address, computer,
+ *  application and the context dependant bytes.
+ * 16 bits fields are sent MSB first (6809 byte order).
+ * The view does not copy the frame : it is valid as long as the frame
+ * buffer is not reused. Lengths of an empty view (failed parse) are 0 and
+ * its context data is nullptr, fields must not be read.
+ **/
+class ConsigneView {
+public:
+    // Field offsets in the frame
+    static constexpr uint32_t HEADER_LEN = 3;
+    static constexpr uint32_t DEST = HEADER_LEN;
+    static constexpr uint32_t CODE_TACHE = HEADER_LEN + 1;
+    static constexpr uint32_t CODE_APP = HEADER_LEN + 2;
+    static constexpr uint32_t MSG_LEN = HEADER_LEN + 3;
+    static constexpr uint32_t PAGE = HEADER_LEN + 5;
+    static constexpr uint32_t MSG_ADDR = HEADER_LEN + 6;
+    static constexpr uint32_t ORDINATEUR = HEADER_LEN + 8;
+    static constexpr uint32_t APPLICATION = HEADER_LEN + 9;
+    static constexpr uint32_t CTX_DATA = HEADER_LEN + 10;
+    static constexpr uint32_t MIN_FRAME_LEN = CTX_DATA;         // Frame holding all fixed fields
+    static constexpr uint32_t MAX_LEN = 15 * 4;                 // Largest length announced by an initial call
+
+    /**
+     * Checks a received frame and views it as a consigne
+     * @param frame Received bytes (following the address)
+     * @param len Number of received bytes
+     * @param expectedLen Length announced by the initial call (received bytes)
+     * @return false if the frame is too short, the view is then empty
+     **/
+    bool parse(const uint8_t* frame, uint32_t len, uint32_t expectedLen)
+    {
+        if(len < MIN_FRAME_LEN || len < expectedLen){
+            frame_ = nullptr;
+            len_ = 0;
+            return false;
+        }
+        frame_ = frame;
+        len_ = len;
+        return true;
+    }
+
+    bool valid() const { return frame_ != nullptr; }
+
+    uint32_t length() const { return valid() ? len_ - HEADER_LEN : 0; } // Longueur de la consigne
+    uint8_t dest() const { return frame_[DEST]; }                       // Destinataire
+    uint8_t code_tache() const { return frame_[CODE_TACHE]; }           // Code tache reseau
+    uint8_t code_app() const { return frame_[CODE_APP]; }               // Code tache application
+    uint16_t msg_len() const { return read_u16_be(&frame_[MSG_LEN]); }  // Nombre d'octets du message
+    uint8_t page() const { return frame_[PAGE]; }                       // Page
+    uint16_t msg_addr() const { return read_u16_be(&frame_[MSG_ADDR]); }// Message adresse
+    uint8_t ordinateur() const { return frame_[ORDINATEUR]; }           // Ordinateur (0 : TO7, 1 : MO5, 2: TO7/70)
+    uint8_t application() const { return frame_[APPLICATION]; }         // Application (0 : Unknown, 1 : Basic 1.0, 2 : LOGO, 3 : LSE)
+    const uint8_t* ctx_data() const { return valid() ? &frame_[CTX_DATA] : nullptr; } // Context dependant bytes
+    uint32_t ctx_len() const { return valid() ? len_ - CTX_DATA : 0; }
+
+private:
+    const uint8_t* frame_ = nullptr;
+    uint32_t len_ = 0;
+};
+
+#endif
@@ -0,0 +1,79 @@
+#include "crc16.h"
+
+#define CRC16_POLY 0x8408           // Reflected 0x1021
+
+/**
+ * CRC tables computed at compile time
+ * table[0] is the classic byte table, table[k][i] is the CRC of byte i
+ * followed by k zero bytes, used to process several bytes at once
+ **/
+template<int N>
+struct Crc16Tables {
+    uint16_t table[N][256];
+
+    constexpr Crc16Tables() : table()
+    {
+        for(int i = 0; i < 256; ++i){
+            uint16_t crc = i;
+            for(int b = 0; b < 8; ++b){
+                crc = (crc & 1) ? ((crc >> 1) ^ CRC16_POLY) : (crc >> 1);
+            }
+            table[0][i] = crc;
+        }
+        for(int k = 1; k < N; ++k){
+            for(int i = 0; i < 256; ++i){
+                uint16_t prev = table[k - 1][i];
+                table[k][i] = (prev >> 8) ^ table[0][prev & 0xFF];
+            }
+        }
+    }
+};
+
+static constexpr Crc16Tables<8> crcTables;
+static_assert(crcTables.table[0][1] == 0x1189, "Bad CRC-16/X-25 table");
+
+uint16_t crc16_update_bitwise(uint16_t crc, const uint8_t* data, uint32_t len)
+{
+    while(len--){
+        crc ^= *data++;
+        for(int b = 0; b < 8; ++b){
+            crc = (crc & 1) ? ((crc >> 1) ^ CRC16_POLY) : (crc >> 1);
+        }
+    }
+    return crc;
+}
+
+uint16_t crc16_update_table(uint16_t crc, const uint8_t* data, uint32_t len)
+{
+    const uint16_t (&t)[256] = crcTables.table[0];
+    while(len--){
+        crc = (crc >> 8) ^ t[(crc ^ *data++) & 0xFF];
+    }
+    return crc;
+}
+
+uint16_t crc16_update_slice4(uint16_t crc, const uint8_t* data, uint32_t len)
+{
+    const uint16_t (&t)[8][256] = crcTables.table;
+    while(len >= 4){
+        //The CRC only overlaps the first 2 bytes, following bytes are shifted by 2 or 3 bytes
+        uint16_t v = crc ^ (data[0] | (data[1] << 8));
+        crc = t[3][v & 0xFF] ^ t[2][v >> 8] ^ t[1][data[2]] ^ t[0][data[3]];
+        data += 4;
+        len -= 4;
+    }
+    return crc16_update_table(crc, data, len);
+}
+
+uint16_t crc16_update_slice8(uint16_t crc, const uint8_t* data, uint32_t len)
+{
+    const uint16_t (&t)[8][256] = crcTables.table;
+    while(len >= 8){
+        uint16_t v = crc ^ (data[0] | (data[1] << 8));
+        crc = t[7][v & 0xFF] ^ t[6][v >> 8] ^ t[5][data[2]] ^ t[4][data[3]] ^
+              t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+        data += 8;
+        len -= 8;
+    }
+    return crc16_update_slice4(crc, data, len);
+}
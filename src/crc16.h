@@ -0,0 +1,76 @@
+#ifndef __CRC16_H__
+#define __CRC16_H__
+#include <stdint.h>
+
+#define CRC16_X25_INIT 0xFFFF       // Initial CRC value
+#define CRC16_X25_RESIDUE 0xF0B8    // CRC of a valid frame followed by its (complemented) CRC
+
+/**
+ * CRC-16/X-25 (HDLC FCS) : reflected 0x1021 polynomial (0x8408), initial
+ * value 0xFFFF, complemented result sent LSB first after the frame.
+ * Functions update a running (not complemented) CRC, so a frame can be
+ * processed in several parts.
+ **/
+
+/**
+ * Updates CRC, one bit at a time (reference)
+ * @param crc Running CRC (CRC16_X25_INIT at frame start)
+ * @param data Bytes to add
+ * @param len Number of bytes
+ * @return Updated running CRC
+ **/
+uint16_t crc16_update_bitwise(uint16_t crc, const uint8_t* data, uint32_t len);
+
+/**
+ * Updates CRC, one byte at a time with a 256 entries table
+ **/
+uint16_t crc16_update_table(uint16_t crc, const uint8_t* data, uint32_t len);
+
+/**
+ * Updates CRC, 4 bytes at a time (slice-by-4 tables)
+ **/
+uint16_t crc16_update_slice4(uint16_t crc, const uint8_t* data, uint32_t len);
+
+/**
+ * Updates CRC, 8 bytes at a time (slice-by-8 tables)
+ **/
+uint16_t crc16_update_slice8(uint16_t crc, const uint8_t* data, uint32_t len);
+
+/**
+ * Updates CRC with the fastest variant for the target
+ * Cortex-M0+ has no cache and flash is slow, slice-by-4 keeps the tables small
+ **/
+static inline uint16_t crc16_update(uint16_t crc, const uint8_t* data, uint32_t len)
+{
+    return crc16_update_slice4(crc, data, len);
+}
+
+/**
+ * Computes the CRC to be sent after a frame
+ * @return CRC, low byte is sent first
+ **/
+static inline uint16_t crc16_x25(const uint8_t* data, uint32_t len)
+{
+    return ~crc16_update(CRC16_X25_INIT, data, len);
+}
+
+/**
+ * Checks a running CRC computed over a frame and its CRC bytes
+ **/
+static inline bool crc16_is_valid(uint16_t crc)
+{
+    return crc == CRC16_X25_RESIDUE;
+}
+
+/**
+ * Converts a running CRC to the value read from the DMA sniffer
+ * Sniffer in CRC-16-CCITT mode with bit-reversed data (0x3), output
+ * bit-reversed (0x400) and inverted (0x800) : the CRC to send is the high
+ * half word
+ **/
+static inline uint32_t crc16_to_sniffer(uint16_t crc)
+{
+    return ((uint32_t)(uint16_t)~crc << 16) | 0xFFFF;
+}
+
+#endif
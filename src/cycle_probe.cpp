@@ -0,0 +1,27 @@
+#include "cycle_probe.h"
+
+#include <string.h>
+
+const char* probe_name(uint32_t id)
+{
+    static const char* const names[PROBE_COUNT] = {"pio0_isr", "rx_dma_isr", "send_frame", "protocol_frame"};
+    return id < PROBE_COUNT ? names[id] : "?";
+}
+
+#ifdef USE_CYCLE_PROBES
+ProbeStat probeStats[PROBE_COUNT];
+
+void probe_init()
+{
+    //Free running from the top of the counter, no interrupt, processor clock
+    systick_hw->rvr = PROBE_SYSTICK_MASK;
+    systick_hw->cvr = 0;
+    systick_hw->csr = 0x5;
+    probe_reset();
+}
+
+void probe_reset()
+{
+    memset(probeStats, 0, sizeof(probeStats));
+}
+#endif
@@ -0,0 +1,86 @@
+#ifndef __CYCLE_PROBE_H__
+#define __CYCLE_PROBE_H__
+#include "pico/stdlib.h"
+
+//#define USE_CYCLE_PROBES              // Counts the cycles of hot path functions (-DPICORESEAU_CYCLE_PROBES=ON)
+
+/**
+ * Cycle counts of hot path functions
+ * A probe reads the SysTick of the core (24 bits, counting down at the
+ * processor clock) when the function starts and when it returns, interrupts
+ * taken meanwhile are included. Statistics are printed as JSON by the
+ * console 'b' command and compared with a baseline by picoreseau_bench.
+ * In the simulator, SysTick follows the host time at the same clock, the
+ * counts give the host cost of the firmware code. Without USE_CYCLE_PROBES
+ * the CYCLE_PROBE macro compiles to nothing.
+ **/
+
+enum probe_id : uint8_t {
+    PROBE_PIO0_ISR,         // RX flags and aborts, all segments
+    PROBE_RX_DMA_ISR,       // RX DMA restart
+    PROBE_SEND_FRAME,       // Frame queued and emitter started (sendData setup)
+    PROBE_PROTOCOL_FRAME,   // Received frame decoded and its session transition
+    PROBE_COUNT
+};
+
+typedef struct ProbeStat {
+    uint32_t count;
+    uint32_t min;           // Cycles
+    uint32_t max;
+    uint64_t sum;
+} ProbeStat;
+
+/**
+ * Gets the name of a probe (JSON metrics)
+ **/
+const char* probe_name(uint32_t id);
+
+#ifdef USE_CYCLE_PROBES
+#include "hardware/structs/systick.h"
+
+#define PROBE_SYSTICK_MASK 0x00FFFFFFu  // SysTick counter bits
+
+extern ProbeStat probeStats[PROBE_COUNT];
+
+/**
+ * Starts the SysTick of the calling core, on each core running probes
+ **/
+void probe_init();
+
+/**
+ * Clears the statistics, from the core running the probes
+ **/
+void probe_reset();
+
+/**
+ * Counts the cycles of the enclosing scope
+ **/
+class CycleProbe {
+public:
+    explicit CycleProbe(probe_id id) : id_(id), start_(systick_hw->cvr) {}
+    ~CycleProbe()
+    {
+        //Counts down
+        uint32_t cycles = (start_ - systick_hw->cvr) & PROBE_SYSTICK_MASK;
+        ProbeStat& s = probeStats[id_];
+        if(s.count == 0 || cycles < s.min){
+            s.min = cycles;
+        }
+        if(cycles > s.max){
+            s.max = cycles;
+        }
+        ++s.count;
+        s.sum += cycles;
+    }
+
+private:
+    probe_id id_;
+    uint32_t start_;
+};
+
+#define CYCLE_PROBE(id) CycleProbe cycleProbe(id)
+#else
+#define CYCLE_PROBE(id) do{}while(0)
+#endif
+
+#endif
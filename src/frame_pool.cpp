@@ -0,0 +1,130 @@
+#include "frame_pool.h"
+#include "pico/sync.h"
+
+typedef struct PoolClass {
+    uint8_t* blocks;        // count blocks of size bytes
+    uint32_t size;
+    uint32_t count;
+    uint8_t* refs;          // Reference count of each block
+    uint8_t* freeList;      // Stack of free block indexes
+    uint32_t freeCount;
+    PoolClassStats stats;
+} PoolClass;
+
+static uint8_t smallBlocks[POOL_SMALL_COUNT][POOL_SMALL_SIZE] __attribute__((aligned(4)));
+static uint8_t smallRefs[POOL_SMALL_COUNT];
+static uint8_t smallFree[POOL_SMALL_COUNT];
+static uint8_t largeBlocks[POOL_LARGE_COUNT][POOL_LARGE_SIZE] __attribute__((aligned(4)));
+static uint8_t largeRefs[POOL_LARGE_COUNT];
+static uint8_t largeFree[POOL_LARGE_COUNT];
+
+static_assert(POOL_SMALL_COUNT <= 256 && POOL_LARGE_COUNT <= 256, "Block indexes are 8 bits");
+
+static PoolClass pools[2] = {
+    {&smallBlocks[0][0], POOL_SMALL_SIZE, POOL_SMALL_COUNT, smallRefs, smallFree, 0, {}},
+    {&largeBlocks[0][0], POOL_LARGE_SIZE, POOL_LARGE_COUNT, largeRefs, largeFree, 0, {}},
+};
+static bool poolReady = false;
+
+/**
+ * Fills the free lists, called with interrupts disabled
+ **/
+static void pool_init()
+{
+    for(PoolClass& p : pools){
+        for(uint32_t i = 0; i < p.count; ++i){
+            p.freeList[i] = p.count - 1 - i;
+        }
+        p.freeCount = p.count;
+    }
+    poolReady = true;
+}
+
+/**
+ * Finds the class and block index of a buffer
+ * @return Class, nullptr if the buffer is not from the pool
+ **/
+static PoolClass* pool_find(const uint8_t* buffer, uint32_t& index)
+{
+    for(PoolClass& p : pools){
+        if(buffer >= p.blocks && buffer < p.blocks + p.size * p.count){
+            index = (buffer - p.blocks) / p.size;
+            return &p;
+        }
+    }
+    return nullptr;
+}
+
+uint8_t* pool_alloc(uint32_t size)
+{
+    uint8_t* buffer = nullptr;
+    uint32_t irqs = save_and_disable_interrupts();
+    if(!poolReady){
+        pool_init();
+    }
+    for(PoolClass& p : pools){
+        if(size > p.size){
+            continue;
+        }
+        if(p.freeCount == 0){
+            //Small requests do not take large blocks, they are kept for messages
+            ++p.stats.failures;
+            break;
+        }
+        uint32_t index = p.freeList[--p.freeCount];
+        p.refs[index] = 1;
+        buffer = p.blocks + index * p.size;
+        ++p.stats.inUse;
+#ifdef USE_POOL_STATS
+        if(p.stats.inUse > p.stats.highWater){
+            p.stats.highWater = p.stats.inUse;
+        }
+#endif
+        break;
+    }
+    if(size > POOL_LARGE_SIZE){
+        ++pools[1].stats.failures;
+    }
+    restore_interrupts(irqs);
+    return buffer;
+}
+
+void pool_retain(const uint8_t* buffer)
+{
+    uint32_t index = 0;
+    PoolClass* p = pool_find(buffer, index);
+    if(p == nullptr){
+        return;
+    }
+    uint32_t irqs = save_and_disable_interrupts();
+    ++p->refs[index];
+    restore_interrupts(irqs);
+}
+
+void pool_release(const uint8_t* buffer)
+{
+    uint32_t index = 0;
+    PoolClass* p = pool_find(buffer, index);
+    if(p == nullptr){
+        return;
+    }
+    uint32_t irqs = save_and_disable_interrupts();
+    if(p->refs[index] != 0 && --p->refs[index] == 0){
+        p->freeList[p->freeCount++] = index;
+        --p->stats.inUse;
+    }
+    restore_interrupts(irqs);
+}
+
+void pool_tx_done(const uint8_t* buffer, void* ctx, bool sent)
+{
+    pool_release(buffer);
+}
+
+void pool_get_stats(PoolStats& stats)
+{
+    uint32_t irqs = save_and_disable_interrupts();
+    stats.small = pools[0].stats;
+    stats.large = pools[1].stats;
+    restore_interrupts(irqs);
+}
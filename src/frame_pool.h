@@ -0,0 +1,59 @@
+#ifndef __FRAME_POOL_H__
+#define __FRAME_POOL_H__
+#include "pico/stdlib.h"
+
+//#define USE_POOL_STATS                // Keeps occupancy high-water marks (-DPICORESEAU_POOL_STATS=ON, default)
+
+#define POOL_SMALL_SIZE 64              // Control frames and consignes
+#define POOL_SMALL_COUNT 32
+#define POOL_LARGE_SIZE 1028            // Largest frame : address, data header and a message chunk
+#define POOL_LARGE_COUNT 4
+
+/**
+ * Fixed-block frame buffers, in two size classes
+ * Buffers are reference counted : the owner allocates, every other user
+ * (TX queue, consigne...) retains and releases. No heap is used, all
+ * functions can be called from interrupts.
+ **/
+
+typedef struct PoolClassStats {
+    uint16_t inUse;         // Blocks currently allocated
+    uint16_t highWater;     // Maximum of inUse
+    uint32_t failures;      // Allocations refused (class exhausted or request too large)
+} PoolClassStats;
+
+typedef struct PoolStats {
+    PoolClassStats small;
+    PoolClassStats large;
+} PoolStats;
+
+/**
+ * Allocates a buffer from the smallest class holding size bytes
+ * @param size Bytes needed
+ * @return Buffer with a reference count of 1, nullptr if none is available
+ *         or size is larger than POOL_LARGE_SIZE
+ **/
+uint8_t* pool_alloc(uint32_t size);
+
+/**
+ * Adds a reference to a buffer
+ **/
+void pool_retain(const uint8_t* buffer);
+
+/**
+ * Removes a reference, the buffer is freed on the last one
+ * @param buffer Buffer given by pool_alloc, nullptr is ignored
+ **/
+void pool_release(const uint8_t* buffer);
+
+/**
+ * Releases a buffer once sent or dropped, to be given as sendFrame callback
+ **/
+void pool_tx_done(const uint8_t* buffer, void* ctx, bool sent);
+
+/**
+ * Gets occupancy statistics (high-water marks are 0 without USE_POOL_STATS)
+ **/
+void pool_get_stats(PoolStats& stats);
+
+#endif
@@ -0,0 +1,413 @@
+#include "hdlc_codec.h"
+#include "crc16.h"
+
+#define DECODE_HOLD_BITS 6          // Data bits held back, they may be the start of a flag
+
+//Events of the decoder
+enum : uint8_t {
+    HDLC_EVENT_NONE = 0,
+    HDLC_EVENT_FLAG = 1,            // Zero after six ones
+    HDLC_EVENT_ABORT = 2,           // Seventh one
+};
+
+/**
+ * Encoding of a byte from a stuffing state
+ **/
+typedef struct HdlcEncodeStep {
+    uint16_t bits;          // Line bits, first bit in bit 0
+    uint8_t count;          // Number of line bits (8 to 10)
+    uint8_t ones;           // Consecutive ones after the byte
+} HdlcEncodeStep;
+
+/**
+ * Decoding of a line byte from a stuffing state
+ * A byte with an event is decoded up to the event bit, the rest is decoded
+ * one bit at a time (once or twice per frame)
+ **/
+typedef struct HdlcDecodeStep {
+    uint8_t data;           // Data bits, first bit in bit 0
+    uint8_t count;          // Number of data bits
+    uint8_t ones;           // Consecutive ones after the byte (after the event bit)
+    uint8_t event;          // Event type in high nibble, bits decoded with the event bit in low nibble
+} HdlcDecodeStep;
+
+/**
+ * Decodes one line bit
+ * @param ones Consecutive ones received, updated
+ * @param bit Line bit
+ * @param keep Set if the bit is a data bit
+ * @return Event ended by the bit
+ **/
+static constexpr uint8_t decode_bit(uint8_t& ones, uint8_t bit, bool& keep)
+{
+    keep = false;
+    if(bit){
+        if(ones == 7){
+            return HDLC_EVENT_NONE;     // Idle line or end of an abort
+        }
+        ++ones;
+        if(ones == 7){
+            return HDLC_EVENT_ABORT;
+        }
+        keep = ones <= 5;               // The sixth one is a flag or an abort
+        return HDLC_EVENT_NONE;
+    }
+    uint8_t previous = ones;
+    ones = 0;
+    if(previous == 6){
+        return HDLC_EVENT_FLAG;
+    }
+    keep = previous < 5;                // Inserted zero or end of an abort otherwise
+    return HDLC_EVENT_NONE;
+}
+
+/**
+ * Encoding and decoding tables computed at compile time
+ **/
+struct HdlcTables {
+    HdlcEncodeStep enc[5][256];
+    HdlcDecodeStep dec[8][256];
+
+    constexpr HdlcTables() : enc(), dec()
+    {
+        for(int s = 0; s < 5; ++s){
+            for(int b = 0; b < 256; ++b){
+                uint16_t bits = 0;
+                uint8_t count = 0;
+                uint8_t ones = s;
+                for(int i = 0; i < 8; ++i){
+                    uint8_t bit = (b >> i) & 1;
+                    bits |= bit << count;
+                    ++count;
+                    if(!bit){
+                        ones = 0;
+                    }else if(++ones == 5){
+                        ++count;                //Inserted zero
+                        ones = 0;
+                    }
+                }
+                enc[s][b] = {bits, count, ones};
+            }
+        }
+        for(int s = 0; s < 8; ++s){
+            for(int b = 0; b < 256; ++b){
+                HdlcDecodeStep step = {0, 0, 0, 0};
+                uint8_t ones = s;
+                for(int i = 0; i < 8; ++i){
+                    bool keep = false;
+                    uint8_t event = decode_bit(ones, (b >> i) & 1, keep);
+                    if(keep){
+                        step.data |= ((b >> i) & 1) << step.count;
+                        ++step.count;
+                    }
+                    if(event != HDLC_EVENT_NONE){
+                        step.event = (event << 4) | (i + 1);
+                        break;
+                    }
+                }
+                step.ones = ones;
+                dec[s][b] = step;
+            }
+        }
+    }
+};
+
+static constexpr HdlcTables hdlcTables;
+static_assert(hdlcTables.enc[4][0x01].count == 9 && hdlcTables.enc[0][0xFF].count == 9, "Bad HDLC encoding table");
+static_assert(hdlcTables.dec[0][HDLC_FLAG].event == ((HDLC_EVENT_FLAG << 4) | 8), "Bad HDLC decoding table");
+
+void hdlc_encoder_init(HdlcEncoder& enc)
+{
+    enc.bits = 0;
+    enc.count = 0;
+    enc.ones = 0;
+    enc.crc = CRC16_X25_INIT;
+}
+
+/**
+ * Writes the complete bytes of the encoder
+ **/
+static inline uint32_t put_bytes(HdlcEncoder& enc, uint8_t* out)
+{
+    uint32_t n = 0;
+    while(enc.count >= 8){
+        out[n++] = enc.bits;
+        enc.bits >>= 8;
+        enc.count -= 8;
+    }
+    return n;
+}
+
+/**
+ * Stuffs bytes, without CRC update
+ **/
+static uint32_t encode_bytes(HdlcEncoder& enc, const uint8_t* data, uint32_t len, uint8_t* out)
+{
+    uint8_t* o = out;
+    uint32_t bits = enc.bits;
+    uint32_t count = enc.count;
+    uint32_t ones = enc.ones;
+    for(uint32_t i = 0; i < len; ++i){
+        const HdlcEncodeStep& s = hdlcTables.enc[ones][data[i]];
+        bits |= (uint32_t)s.bits << count;
+        count += s.count;
+        ones = s.ones;
+        //At most 17 bits : 7 left from the previous byte and 10 encoded
+        if(count >= 8){
+            *o++ = bits;
+            bits >>= 8;
+            count -= 8;
+            if(count >= 8){
+                *o++ = bits;
+                bits >>= 8;
+                count -= 8;
+            }
+        }
+    }
+    enc.bits = bits;
+    enc.count = count;
+    enc.ones = ones;
+    return o - out;
+}
+
+uint32_t hdlc_encode_flag(HdlcEncoder& enc, uint8_t* out)
+{
+    enc.bits |= (uint32_t)HDLC_FLAG << enc.count;
+    enc.count += 8;
+    enc.ones = 0;
+    enc.crc = CRC16_X25_INIT;
+    return put_bytes(enc, out);
+}
+
+uint32_t hdlc_encode_data(HdlcEncoder& enc, const uint8_t* data, uint32_t len, uint8_t* out)
+{
+    enc.crc = crc16_update(enc.crc, data, len);
+    return encode_bytes(enc, data, len, out);
+}
+
+uint32_t hdlc_encode_end(HdlcEncoder& enc, uint8_t* out)
+{
+    uint16_t crc = ~enc.crc;
+    uint8_t fcs[2] = {(uint8_t)(crc & 0xFF), (uint8_t)(crc >> 8)};
+    uint32_t n = encode_bytes(enc, fcs, sizeof(fcs), out);
+    return n + hdlc_encode_flag(enc, out + n);
+}
+
+uint32_t hdlc_encode_abort(HdlcEncoder& enc, uint8_t* out)
+{
+    enc.bits |= (uint32_t)HDLC_ABORT << enc.count;
+    enc.count += 7;
+    enc.ones = 0;
+    return put_bytes(enc, out);
+}
+
+uint32_t hdlc_encode_frame(HdlcEncoder& enc, const uint8_t* data, uint32_t len, uint8_t* out)
+{
+    uint32_t n = hdlc_encode_flag(enc, out);
+    n += hdlc_encode_data(enc, data, len, out + n);
+    return n + hdlc_encode_end(enc, out + n);
+}
+
+uint32_t hdlc_encode_flush(HdlcEncoder& enc, uint8_t* out)
+{
+    if(enc.count == 0){
+        return 0;
+    }
+    out[0] = enc.bits | (0xFF << enc.count);
+    enc.bits = 0;
+    enc.count = 0;
+    enc.ones = 0;
+    return 1;
+}
+
+void hdlc_decoder_init(HdlcDecoder& dec, uint8_t* buffer, uint32_t bufLen)
+{
+    dec.buffer = buffer;
+    dec.bufLen = bufLen;
+    dec.length = 0;
+    dec.crcLen = 0;
+    dec.frameBits = 0;
+    dec.bits = 0;
+    dec.count = 0;
+    dec.ones = 7;               // An idle line until the first flag
+    dec.bitPos = 0;
+    dec.hunting = true;
+    dec.ended = false;
+    dec.crc = CRC16_X25_INIT;
+}
+
+/**
+ * Stores the oldest byte of the data bits
+ **/
+static inline void store_byte(HdlcDecoder& dec)
+{
+    if(dec.length < dec.bufLen){
+        dec.buffer[dec.length] = dec.bits;
+    }
+    ++dec.length;
+    dec.bits >>= 8;
+    dec.count -= 8;
+}
+
+/**
+ * Adds the stored bytes to the CRC
+ **/
+static inline void update_crc(HdlcDecoder& dec)
+{
+    uint32_t end = dec.length < dec.bufLen ? dec.length : dec.bufLen;
+    if(end > dec.crcLen){
+        dec.crc = crc16_update(dec.crc, dec.buffer + dec.crcLen, end - dec.crcLen);
+        dec.crcLen = end;
+    }
+}
+
+/**
+ * Starts a new frame, bytes of the last one are dropped
+ **/
+static inline void start_frame(HdlcDecoder& dec)
+{
+    dec.length = 0;
+    dec.crcLen = 0;
+    dec.crc = CRC16_X25_INIT;
+    dec.frameBits = 0;
+    dec.bits = 0;
+    dec.count = 0;
+}
+
+/**
+ * Handles a flag or an abort
+ * @return Status of the frame it ends, busy if none
+ **/
+static receiver_status end_frame(HdlcDecoder& dec, uint8_t event)
+{
+    if(dec.hunting){
+        if(event == HDLC_EVENT_FLAG){
+            dec.hunting = false;
+            start_frame(dec);
+        }
+        return busy;
+    }
+    //The five ones before the event were taken as data
+    uint32_t dataBits = dec.frameBits - 5;
+    dec.count -= 5;
+    receiver_status status;
+    if(event == HDLC_EVENT_ABORT){
+        dec.hunting = true;
+        if(dataBits == 0){
+            start_frame(dec);   // Idle line after a flag
+            return busy;
+        }
+        status = frame_aborted;
+    }else{
+        //Fill between flags (hdlc_tx sends a zero between idle flags)
+        if(dataBits < 8){
+            start_frame(dec);
+            return busy;
+        }
+        uint32_t extra = dataBits % 8;
+        if(extra == 1){
+            --dec.count;        // Opening zero of the flag
+        }
+        if(dec.count == 8){
+            store_byte(dec);
+        }
+        update_crc(dec);
+        if(extra > 1){
+            status = bad_crc;
+        }else if(dec.length > dec.bufLen){
+            status = overrun;
+        }else if(dec.length < 3){
+            status = frame_short;
+        }else{
+            status = crc16_is_valid(dec.crc) ? done : bad_crc;
+        }
+    }
+    //Bytes are kept until the next call, the flag starts the next frame
+    dec.frameBits = 0;
+    dec.bits = 0;
+    dec.count = 0;
+    dec.ended = true;
+    return status;
+}
+
+/**
+ * Decodes the bits of a byte one at a time
+ * @param pos First bit to decode, next one on return
+ * @return Status of a frame ended, busy if none
+ **/
+static receiver_status decode_bits(HdlcDecoder& dec, uint8_t byte, uint32_t& pos)
+{
+    while(pos < 8){
+        uint8_t bit = (byte >> pos) & 1;
+        ++pos;
+        bool keep = false;
+        uint8_t event = decode_bit(dec.ones, bit, keep);
+        if(keep && !dec.hunting){
+            dec.bits |= (uint32_t)bit << dec.count;
+            ++dec.count;
+            ++dec.frameBits;
+            if(dec.count >= 8 + DECODE_HOLD_BITS){
+                store_byte(dec);
+            }
+        }
+        if(event != HDLC_EVENT_NONE){
+            receiver_status status = end_frame(dec, event);
+            if(status != busy){
+                return status;
+            }
+        }
+    }
+    return busy;
+}
+
+receiver_status hdlc_decode(HdlcDecoder& dec, const uint8_t* data, uint32_t len, uint32_t& used)
+{
+    if(dec.ended){
+        dec.length = 0;
+        dec.crcLen = 0;
+        dec.crc = CRC16_X25_INIT;
+        dec.ended = false;
+    }
+    used = 0;
+    uint32_t i = 0;
+    uint32_t pos = 8;
+    receiver_status status = busy;
+    //Rest of the byte where the last frame ended
+    if(dec.bitPos != 0 && len != 0){
+        pos = dec.bitPos;
+        status = decode_bits(dec, data[0], pos);
+        i = 1;
+    }
+    while(status == busy && i < len){
+        uint8_t byte = data[i++];
+        const HdlcDecodeStep& s = hdlcTables.dec[dec.ones][byte];
+        if(!dec.hunting){
+            dec.bits |= (uint32_t)s.data << dec.count;
+            dec.count += s.count;
+            dec.frameBits += s.count;
+            //At most 21 bits : 13 held and 8 decoded
+            if(dec.count >= 8 + DECODE_HOLD_BITS){
+                store_byte(dec);
+            }
+        }
+        dec.ones = s.ones;
+        pos = 8;
+        if(s.event){
+            pos = s.event & 0x0F;
+            status = end_frame(dec, s.event >> 4);
+            if(status == busy){
+                status = decode_bits(dec, byte, pos);
+            }
+        }
+    }
+    if(status == busy){
+        update_crc(dec);
+        dec.bitPos = 0;
+        used = len;
+        return busy;
+    }
+    //The byte where the frame ended is decoded again from the next bit
+    dec.bitPos = pos < 8 ? pos : 0;
+    used = pos < 8 ? i - 1 : i;
+    return status;
+}
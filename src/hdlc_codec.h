@@ -0,0 +1,117 @@
+#ifndef __HDLC_CODEC_H__
+#define __HDLC_CODEC_H__
+#include <stdint.h>
+#include "hdlc_rx.h"
+
+/**
+ * Software HDLC framing, the same line format as hdlc_tx.pio and hdlc_rx.pio
+ * Encoded streams are bytes of line bits, first bit in bit 0 (bytes are
+ * sent LSB first). A zero is inserted after five consecutive ones, frames
+ * are delimited by flags (01111110) and aborted by seven ones. Both
+ * directions process a whole byte per step with lookup tables, the
+ * stuffing state is carried from one byte (and one call) to the next, so
+ * streams can be split anywhere.
+ **/
+
+#define HDLC_FLAG 0x7E
+#define HDLC_ABORT 0x7F                     // Seven ones
+
+// Encoded bytes written for len data bytes (stuffing can add 2 bits per byte)
+#define HDLC_ENCODED_MAX(len) (((len) * 10 + 7) / 8 + 1)
+
+typedef struct HdlcEncoder {
+    uint32_t bits;          // Encoded bits not written yet, first bit in bit 0
+    uint8_t count;          // Number of bits (less than 8 between calls)
+    uint8_t ones;           // Consecutive ones at the end of the stream (0 to 4)
+    uint16_t crc;           // Running CRC of the frame
+} HdlcEncoder;
+
+typedef struct HdlcDecoder {
+    uint8_t* buffer;        // Frame bytes, as seen on the bus (address, data and CRC)
+    uint32_t bufLen;
+    uint32_t length;        // Bytes of the frame (more than bufLen on overrun)
+    uint32_t crcLen;        // Bytes already added to crc
+    uint32_t frameBits;     // Data bits since the opening flag
+    uint32_t bits;          // Data bits not stored yet, first bit in bit 0
+    uint8_t count;          // Number of bits, the last 6 may belong to a flag
+    uint8_t ones;           // Consecutive ones received (7 : seven or more)
+    uint8_t bitPos;         // Bits of the current input byte already decoded
+    bool hunting;           // Waiting for a flag, bits are ignored
+    bool ended;             // Last call returned a frame, next call starts a new one
+    uint16_t crc;           // Running CRC of the frame
+} HdlcDecoder;
+
+/**
+ * Initializes an encoder, the stream starts on a byte boundary
+ **/
+void hdlc_encoder_init(HdlcEncoder& enc);
+
+/**
+ * Encodes a flag and starts a new frame
+ * @param out Encoded bytes (at most 2)
+ * @return Bytes written in out
+ **/
+uint32_t hdlc_encode_flag(HdlcEncoder& enc, uint8_t* out);
+
+/**
+ * Encodes frame data, can be called several times for a frame
+ * @param data Bytes to send (address first)
+ * @param len Number of bytes
+ * @param out Encoded bytes, HDLC_ENCODED_MAX(len) bytes
+ * @return Bytes written in out
+ **/
+uint32_t hdlc_encode_data(HdlcEncoder& enc, const uint8_t* data, uint32_t len, uint8_t* out);
+
+/**
+ * Ends a frame : encodes its CRC and the closing flag
+ * @param out Encoded bytes (at most 5)
+ * @return Bytes written in out
+ **/
+uint32_t hdlc_encode_end(HdlcEncoder& enc, uint8_t* out);
+
+/**
+ * Aborts the current frame (seven ones)
+ * @param out Encoded bytes (at most 2)
+ * @return Bytes written in out
+ **/
+uint32_t hdlc_encode_abort(HdlcEncoder& enc, uint8_t* out);
+
+/**
+ * Encodes a whole frame : opening flag, data, CRC and closing flag
+ * @param out Encoded bytes, HDLC_ENCODED_MAX(len + 2) + 2 bytes
+ * @return Bytes written in out
+ **/
+uint32_t hdlc_encode_frame(HdlcEncoder& enc, const uint8_t* data, uint32_t len, uint8_t* out);
+
+/**
+ * Writes the bits left in the encoder, the last byte is completed with ones
+ * (idle line, less than seven so it isn't an abort after a flag)
+ * @param out Encoded byte
+ * @return Bytes written in out (0 or 1)
+ **/
+uint32_t hdlc_encode_flush(HdlcEncoder& enc, uint8_t* out);
+
+/**
+ * Initializes a decoder, it waits for a flag
+ * @param buffer Buffer to store frames
+ * @param bufLen Size of buffer
+ **/
+void hdlc_decoder_init(HdlcDecoder& dec, uint8_t* buffer, uint32_t bufLen);
+
+/**
+ * Decodes an encoded stream until the end of a frame
+ * A frame ending inside an input byte leaves it partly decoded, it must be
+ * given again (first byte of the next call), used doesn't count it.
+ * Once a frame is returned, its bytes (dec.buffer, dec.length with CRC)
+ * are valid until the next call.
+ * @param data Encoded bytes
+ * @param len Number of bytes
+ * @param used Bytes fully decoded
+ * @return busy if all bytes were decoded without ending a frame, else the
+ *         frame status : done, bad_crc (also frames not ending on a byte
+ *         boundary), frame_short (shorter than address and CRC), overrun
+ *         (larger than the buffer) or frame_aborted
+ **/
+receiver_status hdlc_decode(HdlcDecoder& dec, const uint8_t* data, uint32_t len, uint32_t& used);
+
+#endif
@@ -6,199 +6,401 @@
 #include "pico/sync.h"
 
 #include "hdlc_rx.pio.h"
+#include "crc16.h"
+#include "trace.h"
+#include "cycle_probe.h"
+#include "bus_stats.h"
+#include "wake.h"
 
 #include <stdio.h>
+#include <string.h>
 
-PIO rxPIO = pio0;               // PIO block for data receipt
-uint rxDataSM = 0;              // Data reception state machine number
-int rxDMAChannel = -1;          // Data reception DMA channel
+//#define USE_SNIFFER_CRC           // CRC checked by the DMA sniffer when available (-DPICORESEAU_SNIFFER_CRC=ON, default)
 
-uint rxEnablePin = 0;           // Tranceiver TX enable pin
+#define RX_DMA_COUNT 0x80000000u    // DMA transfers before re-arming (keeps stream positions continuous)
+#define RX_MIN_FRAME_LEN 5          // Address, at least 2 bytes and CRC
 
-uint8_t* rxBuffer = nullptr;    // RX buffer
-uint32_t rxBufferMaxLen = 0;    // Maximum length of buffer 
-uint8_t rcvAddress = 0;         // Our expected address on the bus
+#define RX_PIO pio0                 // PIO block for data receipt
 
-uint8_t destAddress = 0xFF;     // Address read on frame
-static volatile uint32_t crc[3] = {0,0,0};  // CRC at current byte, -1 ,2
-static volatile uint32_t rxCount = 0;       // Number of received bytes
-static volatile bool rxCompleted = false;   // RX completed
-static volatile bool skipData = false;      // Skip this frame
-static bool firstUse = true;
+// RX ring buffers, DMA wraps the write address on their size (must be aligned on their size)
+static uint8_t rxRings[NR_SEGMENTS][RX_RING_SIZE] __attribute__((aligned(RX_RING_SIZE)));
+static HdlcReceiver receivers[NR_SEGMENTS];
+static int rxDataOffset = -1;               // Program offset, loaded once for all segments
 
-#define USE_ABORT
+/**
+ * Gets current position in the RX byte stream
+ **/
+static inline uint32_t rxStreamPosition(const HdlcReceiver& rx)
+{
+    return rx.streamBase + (RX_DMA_COUNT - dma_channel_hw_addr(rx.dmaChannel)->transfer_count);
+}
 
-static inline void prepareRx()
+/**
+ * Gets if the DMA sniffer is currently computing the RX CRC
+ **/
+static inline bool rxOwnsSniffer(const HdlcReceiver& rx)
 {
-    rxCompleted = false;
-    skipData = false;
-    rxCount = 0;
-    pio_sm_clear_fifos(rxPIO, rxDataSM);
-    // Starts DMA
-    dma_sniffer_enable(rxDMAChannel, 0x3, true);            // Turn on CRC-16/X-25
-    dma_hw->sniff_ctrl |= 0x800;    //Out inverted (bitwise complement, XOR out)
-    dma_hw->sniff_ctrl |= 0x400;    //Out bit-reversed
-    dma_hw->sniff_data = 0xFFFF;    //Start with 0xFFFF
-    dma_channel_set_write_addr(rxDMAChannel, &destAddress, true);   //Start DMA transfer
+    uint32_t ctrl = dma_hw->sniff_ctrl;
+    return (ctrl & DMA_SNIFF_CTRL_EN_BITS) &&
+        (((ctrl & DMA_SNIFF_CTRL_DMACH_BITS) >> DMA_SNIFF_CTRL_DMACH_LSB) == (uint)rx.dmaChannel);
 }
 
 /**
- * Interrupt service routine on PIO 0
- * Interrupt 0 is raised if an abort is found
- * Interrupt 1 is raised if TX is completed is found
+ * Seeds the sniffer for a new frame
+ * The sniffer is a single resource, it is only taken back when free
+ * (frames are then checked in software) : with two segments, the first
+ * configured receiver keeps it
+ * @return true if the sniffer computes the CRC of the new frame
  **/
-void __isr __time_critical_func(pio0_isr)() {
-#ifdef USE_ABORT
-    //IRQ 0 is raised when a HDLC abort is received
-    if(pio_interrupt_get(rxPIO, 0)){
-        pio_interrupt_clear(rxPIO, 0);
-        pio_set_irq0_source_enabled(rxPIO, pis_interrupt0, false);
-        //Prepare for another transfer
-        prepareRx();
+static inline bool rxSeedSniffer(const HdlcReceiver& rx)
+{
+    if(!(dma_hw->sniff_ctrl & DMA_SNIFF_CTRL_EN_BITS)){
+        dma_sniffer_enable(rx.dmaChannel, 0x3, true);   // Turn on CRC-16/X-25
+        dma_hw->sniff_ctrl |= 0x800;    //Out inverted (bitwise complement, XOR out)
+        dma_hw->sniff_ctrl |= 0x400;    //Out bit-reversed
+    }else if(!rxOwnsSniffer(rx)){
+        return false;
+    }
+    dma_hw->sniff_data = 0xFFFF;        //Start with 0xFFFF
+    return true;
+}
+
+/**
+ * Queues a frame ending at given position
+ * @param end Stream position of the closing flag, or of the abort
+ * @param aborted Frame ended by an abort (only queued when promiscuous)
+ * @param crcChecked CRC was computed by the sniffer
+ * @param crcOk CRC of the frame is valid
+ **/
+static inline void queueFrame(HdlcReceiver& rx, uint32_t end, bool aborted, bool crcChecked, bool crcOk)
+{
+    uint32_t len = end - rx.frameStart;
+    if(len == 0 || len > RX_RING_SIZE){
+        //Shared flags or frame larger than the ring
+        return;
+    }
+    TRACE(TR_RX_FRAME, len);
+    uint8_t address = rx.ring[rx.frameStart & (RX_RING_SIZE - 1)];
+    if(address != rx.address && !rx.promiscuous){
+        stat_add(busStats.filtered);
+        return;
+    }
+    uint32_t head = rx.queueHead;
+    if(head - rx.queueTail >= RX_QUEUE_LEN){
+        stat_add(busStats.queueOverflows);
+        return;
+    }
+    RxFrame& f = rx.queue[head & (RX_QUEUE_LEN - 1)];
+    f.address = address;
+    f.segment = rx.segment;
+    f.offset = rx.frameStart + 1;
+    f.time = time_us_32();
+    f.crcChecked = crcChecked;
+    if(aborted){
+        f.length = len - 1;
+        f.crcChecked = true;
+        f.status = frame_aborted;
+    }else if(len < RX_MIN_FRAME_LEN){
+        f.length = len - 1;
+        f.status = frame_short;
+    }else{
+        f.length = len - 3;
+        f.status = (!crcChecked || crcOk) ? done : bad_crc;
+        if(crcChecked){
+            TRACE(TR_CRC, 2 | crcOk);
+        }
+    }
+    rx.queueHead = head + 1;
+    wake_post(WAKE_RX_FRAME);
+}
+
+/**
+ * Handles the frame boundaries of a receiver
+ * Its abort IRQ is raised if an abort is found, its flag IRQ when a flag is
+ * received, delimiting frames
+ * DMA keeps running in the ring buffer, the stream position at each flag
+ * gives the frame boundaries. The frame closing flag must be handled before
+ * the first byte of the next frame is received (9 bits)
+ **/
+static inline void __time_critical_func(rxBoundaries)(HdlcReceiver& rx)
+{
+    uint32_t pos = rxStreamPosition(rx);
+    //Abort IRQ is raised when a HDLC abort is received
+    if(pio_interrupt_get(rx.pio, rx.abortIrq)){
+        pio_interrupt_clear(rx.pio, rx.abortIrq);
+        //Idle line after flags is not an aborted frame
+        if(!rx.frameAborted && pos != rx.frameStart){
+            stat_add(busStats.aborts);
+            if(rx.promiscuous){
+                queueFrame(rx, pos, true, false, false);
+            }
+        }
+        rx.frameAborted = true;
     }
+    //Flag IRQ is raised when a HDLC flag is recieved
+    if(pio_interrupt_get(rx.pio, rx.flagIrq)){
+        pio_interrupt_clear(rx.pio, rx.flagIrq);
+        if(!rx.frameAborted){
+#ifdef USE_SNIFFER_CRC
+            uint32_t crc = dma_hw->sniff_data;
+            bool crcChecked = rx.frameCrcValid && rxOwnsSniffer(rx);
+            queueFrame(rx, pos, false, crcChecked, (crc >> 16) == (crc16_to_sniffer(CRC16_X25_RESIDUE) >> 16));
+#else
+            queueFrame(rx, pos, false, false, false);
 #endif
-    //IRQ 1 is raised when a HDLC flag is recieved
-    if(pio_interrupt_get(rxPIO, 1)){
-        pio_interrupt_clear(rxPIO, 1);
-        //Disable this IRQ (one shot IRQ)
-        pio_set_irq0_source_enabled(rxPIO, pis_interrupt1, false);
-        if(skipData){
-            //Prepare for another transfer
-            prepareRx();
-        }else if(rxCount > 0){
-            rxCompleted = true;            
+        }
+        //Next frame starts after this flag
+        rx.frameStart = pos;
+        rx.frameAborted = false;
+#ifdef USE_SNIFFER_CRC
+        rx.frameCrcValid = rxSeedSniffer(rx);
+#endif
+    }
+}
+
+/**
+ * Interrupt service routine on PIO 0 IRQ 0, serves the receivers of all
+ * segments
+ **/
+void __isr __time_critical_func(pio0_isr)() {
+    CYCLE_PROBE(PROBE_PIO0_ISR);
+    TRACE(TR_ISR_ENTER, TR_PIO0_ISR);
+    for(uint i = 0; i < NR_SEGMENTS; ++i){
+        if(receivers[i].configured){
+            rxBoundaries(receivers[i]);
         }
     }
-    gpio_put(PICO_DEFAULT_LED_PIN, false);
+    TRACE(TR_ISR_EXIT, TR_PIO0_ISR);
 }
 
 /**
  * Interrupt when RX DMA transfer is completed
+ * Only happens every RX_DMA_COUNT bytes, DMA is restarted for the same count
  **/
 void __isr __time_critical_func(rx_dma_isr)() {
-    if(dma_channel_get_irq1_status(rxDMAChannel)){
-        dma_channel_acknowledge_irq1(rxDMAChannel);
-        //Keep latest 3 CRC
-        crc[2] = crc[1];
-        crc[1] = crc[0];
-        crc[0] = dma_hw->sniff_data;
-        //First transfer done on destAddress
-        if(dma_channel_hw_addr(rxDMAChannel)->write_addr == (uintptr_t)&destAddress){
-            //Enable the PIO interrupt 0 to get notified when transfer is done
-#ifdef USE_ABORT
-            pio_interrupt_clear(rxPIO, 0);
-            pio_set_irq0_source_enabled(rxPIO, pis_interrupt0, true);
-#endif
-            pio_interrupt_clear(rxPIO, 1);
-            pio_set_irq0_source_enabled(rxPIO, pis_interrupt1, true);
-            if(destAddress != rcvAddress){
-                //Address don't match, skip all data
-                skipData = true;
-            }else{
-                gpio_put(PICO_DEFAULT_LED_PIN, true);
-                skipData = false;
-                //Receive data in real buffer
-                dma_channel_set_write_addr(rxDMAChannel, rxBuffer, true);
-            }
-        }else if(!skipData){
-            //Increment rx count
-            ++rxCount;        
-            //Start another transfer
-            dma_channel_set_write_addr(rxDMAChannel, &rxBuffer[rxCount], true);
+    CYCLE_PROBE(PROBE_RX_DMA_ISR);
+    for(uint i = 0; i < NR_SEGMENTS; ++i){
+        HdlcReceiver& rx = receivers[i];
+        if(rx.configured && dma_channel_get_irq1_status(rx.dmaChannel)){
+            TRACE(TR_ISR_ENTER, TR_RX_DMA_ISR);
+            dma_channel_acknowledge_irq1(rx.dmaChannel);
+            rx.streamBase = rx.streamBase + RX_DMA_COUNT;
+            dma_channel_set_trans_count(rx.dmaChannel, RX_DMA_COUNT, true);
+            TRACE(TR_ISR_EXIT, TR_RX_DMA_ISR);
         }
     }
 }
 
 /**
- * Configures the RX DMA
+ * Configures the RX DMA of a receiver
  **/
-void configureRXDMA() {
+static void configureRXDMA(HdlcReceiver& rx) {
     //Get an available DMA channel once
-    if(rxDMAChannel == -1){
-        rxDMAChannel = dma_claim_unused_channel(true);
-        dma_channel_set_irq1_enabled(rxDMAChannel, true);
-        irq_add_shared_handler(DMA_IRQ_1, rx_dma_isr, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    if(rx.dmaChannel == -1){
+        rx.dmaChannel = dma_claim_unused_channel(true);
+        dma_channel_set_irq1_enabled(rx.dmaChannel, true);
+        //The handler serves all segments, it is added with the first channel
+        static bool handlerAdded = false;
+        if(!handlerAdded){
+            irq_add_shared_handler(DMA_IRQ_1, rx_dma_isr, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+            handlerAdded = true;
+        }
         irq_set_enabled(DMA_IRQ_1, true);
     }
     //Configure the channel
-    dma_channel_config c = dma_channel_get_default_config(rxDMAChannel);
+    dma_channel_config c = dma_channel_get_default_config(rx.dmaChannel);
     channel_config_set_read_increment(&c, false);
-    channel_config_set_write_increment(&c, false);   //Increment address pointer of rxBuffer
-    channel_config_set_dreq(&c, pio_get_dreq(rxPIO, rxDataSM, false));
+    channel_config_set_write_increment(&c, true);           //Increment address pointer of the ring
+    channel_config_set_ring(&c, true, RX_RING_BITS);        //Wrap in the ring buffer
+    channel_config_set_dreq(&c, pio_get_dreq(rx.pio, rx.sm, false));
     channel_config_set_transfer_data_size(&c, DMA_SIZE_8);  //Transfer 8 bits
     channel_config_set_sniff_enable(&c, true);              //Enable sniffer to compute CRC
-    dma_sniffer_enable(rxDMAChannel, 0x3, true);            // Turn on CRC-16/X-25
-    dma_hw->sniff_ctrl |= 0x800;    //Out inverted (bitwise complement, XOR out)
-    dma_hw->sniff_ctrl |= 0x400;    //Out bit-reversed
-    dma_hw->sniff_data = 0xFFFF;    //Start with 0xFFFF
+    rx.streamBase = 0;
+    rx.frameAborted = true;
+#ifdef USE_SNIFFER_CRC
+    rxSeedSniffer(rx);
+#endif
     dma_channel_configure(
-        rxDMAChannel,
+        rx.dmaChannel,
         &c,
-        &destAddress,                           // Destination pointer
-        (io_rw_8*)&rxPIO->rxf[rxDataSM] + 3,    // Source pointer (get MSB)
-        1,                                      // Number of transfers (one by one)
-        false                                   // Don't start immediately
+        rx.ring,                                // Destination pointer
+        (io_rw_8*)&rx.pio->rxf[rx.sm] + 3,      // Source pointer (get MSB)
+        RX_DMA_COUNT,                           // Number of transfers
+        true                                    // Start immediately
     );
 }
 
+HdlcReceiver& getReceiver(uint segment)
+{
+    return receivers[segment];
+}
+
 /**
  * Configures receiver
  **/
-void configureReceiver(uint rxEnPin, uint clkInPin, uint dataInPin)
+void configureReceiver(HdlcReceiver& rx, uint segment, uint rxEnPin, uint dataInPin)
 {
+    if(!rx.configured){
+        rx.dmaChannel = -1;
+    }
+    rx.segment = segment;
+    rx.ring = rxRings[segment];
+    rx.address = 0;
+    rx.promiscuous = false;
+    rx.queueHead = 0;
+    rx.queueTail = 0;
+
     //configure transceiver enable GPIO
-    rxEnablePin = rxEnPin;
-    gpio_init(rxEnablePin);
-    gpio_set_dir(rxEnablePin, GPIO_OUT);
-    enableReceiver(false);    //Disable RX for now
-
-    //HDLC RX PIO configuration
-    pio_sm_config rxDataSMCfg;
-    uint rxDataOffset = 0;
-    rxDataOffset = pio_add_program(rxPIO, &hdlc_rx_program);
-    rxDataSM = pio_claim_unused_sm(rxPIO, true);
-    rxDataSMCfg = hdlc_rx_program_init(rxPIO, rxDataSM, rxDataOffset, dataInPin);
-    pio_set_irq0_source_enabled(rxPIO, pis_interrupt0, false);       //IRQ0 (abort received)
-    pio_set_irq0_source_enabled(rxPIO, pis_interrupt1, false);       //IRQ1 (TX completed)
-    irq_set_exclusive_handler(PIO0_IRQ_0, pio0_isr);                 //Set IRQ handler for new command
-    irq_set_enabled(PIO0_IRQ_0, true);                               //Enable IRQ
+    rx.enablePin = rxEnPin;
+    gpio_init(rx.enablePin);
+    gpio_set_dir(rx.enablePin, GPIO_OUT);
+    enableReceiver(rx, false);    //Disable RX for now
+
+    //HDLC RX PIO configuration, the program raises IRQ flags relative to its state machine
+    rx.pio = RX_PIO;
+    rx.sm = SEGMENT_RX_SM(segment);
+    rx.abortIrq = pio_relative_irq(0, rx.sm);
+    rx.flagIrq = pio_relative_irq(1, rx.sm);
+    if(rxDataOffset < 0){
+        rxDataOffset = pio_add_program(rx.pio, &hdlc_rx_program);
+    }
+    pio_sm_claim(rx.pio, rx.sm);
+    hdlc_rx_program_init(rx.pio, rx.sm, rxDataOffset, dataInPin);
 
     //Configure DMA channel to receive bytes
-    configureRXDMA();
-}
-
-receiver_status receiveData(uint8_t address, uint8_t* buffer, uint32_t bufLen, uint32_t& rcvLen)
-{
-    if(firstUse) {
-        //Sets receiver address
-        rcvAddress = address;
-        rxBuffer = buffer;
-        rxBufferMaxLen = bufLen;
-        prepareRx();
-        //Enable the RX transceiver
-        enableReceiver(true);
-        firstUse = false;
-    }
-    receiver_status ret = busy;
-    if(rxCompleted){    
-        if(rxCount > 3){
-            // We received enough data for a valid HDLC frame        
-            uint32_t crcCheck = crc[2];
-            if((((crcCheck>>16) & 0xFF) == buffer[rxCount-2]) &&
-                (((crcCheck>>24) & 0xFF) == buffer[rxCount-1])){
-                    ret = done;
-            }else{
-                printf("CRC : %lx/%x%x ", crcCheck,buffer[rxCount-2], buffer[rxCount-1]);
-                ret = bad_crc;
-            }
-            rcvLen = rxCount - 2;
+    configureRXDMA(rx);
+
+    pio_interrupt_clear(rx.pio, rx.abortIrq);
+    pio_interrupt_clear(rx.pio, rx.flagIrq);
+    pio_set_irq0_source_enabled(rx.pio, (pio_interrupt_source)(pis_interrupt0 + rx.abortIrq), true);   //Abort received
+    pio_set_irq0_source_enabled(rx.pio, (pio_interrupt_source)(pis_interrupt0 + rx.flagIrq), true);    //Flag received
+    rx.configured = true;
+    //The handler serves all segments
+    if(!irq_is_enabled(PIO0_IRQ_0)){
+        irq_set_exclusive_handler(PIO0_IRQ_0, pio0_isr);             //Set IRQ handler for frame boundaries
+        irq_set_enabled(PIO0_IRQ_0, true);                           //Enable IRQ
+    }
+}
+
+void setReceiverAddress(HdlcReceiver& rx, uint8_t address)
+{
+    rx.address = address;
+}
+
+void setReceiverPromiscuous(HdlcReceiver& rx, bool enable)
+{
+    rx.promiscuous = enable;
+}
+
+bool receiveFrame(HdlcReceiver& rx, RxFrame& frame)
+{
+    uint32_t tail = rx.queueTail;
+    if(tail == rx.queueHead){
+        return false;
+    }
+    frame = rx.queue[tail & (RX_QUEUE_LEN - 1)];
+    rx.queueTail = tail + 1;
+    if(!frame.crcChecked && frame.status == done){
+        //Verify CRC in software, address to CRC included
+        uint32_t start = (frame.offset - 1) & (RX_RING_SIZE - 1);
+        uint32_t len = frame.length + 3;
+        uint32_t first = RX_RING_SIZE - start;
+        uint16_t crc = CRC16_X25_INIT;
+        if(first >= len){
+            crc = crc16_update(crc, &rx.ring[start], len);
         }else{
+            crc = crc16_update(crc, &rx.ring[start], first);
+            crc = crc16_update(crc, rx.ring, len - first);
+        }
+        frame.crcChecked = true;
+        frame.status = crc16_is_valid(crc) ? done : bad_crc;
+        TRACE(TR_CRC, frame.status == done);
+    }
+    return true;
+}
+
+receiver_status copyFrame(const RxFrame& frame, uint8_t* buffer, uint32_t bufLen, uint32_t& rcvLen)
+{
+    const HdlcReceiver& rx = receivers[frame.segment];
+    uint32_t len = frame.length < bufLen ? frame.length : bufLen;
+    uint32_t start = frame.offset & (RX_RING_SIZE - 1);
+    uint32_t first = RX_RING_SIZE - start;
+    if(first >= len){
+        memcpy(buffer, &rx.ring[start], len);
+    }else{
+        memcpy(buffer, &rx.ring[start], first);
+        memcpy(&buffer[first], rx.ring, len - first);
+    }
+    rcvLen = len;
+    //DMA may have overwritten the frame while copying (CRC bytes included)
+    if(rxStreamPosition(rx) - frame.offset > RX_RING_SIZE - 2){
+        rcvLen = 0;
+        return overrun;
+    }
+    return frame.status;
+}
+
+uint32_t copyRawFrame(const RxFrame& frame, uint8_t* buffer, uint32_t bufLen)
+{
+    const HdlcReceiver& rx = receivers[frame.segment];
+    uint32_t len = frame.length + 1;
+    if(frame.status == done || frame.status == bad_crc){
+        len += 2;
+    }
+    if(len > bufLen){
+        len = bufLen;
+    }
+    uint32_t start = (frame.offset - 1) & (RX_RING_SIZE - 1);
+    uint32_t first = RX_RING_SIZE - start;
+    if(first >= len){
+        memcpy(buffer, &rx.ring[start], len);
+    }else{
+        memcpy(buffer, &rx.ring[start], first);
+        memcpy(&buffer[first], rx.ring, len - first);
+    }
+    if(rxStreamPosition(rx) - (frame.offset - 1) > RX_RING_SIZE){
+        return 0;
+    }
+    return len;
+}
+
+receiver_status receiveData(HdlcReceiver& rx, uint8_t* buffer, uint32_t bufLen, uint32_t& rcvLen, absolute_time_t deadline)
+{
+    RxFrame frame;
+    //Frames are queued by the PIO interrupt, which wakes the core
+    while(!receiveFrame(rx, frame)){
+        if(best_effort_wfe_or_timeout(deadline)){
+            if(receiveFrame(rx, frame)){
+                break;
+            }
             rcvLen = 0;
-            ret = frame_short;
+            return timeout;
         }
-        firstUse = true;
-        dma_sniffer_disable();
-        //enableReceiver(false);
     }
-    return ret;
+    return copyFrame(frame, buffer, bufLen, rcvLen);
+}
+
+void flushReceiver(HdlcReceiver& rx)
+{
+    rx.queueTail = rx.queueHead;
+}
+
+void setReceiverAddress(uint8_t address)
+{
+    setReceiverAddress(receivers[0], address);
+}
+
+void setReceiverPromiscuous(bool enable)
+{
+    setReceiverPromiscuous(receivers[0], enable);
+}
+
+bool receiveFrame(RxFrame& frame)
+{
+    return receiveFrame(receivers[0], frame);
+}
+
+void flushReceiver()
+{
+    flushReceiver(receivers[0]);
 }
@@ -1,40 +1,158 @@
 #ifndef __HDLC_RX_H__
+#define __HDLC_RX_H__
 #include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "transceiver.h"
 
-extern uint rxEnablePin;
+enum receiver_status {busy, done, timeout, bad_crc, frame_short, overrun, frame_aborted};
 
-enum receiver_status {busy, done, timeout, bad_crc, frame_short};
+#define RX_RING_BITS 15                     // Log2 of RX ring buffer size (DMA ring is 32KB max)
+#define RX_RING_SIZE (1u << RX_RING_BITS)   // RX ring buffer size
+#define RX_QUEUE_LEN 32                     // Number of received frames descriptors (power of 2)
+
+/**
+ * Descriptor of a received frame
+ * Offsets are positions in the RX byte stream, the ring buffer keeps the
+ * last RX_RING_SIZE bytes of this stream
+ **/
+typedef struct RxFrame {
+    uint32_t offset;            // Stream position of the first byte after the address
+    uint32_t length;            // Bytes after the address, without CRC
+    uint32_t time;              // Time of the closing flag (us)
+    uint8_t address;            // Frame address
+    uint8_t segment;            // Segment of the receiver
+    bool crcChecked;            // CRC already verified by the DMA sniffer
+    receiver_status status;     // done, bad_crc, frame_short or frame_aborted (promiscuous)
+} RxFrame;
+
+/**
+ * Receiver of a segment : hdlc_rx state machine, DMA channel writing the RX
+ * ring and queue of received frames
+ **/
+typedef struct HdlcReceiver {
+    PIO pio;                            // PIO block for data receipt (pio0)
+    uint sm;                            // Data reception state machine number
+    uint abortIrq;                      // PIO IRQ flags raised by the state machine
+    uint flagIrq;
+    int dmaChannel;                     // Data reception DMA channel
+    uint enablePin;                     // Transceiver RX enable pin
+    uint8_t segment;
+    bool configured;
+    uint8_t* ring;                      // RX ring buffer, aligned on its size
+    volatile uint32_t streamBase;       // Stream position of current DMA transfer start
+    volatile uint8_t address;           // Our expected address on the bus
+    volatile bool promiscuous;          // Frames of all addresses are queued, aborted ones too
+
+    // Frame tracking, only used by the PIO interrupt
+    uint32_t frameStart;                // Stream position following the last flag
+    bool frameAborted;                  // No valid start flag seen yet
+    bool frameCrcValid;                 // Sniffer was seeded at frame start
+
+    // Received frames queue (single producer : PIO interrupt, single consumer)
+    RxFrame queue[RX_QUEUE_LEN];
+    volatile uint32_t queueHead;        // Written by the interrupt
+    volatile uint32_t queueTail;        // Written by the consumer
+} HdlcReceiver;
+
+/**
+ * Gets the receiver of a segment
+ * @param segment Segment number, less than NR_SEGMENTS
+ **/
+HdlcReceiver& getReceiver(uint segment);
 
 /**
  * Configures receiver
+ * Reception runs continuously from there, frames matching the receiver
+ * address are queued
+ * @param segment Segment number, gives the state machine and IRQ flags
+ * @param dataInPin Data pin, the clock is the next pin
  **/
-void configureReceiver(uint rxEnablePin, uint clkInPin, uint dataInPin);
+void configureReceiver(HdlcReceiver& rx, uint segment, uint rxEnablePin, uint dataInPin);
 
 /**
- * Receives data, blocks until done
+ * Sets the address of frames to be queued
  * @param address Receiver address
+ **/
+void setReceiverAddress(HdlcReceiver& rx, uint8_t address);
+
+/**
+ * Queues frames of all addresses, aborted frames included
+ * Used by the capture mode, address filtering is restored when disabled
+ **/
+void setReceiverPromiscuous(HdlcReceiver& rx, bool enable);
+
+/**
+ * Gets next received frame, does not block
+ * @param frame Descriptor of the frame
+ * @return true if a frame was available
+ **/
+bool receiveFrame(HdlcReceiver& rx, RxFrame& frame);
+
+/**
+ * Copies the content of a received frame (from the ring of its segment)
+ * @param frame Descriptor of the frame
  * @param buffer Buffer to store data
- * @param bulLen Maximum length of buffer
+ * @param bufLen Maximum length of buffer
+ * @param rcvLen Bytes copied
+ * @return receiver_status Frame status, overrun if data was overwritten in the ring
+ **/
+receiver_status copyFrame(const RxFrame& frame, uint8_t* buffer, uint32_t bufLen, uint32_t& rcvLen);
+
+/**
+ * Copies a received frame as seen on the bus : address, data and CRC
+ * (no CRC for short and aborted frames)
+ * @param frame Descriptor of the frame
+ * @param buffer Buffer to store the frame
+ * @param bufLen Maximum length of buffer, the frame is truncated
+ * @return Bytes copied, 0 if data was overwritten in the ring
+ **/
+uint32_t copyRawFrame(const RxFrame& frame, uint8_t* buffer, uint32_t bufLen);
+
+/**
+ * Receives next frame, waiting for it until a deadline
+ * The core sleeps between interrupts, a hardware alarm wakes it up at the
+ * deadline
+ * @param buffer Buffer to store data (bytes following the address, without CRC)
+ * @param bufLen Maximum length of buffer
  * @param rcvLen Effective bytes received
- * @return receiver_status Status of the receiver
+ * @param deadline Absolute time to give up, a past time does not wait
+ * @return receiver_status Status of the frame, timeout if none was received in time
+ **/
+receiver_status receiveData(HdlcReceiver& rx, uint8_t* buffer, uint32_t bufLen, uint32_t& rcvLen, absolute_time_t deadline);
+
+/**
+ * Drops all queued frames
  **/
-receiver_status receiveData(uint8_t address, uint8_t* buffer, uint32_t bufLen, uint32_t& rcvLen);
+void flushReceiver(HdlcReceiver& rx);
 
 /**
  * Enables the receiver of the transciever
  **/
-static inline void enableReceiver(bool enable)
+static inline void enableReceiver(HdlcReceiver& rx, bool enable)
 {
-    gpio_put(rxEnablePin, !enable);
+    gpio_put(rx.enablePin, !enable);
 }
 
 /**
  * Gets if the receiver is enabled
  **/
-static inline bool isReceiverEnabled()
+static inline bool isReceiverEnabled(const HdlcReceiver& rx)
 {
-    return !gpio_get(rxEnablePin);
+    return !gpio_get(rx.enablePin);
 }
 
+/**
+ * Same functions on the receiver of the first segment, used by the
+ * protocol engine and the capture
+ **/
+void setReceiverAddress(uint8_t address);
+void setReceiverPromiscuous(bool enable);
+bool receiveFrame(RxFrame& frame);
+void flushReceiver();
+
+static inline void enableReceiver(bool enable)
+{
+    enableReceiver(getReceiver(0), enable);
+}
 
-#endif
\ No newline at end of file
+#endif
@@ -2,73 +2,396 @@
 #include "hardware/pio.h"
 #include "hardware/irq.h"
 #include "hardware/dma.h"
+#include "hardware/timer.h"
+#include "pico/sync.h"
 
 #include "hdlc_tx.pio.h"
 #include "clock_detect.h"
+#include "bus_timing.h"
+#include "bus_stats.h"
+#include "wake.h"
+#include "crc16.h"
+#include "trace.h"
+#include "cycle_probe.h"
 
 #include <stdio.h>
 
-uint txEnablePin = 0;
-PIO txPIO = pio1;           //PIO block for data emit
-uint txClockSM = 0;         //Clock emit state machine number
-uint txDataSM = 0;          //Data emit state machine number
+#define TX_PIO pio1             //PIO block for data emit
+#define COLLISION_IRQ 3         //Relative IRQ of hdlc_tx raised on a collision
 
-static volatile bool dataActive = false;
-static volatile bool flagSent = false;
+static_assert((hdlc_tx_READBACK_DELAY + 1) * 2 == HDLC_TX_BIT_CYCLES, "hdlc_tx reads bits back in the middle of the bit");
 
-void __isr pio1_isr()
+static HdlcEmitter emitters[NR_SEGMENTS];
+static int txClockOffset = -1;  //Program offsets, loaded once for all segments
+static int txDataOffset = -1;
+
+/**
+ * Starts the DMA of next queued frame
+ * Called with interrupts disabled or from interrupt
+ **/
+static void startNextFrame(HdlcEmitter& tx)
+{
+    const TxFrame& f = tx.queue[tx.queueTail & (TX_QUEUE_LEN - 1)];
+    TRACE(TR_TX_START, f.len);
+    tx.state = TX_DATA;
+    dma_channel_set_read_addr(tx.dmaChannel, f.buffer, false);
+    dma_channel_set_trans_count(tx.dmaChannel, f.len, true);
+}
+
+/**
+ * Interrupt when a TX DMA transfer is completed
+ * After frame data, the CRC is sent by DMA
+ * The PIO FIFO still holds up to 8 bytes, giving time to queue the CRC
+ **/
+void __isr __time_critical_func(tx_dma_isr)()
+{
+    for(uint i = 0; i < NR_SEGMENTS; ++i){
+        HdlcEmitter& tx = emitters[i];
+        if(!tx.configured || !dma_channel_get_irq1_status(tx.dmaChannel)){
+            continue;
+        }
+        TRACE(TR_ISR_ENTER, TR_TX_DMA_ISR);
+        dma_channel_acknowledge_irq1(tx.dmaChannel);
+        if(tx.state == TX_DATA){
+            const TxFrame& f = tx.queue[tx.queueTail & (TX_QUEUE_LEN - 1)];
+            tx.state = TX_CRC;
+            dma_channel_set_read_addr(tx.dmaChannel, f.crc, false);
+            dma_channel_set_trans_count(tx.dmaChannel, sizeof(f.crc), true);
+        }else if(tx.state == TX_CRC){
+            tx.state = TX_FLAG;
+        }
+        TRACE(TR_ISR_EXIT, TR_TX_DMA_ISR);
+    }
+}
+
+static void startBackoff(HdlcEmitter& tx);
+
+/**
+ * Removes the current frame from the queue and starts next one
+ * @param sent true if the frame was sent and the bus is ours, false if it
+ *             was dropped : next frame waits for a back-off
+ **/
+static void frameDone(HdlcEmitter& tx, bool sent)
+{
+    const TxFrame& f = tx.queue[tx.queueTail & (TX_QUEUE_LEN - 1)];
+    tx_callback callback = f.callback;
+    const uint8_t* buffer = f.buffer;
+    void* ctx = f.ctx;
+    tx.queueTail = tx.queueTail + 1;
+    if(!sent){
+        //Tickets start at 1, queueTail is now the ticket of the frame
+        tx.droppedMask = tx.droppedMask | (1u << (tx.queueTail % TX_DROP_HISTORY));
+    }
+    tx.done = tx.done + 1;
+    tx.attempts = 0;
+    if(tx.queueTail == tx.queueHead){
+        tx.state = TX_IDLE;
+    }else if(sent){
+        //Chain next frame, the bus is still ours
+        startNextFrame(tx);
+    }else{
+        tx.state = TX_BACKOFF;
+        startBackoff(tx);
+    }
+    if(callback != nullptr){
+        callback(buffer, ctx, sent);
+    }
+    wake_post(WAKE_TX);
+}
+
+/**
+ * Waits a random number of back-off slots, the window doubles with each
+ * collision of the frame
+ **/
+static void startBackoff(HdlcEmitter& tx)
+{
+    //xorshift32, the back-offs of two emitters only have to differ
+    uint32_t r = tx.random;
+    r ^= r << 13;
+    r ^= r >> 17;
+    r ^= r << 5;
+    tx.random = r;
+    uint exp = tx.attempts < TX_BACKOFF_MAX_EXP ? tx.attempts : TX_BACKOFF_MAX_EXP;
+    uint32_t slots = 1 + (r & ((1u << exp) - 1));
+    stat_add(busStats.backoffs);
+    absolute_time_t target = from_us_since_boot(time_us_64() + slots * BusConfig::bitsUs(TX_BACKOFF_SLOT_BITS));
+    if(hardware_alarm_set_target(tx.backoffAlarm, target)){
+        //Already reached
+        hardware_alarm_force_irq(tx.backoffAlarm);
+    }
+}
+
+/**
+ * Sends the aborted frame again once its back-off ended
+ **/
+static void backoff_isr(uint alarm)
 {
-    //Interrupt handler when flag is completed
+    for(uint i = 0; i < NR_SEGMENTS; ++i){
+        HdlcEmitter& tx = emitters[i];
+        if(!tx.configured || tx.backoffAlarm != (int)alarm || tx.state != TX_BACKOFF){
+            continue;
+        }
+        //The bus is ours if the echo clock runs, otherwise it must still be idle
+        if(!gpio_get(tx.enablePin) && !is_bus_idle(*tx.bus)){
+            startBackoff(tx);
+            continue;
+        }
+        startNextFrame(tx);
+        gpio_put(tx.enablePin, true);
+    }
+}
+
+/**
+ * Ends the current frame of an emitter once its flag is completed, starts
+ * next one or releases the bus
+ * After a collision, the flag follows the abort : the frame is sent again
+ * after its back-off, or dropped after TX_MAX_ATTEMPTS collisions
+ **/
+static void flagSent(HdlcEmitter& tx)
+{
+    pio_interrupt_clear(tx.pio, tx.flagIrq);
+    if(tx.state == TX_FLAG){
+        TRACE(TR_TX_END, 0);
+        frameDone(tx, true);
+    }else if(tx.state == TX_ABORT){
+        if(tx.attempts >= TX_MAX_ATTEMPTS){
+            //Reported as dropped, the other emitter still holds the bus
+            stat_add(busStats.collisionDrops);
+            frameDone(tx, false);
+        }else{
+            tx.state = TX_BACKOFF;
+            startBackoff(tx);
+        }
+    }
     //Re-enable the clock if needed
-    flagSent = true;
-    gpio_put(txEnablePin, dataActive);
-    pio_interrupt_clear(txPIO, 0);
+    bool sending = tx.state == TX_DATA || tx.state == TX_CRC || tx.state == TX_FLAG;
+    gpio_put(tx.enablePin, tx.clockActive || sending);
+}
+
+/**
+ * hdlc_tx read a one back as a zero : the frame data is discarded, then
+ * hdlc_tx sends an abort followed by a flag
+ **/
+static void collision(HdlcEmitter& tx)
+{
+    //State first, the DMA interrupt of the aborted transfer is ignored
+    tx.state = TX_ABORT;
+    tx.attempts = tx.attempts + 1;
+    TRACE(TR_TX_COLLISION, tx.attempts);
+    stat_add(busStats.collisions);
+    dma_channel_abort(tx.dmaChannel);
+    pio_sm_clear_fifos(tx.pio, tx.dataSM);
+    pio_interrupt_clear(tx.pio, tx.collisionIrq);
+}
+
+/**
+ * Interrupt handler when flag is completed or on a collision, serves the
+ * emitters of all segments
+ **/
+void __isr pio1_isr()
+{
+    TRACE(TR_ISR_ENTER, TR_PIO1_ISR);
+    for(uint i = 0; i < NR_SEGMENTS; ++i){
+        if(!emitters[i].configured){
+            continue;
+        }
+        if(pio_interrupt_get(emitters[i].pio, emitters[i].collisionIrq)){
+            collision(emitters[i]);
+        }
+        if(pio_interrupt_get(emitters[i].pio, emitters[i].flagIrq)){
+            flagSent(emitters[i]);
+        }
+    }
+    TRACE(TR_ISR_EXIT, TR_PIO1_ISR);
+}
+
+/**
+ * Called from interrupt when the bus becomes idle
+ * Acquires the bus for a frame waiting for it
+ **/
+static void __time_critical_func(tx_bus_idle)(void* ctx)
+{
+    HdlcEmitter& tx = *(HdlcEmitter*)ctx;
+    if(tx.waitingBus){
+        tx.waitingBus = false;
+        gpio_put(tx.enablePin, true);
+    }
+}
+
+HdlcEmitter& getEmitter(uint segment)
+{
+    return emitters[segment];
 }
 
 /**
  * Configures emitter
  **/
-void configureEmitter(uint txEnPin, uint clkTxPin, uint dataTxPin)
+void configureEmitter(HdlcEmitter& tx, uint segment, uint txEnPin, uint clkTxPin, uint dataTxPin, uint dataRxPin)
 {
-    txEnablePin = txEnPin;
+    if(!tx.configured){
+        tx.dmaChannel = -1;
+        tx.backoffAlarm = -1;
+    }
+    tx.bus = &get_bus_activity(segment);
+    tx.state = TX_IDLE;
+    tx.clockActive = false;
+    tx.waitingBus = false;
+    tx.queueHead = 0;
+    tx.queueTail = 0;
+    tx.done = 0;
+    tx.droppedMask = 0;
+    tx.collisionDetect = true;
+    tx.attempts = 0;
+    tx.random = 0x9E3779B9u * (segment + 1) ^ time_us_32();
+    if(tx.random == 0){
+        tx.random = 1;
+    }
+
+    tx.enablePin = txEnPin;
+    tx.dataPin = dataTxPin;
+    tx.readbackPin = dataRxPin;
     //TX enable output
-    gpio_init(txEnablePin);
-    gpio_set_dir(txEnablePin, GPIO_OUT);
-    gpio_put(txEnablePin, false);
+    gpio_init(tx.enablePin);
+    gpio_set_dir(tx.enablePin, GPIO_OUT);
+    gpio_put(tx.enablePin, false);
 
-    //HDLC TX clock configuration
-    uint offset = pio_add_program(txPIO, &clock_tx_program);
-    txClockSM = pio_claim_unused_sm(txPIO, true);
-    clock_tx_program_init(txPIO, txClockSM, offset, clkTxPin, txEnablePin);
+    //HDLC TX clock configuration, hdlc_tx waits for the IRQ of the previous state machine
+    tx.pio = TX_PIO;
+    tx.clockSM = SEGMENT_CLOCK_SM(segment);
+    tx.dataSM = SEGMENT_TX_SM(segment);
+    tx.flagIrq = pio_relative_irq(0, tx.dataSM);
+    tx.collisionIrq = pio_relative_irq(COLLISION_IRQ, tx.dataSM);
+    if(txClockOffset < 0){
+        txClockOffset = pio_add_program(tx.pio, &clock_tx_program);
+        txDataOffset = pio_add_program(tx.pio, &hdlc_tx_program);
+    }
+    pio_sm_claim(tx.pio, tx.clockSM);
+    clock_tx_program_init(tx.pio, tx.clockSM, txClockOffset, clkTxPin, tx.enablePin, BusConfig::clockTxDiv);
 
     //HDLC TX data configuration
-    offset = pio_add_program(txPIO, &hdlc_tx_program);
-    txDataSM = pio_claim_unused_sm(txPIO, true);
-    hdlc_tx_program_init(txPIO, txDataSM, offset, dataTxPin, txEnPin);
+    pio_sm_claim(tx.pio, tx.dataSM);
+    hdlc_tx_program_init(tx.pio, tx.dataSM, txDataOffset, dataTxPin, txEnPin, dataRxPin, BusConfig::hdlcTxDiv);
+
+    //DMA channel kept for all frames
+    if(tx.dmaChannel == -1){
+        tx.dmaChannel = dma_claim_unused_channel(true);
+        dma_channel_set_irq1_enabled(tx.dmaChannel, true);
+        //The handler serves all segments, it is added with the first channel
+        static bool handlerAdded = false;
+        if(!handlerAdded){
+            irq_add_shared_handler(DMA_IRQ_1, tx_dma_isr, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+            handlerAdded = true;
+        }
+        irq_set_enabled(DMA_IRQ_1, true);
+    }
+    dma_channel_config c = dma_channel_get_default_config(tx.dmaChannel);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, pio_get_dreq(tx.pio, tx.dataSM, true));
+    dma_channel_configure(
+        tx.dmaChannel,
+        &c,
+        &tx.pio->txf[tx.dataSM],
+        nullptr,
+        0,
+        false   // Started for each frame
+    );
+    tx.configured = true;
+
+    //Configure interrupts, the handler serves all segments
+    if(!irq_is_enabled(PIO1_IRQ_0)){
+        irq_set_exclusive_handler(PIO1_IRQ_0, pio1_isr);             //Set IRQ handler for flag send
+        irq_set_enabled(PIO1_IRQ_0, true);                           //Enable IRQ
+    }
+    pio_set_irq0_source_enabled(tx.pio, (pio_interrupt_source)(pis_interrupt0 + tx.flagIrq), true);    //Flag sent
+    pio_set_irq0_source_enabled(tx.pio, (pio_interrupt_source)(pis_interrupt0 + tx.collisionIrq), true);   //Collision
+
+    //Alarm kept for all back-offs
+    if(tx.backoffAlarm == -1){
+        tx.backoffAlarm = hardware_alarm_claim_unused(true);
+        hardware_alarm_set_callback(tx.backoffAlarm, backoff_isr);
+    }
+    hardware_alarm_cancel(tx.backoffAlarm);
 
-    //Configure interrupts
-    irq_set_exclusive_handler(PIO1_IRQ_0, pio1_isr);                 //Set IRQ handler for flag send
-    irq_set_enabled(PIO1_IRQ_0, true);                               //Enable IRQ
-    pio_set_irq0_source_enabled(txPIO, pis_interrupt0, true);        //IRQ0 (flag sent)*/
+    //Frames are started when the bus becomes idle
+    set_bus_idle_callback(*tx.bus, tx_bus_idle, &tx);
+}
+
+void setCollisionDetect(HdlcEmitter& tx, bool enabled)
+{
+    //The data pin reads back what is driven
+    tx.collisionDetect = enabled;
+    pio_sm_set_jmp_pin(tx.pio, tx.dataSM, enabled ? tx.readbackPin : tx.dataPin);
 }
 
 /**
  * Send clock on bus used to send echo
  * @param enabled True if the clock is enabled
+ * @return false if the clock can't start, the bus is not idle
  **/
-void setClock(bool enabled)
+bool setClock(HdlcEmitter& tx, bool enabled)
 {
     if(enabled){
-        // Waits for the line to be free
-        wait_for_no_clock();
-        dataActive = true;
-        gpio_put(txEnablePin, true); 
+        //The line must be free unless we already drive it
+        if(!gpio_get(tx.enablePin) && !is_bus_idle(*tx.bus)){
+            return false;
+        }
+        tx.clockActive = true;
+        tx.waitingBus = false;
+        gpio_put(tx.enablePin, true);
     }else{
-        dataActive = false;
-        while(gpio_get(txEnablePin)){
-            tight_loop_contents();
+        //The bus is released by the interrupt at the end of the current flag
+        tx.clockActive = false;
+    }
+    return true;
+}
+
+uint32_t sendFrame(HdlcEmitter& tx, const uint8_t* buffer, uint len, tx_callback callback, void* ctx)
+{
+    CYCLE_PROBE(PROBE_SEND_FRAME);
+    uint32_t head = tx.queueHead;
+    if(len == 0 || (head - tx.queueTail) >= TX_QUEUE_LEN){
+        return 0;
+    }
+    TxFrame& f = tx.queue[head & (TX_QUEUE_LEN - 1)];
+    f.buffer = buffer;
+    f.len = len;
+    f.callback = callback;
+    f.ctx = ctx;
+    //CRC is computed here, the DMA sniffer is left to the receiver
+    uint16_t crc = crc16_x25(buffer, len);
+    f.crc[0] = crc & 0xFF;
+    f.crc[1] = crc >> 8;
+    //Interrupts chain frames while the emitter runs, otherwise start it here
+    //DMA fills the PIO FIFO meanwhile, the frame is sent once the bus is acquired
+    uint32_t irqs = save_and_disable_interrupts();
+    tx.queueHead = head + 1;
+    tx.droppedMask = tx.droppedMask & ~(1u << ((head + 1) % TX_DROP_HISTORY));
+    TRACE(TR_TX_QUEUE, head + 1 - tx.queueTail);
+    if(tx.state == TX_IDLE){
+        startNextFrame(tx);
+        if(!gpio_get(tx.enablePin)){
+            if(is_bus_idle(*tx.bus)){
+                gpio_put(tx.enablePin, true);
+            }else{
+                tx.waitingBus = true;
+            }
         }
     }
+    restore_interrupts(irqs);
+    //Tickets start at 1
+    return head + 1;
+}
+
+bool isFrameDone(const HdlcEmitter& tx, uint32_t ticket)
+{
+    return (int32_t)(tx.done - ticket) >= 0;
+}
+
+bool isFrameSent(const HdlcEmitter& tx, uint32_t ticket)
+{
+    return isFrameDone(tx, ticket) && (tx.droppedMask & (1u << (ticket % TX_DROP_HISTORY))) == 0;
 }
 
 /**
@@ -76,42 +399,33 @@ void setClock(bool enabled)
  * @param buffer buffer to be sent, without CRC
  * @param len lenght of the buffer to be sent
  **/
-void sendData(const uint8_t* buffer, uint len)
+void sendData(HdlcEmitter& tx, const uint8_t* buffer, uint len)
 {
-    setClock(true);
-    //Prepare a DMA transfer
-    uint8_t sDMAChannel = dma_claim_unused_channel(true);
-    dma_channel_config c = dma_channel_get_default_config(sDMAChannel);
-    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
-    channel_config_set_read_increment(&c, true);
-    channel_config_set_write_increment(&c, false);
-    channel_config_set_dreq(&c, pio_get_dreq(txPIO, txDataSM, true));
-    channel_config_set_sniff_enable(&c, true);
-
-    // Turn on CRC-16/X-25
-    dma_sniffer_enable(sDMAChannel, 0x3, true);
-    dma_hw->sniff_ctrl |= 0x800;    //Out inverted (bitwise complement, XOR out)
-    dma_hw->sniff_ctrl |= 0x400;    //Out bit-reversed
-    dma_hw->sniff_data = 0xFFFF;    //Start with 0xFFFF
-
-    //Configure and start DMA
-    dma_channel_configure(
-        sDMAChannel,
-        &c,
-        &txPIO->txf[txDataSM],
-        buffer,
-        len,
-        true    // Start immediately
-    );    
-    dma_channel_wait_for_finish_blocking(sDMAChannel);
-    dma_channel_unclaim(sDMAChannel);
-    //Send CRC
-    flagSent = false;
-    pio_sm_put_blocking(txPIO, txDataSM, ((dma_hw->sniff_data>>16) & 0xFF));
-    pio_sm_put_blocking(txPIO, txDataSM, ((dma_hw->sniff_data>>24) & 0xFF));
-    while(!pio_sm_is_tx_fifo_empty(txPIO, txDataSM) & !flagSent){
+    uint32_t ticket = 0;
+    while((ticket = sendFrame(tx, buffer, len)) == 0){
         tight_loop_contents();
     }
-    dma_sniffer_disable();
-    setClock(false);
+    while(!isFrameDone(tx, ticket)){
+        tight_loop_contents();
+    }
+}
+
+bool setClock(bool enabled)
+{
+    return setClock(emitters[0], enabled);
+}
+
+uint32_t sendFrame(const uint8_t* buffer, uint len, tx_callback callback, void* ctx)
+{
+    return sendFrame(emitters[0], buffer, len, callback, ctx);
+}
+
+bool isFrameDone(uint32_t ticket)
+{
+    return isFrameDone(emitters[0], ticket);
+}
+
+bool isFrameSent(uint32_t ticket)
+{
+    return isFrameSent(emitters[0], ticket);
 }
@@ -1,22 +1,151 @@
 #ifndef __HDLC_TX_H__
+#define __HDLC_TX_H__
 #include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "clock_detect.h"
+
+#define TX_QUEUE_LEN 8          // Number of frames waiting to be sent (power of 2)
+#define TX_BACKOFF_SLOT_BITS 16 // Back-off slot after a collision (bits)
+#define TX_BACKOFF_MAX_EXP 5    // Back-off window doubles up to 2^5 slots
+#define TX_MAX_ATTEMPTS 8       // A frame colliding this many times is dropped
+#define TX_DROP_HISTORY 32      // Tickets whose drop is remembered (bits of droppedMask)
+
+/**
+ * Callback when a frame leaves the queue (called from interrupt)
+ * @param buffer Buffer of the frame, can be reused
+ * @param ctx User context given when queuing the frame
+ * @param sent true if the frame was sent, false if it was dropped after
+ *             TX_MAX_ATTEMPTS collisions
+ **/
+typedef void (*tx_callback)(const uint8_t* buffer, void* ctx, bool sent);
+
+typedef struct TxFrame {
+    const uint8_t* buffer;
+    uint len;
+    tx_callback callback;
+    void* ctx;
+    uint8_t crc[2];                     // CRC sent after the frame
+} TxFrame;
+
+//Emitter state
+enum tx_state {
+    TX_IDLE,    // Nothing to send
+    TX_DATA,    // DMA sends frame data
+    TX_CRC,     // DMA sends CRC
+    TX_FLAG,    // Waiting for closing flag
+    TX_ABORT,   // Collision, waiting for the abort to be sent
+    TX_BACKOFF, // Frame sent again after its back-off
+};
+
+/**
+ * Emitter of a segment : clock_tx and hdlc_tx state machines, DMA channel
+ * feeding hdlc_tx and queue of frames to send
+ * Frames are started once the bus looks idle, hdlc_tx reads each bit back
+ * from the received data : if another emitter changes the line, the frame
+ * is aborted at the next bit and queued again at the head, after a random
+ * back-off (binary exponential, in TX_BACKOFF_SLOT_BITS slots). After
+ * TX_MAX_ATTEMPTS collisions it is dropped, its callback and isFrameSent
+ * tell it was not sent.
+ **/
+typedef struct HdlcEmitter {
+    PIO pio;                            // PIO block for data emit (pio1)
+    uint clockSM;                       // Clock emit state machine number
+    uint dataSM;                        // Data emit state machine number, next to the clock one
+    uint flagIrq;                       // PIO IRQ flag raised when a flag is sent
+    uint collisionIrq;                  // PIO IRQ flag raised on a collision, hdlc_tx waits for its clear
+    int dmaChannel;                     // Data emit DMA channel
+    int backoffAlarm;                   // Timer alarm ending the back-off
+    uint enablePin;                     // Transceiver TX enable pin, also enables the clock
+    uint dataPin;                       // TX data pin
+    uint readbackPin;                   // RX data pin, read back by hdlc_tx
+    bool configured;
+    BusActivity* bus;                   // Activity of the segment bus
+
+    volatile bool clockActive;          // Clock requested for echo
+    volatile bool waitingBus;           // Frame ready, waiting for the bus to be idle
+    volatile tx_state state;
+    bool collisionDetect;               // Data bits are read back (the data pin is read back otherwise)
+    uint attempts;                      // Collisions of the current frame
+    uint32_t random;                    // Back-off random generator state
+
+    // Frames queue (single producer : sendFrame, single consumer : interrupts)
+    TxFrame queue[TX_QUEUE_LEN];
+    volatile uint32_t queueHead;        // Number of queued frames
+    volatile uint32_t queueTail;        // Number of frames started
+    volatile uint32_t done;             // Number of frames sent or dropped
+    volatile uint32_t droppedMask;      // Bit (ticket % TX_DROP_HISTORY) set for a dropped frame
+} HdlcEmitter;
+
+/**
+ * Gets the emitter of a segment
+ * @param segment Segment number, less than NR_SEGMENTS
+ **/
+HdlcEmitter& getEmitter(uint segment);
 
 /**
  * Configures emitter
+ * Frames are sent once the bus of the segment is idle, its bus activity
+ * must be initialized. Collision detection is enabled.
+ * @param segment Segment number, gives the state machines and IRQ flag
+ * @param dataRxPin Received data, read back while sending
  **/
-void configureEmitter(uint txEnablePin, uint clkTxPin, uint dataTxPin);
+void configureEmitter(HdlcEmitter& tx, uint segment, uint txEnablePin, uint clkTxPin, uint dataTxPin, uint dataRxPin);
 
 /**
- * Send clock on bus used to send echo
+ * Enables the read back of the emitted data
+ * Without it, frames are sent to the end whatever the line state
+ **/
+void setCollisionDetect(HdlcEmitter& tx, bool enabled);
+
+/**
+ * Send clock on bus used to send echo, does not wait
+ * Once disabled, the clock stops at the end of the current flag
  * @param enabled True if the clock is enabled
+ * @return false if the clock can't start, the bus is not idle
  **/
-void setClock(bool enabled);
+bool setClock(HdlcEmitter& tx, bool enabled);
 
 /**
- * Send data to bus
+ * Queues a frame to be sent, does not wait for the frame to be sent
+ * Frames are sent back to back, the buffer must stay valid until sent.
+ * If the emitter is idle, the bus is acquired once free
  * @param buffer buffer to be sent, without CRC
  * @param len lenght of the buffer to be sent
+ * @param callback Called once the frame is sent or dropped (optional)
+ * @param ctx Context given to the callback
+ * @return Frame ticket to poll with isFrameDone and isFrameSent, 0 if the queue is full
+ **/
+uint32_t sendFrame(HdlcEmitter& tx, const uint8_t* buffer, uint len, tx_callback callback = nullptr, void* ctx = nullptr);
+
+/**
+ * Gets if a queued frame left the queue, sent or dropped : its buffer can
+ * be reused
+ * @param ticket Ticket returned by sendFrame
+ **/
+bool isFrameDone(const HdlcEmitter& tx, uint32_t ticket);
+
+/**
+ * Gets if a queued frame was sent (including closing flag)
+ * A frame dropped after TX_MAX_ATTEMPTS collisions is never sent, this is
+ * known until TX_DROP_HISTORY more frames are queued
+ * @param ticket Ticket returned by sendFrame
+ **/
+bool isFrameSent(const HdlcEmitter& tx, uint32_t ticket);
+
+/**
+ * Send data to bus, blocks until sent or dropped
+ * @param buffer buffer to be sent, without CRC
+ * @param len lenght of the buffer to be sent
+ **/
+void sendData(HdlcEmitter& tx, const uint8_t* buffer, uint len);
+
+/**
+ * Same functions on the emitter of the first segment, used by the protocol
+ * engine
  **/
-void sendData(const uint8_t* buffer, uint len);
+bool setClock(bool enabled);
+uint32_t sendFrame(const uint8_t* buffer, uint len, tx_callback callback = nullptr, void* ctx = nullptr);
+bool isFrameDone(uint32_t ticket);
+bool isFrameSent(uint32_t ticket);
 
-#endif
\ No newline at end of file
+#endif
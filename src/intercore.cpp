@@ -0,0 +1,19 @@
+#include "intercore.h"
+#include "bus_stats.h"
+
+#include <stdio.h>
+
+SpscQueue<IntercoreMessage, 32> busToHost;
+SpscQueue<IntercoreMessage, 8> hostToBus;
+volatile uint32_t logDropped = 0;
+
+void intercore_dropped(const void* queue)
+{
+    stat_add(queue == &busToHost ? busStats.busToHostDrops : busStats.hostToBusDrops);
+}
+
+void log_print(const LogRecord& r)
+{
+    //Arguments are uint32_t as the formats expect (PRIu32), ignored when not used by the format
+    printf(r.format, r.args[0], r.args[1], r.args[2], r.args[3], r.args[4], r.args[5]);
+}
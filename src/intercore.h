@@ -0,0 +1,193 @@
+#ifndef __INTERCORE_H__
+#define __INTERCORE_H__
+#include "pico/stdlib.h"
+#include "spsc_queue.h"
+#include <stdio.h>
+#include <inttypes.h>
+#include <type_traits>
+
+/**
+ * Messages between the bus engine (core 1) and the host side (core 0)
+ **/
+
+#define INTERCORE_PAYLOAD 60        // Maximum payload of a message
+
+enum intercore_type : uint8_t {
+    IC_LOG,             // Bus -> host : log message to format (LogRecord)
+    IC_LATENCY,         // Bus -> host : reply latency report (ReplyLatencyReport)
+    IC_RESET_LATENCY,   // Host -> bus : resets reply latency statistics
+    IC_POOL,            // Bus -> host : frame pool occupancy (PoolStats)
+    IC_SCHEDULER,       // Bus -> host : bus utilisation and service latency (SchedulerReport)
+    IC_STATIONS,        // Bus -> host : per station service latency (StationService array)
+    IC_CAPTURE,         // Host -> bus : starts (data[0] = 1) or stops promiscuous capture
+    IC_SERVER,          // Host -> bus : host side serves messages (data[0] = 1) or not
+    IC_CONSIGNE,        // Bus -> host : station waiting after its consigne (MessageRequest)
+    IC_MESSAGE,         // Host -> bus : message to exchange with a waiting station (MessageOrder)
+    IC_MESSAGE_END,     // Bus -> host : message ended, stream given back (MessageEnd)
+    IC_WAKE,            // Bus -> host : bus engine sleep and wake-up latency (WakeReport)
+};
+
+typedef struct IntercoreMessage {
+    intercore_type type;
+    uint8_t len;                        // Payload length
+    uint8_t data[INTERCORE_PAYLOAD];
+} IntercoreMessage;
+
+/**
+ * Reply latency statistics, from the closing flag of a request to the
+ * reply being on the bus
+ **/
+typedef struct LatencyStat {
+    uint32_t count;
+    uint32_t min;       // Best case in us
+    uint32_t max;       // Worst case in us
+    uint32_t sum;       // Sum of latencies in us
+} LatencyStat;
+
+typedef struct ReplyLatencyReport {
+    LatencyStat echo;   // Initial call to echo
+    LatencyStat ack;    // Consigne to MCPCH
+} ReplyLatencyReport;
+
+/**
+ * Scheduler report, bus utilisation is given over the report period
+ **/
+typedef struct SchedulerReport {
+    uint32_t periodUs;
+    uint32_t busyUs;        // Bus activity during the period
+    uint32_t calls;         // Call backs
+    LatencyStat service;    // Initial call to call back
+} SchedulerReport;
+
+typedef struct StationService {
+    uint32_t station;
+    LatencyStat service;
+} StationService;
+
+#define STATIONS_PER_MESSAGE (INTERCORE_PAYLOAD / sizeof(StationService))
+
+static inline void latency_add(LatencyStat& s, uint32_t us)
+{
+    if(s.count == 0 || us < s.min){
+        s.min = us;
+    }
+    ++s.count;
+    s.sum += us;
+    if(us > s.max){
+        s.max = us;
+    }
+}
+
+extern SpscQueue<IntercoreMessage, 32> busToHost;   // Core 1 to core 0
+extern SpscQueue<IntercoreMessage, 8> hostToBus;    // Core 0 to core 1
+
+/**
+ * Counts a message lost on a full queue (busStats, one counter per queue
+ * written by its producer core)
+ **/
+void intercore_dropped(const void* queue);
+
+/**
+ * Posts a message, does not block
+ * @return false if the queue is full, the message is counted as lost
+ **/
+template<uint32_t N>
+static inline bool intercore_post(SpscQueue<IntercoreMessage, N>& queue, intercore_type type, const void* data, uint len)
+{
+    IntercoreMessage* m = queue.reserve();
+    if(m == nullptr){
+        intercore_dropped(&queue);
+        return false;
+    }
+    m->type = type;
+    m->len = len < INTERCORE_PAYLOAD ? len : INTERCORE_PAYLOAD;
+    for(uint i = 0; i < m->len; ++i){
+        m->data[i] = ((const uint8_t*)data)[i];
+    }
+    queue.commit();
+    return true;
+}
+
+#define LOG_MAX_ARGS 6              // Integer arguments of a deferred log message
+
+/**
+ * Deferred log message : the format is not expanded by the bus engine,
+ * core 0 formats it with the raw arguments
+ **/
+typedef struct LogRecord {
+    const char* format;             // Format string (constant, shared by both cores)
+    uint32_t args[LOG_MAX_ARGS];
+} LogRecord;
+
+static_assert(sizeof(LogRecord) <= INTERCORE_PAYLOAD, "Log record must fit in a message");
+
+extern volatile uint32_t logDropped;                // Log messages lost because the queue was full
+
+/**
+ * Counts the arguments of a log format
+ * @return -1 if a conversion is not an integer (%s, %f, %p...)
+ **/
+constexpr int log_arg_count(const char* fmt)
+{
+    int count = 0;
+    for(; *fmt != '\0'; ++fmt){
+        if(*fmt != '%'){
+            continue;
+        }
+        ++fmt;
+        if(*fmt == '%'){
+            continue;
+        }
+        //Flags, width and length modifiers
+        while(*fmt != '\0' && (*fmt == '-' || *fmt == '+' || *fmt == ' ' || *fmt == '#' || *fmt == '.' ||
+              (*fmt >= '0' && *fmt <= '9') || *fmt == 'l' || *fmt == 'h')){
+            ++fmt;
+        }
+        if(*fmt != 'd' && *fmt != 'i' && *fmt != 'u' && *fmt != 'x' && *fmt != 'X' && *fmt != 'o' && *fmt != 'c'){
+            return -1;
+        }
+        ++count;
+    }
+    return count;
+}
+
+static inline void __attribute__((format(printf, 1, 2))) log_format_check(const char* fmt, ...) {}
+
+/**
+ * Posts a log message, see LOG
+ **/
+template<int N, typename... Args>
+static inline void log_post(const char* fmt, Args... args)
+{
+    static_assert(N >= 0, "Only integer conversions can be deferred");
+    static_assert(N == sizeof...(Args), "Arguments do not match the format");
+    static_assert(N <= LOG_MAX_ARGS, "Too many arguments");
+    static_assert((std::is_same<Args, uint32_t>::value && ...), "Arguments must be uint32_t (PRIu32 formats)");
+    if(get_core_num() == 0){
+        printf(fmt, args...);
+        return;
+    }
+    LogRecord r = {fmt, {static_cast<uint32_t>(args)...}};
+    if(!intercore_post(busToHost, IC_LOG, &r, sizeof(r))){
+        logDropped = logDropped + 1;
+    }
+}
+
+/**
+ * Prints a deferred log message (core 0)
+ **/
+void log_print(const LogRecord& r);
+
+/**
+ * Logs a message from any core, with a constant format and integer arguments
+ * Arguments are uint32_t, formatted with PRIu32, PRIx32... (their type
+ * differs between the host and arm-none-eabi). Core 0 prints directly. On core 1 only the format address and the raw
+ * arguments are queued (no formatting, never waits for USB), core 0
+ * formats them later. Lost messages are counted in logDropped.
+ **/
+#define LOG(fmt, ...) do{ \
+        if(false){ log_format_check(fmt, ##__VA_ARGS__); } \
+        log_post<log_arg_count(fmt)>(fmt, ##__VA_ARGS__); \
+    }while(0)
+
+#endif
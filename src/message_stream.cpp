@@ -0,0 +1,98 @@
+#include "message_stream.h"
+#include "hdlc_tx.h"
+#include "intercore.h"
+#include "frame_pool.h"
+
+#include <string.h>
+
+static_assert(MSG_CHUNK_OFFSET + NR_DATA_CHUNK <= POOL_LARGE_SIZE, "A data frame kept for a late host side must fit in a pool buffer");
+
+static MessageStream streams[MSG_STREAMS];
+
+int stream_open()
+{
+    for(uint i = 0; i < MSG_STREAMS; ++i){
+        if(!streams[i].inUse){
+            streams[i].inUse = true;
+            return i;
+        }
+    }
+    return -1;
+}
+
+void stream_close(uint index)
+{
+    MessageStream& s = streams[index];
+    //The bus engine gave the stream back, chunks left by an aborted message are dropped
+    while(s.chunks.front() != nullptr){
+        s.chunks.release();
+    }
+    s.inUse = false;
+}
+
+MessageStream& stream_get(uint index)
+{
+    return streams[index];
+}
+
+uint stream_index(const MessageStream& stream)
+{
+    return &stream - streams;
+}
+
+uint8_t* stream_write(MessageStream& stream)
+{
+    MessageChunk* c = stream.chunks.reserve();
+    return c ? &c->frame[MSG_CHUNK_OFFSET] : nullptr;
+}
+
+void stream_commit(MessageStream& stream, uint32_t len)
+{
+    stream.chunks.reserve()->len = len;
+    stream.chunks.commit();
+}
+
+uint8_t* stream_read(MessageStream& stream, uint32_t& len)
+{
+    MessageChunk* c = stream.chunks.front();
+    if(c == nullptr){
+        return nullptr;
+    }
+    len = c->len;
+    return &c->frame[MSG_CHUNK_OFFSET];
+}
+
+void stream_release(MessageStream& stream)
+{
+    stream.chunks.release();
+}
+
+void stream_end(MessageStream& stream, uint8_t station, message_status status, uint32_t bytes, uint32_t ticket)
+{
+    stream.end.station = station;
+    stream.end.stream = stream_index(stream);
+    stream.end.status = status;
+    stream.end.bytes = bytes;
+    stream.endTicket = ticket;
+    stream.ending = true;
+}
+
+void stream_poll()
+{
+    for(MessageStream& s : streams){
+        // The emitter may still read the last chunk
+        if(!s.ending || (s.endTicket != 0 && !isFrameDone(s.endTicket))){
+            continue;
+        }
+        //Posted again on the next call if the queue is full
+        IntercoreMessage* m = busToHost.reserve();
+        if(m == nullptr){
+            continue;
+        }
+        m->type = IC_MESSAGE_END;
+        m->len = sizeof(s.end);
+        memcpy(m->data, &s.end, sizeof(s.end));
+        busToHost.commit();
+        s.ending = false;
+    }
+}
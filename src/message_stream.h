@@ -0,0 +1,138 @@
+#ifndef __MESSAGE_STREAM_H__
+#define __MESSAGE_STREAM_H__
+#include "pico/stdlib.h"
+#include "spsc_queue.h"
+#include "protocol.h"
+
+/**
+ * Messages exchanged with stations (GET_DATA / SEND_DATA), streamed
+ * between the bus engine (core 1) and the host side (core 0)
+ * A message moves in chunks of NR_DATA_CHUNK bytes through a ring of
+ * MSG_STREAM_BUFFERS buffers : while one chunk is on the bus, the host side
+ * fills or drains the other. A buffer holds the whole data frame, the bus
+ * engine writes the address and header in front of the data and sends it
+ * in place. Memory is fixed, MSG_STREAMS messages at once whatever their
+ * length.
+ * The host side takes a free stream, gives it to the bus engine with
+ * IC_MESSAGE and gets it back with IC_MESSAGE_END, once no frame of the
+ * stream is left in the emitter. Meanwhile, the bus engine is the consumer
+ * of a message sent to a station and the producer of a message received
+ * from it, the host side the other end.
+ **/
+
+#define MSG_STREAMS 2                   // Messages streamed at once
+#define MSG_STREAM_BUFFERS 2            // Chunk buffers of a stream (power of 2)
+#define MSG_CHUNK_OFFSET (1 + NR_DATA_HEADER_LEN)   // Data offset in a chunk buffer
+#define MSG_NO_STREAM 0xFF              // IC_MESSAGE without stream : the station is disconnected
+
+typedef struct MessageChunk {
+    uint32_t len;                                       // Data bytes
+    uint8_t frame[MSG_CHUNK_OFFSET + NR_DATA_CHUNK];    // Data frame : address, header (bus engine) and data
+} MessageChunk;
+
+enum message_status : uint8_t {
+    MSG_DONE,           // Whole message exchanged
+    MSG_FAILED,         // Station timeout, new transaction, or protocol stopped
+    MSG_REFUSED,        // Station not waiting for a message
+};
+
+/**
+ * IC_CONSIGNE payload : a station waits after its consigne
+ **/
+typedef struct MessageRequest {
+    uint8_t station;
+    uint8_t codeTache;
+    uint8_t codeApp;
+    uint8_t page;
+    uint16_t msgLen;
+    uint16_t msgAddr;
+} MessageRequest;
+
+/**
+ * IC_MESSAGE payload : message to exchange with a waiting station
+ **/
+typedef struct MessageOrder {
+    uint8_t station;
+    uint8_t stream;                     // Stream index, MSG_NO_STREAM if there is no message
+    uint8_t send;                       // 1 : message sent to the station, 0 : received from it
+    uint32_t len;                       // Bytes to send
+} MessageOrder;
+
+/**
+ * IC_MESSAGE_END payload : stream given back to the host side
+ **/
+typedef struct MessageEnd {
+    uint8_t station;
+    uint8_t stream;
+    uint8_t status;                     // message_status
+    uint32_t bytes;                     // Message bytes exchanged
+} MessageEnd;
+
+typedef struct MessageStream {
+    SpscQueue<MessageChunk, MSG_STREAM_BUFFERS> chunks;
+    bool inUse;                         // Taken by the host side (core 0)
+    bool ending;                        // Message ended, end is posted once endTicket is sent (core 1)
+    uint32_t endTicket;
+    MessageEnd end;
+} MessageStream;
+
+/**
+ * Takes a free stream (host side)
+ * @return Stream index, -1 if all are in use
+ **/
+int stream_open();
+
+/**
+ * Gives back a stream after its IC_MESSAGE_END (host side)
+ **/
+void stream_close(uint index);
+
+/**
+ * Gets a stream
+ * @param index Index given by stream_open, less than MSG_STREAMS
+ **/
+MessageStream& stream_get(uint index);
+
+/**
+ * Gets the index of a stream
+ **/
+uint stream_index(const MessageStream& stream);
+
+/**
+ * Gets the next buffer to fill (producer side)
+ * @return Data of the chunk (NR_DATA_CHUNK bytes), nullptr if all buffers are full
+ **/
+uint8_t* stream_write(MessageStream& stream);
+
+/**
+ * Publishes the buffer given by stream_write (producer side)
+ * @param len Data bytes, NR_DATA_CHUNK unless it is the last chunk
+ **/
+void stream_commit(MessageStream& stream, uint32_t len);
+
+/**
+ * Gets the oldest chunk (consumer side)
+ * The MSG_CHUNK_OFFSET bytes before the data are free for the frame
+ * address and header
+ * @return Data of the chunk, nullptr if none is ready
+ **/
+uint8_t* stream_read(MessageStream& stream, uint32_t& len);
+
+/**
+ * Frees the chunk given by stream_read (consumer side)
+ **/
+void stream_release(MessageStream& stream);
+
+/**
+ * Ends the message of a stream (bus engine), IC_MESSAGE_END is posted by
+ * stream_poll once the frame of the ticket is sent
+ * @param ticket Last frame queued with data of the stream, 0 if none
+ **/
+void stream_end(MessageStream& stream, uint8_t station, message_status status, uint32_t bytes, uint32_t ticket);
+
+/**
+ * Gives back ended streams, to be called in the bus engine loop
+ **/
+void stream_poll();
+
+#endif
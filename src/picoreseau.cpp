@@ -2,6 +2,8 @@
 #include <string.h>
 #include "pico/stdlib.h"
 #include "pico/multicore.h"
+#include "pico/stdio_usb.h"
+#include "tusb.h"
 #include "hardware/pio.h"
 #include "hardware/irq.h"
 #include "hardware/dma.h"
@@ -9,12 +11,24 @@
 #include "hdlc_rx.h"
 #include "hdlc_tx.h"
 #include "clock_detect.h"
+#include "transceiver.h"
+#include "intercore.h"
+#include "protocol.h"
+#include "scheduler.h"
+#include "trace.h"
+#include "cycle_probe.h"
+#include "bus_stats.h"
+#include "frame_pool.h"
+#include "capture.h"
+#include "usb_bridge.h"
+#include "message_stream.h"
+#include "wake.h"
 #include "pico/time.h"
 
 #include "picoreseau.hxx"
 
 #define DATA_RX_PIN 0
-#define CLK_RX_PIN 1
+#define CLK_RX_PIN 1                // Always the pin following DATA_RX_PIN
 #define RX_TRCV_ENABLE_PIN  2       //Receiver transceiver enable GPIO
 
 #define DATA_TX_PIN 3
@@ -23,139 +37,556 @@
 
 #define DEV_NUMBER 0x0              // Device address on BUS (0 for master)
 
-#define MIN_CONSIGNE_LEN 11         // A consigne must be at least 11 bytes
-
-uint8_t buffer[65535];
-NR_STATE state = IDLE;
-Consigne consigne;
-uint8_t dest = 0;
-uint8_t msg_num = 0;
-/**
- * Convert a RX buffer to consigne
- **/
-void buffer_to_consigne(uint8_t* buffer, Consigne* consigne, uint32_t len) {
-    consigne->length = len - 3; //Remove the 3 first bytes
-    memcpy(&consigne->dest, &buffer[3], (sizeof(Consigne) - sizeof(consigne->ctx_data) -sizeof(consigne->length)));
-    consigne->ctx_data = &buffer[10];
-}
-
-/**
- * Handles when the device is IDLE
- **/
-void handle_state_idle() {
-    enum InternalState {WAIT_SELECT, GET_COMMAND, ACK, WAIT_IDLE, ERROR};
-    static InternalState int_state = WAIT_SELECT;
-    uint32_t nbBytes = 0;
-    receiver_status status = bad_crc;
-    switch (int_state)
-    {
-    case WAIT_SELECT:
-        //Waits to receive a "Prise de ligne" request
-        consigne.length = 0;
-        status = receiveData(DEV_NUMBER, buffer, sizeof(buffer), nbBytes);
-        if((status == done) && (nbBytes == 2)){
-            uint8_t ctrlW = buffer[0] & 0xF0;
-            // Lenght of the consigne
-            consigne.length = (buffer[0] & 0xF) * 4;
-            dest = buffer[1];
-            if(ctrlW == MCAPI){
-                // Got select
-                //printf("Appel initial de %u\n", dest);
-                // Send echo by outputing a clock
-                wait_for_no_clock();
-                sleep_us(50);
-                setClock(true);
-                sleep_us(300);
-                int_state = GET_COMMAND;
-                return;
-            }
+#define LATENCY_REPORT_MS 1000     // Reply latency report period
+#define RX_FRAMES_PER_LOOP 4        // Received frames handled per bus engine loop
+#define TRACE_DRAIN_LINES 4         // Trace lines printed per host loop
+#define HOST_IDLE_US 1000           // Host loop sleep without USB or bus engine activity
+
+/**
+ * Gives received frames to the protocol engine
+ * Message data is copied from the RX ring straight to its chunk buffer,
+ * other frames to a pool buffer.
+ * At most RX_FRAMES_PER_LOOP frames are handled, to keep the loop bounded
+ * @return true if frames were handled
+ **/
+static bool receiveFrames() {
+    RxFrame frame;
+    uint32_t n = 0;
+    for(; n < RX_FRAMES_PER_LOOP && receiveFrame(frame); ++n){
+        if(frame.status == bad_crc){
+            stat_add(busStats.crcErrors);
+        }else if(frame.status == frame_short){
+            stat_add(busStats.shortFrames);
+        }
+        if(frame.status != done){
+            continue;
+        }
+        uint8_t head[2];
+        uint32_t nbBytes = 0;
+        copyFrame(frame, head, sizeof(head), nbBytes);
+        uint8_t* chunk = nbBytes == sizeof(head) ? protocol_rx_buffer(head, frame.length) : nullptr;
+        uint8_t* buffer = chunk != nullptr ? chunk : pool_alloc(frame.length);
+        if(buffer == nullptr){
+            stat_add(busStats.noBuffer);
+            continue;
         }
-        break;
-    case GET_COMMAND:
-        //Stop sending echo
+        if(copyFrame(frame, buffer, frame.length, nbBytes) == done){
+            protocol_frame(buffer, nbBytes, frame.time);
+        }else{
+            stat_add(busStats.overruns);
+        }
+        if(chunk == nullptr){
+            pool_release(buffer);
+        }
+    }
+    return n != 0;
+}
+
+/**
+ * Gives received frames to the capture, the protocol engine is stopped
+ * @return true if frames were handled
+ **/
+static bool captureFrames() {
+    RxFrame frame;
+    uint32_t n = 0;
+    for(; n < RX_FRAMES_PER_LOOP && receiveFrame(frame); ++n){
+        capture_frame(frame);
+    }
+    capture_poll();
+    return n != 0;
+}
+
+/**
+ * Gives received frames to the host program, the protocol engine is stopped
+ * @return true if frames were handled
+ **/
+static bool bridgeFrames() {
+    RxFrame frame;
+    uint32_t n = 0;
+    for(; n < RX_FRAMES_PER_LOOP && receiveFrame(frame); ++n){
+        bridge_frame(frame);
+    }
+    return n != 0;
+}
+
+/**
+ * Switches between the protocol engine and the passive capture
+ **/
+static void setCaptureMode(bool enable) {
+    if(enable){
+        //Sessions are dropped, the adapter no longer answers
         setClock(false);
-        // Receives the command
-        status = receiveData(DEV_NUMBER, buffer, sizeof(buffer), nbBytes);
-        if(status == done){
-            if(nbBytes < consigne.length){
-                printf("Received %u bytes/%lu", nbBytes, consigne.length);
-                int_state = ERROR;
-                break;
-            }else{
-                buffer_to_consigne(buffer, &consigne, nbBytes);
-                int_state = ACK;
+        protocol_init(DEV_NUMBER);
+        setReceiverPromiscuous(true);
+        capture_start();
+    }else{
+        capture_stop();
+        setReceiverPromiscuous(false);
+        flushReceiver();
+        protocol_init(DEV_NUMBER);
+    }
+}
+
+/**
+ * Switches between the protocol engine and the host program over USB
+ **/
+static void setBridgeMode(bool enable) {
+    //Same receiver setup as the capture, the host program sends its own frames
+    setClock(false);
+    protocol_init(DEV_NUMBER);
+    setReceiverPromiscuous(enable);
+    if(!enable){
+        flushReceiver();
+    }
+}
+
+/**
+ * Tells the host side a station waits with its consigne
+ * @return true if the host side decides of the message
+ **/
+static bool post_waiting(const Session& s) {
+    const ConsigneView& c = s.consigne;
+    MessageRequest r = {s.station, c.code_tache(), c.code_app(), c.page(), c.msg_len(), c.msg_addr()};
+    return intercore_post(busToHost, IC_CONSIGNE, &r, sizeof(r));
+}
+
+/**
+ * Gives a message of the host side to the protocol engine, the stream is
+ * given back at once if the engine can't take it
+ * @param running false if the protocol engine is stopped (capture, bridge)
+ **/
+static void orderMessage(const IntercoreMessage& msg, bool running) {
+    MessageOrder order;
+    memcpy(&order, msg.data, sizeof(order));
+    if(order.stream == MSG_NO_STREAM){
+        protocol_decline_message(order.station);
+        return;
+    }
+    if(order.stream >= MSG_STREAMS){
+        return;
+    }
+    MessageStream& stream = stream_get(order.stream);
+    bool taken = running && (order.send ? protocol_send_message(order.station, stream, order.len)
+                                        : protocol_get_message(order.station, stream));
+    if(!taken){
+        stream_end(stream, order.station, MSG_REFUSED, 0, 0);
+    }
+}
+
+/**
+ * Posts the scheduler report and the service latency of served stations
+ * @param periodUs Time since the previous report
+ * @param busyUs Bus activity since the previous report
+ **/
+static void post_scheduler_report(uint32_t periodUs, uint32_t busyUs) {
+    const SchedulerStats& stats = scheduler_stats();
+    SchedulerReport report = {periodUs, busyUs, stats.calls, stats.service};
+    intercore_post(busToHost, IC_SCHEDULER, &report, sizeof(report));
+    StationService entries[STATIONS_PER_MESSAGE];
+    uint32_t n = 0;
+    for(uint32_t i = 0; i < NR_MAX_STATIONS; ++i){
+        if(stats.station[i].count == 0){
+            continue;
+        }
+        entries[n].station = i;
+        entries[n].service = stats.station[i];
+        if(++n == STATIONS_PER_MESSAGE){
+            intercore_post(busToHost, IC_STATIONS, entries, n * sizeof(StationService));
+            n = 0;
+        }
+    }
+    if(n != 0){
+        intercore_post(busToHost, IC_STATIONS, entries, n * sizeof(StationService));
+    }
+}
+
+/**
+ * Posts the sleep time and wake-up latency of the bus engine
+ * @param periodUs Time since the previous report
+ * @param sleepUs Time asleep since the previous report
+ * @param sleeps Sleeps since the previous report
+ **/
+static void post_wake_report(uint32_t periodUs, uint32_t sleepUs, uint32_t sleeps) {
+    const WakeStats& stats = wake_stats();
+    WakeReport report = {periodUs, sleepUs, sleeps, {}, {}};
+    for(uint32_t i = 0; i < WAKE_EVENTS; ++i){
+        const LatencyStat& l = stats.latency[i];
+        if(l.count == 0){
+            continue;
+        }
+        if(report.latency.count == 0 || l.min < report.latency.min){
+            report.latency.min = l.min;
+        }
+        report.latency.count += l.count;
+        report.latency.sum += l.sum;
+        if(l.max > report.latency.max){
+            report.latency.max = l.max;
+        }
+        report.maxUs[i] = l.max;
+    }
+    intercore_post(busToHost, IC_WAKE, &report, sizeof(report));
+}
+
+/**
+ * Brings the wake-up of the bus engine forward to a time given by a module
+ * @param time Time (us)
+ **/
+static void wake_before(absolute_time_t& deadline, uint32_t time) {
+    int32_t delay = (int32_t)(time - time_us_32());
+    absolute_time_t t = make_timeout_time_us(delay > 0 ? delay : 0);
+    if(absolute_time_diff_us(t, deadline) > 0){
+        deadline = t;
+    }
+}
+
+/**
+ * Bus engine, runs on core 1
+ * Owns the transceiver (PIO, DMA and their interrupts are set up from this
+ * core so they are handled here), never waits for USB
+ * Event loop : the interrupts post what is to be done (wake.h), the core
+ * sleeps once nothing is left, until an interrupt, a message of core 0 or
+ * the next report or batch flush
+ **/
+void bus_engine() {
+    //Initialize the clock detection, TX and RX state machines of the bus
+    TransceiverPins pins = {DATA_RX_PIN, RX_TRCV_ENABLE_PIN, DATA_TX_PIN, CLK_TX_PIN, TX_TRCV_ENABLE_PIN};
+    configureTransceiver(0, pins);
+    setReceiverAddress(DEV_NUMBER);
+    enableReceiver(true);
+    protocol_init(DEV_NUMBER);
+    wake_init();
+#ifdef USE_CYCLE_PROBES
+    probe_init();
+#endif
+    absolute_time_t pTime = make_timeout_time_ms(LATENCY_REPORT_MS);
+    uint32_t reportTime = time_us_32();
+    uint32_t reportBusy = get_bus_busy_time();
+    uint32_t reportSleep = wake_stats().sleepUs;
+    uint32_t reportSleeps = wake_stats().sleeps;
+    bool capturing = false;
+    bool bridging = false;
+    while(true){
+        wake_service();
+        bool idle;
+        if(capturing){
+            idle = !captureFrames();
+        }else if(bridging){
+            idle = !bridgeFrames();
+        }else{
+            idle = !receiveFrames();
+            protocol_poll();
+        }
+        bridge_event event = bridge_poll();
+        if(event != BRIDGE_NONE){
+            //Host batches left after the mode change
+            idle = false;
+        }
+        if(event == BRIDGE_OPENED && !bridging){
+            if(capturing){
+                capturing = false;
+                capture_stop();
             }
+            bridging = true;
+            setBridgeMode(true);
+        }else if(event == BRIDGE_CLOSED && bridging){
+            bridging = false;
+            setBridgeMode(false);
         }
-        break;
-    case ACK:
-        // Sends the acknowledge
-        uint8_t ack[3];
-        ack[0] = dest;
-        ack[1] = MCPCH;
-        ack[2] = DEV_NUMBER;
-        sendData(ack, sizeof(ack));
-        int_state = WAIT_IDLE;
-        break;
-    case WAIT_IDLE:
-        status = receiveData(DEV_NUMBER, buffer, sizeof(buffer), nbBytes);
-        if((status == done) && (nbBytes == 2)){
-            uint8_t ctrlW = buffer[0] & 0xF0;
-            if(ctrlW == MCAMA){
-                msg_num = buffer[0] & 0xF;
-                // Got select
-                printf("Avis de mise en attente de %u (msg num : %x)\n", dest, msg_num);
-                int_state = WAIT_SELECT;
-                state = SELECTED;
-                return;
-            }else{
-                int_state = ERROR;
+        stream_poll();
+        IntercoreMessage msg;
+        while(hostToBus.pop(msg)){
+            idle = false;
+            if(msg.type == IC_MESSAGE){
+                orderMessage(msg, !capturing && !bridging);
+            }else if(msg.type == IC_SERVER){
+                protocol_set_waiting_callback(msg.data[0] ? post_waiting : nullptr);
+            }else if(bridging){
+                //The host program owns the bus, no capture meanwhile
+            }else if(msg.type == IC_CAPTURE && (msg.data[0] != 0) != capturing){
+                capturing = !capturing;
+                setCaptureMode(capturing);
+            }else if(msg.type == IC_RESET_LATENCY){
+                memset(&protocol_latency(), 0, sizeof(ReplyLatencyReport));
+                memset(&scheduler_stats(), 0, sizeof(SchedulerStats));
+                memset(wake_stats().latency, 0, sizeof(wake_stats().latency));
+                bus_stats_reset();
+#ifdef USE_CYCLE_PROBES
+                probe_reset();
+#endif
             }
-        }else if(status != busy){
-            printf("%u ", status);
-            int_state = ERROR;
         }
-        break;
-    default:
-        break;
+        if(absolute_time_diff_us(pTime, get_absolute_time())>0){
+            pTime = make_timeout_time_ms(LATENCY_REPORT_MS);
+            intercore_post(busToHost, IC_LATENCY, &protocol_latency(), sizeof(ReplyLatencyReport));
+            PoolStats pool;
+            pool_get_stats(pool);
+            intercore_post(busToHost, IC_POOL, &pool, sizeof(pool));
+            uint32_t now = time_us_32();
+            uint32_t busy = get_bus_busy_time();
+            post_scheduler_report(now - reportTime, busy - reportBusy);
+            const WakeStats& wake = wake_stats();
+            post_wake_report(now - reportTime, wake.sleepUs - reportSleep, wake.sleeps - reportSleeps);
+            reportTime = now;
+            reportBusy = busy;
+            reportSleep = wake.sleepUs;
+            reportSleeps = wake.sleeps;
+        }
+        if(idle){
+            absolute_time_t deadline = pTime;
+            uint32_t flush;
+            if(capturing && capture_flush_time(flush)){
+                wake_before(deadline, flush);
+            }else if(bridging && bridge_flush_time(flush)){
+                wake_before(deadline, flush);
+            }
+            wake_sleep(deadline);
+        }
     }
-    if(int_state == ERROR){
-        printf("Error!\n");
-        setClock(false);
-        int_state = WAIT_SELECT;
-        state = IDLE;
+}
+
+/**
+ * Prints a reply latency report
+ **/
+static void print_latency(const ReplyLatencyReport& r, bool usbLoad) {
+    printf("\nReply latency (us) echo n=%lu avg=%lu max=%lu, ack n=%lu avg=%lu max=%lu, USB load %s\n",
+        (unsigned long)r.echo.count, (unsigned long)(r.echo.count ? r.echo.sum / r.echo.count : 0),
+        (unsigned long)r.echo.max, (unsigned long)r.ack.count,
+        (unsigned long)(r.ack.count ? r.ack.sum / r.ack.count : 0), (unsigned long)r.ack.max,
+        usbLoad ? "on" : "off");
+}
+
+/**
+ * Prints frame pool occupancy
+ **/
+static void print_pool(const PoolStats& p) {
+    printf("Frame pool small %u/%u (max %u, %lu failures), large %u/%u (max %u, %lu failures)\n",
+        p.small.inUse, POOL_SMALL_COUNT, p.small.highWater, (unsigned long)p.small.failures,
+        p.large.inUse, POOL_LARGE_COUNT, p.large.highWater, (unsigned long)p.large.failures);
+}
+
+/**
+ * Prints bus utilisation and service latency
+ **/
+static void print_scheduler(const SchedulerReport& r) {
+    printf("Bus utilisation %lu.%lu %%, %lu calls, service (us) avg=%lu max=%lu\n",
+        (unsigned long)(r.busyUs * 100ull / r.periodUs), (unsigned long)(r.busyUs * 1000ull / r.periodUs % 10),
+        (unsigned long)r.calls, (unsigned long)(r.service.count ? r.service.sum / r.service.count : 0),
+        (unsigned long)r.service.max);
+}
+
+/**
+ * Prints the bus engine idle time and wake-up latency, with the worst one
+ * of each event (us)
+ **/
+static void print_wake(const WakeReport& r) {
+    printf("Bus engine asleep %lu.%lu %%, %lu sleeps, wake-up (us) avg=%lu max=%lu (rx %lu bus %lu tx %lu deadline %lu timer %lu)\n",
+        (unsigned long)(r.sleepUs * 100ull / r.periodUs), (unsigned long)(r.sleepUs * 1000ull / r.periodUs % 10),
+        (unsigned long)r.sleeps, (unsigned long)(r.latency.count ? r.latency.sum / r.latency.count : 0),
+        (unsigned long)r.latency.max, (unsigned long)r.maxUs[0], (unsigned long)r.maxUs[1],
+        (unsigned long)r.maxUs[2], (unsigned long)r.maxUs[3], (unsigned long)r.maxUs[4]);
+}
+
+/**
+ * Prints the service latency of stations (avg/max us)
+ **/
+static void print_stations(const StationService* s, uint32_t n) {
+    printf("Service");
+    for(uint32_t i = 0; i < n; ++i){
+        printf(" %lu:%lu/%lu", (unsigned long)s[i].station,
+            (unsigned long)(s[i].service.sum / s[i].service.count), (unsigned long)s[i].service.max);
+    }
+    printf("\n");
+}
+
+/**
+ * Prints bus statistics, global then for each station with traffic
+ * Counters are read directly from core 1, turnaround values may be from
+ * different updates
+ **/
+static void print_bus_stats() {
+    const BusStats& b = busStats;
+    printf("\nBus rx %lu frames %lu bytes, tx %lu frames %lu bytes\n",
+        (unsigned long)b.rxFrames, (unsigned long)b.rxBytes, (unsigned long)b.txFrames, (unsigned long)b.txBytes);
+    printf("Errors crc=%lu abort=%lu short=%lu overrun=%lu overflow=%lu no buffer=%lu, filtered=%lu\n",
+        (unsigned long)b.crcErrors, (unsigned long)b.aborts, (unsigned long)b.shortFrames,
+        (unsigned long)b.overruns, (unsigned long)b.queueOverflows, (unsigned long)b.noBuffer,
+        (unsigned long)b.filtered);
+    printf("Messages lost bus->host %lu, host->bus %lu\n",
+        (unsigned long)b.busToHostDrops, (unsigned long)b.hostToBusDrops);
+    printf("Collisions %lu, back-offs %lu, dropped %lu\n",
+        (unsigned long)b.collisions, (unsigned long)b.backoffs, (unsigned long)b.collisionDrops);
+    printf("Timeouts echo=%lu reply=%lu, retransmissions=%lu, call retries=%lu, turnaround (us) min=%lu avg=%lu max=%lu\n",
+        (unsigned long)b.echoTimeouts, (unsigned long)b.replyTimeouts, (unsigned long)b.retransmissions,
+        (unsigned long)b.callRetries,
+        (unsigned long)b.turnaround.min, (unsigned long)(b.turnaround.count ? b.turnaround.sum / b.turnaround.count : 0),
+        (unsigned long)b.turnaround.max);
+    for(uint32_t i = 0; i < NR_MAX_STATIONS; ++i){
+        const StationStats& s = b.stations[i];
+        if(s.rxFrames == 0 && s.txFrames == 0){
+            continue;
+        }
+        printf(" %2lu: rx %lu/%lu tx %lu/%lu echo=%lu reply=%lu retx=%lu retry=%lu turnaround %lu/%lu/%lu\n",
+            (unsigned long)i, (unsigned long)s.rxFrames, (unsigned long)s.rxBytes,
+            (unsigned long)s.txFrames, (unsigned long)s.txBytes, (unsigned long)s.echoTimeouts,
+            (unsigned long)s.replyTimeouts, (unsigned long)s.retransmissions, (unsigned long)s.callRetries,
+            (unsigned long)s.turnaround.min,
+            (unsigned long)(s.turnaround.count ? s.turnaround.sum / s.turnaround.count : 0),
+            (unsigned long)s.turnaround.max);
+    }
+}
+
+/**
+ * Prints the cycle probes and the turnaround on one JSON line, to compare
+ * with a baseline (picoreseau_bench --target)
+ **/
+static void print_probes() {
+    printf("\n{\"suite\": \"target\", \"metrics\": {");
+#ifdef USE_CYCLE_PROBES
+    for(uint32_t i = 0; i < PROBE_COUNT; ++i){
+        const ProbeStat& p = probeStats[i];
+        printf("\"%s_cycles\": %lu, \"%s_max_cycles\": %lu, ", probe_name(i),
+            (unsigned long)(p.count ? p.sum / p.count : 0), probe_name(i), (unsigned long)p.max);
+    }
+#endif
+    const LatencyStat& t = busStats.turnaround;
+    printf("\"turnaround_us\": %lu, \"turnaround_max_us\": %lu}}\n",
+        (unsigned long)(t.count ? t.sum / t.count : 0), (unsigned long)t.max);
+}
+
+/**
+ * Message of a station received by core 0 (console 'm'), counted then dropped
+ **/
+typedef struct ServedMessage {
+    uint8_t station;
+    uint32_t bytes;
+    uint32_t sum;                   // Sum of the message bytes
+} ServedMessage;
+
+static ServedMessage served[MSG_STREAMS];
+
+/**
+ * Answers a waiting station : the message announced by its consigne is
+ * received on a stream, declined if there is none or no stream is free
+ * @param quiet Nothing printed (capture)
+ **/
+static void serve_consigne(const MessageRequest& r, bool quiet) {
+    int index = r.msgLen != 0 ? stream_open() : -1;
+    MessageOrder order = {r.station, MSG_NO_STREAM, 0, r.msgLen};
+    if(index >= 0){
+        served[index] = {r.station, 0, 0};
+        order.stream = index;
+    }
+    if(!quiet){
+        printf("Consigne of %u : tasks %u/%u, %u bytes at %u:%04x, %s\n", r.station, r.codeTache, r.codeApp,
+            r.msgLen, r.page, r.msgAddr, index >= 0 ? "receiving" : "declined");
+    }
+    if(!intercore_post(hostToBus, IC_MESSAGE, &order, sizeof(order)) && index >= 0){
+        //The station is called back once the host decision delay is over
+        stream_close(index);
+    }
+}
+
+/**
+ * Counts and frees the chunks received on the streams
+ * @return true if chunks were drained
+ **/
+static bool drain_messages() {
+    bool drained = false;
+    for(uint i = 0; i < MSG_STREAMS; ++i){
+        MessageStream& stream = stream_get(i);
+        if(!stream.inUse){
+            continue;
+        }
+        const uint8_t* data;
+        uint32_t len = 0;
+        while((data = stream_read(stream, len)) != nullptr){
+            for(uint32_t j = 0; j < len; ++j){
+                served[i].sum += data[j];
+            }
+            served[i].bytes += len;
+            stream_release(stream);
+            drained = true;
+        }
     }
+    return drained;
 }
 
-void handle_state_selected() {
-    enum InternalState {SDCALL, WAIT_ECHO, SEND_CMD, WAIT_ACK};
-    static InternalState int_state = SDCALL;
-    switch(int_state){
-        case SDCALL:
-            printf("SDCALL\n");
-            sleep_us(100);
-            uint8_t msg[3];
-            msg[0] = dest;
-            //msg[1] = MCAPA | msg_num;
-            msg[1] = MCDISC;
-            msg[2] = DEV_NUMBER;
-            sendData(msg, sizeof(msg));
-            int_state = WAIT_ECHO;
-            break;
-        case WAIT_ECHO:
-            while(!is_clock_detected(true)){}
-            printf("Echo detected!\n");
-            int_state = SDCALL;
-            state = IDLE;
-            break;
-        case SEND_CMD:
-            break;
+/**
+ * Stream given back by the bus engine, the message is over
+ * @param quiet Nothing printed (capture)
+ **/
+static void end_message(const MessageEnd& e, bool quiet) {
+    static const char* const status[] = {"done", "failed", "refused"};
+    if(e.stream >= MSG_STREAMS){
+        return;
+    }
+    drain_messages();
+    const ServedMessage& m = served[e.stream];
+    if(!quiet){
+        printf("Message of %u : %s, %lu bytes, sum %08lx\n", m.station, e.status <= MSG_REFUSED ? status[e.status] : "?",
+            (unsigned long)m.bytes, (unsigned long)m.sum);
+    }
+    stream_close(e.stream);
+}
+
+/**
+ * Sends capture batches over USB, they are dropped if the capture stopped
+ * @return true if data was sent
+ **/
+static bool send_capture(bool capturing) {
+    const uint8_t* data;
+    uint32_t len;
+    bool sent = false;
+    while(capture_get_batch(data, len)){
+        if(capturing){
+            fwrite(data, 1, len, stdout);
+            sent = true;
+        }
+        capture_release_batch();
+    }
+    if(sent){
+        fflush(stdout);
     }
+    return sent;
 }
 
 /**
- * Application main entry
+ * Starts or stops the capture, the pcap header starts the binary stream
+ * @return false if the bus engine can't be told (queue full), nothing changed
+ **/
+static bool set_capture(bool capturing) {
+    uint8_t on = capturing;
+    //Records wait in the capture ring until the header is written
+    if(!intercore_post(hostToBus, IC_CAPTURE, &on, 1)){
+        return false;
+    }
+    if(capturing){
+        stdio_set_translate_crlf(&stdio_usb, false);
+        PcapHeader header;
+        capture_header(header);
+        fwrite(&header, 1, sizeof(header), stdout);
+        fflush(stdout);
+    }else{
+        stdio_set_translate_crlf(&stdio_usb, true);
+    }
+    return true;
+}
+
+/**
+ * Application main entry, core 0 handles USB and the host side
+ * Console commands : 'l' toggles USB load, 'r' resets statistics,
+ * 's' prints bus statistics, 'b' the cycle probes (cycle_probe.h) as JSON,
+ * 'm' toggles the message server (messages of waiting stations are
+ * received and counted, see serve_consigne), 'c' starts or stops the
+ * capture. While capturing, the output is a pcap stream and text messages
+ * are dropped.
+ * Host programs use the bus through the vendor interface (usb_bridge.h)
+ * The application links tinyusb_device for its own descriptors, the SDK then
+ * leaves TinyUSB to it : it is started before stdio and tud_task() runs in
+ * every loop.
  **/
 int main() {
+    tusb_init();
     stdio_init_all();
     gpio_init(PICO_DEFAULT_LED_PIN);
     gpio_set_dir(PICO_DEFAULT_LED_PIN, GPIO_OUT);
@@ -167,32 +598,128 @@ int main() {
     // For debug, wait some time
     for(int i=0;i<30;++i){
         printf(".");
-        sleep_ms(100);
+        //Enumeration goes on meanwhile
+        for(int j=0;j<100;++j){
+            tud_task();
+            sleep_ms(1);
+        }
     }
     printf("\n");
-    //Initialize the clock detection
-    initialize_clock_detect();    
-    //Initialize TX state machine
-    configureEmitter(TX_TRCV_ENABLE_PIN, CLK_TX_PIN, DATA_TX_PIN);
-    //Initialize RX state machine
-    configureReceiver(RX_TRCV_ENABLE_PIN, CLK_RX_PIN, DATA_RX_PIN);
-    enableReceiver(true);
-    absolute_time_t pTime = make_timeout_time_ms(500);
+    multicore_launch_core1(bus_engine);
+    bool usbLoad = false;
+    bool capturing = false;
+    bool serving = false;
+    uint32_t reportedLogDrops = 0;
     while(true){
-        switch (state)
-        {
-        case IDLE:
-            handle_state_idle();
-            break;
-        case SELECTED:
-            handle_state_selected();            
-            break;
-        default:
-            break;
-        }       
-        if(absolute_time_diff_us(pTime, get_absolute_time())>0){
-            pTime = make_timeout_time_ms(500);
-            printf(".");
+        IntercoreMessage msg;
+        tud_task();
+        bool idle = !send_capture(capturing);
+        if(bridge_usb_task()){
+            idle = false;
+        }
+        if(drain_messages()){
+            idle = false;
+        }
+        while(busToHost.pop(msg)){
+            idle = false;
+            //Streams are given back whatever the mode
+            if(msg.type == IC_CONSIGNE){
+                MessageRequest request;
+                memcpy(&request, msg.data, sizeof(request));
+                serve_consigne(request, capturing);
+                continue;
+            }else if(msg.type == IC_MESSAGE_END){
+                MessageEnd end;
+                memcpy(&end, msg.data, sizeof(end));
+                end_message(end, capturing);
+                continue;
+            }
+            if(capturing){
+                continue;
+            }
+            switch(msg.type){
+            case IC_LOG:
+                LogRecord record;
+                memcpy(&record, msg.data, sizeof(record));
+                log_print(record);
+                break;
+            case IC_LATENCY:
+                ReplyLatencyReport report;
+                memcpy(&report, msg.data, sizeof(report));
+                print_latency(report, usbLoad);
+                break;
+            case IC_POOL:
+                PoolStats pool;
+                memcpy(&pool, msg.data, sizeof(pool));
+                print_pool(pool);
+                break;
+            case IC_SCHEDULER:
+                SchedulerReport sched;
+                memcpy(&sched, msg.data, sizeof(sched));
+                print_scheduler(sched);
+                break;
+            case IC_WAKE:
+                WakeReport wake;
+                memcpy(&wake, msg.data, sizeof(wake));
+                print_wake(wake);
+                break;
+            case IC_STATIONS:{
+                StationService stations[STATIONS_PER_MESSAGE];
+                memcpy(stations, msg.data, msg.len);
+                print_stations(stations, msg.len / sizeof(StationService));
+                break;
+            }
+            default:
+                break;
+            }
+        }
+        uint32_t logDrops = logDropped;
+        if(!capturing && logDrops != reportedLogDrops){
+            printf("*** %lu log messages lost\n", (unsigned long)(logDrops - reportedLogDrops));
+            reportedLogDrops = logDrops;
+        }
+#ifdef USE_TRACE
+        //Trace is only drained when there is nothing else to print
+        if(idle && !capturing && trace_drain(TRACE_DRAIN_LINES)){
+            idle = false;
+        }
+#endif
+        if(usbLoad){
+            //Keeps USB busy to check the bus engine is not disturbed
+            printf("USB load 0123456789abcdefghijklmnopqrstuvwxyz0123456789ABCDEFGHIJKL\n");
+        }
+        if(idle && !usbLoad){
+            //USB interrupts and the messages of the bus engine (SEV) wake the core
+            best_effort_wfe_or_timeout(make_timeout_time_us(HOST_IDLE_US));
+        }
+        int c = getchar_timeout_us(0);
+        if(c == 'c'){
+            //Typing 'c' again retries
+            if(set_capture(!capturing)){
+                capturing = !capturing;
+                usbLoad = false;
+            }else if(!capturing){
+                printf("\nBus engine busy, capture not started\n");
+            }
+        }else if(capturing){
+            //Other commands would print in the capture stream
+        }else if(c == 'l'){
+            usbLoad = !usbLoad;
+            intercore_post(hostToBus, IC_RESET_LATENCY, nullptr, 0);
+        }else if(c == 'r'){
+            intercore_post(hostToBus, IC_RESET_LATENCY, nullptr, 0);
+        }else if(c == 's'){
+            print_bus_stats();
+        }else if(c == 'b'){
+            print_probes();
+        }else if(c == 'm'){
+            uint8_t on = !serving;
+            if(intercore_post(hostToBus, IC_SERVER, &on, 1)){
+                serving = on;
+                printf("\nMessage server %s\n", serving ? "on" : "off");
+            }else{
+                printf("\nBus engine busy, message server unchanged\n");
+            }
         }
     }
-}
\ No newline at end of file
+}
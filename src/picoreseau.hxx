@@ -2,13 +2,20 @@
 #define _PICORESEAU_HXX__
 #include "pico/stdlib.h"
 
-//Main state machine
-enum NR_STATE{
+#define NR_MAX_STATIONS 32          // Station addresses handled (0 is the master)
+
+//Session state machine (one per station)
+enum NR_STATE : uint8_t {
     IDLE,       // IDLE, waiting for initial call
-    SELECTED,   // Device selected (initial call received)
+    CALLED,     // Initial call received, echo sent once the bus is free
+    ECHO,       // Sending the echo
+    SELECTED,   // Device selected (initial call received), waiting for the consigne
+    ACK,        // Consigne acknowledged, waiting for the notice of waiting
     WAITING,    // Device under waiting state
+    CALL,       // Station called back (MCAPA or MCDISC), waiting for its answer
     GET_DATA,   // Device will send data
     SEND_DATA,  // Device will receive data
+    NR_STATE_COUNT
 };
 
 //Control words
@@ -24,19 +31,4 @@ enum CTRL_WORD {
     MCAPI   = 0b11110000,     // Appel initial
 };
 
-//Nanoreseau consigne
-#pragma pack (1)
-typedef struct Consigne {
-    uint8_t length;         // Longueur de la consigne
-    uint8_t dest;           // Destinataire
-    uint8_t code_tache;     // Code tache reseau
-    uint8_t code_app;       // Code tache application 
-    uint16_t msg_len;       // Nombre d'ocets du message
-    uint8_t page;           // Page
-    uint16_t msg_addr;      // Message adresse
-    uint8_t ordinateur;     // Ordinateur (0 : TO7, 1 : MO5, 2: TO7/70)
-    uint8_t application;    // Application (0 : Unknown, 1 : Basic 1.0, 2 : LOGO, 3 : LSE)
-    uint8_t* ctx_data;      // Context dependant bytes
-}Consigne;
-
-#endif
\ No newline at end of file
+#endif
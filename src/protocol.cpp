@@ -0,0 +1,769 @@
+#include "protocol.h"
+#include "hdlc_tx.h"
+#include "clock_detect.h"
+#include "frame_pool.h"
+#include "scheduler.h"
+#include "trace.h"
+#include "cycle_probe.h"
+#include "bus_stats.h"
+#include "wake.h"
+#include "message_stream.h"
+#include "pico/time.h"
+#include "hardware/timer.h"
+
+#include <string.h>
+
+/**
+ * Received event, with its frame for control words and data
+ **/
+typedef struct ProtoEvent {
+    NR_EVENT type;
+    uint8_t* frame;             // Bytes following the address, nullptr for local events
+    uint32_t len;
+    uint32_t time;              // Closing flag of the frame, or current time (us)
+} ProtoEvent;
+
+/**
+ * Action of a transition
+ * @param next State given by the table
+ * @return State of the session after the action (next, or another one on error)
+ **/
+typedef NR_STATE (*proto_action)(Session& s, const ProtoEvent& e, NR_STATE next);
+
+typedef struct Transition {
+    NR_STATE state;
+    NR_EVENT event;
+    proto_action action;
+    NR_STATE next;
+} Transition;
+
+static Session sessions[NR_MAX_STATIONS];
+static uint32_t activeSessions = 0;         // Bit per session not IDLE
+static uint8_t deviceAddress = 0;
+static ReplyLatencyReport latency;
+static waiting_callback waitingCallback = nullptr;
+static RetryPolicy retryPolicy = {CALL_RETRIES, CALL_ECHO_TIMEOUT_US, CALL_BACKOFF_US, CALL_BACKOFF_MAX_US};
+static int deadlineAlarm = -1;
+static volatile bool deadlineFired = false;     // Set by the alarm interrupt
+static bool alarmArmed = false;
+static uint32_t alarmDeadline = 0;              // Target of the alarm (us)
+
+/**
+ * Alarm interrupt, a session deadline may be reached
+ **/
+static void __time_critical_func(deadline_isr)(uint alarm)
+{
+    deadlineFired = true;
+    wake_post(WAKE_DEADLINE);
+}
+
+/**
+ * Sets the alarm on a deadline, unless it is set on an earlier one
+ **/
+static void setAlarm(uint32_t deadline)
+{
+    if(alarmArmed && (int32_t)(deadline - alarmDeadline) >= 0){
+        return;
+    }
+    alarmArmed = true;
+    alarmDeadline = deadline;
+    int32_t delay = (int32_t)(deadline - time_us_32());
+    absolute_time_t target = from_us_since_boot(time_us_64() + (delay > 0 ? delay : 0));
+    if(hardware_alarm_set_target(deadlineAlarm, target)){
+        //Already reached, the loop may be about to sleep
+        deadlineFired = true;
+        wake_post(WAKE_DEADLINE);
+    }
+}
+
+/**
+ * Arms the session timer
+ **/
+static inline void arm(Session& s, uint32_t deadline)
+{
+    s.deadline = deadline;
+    s.timerArmed = true;
+    setAlarm(deadline);
+}
+
+/**
+ * Sends a frame from a pool buffer, released once sent
+ * @return Frame ticket, 0 if not queued (the buffer is released)
+ **/
+static uint32_t sendPoolFrame(uint8_t* frame, uint len)
+{
+    uint32_t ticket = sendFrame(frame, len, pool_tx_done);
+    if(ticket == 0){
+        pool_release(frame);
+    }else{
+        bus_stats_tx(frame[0], len);
+    }
+    return ticket;
+}
+
+/**
+ * Sends a control word to the station of a session
+ * @return Frame ticket, 0 if not queued
+ **/
+static uint32_t sendControl(Session& s, uint8_t ctrl)
+{
+    uint8_t* frame = pool_alloc(3);
+    if(frame == nullptr){
+        return 0;
+    }
+    frame[0] = s.station;
+    frame[1] = ctrl;
+    frame[2] = deviceAddress;
+    s.ticket = sendPoolFrame(frame, 3);
+    return s.ticket;
+}
+
+/**
+ * Gives the stream of the message back to the host side
+ * @param failed Message given up, even if all bytes were exchanged
+ **/
+static void endStream(Session& s, bool failed = false)
+{
+    if(s.stream != nullptr){
+        bool done = !failed && s.msgPos >= s.msgLen;
+        stream_end(*s.stream, s.station, done ? MSG_DONE : MSG_FAILED, s.msgPos, s.ticket);
+        s.stream = nullptr;
+    }
+    pool_release(s.pendingFrame);
+    s.pendingFrame = nullptr;
+    s.streamWait = false;
+    s.msgLen = 0;
+    s.msgPos = 0;
+}
+
+/**
+ * Ends the transaction of a session, releasing its buffers
+ **/
+static void release(Session& s)
+{
+    endStream(s);
+    s.consigne = ConsigneView();
+    pool_release(s.consigneFrame);
+    s.consigneFrame = nullptr;
+    s.timerArmed = false;
+}
+
+/**
+ * Calls back the station to end the transaction
+ **/
+static NR_STATE disconnect(Session& s)
+{
+    endStream(s);
+    if(sendControl(s, MCDISC) == 0){
+        release(s);
+        return IDLE;
+    }
+    s.call = MCDISC;
+    s.idleAfterCall = false;
+    arm(s, time_us_32() + retryPolicy.echoTimeoutUs);
+    return CALL;
+}
+
+/**
+ * Initial call : the echo is sent once the bus is idle
+ **/
+static NR_STATE act_called(Session& s, const ProtoEvent& e, NR_STATE next)
+{
+    if(s.state != IDLE){
+        bus_stats_retransmission(s.station);
+    }
+    release(s);
+    s.retries = 0;
+    s.consigneLen = (e.frame[0] & 0xF) * 4;
+    s.serviceStart = e.time;
+    arm(s, e.time + ECHO_TURNAROUND_US);
+    return next;
+}
+
+/**
+ * Starts the echo after ECHO_TURNAROUND_US of bus idle
+ **/
+static NR_STATE act_start_echo(Session& s, const ProtoEvent& e, NR_STATE next)
+{
+    if((e.time - s.requestTime) > REPLY_TIMEOUT_US){
+        LOG("Bus busy, no echo to %" PRIu32 "\n", (uint32_t)s.station);
+        release(s);
+        return IDLE;
+    }
+    if(!is_bus_idle()){
+        arm(s, e.time + BUS_IDLE_US);
+        return s.state;
+    }
+    uint32_t idleSince = get_last_clock_time() + BUS_IDLE_US;
+    if((int32_t)(e.time - idleSince) < ECHO_TURNAROUND_US){
+        arm(s, idleSince + ECHO_TURNAROUND_US);
+        return s.state;
+    }
+    if(!setClock(true)){
+        arm(s, e.time + BUS_IDLE_US);
+        return s.state;
+    }
+    latency_add(latency.echo, time_us_32() - s.requestTime);
+    bus_stats_turnaround(s.station, time_us_32() - s.requestTime);
+    arm(s, time_us_32() + ECHO_DURATION_US);
+    return next;
+}
+
+/**
+ * End of the echo, the station sends its consigne
+ **/
+static NR_STATE act_stop_echo(Session& s, const ProtoEvent& e, NR_STATE next)
+{
+    setClock(false);
+    arm(s, e.time + REPLY_TIMEOUT_US);
+    return next;
+}
+
+/**
+ * Consigne received, kept during the transaction and acknowledged
+ **/
+static NR_STATE act_consigne(Session& s, const ProtoEvent& e, NR_STATE next)
+{
+    if(s.state == ACK){
+        bus_stats_retransmission(s.station);
+    }
+    release(s);
+    if(!s.consigne.parse(e.frame, e.len, s.consigneLen)){
+        LOG("Received %" PRIu32 " bytes/%" PRIu32 "\n", e.len, (uint32_t)s.consigneLen);
+        return IDLE;
+    }
+    s.consigneFrame = e.frame;
+    pool_retain(s.consigneFrame);
+    // Next frame is received while the acknowledge is sent
+    if(sendControl(s, MCPCH) == 0){
+        release(s);
+        return IDLE;
+    }
+    latency_add(latency.ack, time_us_32() - s.requestTime);
+    bus_stats_turnaround(s.station, time_us_32() - s.requestTime);
+    arm(s, time_us_32() + REPLY_TIMEOUT_US);
+    return next;
+}
+
+/**
+ * Notice of waiting, the station waits for the scheduler to call it back,
+ * once the host side gave its message if it serves them
+ **/
+static NR_STATE act_waiting(Session& s, const ProtoEvent& e, NR_STATE next)
+{
+    s.msgNum = e.frame[0] & 0xF;
+    s.timerArmed = false;
+    LOG("Avis de mise en attente de %" PRIu32 " (msg num : %" PRIx32 ")\n", (uint32_t)s.station, (uint32_t)s.msgNum);
+    waiting_callback callback = waitingCallback;
+    if(callback != nullptr && callback(s)){
+        arm(s, e.time + HOST_DECISION_US);
+    }
+    return next;
+}
+
+/**
+ * Calls back a waiting station, with MCAPA if a message is exchanged
+ **/
+static NR_STATE act_call(Session& s, const ProtoEvent& e, NR_STATE next)
+{
+    s.call = (s.stream != nullptr) ? MCAPA : MCDISC;
+    if(sendControl(s, s.call == MCAPA ? (MCAPA | s.msgNum) : MCDISC) == 0){
+        release(s);
+        return IDLE;
+    }
+    s.idleAfterCall = false;
+    if(s.retries == 0){
+        scheduler_served(s.station, e.time - s.serviceStart);
+    }
+    arm(s, time_us_32() + retryPolicy.echoTimeoutUs);
+    return next;
+}
+
+/**
+ * Longest time a data frame takes on the bus, a bit stuffed every 5 bits
+ * @param len Bytes following the address
+ **/
+static inline uint32_t dataFrameUs(uint32_t len)
+{
+    return BusConfig::bitsUs((1 + len + 2) * 8 * 6 / 5 + 16);
+}
+
+/**
+ * Sends the next chunk of the message in place, or waits for the host
+ * side to commit it. The chunk is freed once acknowledged
+ **/
+static NR_STATE nextChunk(Session& s, NR_STATE next)
+{
+    uint32_t n = 0;
+    uint8_t* data = stream_read(*s.stream, n);
+    s.streamWait = data == nullptr;
+    if(s.streamWait){
+        // The station waits for data as long as for an answer
+        arm(s, time_us_32() + REPLY_TIMEOUT_US);
+        return next;
+    }
+    uint8_t* frame = data - MSG_CHUNK_OFFSET;
+    frame[0] = s.station;
+    frame[1] = 0x00;
+    frame[2] = deviceAddress;
+    frame[3] = 0x00;
+    uint32_t ticket = sendFrame(frame, MSG_CHUNK_OFFSET + n);
+    if(ticket == 0){
+        return disconnect(s);
+    }
+    bus_stats_tx(s.station, MSG_CHUNK_OFFSET + n);
+    s.ticket = ticket;
+    arm(s, time_us_32() + dataFrameUs(NR_DATA_HEADER_LEN + n) + REPLY_TIMEOUT_US);
+    return next;
+}
+
+/**
+ * Commits message data to the next chunk buffer and acknowledges it, the
+ * frame is kept until the host side frees a buffer
+ * Frames received in the chunk buffer (protocol_rx_buffer) are committed in
+ * place, a kept frame is copied
+ * @param frame Data frame, or the kept one
+ **/
+static NR_STATE storeChunk(Session& s, uint8_t* frame, uint32_t len, NR_STATE next)
+{
+    uint8_t* data = stream_write(*s.stream);
+    if(data == nullptr){
+        if(!s.streamWait){
+            s.streamWait = true;
+            s.pendingFrame = frame;
+            s.pendingLen = len;
+            pool_retain(frame);
+            arm(s, time_us_32() + REPLY_TIMEOUT_US);
+        }
+        return next;
+    }
+    uint32_t n = len - NR_DATA_HEADER_LEN;
+    if(n > s.msgLen - s.msgPos){
+        n = s.msgLen - s.msgPos;
+    }
+    if(n > NR_DATA_CHUNK){
+        n = NR_DATA_CHUNK;
+    }
+    if(&frame[NR_DATA_HEADER_LEN] != data){
+        memcpy(data, &frame[NR_DATA_HEADER_LEN], n);
+    }
+    stream_commit(*s.stream, n);
+    s.msgPos += n;
+    pool_release(s.pendingFrame);
+    s.pendingFrame = nullptr;
+    s.streamWait = false;
+    if(sendControl(s, MCOK) == 0){
+        //Station would send the chunk again until its timeout, the message is given up
+        LOG("No acknowledge for station %" PRIu32 ", message failed\n", (uint32_t)s.station);
+        endStream(s, true);
+        return disconnect(s);
+    }
+    if(s.msgPos < s.msgLen){
+        arm(s, time_us_32() + REPLY_TIMEOUT_US + dataFrameUs(NR_DATA_HEADER_LEN + NR_DATA_CHUNK));
+        return next;
+    }
+    return disconnect(s);
+}
+
+/**
+ * Station answered the call : transaction ends after MCDISC, the message
+ * is exchanged after MCAPA
+ **/
+static NR_STATE act_answered(Session& s, const ProtoEvent& e, NR_STATE next)
+{
+    s.retries = 0;
+    if(s.call == MCDISC){
+        LOG("Echo detected!\n");
+        release(s);
+        return IDLE;
+    }
+    if(!s.sendMessage){
+        if(sendControl(s, MCVE) == 0){
+            return disconnect(s);
+        }
+        arm(s, time_us_32() + REPLY_TIMEOUT_US);
+        return GET_DATA;
+    }
+    if(sendControl(s, MCVR) == 0){
+        return disconnect(s);
+    }
+    return nextChunk(s, SEND_DATA);
+}
+
+/**
+ * Message data from the station, each frame is acknowledged once stored
+ **/
+static NR_STATE act_get_data(Session& s, const ProtoEvent& e, NR_STATE next)
+{
+    if(s.streamWait){
+        //Sent again while the previous one waits for a buffer
+        return next;
+    }
+    return storeChunk(s, e.frame, e.len, next);
+}
+
+/**
+ * Host side freed a buffer for the kept data frame
+ **/
+static NR_STATE act_get_stream(Session& s, const ProtoEvent& e, NR_STATE next)
+{
+    return storeChunk(s, s.pendingFrame, s.pendingLen, next);
+}
+
+/**
+ * Message data acknowledged by the station, its chunk is freed and the
+ * next one sent
+ **/
+static NR_STATE act_data_ok(Session& s, const ProtoEvent& e, NR_STATE next)
+{
+    uint32_t n = 0;
+    if(s.streamWait || stream_read(*s.stream, n) == nullptr){
+        //No chunk on the bus
+        return next;
+    }
+    stream_release(*s.stream);
+    s.msgPos += n;
+    if(s.msgPos >= s.msgLen){
+        return disconnect(s);
+    }
+    return nextChunk(s, next);
+}
+
+/**
+ * Host side committed the chunk to send
+ **/
+static NR_STATE act_send_stream(Session& s, const ProtoEvent& e, NR_STATE next)
+{
+    return nextChunk(s, next);
+}
+
+/**
+ * Disconnect acknowledged (MCUA)
+ **/
+static NR_STATE act_done(Session& s, const ProtoEvent& e, NR_STATE next)
+{
+    release(s);
+    return next;
+}
+
+/**
+ * Station did not answer in time
+ **/
+static NR_STATE act_timeout(Session& s, const ProtoEvent& e, NR_STATE next)
+{
+    LOG("Error! Station %" PRIu32 " timeout in state %" PRIu32 "\n", (uint32_t)s.station, (uint32_t)s.state);
+    bus_stats_timeout(s.station, s.state == CALL);
+    release(s);
+    return next;
+}
+
+/**
+ * Call back not echoed : the station is called again after a backoff,
+ * until the policy gives up
+ **/
+static NR_STATE act_call_timeout(Session& s, const ProtoEvent& e, NR_STATE next)
+{
+    if(s.retries >= retryPolicy.retries){
+        return act_timeout(s, e, next);
+    }
+    uint32_t backoff = retryPolicy.backoffUs;
+    for(uint32_t i = 0; i < s.retries && backoff < retryPolicy.maxBackoffUs; ++i){
+        backoff <<= 1;
+    }
+    if(backoff > retryPolicy.maxBackoffUs){
+        backoff = retryPolicy.maxBackoffUs;
+    }
+    ++s.retries;
+    bus_stats_call_retry(s.station);
+    LOG("No echo from %" PRIu32 ", call %" PRIu32 " in %" PRIu32 " us\n", (uint32_t)s.station, (uint32_t)s.retries, backoff);
+    arm(s, e.time + backoff);
+    return WAITING;
+}
+
+/**
+ * End of the backoff, the scheduler may call the station again
+ **/
+static NR_STATE act_backoff_end(Session& s, const ProtoEvent& e, NR_STATE next)
+{
+    return next;
+}
+
+/**
+ * Transitions, events missing for a state are ignored
+ * Control words only sent by the master (MCPCH, MCVE, MCVR, MCDISC, MCAPA)
+ * are never expected from a station
+ **/
+static constexpr Transition transitions[] = {
+    {IDLE,      EV_MCAPI,   act_called,     CALLED},
+    {CALLED,    EV_MCAPI,   act_called,     CALLED},
+    {CALLED,    EV_TIMER,   act_start_echo, ECHO},
+    {ECHO,      EV_TIMER,   act_stop_echo,  SELECTED},
+    {SELECTED,  EV_DATA,    act_consigne,   ACK},
+    {SELECTED,  EV_MCAPI,   act_called,     CALLED},
+    {SELECTED,  EV_TIMER,   act_timeout,    IDLE},
+    {ACK,       EV_MCAMA,   act_waiting,    WAITING},
+    {ACK,       EV_DATA,    act_consigne,   ACK},           // MCPCH lost, consigne sent again
+    {ACK,       EV_MCAPI,   act_called,     CALLED},
+    {ACK,       EV_TIMER,   act_timeout,    IDLE},
+    {WAITING,   EV_CALL,    act_call,       CALL},
+    {WAITING,   EV_MCAPI,   act_called,     CALLED},
+    {WAITING,   EV_TIMER,   act_backoff_end, WAITING},
+    {CALL,      EV_ECHO,    act_answered,   IDLE},
+    {CALL,      EV_MCOK,    act_answered,   IDLE},          // MCUA
+    {CALL,      EV_MCAPI,   act_called,     CALLED},
+    {CALL,      EV_TIMER,   act_call_timeout, IDLE},        // WAITING while retrying
+    {GET_DATA,  EV_DATA,    act_get_data,   GET_DATA},
+    {GET_DATA,  EV_STREAM,  act_get_stream, GET_DATA},
+    {GET_DATA,  EV_MCAPI,   act_called,     CALLED},
+    {GET_DATA,  EV_TIMER,   act_timeout,    IDLE},
+    {SEND_DATA, EV_MCOK,    act_data_ok,    SEND_DATA},
+    {SEND_DATA, EV_STREAM,  act_send_stream, SEND_DATA},
+    {SEND_DATA, EV_MCAPI,   act_called,     CALLED},
+    {SEND_DATA, EV_TIMER,   act_timeout,    IDLE},
+};
+
+typedef struct TransitionTable {
+    uint8_t index[NR_STATE_COUNT][NR_EVENT_COUNT];     // Transition index + 1, 0 if the event is ignored
+} TransitionTable;
+
+static constexpr TransitionTable buildTable()
+{
+    TransitionTable t = {};
+    for(uint32_t i = 0; i < sizeof(transitions) / sizeof(transitions[0]); ++i){
+        t.index[transitions[i].state][transitions[i].event] = i + 1;
+    }
+    return t;
+}
+
+static constexpr TransitionTable table = buildTable();
+
+/**
+ * Gives the work of a session to the scheduler
+ **/
+static void track(const Session& s)
+{
+    scheduler_set(s.station, WORK_MCAPI, s.state >= CALLED && s.state <= ACK);
+    scheduler_set(s.station, WORK_CALL, s.state >= CALL);
+    // Not called back before the end of the backoff
+    bool waiting = s.state == WAITING && !s.timerArmed;
+    scheduler_set(s.station, WORK_MCAMA, waiting);
+    scheduler_set(s.station, WORK_MCAPA, waiting && s.stream != nullptr);
+}
+
+/**
+ * Runs the transition of an event
+ **/
+static void dispatch(Session& s, const ProtoEvent& e)
+{
+    uint8_t index = table.index[s.state][e.type];
+    if(index == 0){
+        return;
+    }
+    const Transition& t = transitions[index - 1];
+    NR_STATE previous = s.state;
+    s.state = t.action(s, e, t.next);
+    if(s.state != previous){
+        TRACE(TR_STATE, (s.station << 8) | s.state);
+    }
+    track(s);
+    if(s.state == IDLE){
+        activeSessions &= ~(1u << s.station);
+    }else{
+        activeSessions |= 1u << s.station;
+    }
+}
+
+void protocol_init(uint8_t address)
+{
+    deviceAddress = address;
+    for(uint32_t i = 0; i < NR_MAX_STATIONS; ++i){
+        release(sessions[i]);
+        sessions[i] = Session();
+        sessions[i].station = i;
+    }
+    activeSessions = 0;
+    scheduler_init();
+    if(deadlineAlarm < 0){
+        deadlineAlarm = hardware_alarm_claim_unused(true);
+        hardware_alarm_set_callback(deadlineAlarm, deadline_isr);
+    }
+    hardware_alarm_cancel(deadlineAlarm);
+    alarmArmed = false;
+    deadlineFired = false;
+}
+
+void protocol_frame(uint8_t* frame, uint32_t len, uint32_t time)
+{
+    CYCLE_PROBE(PROBE_PROTOCOL_FRAME);
+    if(len < 2 || frame[1] >= NR_MAX_STATIONS){
+        return;
+    }
+    ProtoEvent e = {EV_DATA, frame, len, time};
+    if(frame[0] & 0x80){
+        if(len != 2){
+            return;
+        }
+        e.type = (NR_EVENT)((frame[0] >> 4) & 0x7);
+    }else if(len < NR_DATA_HEADER_LEN){
+        return;
+    }
+    Session& s = sessions[frame[1]];
+    s.requestTime = time;
+    bus_stats_rx(s.station, len);
+    dispatch(s, e);
+}
+
+void protocol_poll()
+{
+    // Deadlines are only checked once the alarm fired
+    bool expired = deadlineFired;
+    if(expired){
+        deadlineFired = false;
+        alarmArmed = false;
+    }
+    uint32_t active = activeSessions;
+    while(active != 0){
+        uint32_t i = __builtin_ctz(active);
+        active &= active - 1;
+        Session& s = sessions[i];
+        uint32_t now = time_us_32();
+        // Chunk committed or buffer freed by the host side
+        uint32_t n = 0;
+        if(s.streamWait && (s.sendMessage ? stream_read(*s.stream, n) != nullptr : stream_write(*s.stream) != nullptr)){
+            dispatch(s, {EV_STREAM, nullptr, 0, now});
+            continue;
+        }
+        // Our own clock must not be taken for the echo
+        if(s.state == CALL && isFrameSent(s.ticket)){
+            if(!s.idleAfterCall){
+                s.idleAfterCall = is_bus_idle();
+            }else if(is_clock_detected()){
+                dispatch(s, {EV_ECHO, nullptr, 0, now});
+                continue;
+            }
+        }
+        if(expired && s.timerArmed && (int32_t)(now - s.deadline) >= 0){
+            s.timerArmed = false;
+            dispatch(s, {EV_TIMER, nullptr, 0, now});
+        }
+    }
+    if(expired){
+        // Alarm on the nearest deadline left
+        for(active = activeSessions; active != 0; active &= active - 1){
+            const Session& s = sessions[__builtin_ctz(active)];
+            if(s.timerArmed){
+                setAlarm(s.deadline);
+            }
+        }
+    }
+    // Next call back once the bus was idle for the turnaround, while the
+    // previous station echoes the call is chosen and sent in the idle gap
+    if(!is_bus_idle()){
+        return;
+    }
+    uint32_t now = time_us_32();
+    uint32_t callTime = get_last_clock_time() + BUS_IDLE_US + CALL_TURNAROUND_US;
+    if((int32_t)(now - callTime) < 0){
+        // The alarm wakes the bus engine at the end of the turnaround
+        if(scheduler_waiting()){
+            setAlarm(callTime);
+        }
+        return;
+    }
+    int station = scheduler_next();
+    if(station >= 0){
+        dispatch(sessions[station], {EV_CALL, nullptr, 0, now});
+    }
+}
+
+uint8_t* protocol_rx_buffer(const uint8_t* head, uint32_t len)
+{
+    if(len < NR_DATA_HEADER_LEN || len > NR_DATA_HEADER_LEN + NR_DATA_CHUNK || (head[0] & 0x80) ||
+       head[1] >= NR_MAX_STATIONS){
+        return nullptr;
+    }
+    Session& s = sessions[head[1]];
+    if(s.state != GET_DATA || s.streamWait){
+        return nullptr;
+    }
+    uint8_t* data = stream_write(*s.stream);
+    return data != nullptr ? data - NR_DATA_HEADER_LEN : nullptr;
+}
+
+const Session* protocol_session(uint8_t station)
+{
+    return station < NR_MAX_STATIONS ? &sessions[station] : nullptr;
+}
+
+bool protocol_send_message(uint8_t station, MessageStream& stream, uint32_t len)
+{
+    if(station >= NR_MAX_STATIONS){
+        return false;
+    }
+    Session& s = sessions[station];
+    if(s.state != WAITING || s.stream != nullptr || len == 0){
+        return false;
+    }
+    s.stream = &stream;
+    s.msgLen = len;
+    s.msgPos = 0;
+    s.sendMessage = true;
+    if(s.retries == 0){
+        // Held for the host decision
+        s.timerArmed = false;
+    }
+    track(s);
+    return true;
+}
+
+bool protocol_get_message(uint8_t station, MessageStream& stream)
+{
+    if(station >= NR_MAX_STATIONS){
+        return false;
+    }
+    Session& s = sessions[station];
+    if(s.state != WAITING || s.stream != nullptr || !s.consigne.valid() || s.consigne.msg_len() == 0){
+        return false;
+    }
+    s.stream = &stream;
+    s.msgLen = s.consigne.msg_len();
+    s.msgPos = 0;
+    s.sendMessage = false;
+    if(s.retries == 0){
+        s.timerArmed = false;
+    }
+    track(s);
+    return true;
+}
+
+void protocol_decline_message(uint8_t station)
+{
+    if(station >= NR_MAX_STATIONS){
+        return;
+    }
+    Session& s = sessions[station];
+    if(s.state == WAITING && s.stream == nullptr && s.retries == 0){
+        s.timerArmed = false;
+        track(s);
+    }
+}
+
+void protocol_set_waiting_callback(waiting_callback callback)
+{
+    waitingCallback = callback;
+}
+
+void protocol_set_retry_policy(const RetryPolicy& policy)
+{
+    retryPolicy = policy;
+}
+
+const RetryPolicy& protocol_retry_policy()
+{
+    return retryPolicy;
+}
+
+ReplyLatencyReport& protocol_latency()
+{
+    return latency;
+}
@@ -0,0 +1,179 @@
+#ifndef __PROTOCOL_H__
+#define __PROTOCOL_H__
+#include "pico/stdlib.h"
+#include "picoreseau.hxx"
+#include "consigne.h"
+#include "intercore.h"
+#include "bus_timing.h"
+
+/**
+ * Nanoreseau protocol engine (master side)
+ * Each station has its own session, driven by a (state, event) table :
+ * several stations can be in different phases of their transaction.
+ * Nothing waits : delays are absolute deadlines, a hardware alarm is set
+ * on the nearest one and protocol_poll only looks at them once it fired,
+ * so one call of protocol_frame or protocol_poll takes a bounded time.
+ * The alarm also ends the turnaround before a call back : its interrupt
+ * wakes the bus engine (wake.h), which never polls for the time.
+ * A call back which is not echoed is sent again after a backoff, following
+ * the retry policy, before the station is dropped.
+ * Messages are streamed : data frames are sent from, or received into, the
+ * chunk buffers of a stream (message_stream.h) the host side fills or
+ * drains meanwhile, a received data frame is copied once, from the RX ring
+ * to its chunk. The engine waits for the host side when it is late.
+ * The engine only uses the emitter, bus activity and frame pool APIs, it
+ * runs unchanged on the host simulator.
+ **/
+
+struct MessageStream;
+
+#define NR_DATA_HEADER_LEN 3        // Bytes before the data of consigne and message frames
+#define NR_DATA_CHUNK 1024          // Message bytes sent in one data frame
+
+#define ECHO_TURNAROUND_US (BusConfig::echoTurnaroundUs)    // Bus idle before answering an initial call with the echo
+#define ECHO_DURATION_US (BusConfig::echoDurationUs)        // Duration of the echo clock
+#define REPLY_TIMEOUT_US 20000      // Maximum wait for a station answer
+#define HOST_DECISION_US 10000      // Maximum wait for the host side to give the message of a waiting station
+
+#define CALL_ECHO_TIMEOUT_US 5000   // Default wait for the echo of a call back
+#define CALL_RETRIES 3              // Default call backs sent again without echo
+#define CALL_BACKOFF_US 1000        // Default delay before the first retry, doubled on each retry
+#define CALL_BACKOFF_MAX_US 16000   // Default maximum delay between retries
+
+//Events of a session
+enum NR_EVENT : uint8_t {
+    EV_MCVR,        // Control words received, in the order of their code (bits 4-6)
+    EV_MCPCH,
+    EV_MCAMA,
+    EV_MCVE,
+    EV_MCDISC,
+    EV_MCAPA,
+    EV_MCOK,        // MCOK or MCUA
+    EV_MCAPI,
+    EV_DATA,        // Consigne or message frame
+    EV_ECHO,        // Bus activity after our call
+    EV_TIMER,       // Session deadline reached
+    EV_CALL,        // Scheduler chose the station to be called back
+    EV_STREAM,      // Host side filled or freed a chunk buffer the session waits for
+    NR_EVENT_COUNT
+};
+
+typedef struct RetryPolicy {
+    uint8_t retries;            // Call backs sent again without echo, before the station is dropped
+    uint32_t echoTimeoutUs;     // Wait for the echo of a call back (us)
+    uint32_t backoffUs;         // Delay before the first retry (us), doubled on each retry
+    uint32_t maxBackoffUs;      // Maximum delay between retries (us)
+} RetryPolicy;
+
+typedef struct Session {
+    NR_STATE state;
+    uint8_t station;            // Station address
+    uint8_t consigneLen;        // Consigne length announced by the initial call
+    uint8_t msgNum;             // Message number given by MCAMA
+    uint8_t call;               // Control word of the call back (MCAPA or MCDISC)
+    uint8_t retries;            // Call backs of the transaction sent again without echo
+    bool sendMessage;           // message is sent to the station (SEND_DATA), else received
+    bool idleAfterCall;         // Bus was idle after our call, next activity is the echo
+    bool timerArmed;
+    uint32_t deadline;          // Timer (us), also the end of the backoff while WAITING
+    uint32_t requestTime;       // End of the last frame received from the station (us)
+    uint32_t serviceStart;      // End of the initial call (us)
+    uint32_t ticket;            // Last frame queued for the station
+    ConsigneView consigne;
+    uint8_t* consigneFrame;     // Frame of the consigne (pool buffer)
+    MessageStream* stream;      // Message chunks, nullptr if no message
+    uint32_t msgLen;            // Message bytes
+    uint32_t msgPos;            // Message bytes transferred
+    bool streamWait;            // Waiting for the host side : chunk to send, or free buffer
+    uint8_t* pendingFrame;      // Data frame waiting for a free buffer (pool buffer)
+    uint32_t pendingLen;
+} Session;
+
+/**
+ * Callback when a station waits after its consigne (notice of waiting)
+ * @return true if the host side decides : the station is not called back
+ *         before it gives a message or declines, or HOST_DECISION_US
+ **/
+typedef bool (*waiting_callback)(const Session& session);
+
+/**
+ * Initializes the engine, all sessions are idle
+ * A hardware alarm is claimed, its interrupt runs on the calling core
+ * @param address Device address on the bus
+ **/
+void protocol_init(uint8_t address);
+
+/**
+ * Gets the buffer receiving a frame when it is message data : the next
+ * chunk buffer of the station in GET_DATA, so the data lands in place
+ * @param head First 2 bytes of the frame (header, station)
+ * @param len Bytes following the address
+ * @return Buffer of len bytes, nullptr if the frame goes to a pool buffer
+ **/
+uint8_t* protocol_rx_buffer(const uint8_t* head, uint32_t len);
+
+/**
+ * Handles a received frame
+ * @param frame Bytes following the address (pool buffer, retained if kept,
+ *        or the buffer given by protocol_rx_buffer)
+ * @param len Number of bytes
+ * @param time Time of the closing flag (us)
+ **/
+void protocol_frame(uint8_t* frame, uint32_t len, uint32_t time);
+
+/**
+ * Fires session deadlines and echo detection, calls back the station chosen
+ * by the scheduler once the bus is free, to be called in the main loop
+ **/
+void protocol_poll();
+
+/**
+ * Gets the session of a station
+ * @return nullptr if the address is out of range
+ **/
+const Session* protocol_session(uint8_t station);
+
+/**
+ * Streams a message to a waiting station, it is called back with MCAPA
+ * Chunks are sent as the host side commits them, the stream is ended
+ * (stream_end) with the transaction
+ * @param len Message bytes
+ * @return false if the station is not waiting or already has a message
+ **/
+bool protocol_send_message(uint8_t station, MessageStream& stream, uint32_t len);
+
+/**
+ * Asks a waiting station for the message announced by its consigne, its
+ * chunks are committed to the stream as they are received
+ * @return false if the station is not waiting or already has a message
+ **/
+bool protocol_get_message(uint8_t station, MessageStream& stream);
+
+/**
+ * Host side has no message for a waiting station, it is called back with
+ * MCDISC
+ **/
+void protocol_decline_message(uint8_t station);
+
+/**
+ * Sets the function told about waiting stations, nullptr if the host
+ * side does not serve messages
+ **/
+void protocol_set_waiting_callback(waiting_callback callback);
+
+/**
+ * Sets the retry policy of call backs, from the bus engine
+ **/
+void protocol_set_retry_policy(const RetryPolicy& policy);
+
+/**
+ * Gets the retry policy of call backs
+ **/
+const RetryPolicy& protocol_retry_policy();
+
+/**
+ * Reply latency statistics of the engine
+ **/
+ReplyLatencyReport& protocol_latency();
+
+#endif
@@ -0,0 +1,69 @@
+#include "scheduler.h"
+
+#include <string.h>
+
+static uint32_t pending[WORK_COUNT];       // Bit per station for each work
+static uint8_t lastServed = NR_MAX_STATIONS - 1;
+static SchedulerStats stats;
+
+static_assert(NR_MAX_STATIONS <= 32, "Pending work is a 32 bits mask");
+
+/**
+ * Round robin : first station of the mask after the last one served
+ **/
+static int pick(uint32_t mask)
+{
+    if(mask == 0){
+        return -1;
+    }
+    uint32_t after = mask & ~((2u << lastServed) - 1);
+    return __builtin_ctz(after != 0 ? after : mask);
+}
+
+void scheduler_set(uint8_t station, sched_work work, bool set)
+{
+    if(set){
+        pending[work] |= 1u << station;
+    }else{
+        pending[work] &= ~(1u << station);
+    }
+}
+
+int scheduler_next()
+{
+    if((pending[WORK_MCAPI] | pending[WORK_CALL]) != 0){
+        return -1;
+    }
+    int station = pick(pending[WORK_MCAPA]);
+    if(station < 0){
+        station = pick(pending[WORK_MCAMA]);
+    }
+    if(station >= 0){
+        lastServed = station;
+    }
+    return station;
+}
+
+bool scheduler_waiting()
+{
+    return (pending[WORK_MCAPI] | pending[WORK_CALL]) == 0 && (pending[WORK_MCAPA] | pending[WORK_MCAMA]) != 0;
+}
+
+void scheduler_served(uint8_t station, uint32_t serviceUs)
+{
+    ++stats.calls;
+    latency_add(stats.service, serviceUs);
+    latency_add(stats.station[station], serviceUs);
+}
+
+void scheduler_init()
+{
+    memset(pending, 0, sizeof(pending));
+    memset(&stats, 0, sizeof(stats));
+    lastServed = NR_MAX_STATIONS - 1;
+}
+
+SchedulerStats& scheduler_stats()
+{
+    return stats;
+}
@@ -0,0 +1,67 @@
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+#include "pico/stdlib.h"
+#include "picoreseau.hxx"
+#include "intercore.h"
+#include "bus_timing.h"
+
+/**
+ * Master call scheduler
+ * Keeps the pending work of each station and chooses the next waiting
+ * station to call back. One exchange is on the bus at a time : an initial
+ * call (MCAPI up to MCAMA) or a call back (MCAPA/MCDISC up to the echo).
+ * Initial calls are never delayed by call backs, waiting stations are then
+ * served round robin, those with a message to exchange (MCAPA) first.
+ **/
+
+#define CALL_TURNAROUND_US (BusConfig::callTurnaroundUs)    // Bus idle before calling back a waiting station
+
+//Work of a station
+enum sched_work : uint8_t {
+    WORK_MCAPI,     // Initial exchange in progress (echo, consigne, MCPCH)
+    WORK_CALL,      // Call back in progress (waiting echo, message exchange)
+    WORK_MCAMA,     // Waiting to be called back
+    WORK_MCAPA,     // Waiting with a message to exchange
+    WORK_COUNT
+};
+
+typedef struct SchedulerStats {
+    uint32_t calls;                             // Call backs sent
+    LatencyStat service;                        // Initial call to call back, all stations
+    LatencyStat station[NR_MAX_STATIONS];       // Same, per station
+} SchedulerStats;
+
+/**
+ * Sets or clears a pending work of a station
+ **/
+void scheduler_set(uint8_t station, sched_work work, bool pending);
+
+/**
+ * Chooses the next station to call back
+ * @return Station address, -1 if an exchange is in progress or nobody waits
+ **/
+int scheduler_next();
+
+/**
+ * Gets if a station waits to be called back once the bus is free, does not
+ * choose it
+ **/
+bool scheduler_waiting();
+
+/**
+ * Accounts a call back
+ * @param serviceUs Time since the initial call of the station
+ **/
+void scheduler_served(uint8_t station, uint32_t serviceUs);
+
+/**
+ * Clears pending work and statistics
+ **/
+void scheduler_init();
+
+/**
+ * Statistics of the scheduler (bus engine)
+ **/
+SchedulerStats& scheduler_stats();
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef __SPSC_QUEUE_H__
+#define __SPSC_QUEUE_H__
+#include <stdint.h>
+#include <atomic>
+#include "pico/sync.h"
+
+/**
+ * Lock-free single producer, single consumer queue
+ * Can be shared between both cores, or between an interrupt and the
+ * thread code. Only loads and stores are atomic (no read-modify-write,
+ * not available on Cortex-M0+), the producer owns head and the consumer
+ * owns tail
+ * Publishing or freeing an item sends an event (SEV) : a core sleeping in
+ * WFE on the other end wakes up
+ * @param T Item type
+ * @param N Number of items (power of 2)
+ **/
+template<typename T, uint32_t N>
+class SpscQueue {
+    static_assert((N & (N - 1)) == 0, "Queue size must be a power of 2");
+public:
+    /**
+     * Adds an item (producer side)
+     * @return false if the queue is full
+     **/
+    bool push(const T& item)
+    {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        if(head - tail_.load(std::memory_order_acquire) >= N){
+            return false;
+        }
+        items_[head & (N - 1)] = item;
+        head_.store(head + 1, std::memory_order_release);
+        __sev();
+        return true;
+    }
+
+    /**
+     * Gets a slot to fill in place (producer side), commit it with commit()
+     * @return nullptr if the queue is full
+     **/
+    T* reserve()
+    {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        if(head - tail_.load(std::memory_order_acquire) >= N){
+            return nullptr;
+        }
+        return &items_[head & (N - 1)];
+    }
+
+    /**
+     * Publishes the slot given by reserve() (producer side)
+     **/
+    void commit()
+    {
+        head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        __sev();
+    }
+
+    /**
+     * Removes the oldest item (consumer side)
+     * @return false if the queue is empty
+     **/
+    bool pop(T& item)
+    {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        if(tail == head_.load(std::memory_order_acquire)){
+            return false;
+        }
+        item = items_[tail & (N - 1)];
+        tail_.store(tail + 1, std::memory_order_release);
+        __sev();
+        return true;
+    }
+
+    /**
+     * Gets the oldest item in place (consumer side), remove it with release()
+     * @return nullptr if the queue is empty
+     **/
+    T* front()
+    {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        if(tail == head_.load(std::memory_order_acquire)){
+            return nullptr;
+        }
+        return &items_[tail & (N - 1)];
+    }
+
+    /**
+     * Removes the item given by front() (consumer side)
+     **/
+    void release()
+    {
+        tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        __sev();
+    }
+
+    /**
+     * Gets if the queue is empty (consumer side)
+     **/
+    bool empty() const
+    {
+        return tail_.load(std::memory_order_relaxed) == head_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Gets the number of queued items (approximate from the other side)
+     **/
+    uint32_t size() const
+    {
+        return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+    }
+
+private:
+    std::atomic<uint32_t> head_{0};     // Number of pushed items
+    std::atomic<uint32_t> tail_{0};     // Number of popped items
+    T items_[N];
+};
+
+#endif
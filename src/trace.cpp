@@ -0,0 +1,48 @@
+#include "trace.h"
+
+#ifdef USE_TRACE
+#include <stdio.h>
+
+SpscQueue<TraceEvent, TRACE_RING_LEN> traceRings[2];
+volatile uint32_t traceDropped = 0;
+
+bool trace_drain(uint32_t maxLines)
+{
+    static uint32_t reportedDrops = 0;
+    bool printed = false;
+    for(uint32_t line = 0; line < maxLines; ++line){
+        char text[4 + TRACE_LINE_EVENTS * 16 + 2];
+        uint32_t len = 0;
+        uint32_t n = 0;
+        TraceEvent e;
+        text[len++] = '@';
+        text[len++] = 'T';
+        text[len++] = ' ';
+        //Both rings are emptied alternately, the decoder sorts by time
+        for(uint32_t core = 0; n < TRACE_LINE_EVENTS; core ^= 1){
+            if(!traceRings[core].pop(e)){
+                if(!traceRings[core ^ 1].pop(e)){
+                    break;
+                }
+            }
+            const uint8_t* b = (const uint8_t*)&e;
+            for(uint32_t i = 0; i < sizeof(e); ++i){
+                len += sprintf(&text[len], "%02x", b[i]);
+            }
+            ++n;
+        }
+        if(n == 0){
+            break;
+        }
+        text[len++] = '\n';
+        fwrite(text, 1, len, stdout);
+        printed = true;
+    }
+    uint32_t dropped = traceDropped;
+    if(dropped != reportedDrops){
+        printf("@D %lu\n", (unsigned long)dropped);
+        reportedDrops = dropped;
+    }
+    return printed;
+}
+#endif
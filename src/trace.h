@@ -0,0 +1,91 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+#include "pico/stdlib.h"
+
+//#define USE_TRACE                     // Records hot path events, drained by core 0 over USB (-DPICORESEAU_TRACE=ON)
+
+#define TRACE_RING_LEN 1024             // Events kept per core (power of 2)
+#define TRACE_LINE_EVENTS 8             // Events per output line
+
+/**
+ * Hot path tracing
+ * Events are written in a RAM ring per core (interrupts disabled during the
+ * write, a few cycles) and printed lazily by core 0 as lines
+ *   @T <16 hex digits per event>
+ * decoded on the host by trace_decode. Without USE_TRACE the TRACE macro
+ * compiles to nothing.
+ **/
+
+enum trace_id : uint8_t {
+    TR_ISR_ENTER,       // Payload : trace_isr
+    TR_ISR_EXIT,        // Payload : trace_isr
+    TR_RX_FRAME,        // Closing flag of a received frame, payload : length
+    TR_CRC,             // Payload : bit 0 CRC valid, bit 1 checked by the sniffer
+    TR_TX_START,        // Emitter starts a frame, payload : length
+    TR_TX_END,          // Closing flag sent
+    TR_TX_QUEUE,        // Frame queued to send, payload : frames in the queue
+    TR_TX_COLLISION,    // Frame aborted on a collision, payload : collisions of the frame
+    TR_STATE,           // Payload : station << 8 | new NR_STATE
+    TR_COUNT
+};
+
+enum trace_isr : uint8_t {
+    TR_PIO0_ISR,        // RX flags and aborts
+    TR_RX_DMA_ISR,
+    TR_PIO1_ISR,        // TX flag sent and collisions
+    TR_TX_DMA_ISR,
+    TR_BUS_IDLE_ISR,
+    TR_ISR_COUNT
+};
+
+/**
+ * Recorded event, 8 bytes, printed little endian
+ **/
+typedef struct TraceEvent {
+    uint32_t time;      // us
+    uint8_t id;         // trace_id
+    uint8_t core;
+    uint16_t payload;
+} TraceEvent;
+
+static_assert(sizeof(TraceEvent) == 8, "Events are printed as 8 bytes");
+
+#ifdef USE_TRACE
+#include "spsc_queue.h"
+#include "pico/sync.h"
+
+extern SpscQueue<TraceEvent, TRACE_RING_LEN> traceRings[2];
+extern volatile uint32_t traceDropped;      // Events lost because a ring was full
+
+/**
+ * Records an event, from thread or interrupt on any core
+ **/
+static inline void trace_record(trace_id id, uint16_t payload)
+{
+    uint32_t irqs = save_and_disable_interrupts();
+    uint core = get_core_num();
+    TraceEvent* e = traceRings[core].reserve();
+    if(e != nullptr){
+        e->time = time_us_32();
+        e->id = id;
+        e->core = core;
+        e->payload = payload;
+        traceRings[core].commit();
+    }else{
+        traceDropped = traceDropped + 1;
+    }
+    restore_interrupts(irqs);
+}
+
+/**
+ * Prints recorded events (core 0), at most maxLines lines
+ * @return true if events were printed
+ **/
+bool trace_drain(uint32_t maxLines);
+
+#define TRACE(id, payload) trace_record(id, payload)
+#else
+#define TRACE(id, payload) do{}while(0)
+#endif
+
+#endif
@@ -0,0 +1,12 @@
+#include "transceiver.h"
+#include "clock_detect.h"
+#include "hdlc_tx.h"
+#include "hdlc_rx.h"
+
+void configureTransceiver(uint segment, const TransceiverPins& pins)
+{
+    //Bus activity first, the emitter waits for the bus to be idle
+    initialize_clock_detect(get_bus_activity(segment), segment, pins.dataRx + 1);
+    configureEmitter(getEmitter(segment), segment, pins.txEnable, pins.clkTx, pins.dataTx, pins.dataRx);
+    configureReceiver(getReceiver(segment), segment, pins.rxEnable, pins.dataRx);
+}
@@ -0,0 +1,65 @@
+#ifndef __TRANSCEIVER_H__
+#define __TRANSCEIVER_H__
+#include "pico/stdlib.h"
+
+/**
+ * Bus segments driven by one chip
+ * Each segment has its own transceiver : bus activity, emitter and receiver
+ * instances with their state machines, DMA channels and ring buffer. The
+ * state machines of a segment are fixed by its number, programs are loaded
+ * once per PIO block and use relative IRQ numbers so that all instances
+ * share them :
+ *   pio0 : hdlc_rx (26 instructions) on SM 2n, IRQ flags 2n (abort) and 2n+1 (flag)
+ *          bus_idle (6 instructions) on SM 2n+1, notifies through its RX FIFO
+ *   pio1 : clock_tx (3 instructions) on SM 2n, IRQ 4 + 2n+1 (clock falling edge)
+ *          hdlc_tx (29 instructions) on SM 2n+1, IRQ flags 2n+1 (flag sent) and 2n (collision)
+ * Two segments use all state machines of both blocks and the whole
+ * instruction memory of both, the IRQ flags seen by the system are all taken : a
+ * third segment doesn't fit.
+ * Interrupt handlers are shared by the segments, each one serves all the
+ * configured instances of its source (PIO0_IRQ_0 : frame boundaries,
+ * PIO0_IRQ_1 : bus activity, PIO1_IRQ_0 : flag sent and collision,
+ * DMA_IRQ_1 : DMA, a timer alarm for the back-off of each emitter).
+ **/
+
+#ifndef NR_SEGMENTS
+#define NR_SEGMENTS 1               // Bus segments (CMake option PICORESEAU_SEGMENTS), each one has a 32KB RX ring
+#endif
+#define NR_MAX_SEGMENTS 2           // State machines and pio0 instruction memory are full with 2 segments
+
+static_assert(NR_SEGMENTS >= 1 && NR_SEGMENTS <= NR_MAX_SEGMENTS, "One RP2040 drives 1 or 2 bus segments");
+
+#define SEGMENT_RX_SM(n) (2 * (n))          // hdlc_rx state machine of a segment (pio0)
+#define SEGMENT_IDLE_SM(n) (2 * (n) + 1)    // bus_idle state machine of a segment (pio0)
+#define SEGMENT_CLOCK_SM(n) (2 * (n))       // clock_tx state machine of a segment (pio1)
+#define SEGMENT_TX_SM(n) (2 * (n) + 1)      // hdlc_tx state machine of a segment (pio1), next to its clock
+
+/**
+ * Gets the PIO IRQ flag raised by an "irq <index> rel" instruction
+ * @param index IRQ index of the instruction
+ * @param sm State machine running it
+ **/
+static inline uint pio_relative_irq(uint index, uint sm)
+{
+    return (index & 4) | ((index + sm) & 3);
+}
+
+/**
+ * GPIOs of a segment transceiver
+ **/
+typedef struct TransceiverPins {
+    uint dataRx;        // Received data, the received clock is the next pin
+    uint rxEnable;      // Receiver transceiver enable (active low)
+    uint dataTx;
+    uint clkTx;
+    uint txEnable;      // Emitter transceiver enable, also starts the clock
+} TransceiverPins;
+
+/**
+ * Configures the transceiver of a segment : bus activity, emitter and receiver
+ * The receiver is left disabled, without address (0)
+ * @param segment Segment number, less than NR_SEGMENTS
+ **/
+void configureTransceiver(uint segment, const TransceiverPins& pins);
+
+#endif
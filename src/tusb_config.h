@@ -0,0 +1,31 @@
+#ifndef __TUSB_CONFIG_H__
+#define __TUSB_CONFIG_H__
+
+/**
+ * TinyUSB configuration : CDC for the stdio console and the vendor
+ * interface of the bus bridge (usb_bridge.h)
+ **/
+
+#ifndef CFG_TUSB_MCU
+#define CFG_TUSB_MCU OPT_MCU_RP2040
+#endif
+#define CFG_TUSB_RHPORT0_MODE (OPT_MODE_DEVICE | OPT_MODE_FULL_SPEED)
+#define CFG_TUSB_OS OPT_OS_PICO
+
+#define CFG_TUD_ENDPOINT0_SIZE 64
+
+#define CFG_TUD_CDC 1                   // stdio console
+#define CFG_TUD_VENDOR 1                // Bus bridge
+#define CFG_TUD_MSC 0
+#define CFG_TUD_HID 0
+#define CFG_TUD_MIDI 0
+
+#define CFG_TUD_CDC_RX_BUFSIZE 256
+#define CFG_TUD_CDC_TX_BUFSIZE 256
+
+//Vendor FIFOs hold one batch each way, core 0 moves whole batches
+#define CFG_TUD_VENDOR_EPSIZE 64
+#define CFG_TUD_VENDOR_RX_BUFSIZE 4096
+#define CFG_TUD_VENDOR_TX_BUFSIZE 4096
+
+#endif
@@ -0,0 +1,354 @@
+#include "usb_bridge.h"
+#include "hdlc_tx.h"
+#include "frame_pool.h"
+#include "spsc_queue.h"
+#include "tusb.h"
+
+#include <stddef.h>
+#include <string.h>
+
+static_assert(USB_BRIDGE_MAX_FRAME <= POOL_LARGE_SIZE, "Frames of the host are sent from a pool buffer");
+
+typedef struct BridgeBatch {
+    uint32_t len;
+    uint8_t data[USB_BRIDGE_BATCH_SIZE];
+} BridgeBatch;
+
+//Frame sent for the host, completed in order
+typedef struct BridgeCompletion {
+    uint32_t ticket;                    // Emitter ticket, 0 if rejected
+    uint16_t tag;
+    uint8_t status;
+} BridgeCompletion;
+
+static SpscQueue<BridgeBatch, BRIDGE_IN_BATCHES> toHost;
+static SpscQueue<BridgeBatch, BRIDGE_OUT_BATCHES> fromHost;
+static volatile BridgeStats stats;
+
+//Core 1
+static bool opened = false;
+static bool batching = true;
+static BridgeBatch* inBatch = nullptr;      // Batch being filled, nullptr if none is free
+static uint16_t inCount = 0;                // Records of the current batch
+static uint32_t inStart = 0;                // Time of the first record of the current batch (us)
+static uint16_t inDropped = 0;              // Frames lost since the previous batch
+static uint32_t outOffset = 0;              // Next record of the front host batch, 0 before its header
+static BridgeCompletion completions[BRIDGE_CREDITS];
+static uint32_t completionHead = 0;
+static uint32_t completionTail = 0;
+
+//Core 0
+static BridgeBatch* usbOut = nullptr;       // Batch being read from USB
+static uint32_t usbInOffset = 0;            // Bytes of the front batch written to USB
+static bool usbMounted = false;
+
+/**
+ * Gives the current batch to core 0
+ **/
+static void sendBatch()
+{
+    if(inBatch == nullptr || inCount == 0){
+        return;
+    }
+    UsbBatchHeader h = {USB_BRIDGE_MAGIC, (uint16_t)inBatch->len, inCount, inDropped};
+    memcpy(inBatch->data, &h, sizeof(h));
+    toHost.commit();
+    inBatch = nullptr;
+    inDropped = 0;
+    stats.inBatches = stats.inBatches + 1;
+}
+
+/**
+ * Adds a record to the current batch
+ * @return Payload to fill, nullptr if no batch is free
+ **/
+static uint8_t* addRecord(uint8_t type, uint8_t flags, uint32_t len)
+{
+    uint32_t size = sizeof(UsbRecordHeader) + len;
+    if(inBatch != nullptr && inBatch->len + size > USB_BRIDGE_BATCH_SIZE){
+        sendBatch();
+    }
+    if(inBatch == nullptr){
+        inBatch = toHost.reserve();
+        if(inBatch == nullptr){
+            return nullptr;
+        }
+        inBatch->len = sizeof(UsbBatchHeader);
+        inCount = 0;
+        inStart = time_us_32();
+    }
+    UsbRecordHeader r = {type, flags, (uint16_t)len};
+    uint8_t* record = &inBatch->data[inBatch->len];
+    memcpy(record, &r, sizeof(r));
+    inBatch->len += size;
+    ++inCount;
+    return record + sizeof(r);
+}
+
+/**
+ * Ends the current batch if it must not wait for more records
+ **/
+static void flushBatch()
+{
+    if(inBatch != nullptr && inCount != 0 && (!batching || (time_us_32() - inStart) >= BRIDGE_FLUSH_US)){
+        sendBatch();
+    }
+}
+
+/**
+ * Reports the frames sent, in order
+ **/
+static void completeFrames()
+{
+    while(completionTail != completionHead){
+        const BridgeCompletion& c = completions[completionTail & (BRIDGE_CREDITS - 1)];
+        if(c.ticket != 0 && !isFrameDone(c.ticket)){
+            break;
+        }
+        uint8_t* payload = addRecord(USB_SENT, 0, sizeof(UsbSent));
+        if(payload == nullptr){
+            return;
+        }
+        UsbSent s = {c.tag, c.status, 0};
+        if(c.ticket != 0 && !isFrameSent(c.ticket)){
+            s.status = USB_SENT_DROPPED;
+        }
+        memcpy(payload, &s, sizeof(s));
+        ++completionTail;
+    }
+}
+
+/**
+ * Queues a frame of the host on the bus
+ * @return false if it must be retried (TX queue or pool full)
+ **/
+static bool sendRecord(const uint8_t* payload, uint32_t len)
+{
+    if(completionHead - completionTail >= BRIDGE_CREDITS){
+        //Host went over its credits
+        return false;
+    }
+    BridgeCompletion& c = completions[completionHead & (BRIDGE_CREDITS - 1)];
+    UsbSend send = {0};
+    memcpy(&send, payload, len < sizeof(send) ? len : sizeof(send));
+    c.tag = send.tag;
+    c.ticket = 0;
+    c.status = USB_SENT_REJECTED;
+    uint32_t frameLen = len > sizeof(send) ? len - sizeof(send) : 0;
+    if(opened && frameLen != 0 && frameLen <= USB_BRIDGE_MAX_FRAME){
+        uint8_t* buffer = pool_alloc(frameLen);
+        if(buffer == nullptr){
+            return false;
+        }
+        memcpy(buffer, &payload[sizeof(send)], frameLen);
+        uint32_t ticket = sendFrame(buffer, frameLen, pool_tx_done);
+        if(ticket == 0){
+            pool_release(buffer);
+            return false;
+        }
+        c.ticket = ticket;
+        c.status = USB_SENT_OK;
+        stats.txFrames = stats.txFrames + 1;
+    }else{
+        stats.txRejected = stats.txRejected + 1;
+    }
+    ++completionHead;
+    return true;
+}
+
+/**
+ * Starts a session, a host opening again drops the previous one
+ **/
+static void openBridge(uint8_t flags)
+{
+    opened = true;
+    batching = (flags & USB_OPEN_NO_BATCH) == 0;
+    //Frames still queued are sent, but not reported to the new session
+    completionTail = completionHead;
+    UsbHello hello = {USB_BRIDGE_VERSION, BRIDGE_CREDITS, USB_BRIDGE_MAX_FRAME, USB_BRIDGE_BATCH_SIZE};
+    uint8_t* p = addRecord(USB_HELLO, 0, sizeof(hello));
+    if(p != nullptr){
+        memcpy(p, &hello, sizeof(hello));
+    }
+    sendBatch();
+}
+
+bridge_event bridge_poll()
+{
+    completeFrames();
+    bridge_event event = BRIDGE_NONE;
+    BridgeBatch* b;
+    while(event == BRIDGE_NONE && (b = fromHost.front()) != nullptr){
+        if(outOffset == 0){
+            outOffset = sizeof(UsbBatchHeader);
+        }
+        if(outOffset + sizeof(UsbRecordHeader) > b->len){
+            fromHost.release();
+            outOffset = 0;
+            continue;
+        }
+        UsbRecordHeader r;
+        memcpy(&r, &b->data[outOffset], sizeof(r));
+        const uint8_t* payload = &b->data[outOffset + sizeof(r)];
+        uint32_t end = outOffset + sizeof(r) + r.length;
+        if(end > b->len){
+            stats.badRecords = stats.badRecords + 1;
+            end = b->len;
+        }else if(r.type == USB_SEND){
+            if(!sendRecord(payload, r.length)){
+                break;
+            }
+        }else if(r.type == USB_OPEN){
+            openBridge(r.flags);
+            event = BRIDGE_OPENED;
+        }else if(r.type == USB_CLOSE && opened){
+            opened = false;
+            event = BRIDGE_CLOSED;
+        }
+        outOffset = end;
+    }
+    completeFrames();
+    if(event == BRIDGE_CLOSED){
+        sendBatch();
+    }else{
+        flushBatch();
+    }
+    return event;
+}
+
+bool bridge_flush_time(uint32_t& time)
+{
+    time = inStart + BRIDGE_FLUSH_US;
+    return inBatch != nullptr && inCount != 0;
+}
+
+void bridge_frame(const RxFrame& frame)
+{
+    uint32_t len = frame.length + 1;
+    uint8_t flags = 0;
+    switch(frame.status){
+    case done:
+        flags = USB_RX_CRC_OK;
+        break;
+    case bad_crc:
+        break;
+    case frame_aborted:
+        flags = USB_RX_ABORTED;
+        break;
+    default:
+        flags = USB_RX_SHORT;
+        break;
+    }
+    if(len > USB_BRIDGE_MAX_FRAME){
+        len = USB_BRIDGE_MAX_FRAME;
+        flags |= USB_RX_TRUNCATED;
+    }
+    uint8_t* payload = addRecord(USB_RECEIVED, flags, sizeof(UsbReceived) + len);
+    if(payload == nullptr){
+        if(inDropped != UINT16_MAX){
+            ++inDropped;
+        }
+        stats.rxDropped = stats.rxDropped + 1;
+        return;
+    }
+    UsbReceived r = {frame.time};
+    memcpy(payload, &r, sizeof(r));
+    //Address and data, the CRC is not given
+    if(copyRawFrame(frame, &payload[sizeof(r)], len) == 0){
+        uint8_t* record = payload - sizeof(UsbRecordHeader);
+        record[offsetof(UsbRecordHeader, flags)] |= USB_RX_OVERRUN;
+    }
+    stats.rxFrames = stats.rxFrames + 1;
+    flushBatch();
+}
+
+/**
+ * Host gone : core 1 gets a USB_CLOSE as if the host had sent it
+ **/
+static void usbDisconnected()
+{
+    BridgeBatch* b = fromHost.reserve();
+    if(b == nullptr){
+        return;
+    }
+    UsbRecordHeader r = {USB_CLOSE, 0, 0};
+    b->len = sizeof(UsbBatchHeader) + sizeof(r);
+    UsbBatchHeader h = {USB_BRIDGE_MAGIC, (uint16_t)b->len, 1, 0};
+    memcpy(b->data, &h, sizeof(h));
+    memcpy(&b->data[sizeof(h)], &r, sizeof(r));
+    fromHost.commit();
+    usbOut = nullptr;
+}
+
+bool bridge_usb_task()
+{
+    bool active = false;
+    bool mounted = tud_vendor_mounted();
+    if(mounted != usbMounted){
+        usbMounted = mounted;
+        if(!mounted){
+            usbDisconnected();
+        }
+    }
+    //Host to device, a batch is only read once there is room for it
+    while(mounted && tud_vendor_available() != 0){
+        if(usbOut == nullptr){
+            usbOut = fromHost.reserve();
+            if(usbOut == nullptr){
+                break;
+            }
+            usbOut->len = 0;
+        }
+        uint32_t want = sizeof(UsbBatchHeader);
+        UsbBatchHeader h;
+        if(usbOut->len >= sizeof(h)){
+            memcpy(&h, usbOut->data, sizeof(h));
+            want = h.length;
+        }
+        usbOut->len += tud_vendor_read(&usbOut->data[usbOut->len], want - usbOut->len);
+        active = true;
+        if(usbOut->len == sizeof(h) && want == sizeof(h)){
+            memcpy(&h, usbOut->data, sizeof(h));
+            if(h.magic != USB_BRIDGE_MAGIC || h.length < sizeof(h) || h.length > USB_BRIDGE_BATCH_SIZE){
+                //Resynchronizes on the next byte
+                memmove(usbOut->data, &usbOut->data[1], sizeof(h) - 1);
+                usbOut->len = sizeof(h) - 1;
+                stats.badRecords = stats.badRecords + 1;
+                continue;
+            }
+            want = h.length;
+        }
+        if(usbOut->len == want){
+            fromHost.commit();
+            usbOut = nullptr;
+            stats.outBatches = stats.outBatches + 1;
+        }
+    }
+    //Device to host, dropped while no host is there
+    BridgeBatch* b;
+    while((b = toHost.front()) != nullptr){
+        if(mounted){
+            uint32_t n = tud_vendor_write_available();
+            if(n == 0){
+                break;
+            }
+            if(n > b->len - usbInOffset){
+                n = b->len - usbInOffset;
+            }
+            usbInOffset += tud_vendor_write(&b->data[usbInOffset], n);
+            if(usbInOffset < b->len){
+                continue;
+            }
+            tud_vendor_write_flush();
+        }
+        toHost.release();
+        usbInOffset = 0;
+        active = true;
+    }
+    return active;
+}
+
+const volatile BridgeStats& bridge_stats()
+{
+    return stats;
+}
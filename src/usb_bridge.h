@@ -0,0 +1,71 @@
+#ifndef __USB_BRIDGE_H__
+#define __USB_BRIDGE_H__
+#include "pico/stdlib.h"
+#include "hdlc_rx.h"
+#include "usb_protocol.h"
+
+/**
+ * Bus access from a host program over the USB vendor interface
+ * (protocol in usb_protocol.h)
+ * Core 0 only moves whole batches between the TinyUSB vendor FIFOs and
+ * two queues of batches. Core 1 parses the host batches (frames to send)
+ * and writes received frames and completions as records in its own
+ * batches, sent when full or once their first record is BRIDGE_FLUSH_US
+ * old. While the host holds the bus (USB_OPEN), the protocol engine is
+ * stopped and the receiver is promiscuous.
+ **/
+
+#define BRIDGE_IN_BATCHES 4             // Device to host batches (power of 2)
+#define BRIDGE_OUT_BATCHES 2            // Host to device batches (power of 2)
+#define BRIDGE_CREDITS 16               // Frames the host may have in flight (power of 2)
+#define BRIDGE_FLUSH_US 1000            // A partial batch is sent after this delay (one USB frame)
+
+enum bridge_event {
+    BRIDGE_NONE,
+    BRIDGE_OPENED,                      // The host takes the bus
+    BRIDGE_CLOSED,                      // The host gives the bus back (or was disconnected)
+};
+
+typedef struct BridgeStats {
+    uint32_t rxFrames;                  // Frames given to the host
+    uint32_t rxDropped;                 // Frames lost, no free batch
+    uint32_t txFrames;                  // Frames queued on the bus
+    uint32_t txRejected;                // Frames refused (empty, too long or bridge closed)
+    uint32_t inBatches;                 // Batches given to core 0
+    uint32_t outBatches;                // Batches received from the host
+    uint32_t badRecords;                // Malformed batches or records skipped
+} BridgeStats;
+
+/**
+ * Handles the host batches and the frames sent, sends the current batch
+ * when it is old enough (core 1)
+ * Parsing stops after a USB_OPEN or USB_CLOSE, so the bus engine switches
+ * before the next frames are sent
+ * @return Mode change requested by the host
+ **/
+bridge_event bridge_poll();
+
+/**
+ * Gets when bridge_poll sends the current batch (core 1)
+ * @param time Time of the flush (us)
+ * @return false if no record waits
+ **/
+bool bridge_flush_time(uint32_t& time);
+
+/**
+ * Writes a received frame for the host (core 1)
+ **/
+void bridge_frame(const RxFrame& frame);
+
+/**
+ * Moves batches between the USB vendor interface and core 1 (core 0)
+ * @return true if data was moved
+ **/
+bool bridge_usb_task();
+
+/**
+ * Statistics of the bridge (written by both cores)
+ **/
+const volatile BridgeStats& bridge_stats();
+
+#endif
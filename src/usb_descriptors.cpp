@@ -0,0 +1,105 @@
+/**
+ * USB descriptors : CDC console (stdio_usb) and the vendor interface of
+ * the bus bridge, replacing the stdio_usb ones
+ **/
+#include "tusb.h"
+#include "pico/unique_id.h"
+#include "usb_protocol.h"
+
+#include <string.h>
+
+#define USB_EP_CDC_NOTIF 0x81
+#define USB_EP_CDC_OUT 0x02
+#define USB_EP_CDC_IN 0x82
+
+enum {
+    ITF_CDC = 0,
+    ITF_CDC_DATA,
+    ITF_VENDOR,
+    ITF_COUNT
+};
+
+static_assert(ITF_VENDOR == USB_BRIDGE_INTERFACE, "Vendor interface number is part of the protocol");
+
+enum {
+    STR_LANGID = 0,
+    STR_MANUFACTURER,
+    STR_PRODUCT,
+    STR_SERIAL,
+    STR_CDC,
+    STR_VENDOR,
+};
+
+static const tusb_desc_device_t deviceDescriptor = {
+    .bLength = sizeof(tusb_desc_device_t),
+    .bDescriptorType = TUSB_DESC_DEVICE,
+    .bcdUSB = 0x0200,
+    //Interface association, the CDC functions are grouped
+    .bDeviceClass = TUSB_CLASS_MISC,
+    .bDeviceSubClass = MISC_SUBCLASS_COMMON,
+    .bDeviceProtocol = MISC_PROTOCOL_IAD,
+    .bMaxPacketSize0 = CFG_TUD_ENDPOINT0_SIZE,
+    .idVendor = USB_BRIDGE_VID,
+    .idProduct = USB_BRIDGE_PID,
+    .bcdDevice = 0x0100,
+    .iManufacturer = STR_MANUFACTURER,
+    .iProduct = STR_PRODUCT,
+    .iSerialNumber = STR_SERIAL,
+    .bNumConfigurations = 1,
+};
+
+#define CONFIG_TOTAL_LEN (TUD_CONFIG_DESC_LEN + TUD_CDC_DESC_LEN + TUD_VENDOR_DESC_LEN)
+
+static const uint8_t configurationDescriptor[] = {
+    TUD_CONFIG_DESCRIPTOR(1, ITF_COUNT, 0, CONFIG_TOTAL_LEN, 0, 250),
+    TUD_CDC_DESCRIPTOR(ITF_CDC, STR_CDC, USB_EP_CDC_NOTIF, 8, USB_EP_CDC_OUT, USB_EP_CDC_IN, 64),
+    TUD_VENDOR_DESCRIPTOR(ITF_VENDOR, STR_VENDOR, USB_BRIDGE_EP_OUT, USB_BRIDGE_EP_IN, USB_BRIDGE_EP_SIZE),
+};
+
+static const char* const strings[] = {
+    nullptr,
+    "picoreseau",
+    "picoreseau nanoreseau adapter",
+    nullptr,                            // Board unique id
+    "picoreseau console",
+    "picoreseau bus bridge",
+};
+
+uint8_t const* tud_descriptor_device_cb(void)
+{
+    return (uint8_t const*)&deviceDescriptor;
+}
+
+uint8_t const* tud_descriptor_configuration_cb(uint8_t index)
+{
+    return configurationDescriptor;
+}
+
+uint16_t const* tud_descriptor_string_cb(uint8_t index, uint16_t langid)
+{
+    static uint16_t desc[32];
+    char serial[2 * PICO_UNIQUE_BOARD_ID_SIZE_BYTES + 1];
+    uint len = 0;
+    if(index == STR_LANGID){
+        desc[1] = 0x0409;
+        len = 1;
+    }else{
+        if(index >= sizeof(strings) / sizeof(strings[0])){
+            return nullptr;
+        }
+        const char* s = strings[index];
+        if(index == STR_SERIAL){
+            pico_get_unique_board_id_string(serial, sizeof(serial));
+            s = serial;
+        }
+        len = strlen(s);
+        if(len > 31){
+            len = 31;
+        }
+        for(uint i = 0; i < len; ++i){
+            desc[1 + i] = s[i];
+        }
+    }
+    desc[0] = (TUSB_DESC_STRING << 8) | (2 * len + 2);
+    return desc;
+}
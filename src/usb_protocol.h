@@ -0,0 +1,100 @@
+#ifndef __USB_PROTOCOL_H__
+#define __USB_PROTOCOL_H__
+#include <stdint.h>
+
+/**
+ * Binary protocol of the USB vendor interface, shared by the firmware and
+ * the host library (no Pico SDK dependency)
+ * Each bulk transfer is a batch : a UsbBatchHeader followed by records, a
+ * UsbRecordHeader each followed by its payload. Batches carry their length
+ * so they can be cut back from a byte stream (pipe or pty transports).
+ * All fields are little endian, records are not aligned.
+ *
+ * Flow control : the host may have at most `credits` (given by USB_HELLO)
+ * USB_SEND records not yet completed, each USB_SENT record gives one credit
+ * back. The device only reads a batch when it has room for it, the bulk OUT
+ * endpoint NAKs meanwhile. Received frames the host does not read fast
+ * enough are dropped and counted in the `dropped` field of the next batch.
+ **/
+
+#define USB_BRIDGE_VID 0x1209           // pid.codes
+#define USB_BRIDGE_PID 0x0001           // pid.codes test PID, private use only
+#define USB_BRIDGE_INTERFACE 2          // Vendor interface, after the 2 stdio CDC interfaces
+#define USB_BRIDGE_EP_OUT 0x03
+#define USB_BRIDGE_EP_IN 0x83
+#define USB_BRIDGE_EP_SIZE 64           // Full speed bulk packet
+
+#define USB_BRIDGE_MAGIC 0x4252         // "RB"
+#define USB_BRIDGE_VERSION 1
+#define USB_BRIDGE_BATCH_SIZE 4096      // Maximum bytes of a batch, header included
+#define USB_BRIDGE_MAX_FRAME 1028       // Maximum frame bytes in a record (address and data), a data frame
+
+typedef struct __attribute__((packed)) UsbBatchHeader {
+    uint16_t magic;                     // USB_BRIDGE_MAGIC
+    uint16_t length;                    // Bytes of the batch, header included
+    uint16_t count;                     // Number of records
+    uint16_t dropped;                   // Device : received frames lost since the previous batch
+} UsbBatchHeader;
+
+typedef struct __attribute__((packed)) UsbRecordHeader {
+    uint8_t type;                       // usb_record_type
+    uint8_t flags;                      // Depends on the type
+    uint16_t length;                    // Bytes of the payload
+} UsbRecordHeader;
+
+enum usb_record_type : uint8_t {
+    USB_OPEN = 1,           // Host -> device : takes the bus (UsbOpen), the protocol engine stops
+    USB_CLOSE = 2,          // Host -> device : gives the bus back to the protocol engine
+    USB_SEND = 3,           // Host -> device : frame to send (UsbSend then address and data)
+    USB_HELLO = 0x81,       // Device -> host : answer to USB_OPEN (UsbHello)
+    USB_RECEIVED = 0x82,    // Device -> host : frame seen on the bus (UsbReceived then address and data)
+    USB_SENT = 0x83,        // Device -> host : completion of a USB_SEND (UsbSent), gives a credit back
+};
+
+//Flags of USB_OPEN
+enum usb_open_flags : uint8_t {
+    USB_OPEN_NO_BATCH = 0x01,           // One record per transfer (latency tests)
+};
+
+//Flags of USB_RECEIVED, as the capture ones
+enum usb_received_flags : uint8_t {
+    USB_RX_CRC_OK = 0x01,               // CRC of the frame is valid
+    USB_RX_ABORTED = 0x02,              // Frame ended by an HDLC abort
+    USB_RX_SHORT = 0x04,                // Frame shorter than address and CRC
+    USB_RX_OVERRUN = 0x08,              // Frame overwritten in the RX ring, no data
+    USB_RX_TRUNCATED = 0x10,            // Longer than USB_BRIDGE_MAX_FRAME, end is missing
+};
+
+//Status of USB_SENT
+enum usb_sent_status : uint8_t {
+    USB_SENT_OK = 0,                    // Frame was sent on the bus
+    USB_SENT_REJECTED = 1,              // Empty or longer than USB_BRIDGE_MAX_FRAME
+    USB_SENT_DROPPED = 2,               // Dropped after TX_MAX_ATTEMPTS collisions
+};
+
+typedef struct __attribute__((packed)) UsbOpen {
+    uint16_t version;                   // USB_BRIDGE_VERSION
+} UsbOpen;
+
+typedef struct __attribute__((packed)) UsbHello {
+    uint16_t version;
+    uint16_t credits;                   // USB_SEND records the host may have in flight
+    uint16_t maxFrame;                  // USB_BRIDGE_MAX_FRAME
+    uint16_t batchSize;                 // USB_BRIDGE_BATCH_SIZE
+} UsbHello;
+
+typedef struct __attribute__((packed)) UsbSend {
+    uint16_t tag;                       // Given back by USB_SENT
+} UsbSend;
+
+typedef struct __attribute__((packed)) UsbReceived {
+    uint32_t time;                      // Closing flag (us, device clock)
+} UsbReceived;
+
+typedef struct __attribute__((packed)) UsbSent {
+    uint16_t tag;
+    uint8_t status;                     // usb_sent_status
+    uint8_t reserved;
+} UsbSent;
+
+#endif
@@ -0,0 +1,103 @@
+#include "wake.h"
+#include "hardware/timer.h"
+#include "pico/sync.h"
+
+#include <string.h>
+
+static volatile uint32_t pending = 0;       // Events posted since the last service
+static uint32_t postTime[WAKE_EVENTS];      // First post of each pending event (us)
+static int wakeAlarm = -1;
+static bool polling = false;
+static volatile bool asleep = false;        // Slept, until the next service
+static volatile uint32_t sleepStart = 0;    // Start of the sleep (us)
+static WakeStats stats;
+
+/**
+ * Alarm interrupt, the loop deadline is reached
+ **/
+static void __time_critical_func(wake_alarm_isr)(uint alarm)
+{
+    wake_post(WAKE_TIMER);
+}
+
+void wake_init()
+{
+    if(wakeAlarm < 0){
+        wakeAlarm = hardware_alarm_claim_unused(true);
+        hardware_alarm_set_callback(wakeAlarm, wake_alarm_isr);
+    }
+    hardware_alarm_cancel(wakeAlarm);
+}
+
+void __time_critical_func(wake_post)(uint32_t events)
+{
+    //Interrupts of other priorities may post too
+    uint32_t irqs = save_and_disable_interrupts();
+    uint32_t now = time_us_32();
+    for(uint32_t fresh = events & ~pending; fresh != 0; fresh &= fresh - 1){
+        postTime[__builtin_ctz(fresh)] = now;
+    }
+    pending = pending | events;
+    restore_interrupts(irqs);
+}
+
+uint32_t wake_service()
+{
+    if(pending == 0 && !asleep){
+        return 0;
+    }
+    uint32_t times[WAKE_EVENTS];
+    uint32_t irqs = save_and_disable_interrupts();
+    uint32_t events = pending;
+    pending = 0;
+    memcpy(times, postTime, sizeof(times));
+    restore_interrupts(irqs);
+    //One time read for the latency and the end of the sleep
+    uint32_t now = time_us_32();
+    if(asleep){
+        stats.sleepUs = wake_sleep_time(now);
+        asleep = false;
+        ++stats.sleeps;
+    }
+    for(uint32_t e = events; e != 0; e &= e - 1){
+        uint32_t i = __builtin_ctz(e);
+        latency_add(stats.latency[i], now - times[i]);
+    }
+    return events;
+}
+
+void wake_sleep(absolute_time_t deadline)
+{
+    if(polling || pending != 0){
+        return;
+    }
+    uint32_t start = time_us_32();
+    //Already reached if the alarm can't be set
+    if(hardware_alarm_set_target(wakeAlarm, deadline)){
+        return;
+    }
+    sleepStart = start;
+    asleep = true;
+    //An interrupt between the check and here leaves an event, WFE returns at once
+    __wfe();
+    hardware_alarm_cancel(wakeAlarm);
+}
+
+void wake_set_polling(bool enable)
+{
+    polling = enable;
+}
+
+WakeStats& wake_stats()
+{
+    return stats;
+}
+
+uint32_t wake_sleep_time(uint32_t now)
+{
+    uint32_t t = stats.sleepUs;
+    if(asleep){
+        t += now - sleepStart;
+    }
+    return t;
+}
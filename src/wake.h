@@ -0,0 +1,88 @@
+#ifndef __WAKE_H__
+#define __WAKE_H__
+#include "pico/stdlib.h"
+#include "intercore.h"
+
+/**
+ * Wake-ups of the bus engine (core 1)
+ * Interrupt handlers post the events the bus engine loop has to handle,
+ * the loop sleeps (WFE) once it has nothing left to do. It wakes up on any
+ * interrupt of the core, on a SEV of core 0 (SpscQueue publishing), or on
+ * its own deadline with a hardware alarm.
+ * The time from an event post to the loop servicing it is measured for
+ * each event, and the time spent asleep gives the idle CPU.
+ **/
+
+#define WAKE_EVENTS 5                   // Number of events
+
+enum wake_event : uint32_t {
+    WAKE_RX_FRAME = 1u << 0,            // Frame queued by a receiver (pio0_isr)
+    WAKE_BUS = 1u << 1,                 // Bus became active or idle (bus_idle_isr)
+    WAKE_TX = 1u << 2,                  // Frame sent by an emitter (pio1_isr)
+    WAKE_DEADLINE = 1u << 3,            // Protocol deadline alarm
+    WAKE_TIMER = 1u << 4,               // Deadline of the loop (wake_sleep alarm)
+};
+
+typedef struct WakeStats {
+    uint32_t sleepUs;                   // Time asleep (us, wraps around)
+    uint32_t sleeps;                    // Number of times the loop slept
+    LatencyStat latency[WAKE_EVENTS];   // Post to service (us), per event
+} WakeStats;
+
+/**
+ * IC_WAKE payload : wake-ups over the report period
+ **/
+typedef struct WakeReport {
+    uint32_t periodUs;
+    uint32_t sleepUs;                   // Time asleep during the period
+    uint32_t sleeps;
+    LatencyStat latency;                // Post to service, all events
+    uint32_t maxUs[WAKE_EVENTS];        // Worst post to service of each event
+} WakeReport;
+
+static_assert(sizeof(WakeReport) <= INTERCORE_PAYLOAD, "Wake report must fit in a message");
+
+/**
+ * Claims the alarm of the loop deadline, its interrupt runs on the calling
+ * core (bus engine)
+ **/
+void wake_init();
+
+/**
+ * Posts events, from an interrupt of the bus engine core
+ * @param events wake_event bits
+ **/
+void wake_post(uint32_t events);
+
+/**
+ * Takes the posted events and accounts their latency, and the previous
+ * sleep, at the start of each loop iteration
+ * @return wake_event bits posted since the previous call
+ **/
+uint32_t wake_service();
+
+/**
+ * Sleeps until an interrupt, a SEV or the deadline, when the loop has
+ * nothing left to do. Returns at once in polling mode.
+ * @param deadline Time the loop has to run again
+ **/
+void wake_sleep(absolute_time_t deadline);
+
+/**
+ * The loop never sleeps, as before the event loop (to compare response
+ * times), latency is still measured
+ **/
+void wake_set_polling(bool polling);
+
+/**
+ * Statistics of the wake-ups (bus engine)
+ **/
+WakeStats& wake_stats();
+
+/**
+ * Gets the time asleep, the current sleep included (us, wraps around)
+ * @param now Current time (us)
+ **/
+uint32_t wake_sleep_time(uint32_t now);
+
+#endif